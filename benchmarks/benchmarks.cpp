@@ -0,0 +1,569 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "../include/tiny_rl/tiny_rl.h"
+
+/*
+ Micro and macro benchmarks. Each case is calibrated until one run of
+ `iterations` takes at least --min-time seconds, then run --repetitions
+ times at that count; the median is reported. Inputs come from fixed seeds
+ and the network shapes are fixed, so two runs on the same machine are
+ directly comparable. Replay buffers seed their own samplers, which only
+ changes which slots are read, not the amount of work.
+
+ dqn/learner isolates the learner: it pre-fills a DQNAgent's replay buffer
+ from a recorded trace (--trace, a TransitionRecorder file) or synthetic
+ transitions, then runs train_step() (sample, TD targets, train, priority
+ update, target sync) back to back with no env in the loop. It reports
+ gradient steps/s and samples/s and, in a -DTINY_RL_PROFILE=1 build, the
+ time per step spent in each phase. --learner-only skips everything else.
+
+ Usage: benchmarks [--filter substr] [--min-time s] [--repetitions n] [--json path]
+                   [--trace path] [--learner-only]
+*/
+
+namespace
+{
+    template <typename T>
+    inline void keep(const T &value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    struct Options
+    {
+        std::string filter;
+        double min_time = 0.2;
+        int repetitions = 5;
+        std::string json = "benchmarks.json";
+        std::string trace;         // dataset file to pre-fill the learner benchmark's replay
+        bool learner_only = false;
+    };
+
+    struct Result
+    {
+        std::string name;
+        std::vector<std::pair<std::string, long long>> params;
+        uint64_t iterations;
+        double items_per_iteration;
+        double median_ns;
+        double min_ns;
+        double max_ns;
+        std::vector<std::pair<std::string, double>> counters; // extra per-case figures
+    };
+
+    class Runner
+    {
+    public:
+        explicit Runner(Options options) : options_(std::move(options)) {}
+
+        using Params = std::vector<std::pair<std::string, long long>>;
+
+        // body(n) performs n iterations; each iteration processes `items`
+        // units (transitions, env steps, ...) for the items/s column
+        void run(const std::string &name, Params params, double items, const std::function<void(uint64_t)> &body)
+        {
+            std::string label = name;
+            for (const auto &p : params)
+                label += "/" + p.first + ":" + std::to_string(p.second);
+            last_ran_ = false;
+            if (!options_.filter.empty() && label.find(options_.filter) == std::string::npos)
+                return;
+
+            uint64_t n = 1;
+            while (true)
+            {
+                double t = time(body, n);
+                if (t >= options_.min_time || n >= (uint64_t(1) << 40))
+                    break;
+                double grow = t > 0.0 ? options_.min_time * 1.2 / t : 10.0;
+                n = static_cast<uint64_t>(n * std::min(std::max(grow, 2.0), 100.0));
+            }
+
+            std::vector<double> samples;
+            for (int r = 0; r < std::max(1, options_.repetitions); ++r)
+                samples.push_back(time(body, n) * 1e9 / n);
+            std::sort(samples.begin(), samples.end());
+
+            Result res{name, std::move(params), n, items,
+                       samples[samples.size() / 2], samples.front(), samples.back(), {}};
+            std::printf("%-60s %14.1f ns/iter %16.0f items/s\n", label.c_str(), res.median_ns,
+                        items * 1e9 / res.median_ns);
+            std::fflush(stdout);
+            results_.push_back(std::move(res));
+            last_ran_ = true;
+        }
+
+        // True if the last run() call was not filtered out
+        bool ran() const
+        {
+            return last_ran_;
+        }
+
+        double last_median_ns() const
+        {
+            return results_.back().median_ns;
+        }
+
+        // Attaches a figure to the case just run; printed under it and
+        // written to the json as a counter
+        void annotate(const std::string &key, double value)
+        {
+            if (!last_ran_)
+                return;
+            std::printf("    %-56s %14.3f\n", key.c_str(), value);
+            std::fflush(stdout);
+            results_.back().counters.emplace_back(key, value);
+        }
+
+        void write_json() const
+        {
+            std::ofstream out(options_.json);
+            if (!out)
+            {
+                std::cerr << "cannot write " << options_.json << "\n";
+                return;
+            }
+            char stamp[32];
+            std::time_t now = std::time(nullptr);
+            std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+            out << "{\n";
+            out << "  \"context\": {\n";
+            out << "    \"date\": \"" << stamp << "\",\n";
+            out << "    \"compiler\": \"" << __VERSION__ << "\",\n";
+            out << "    \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+            out << "    \"min_time\": " << options_.min_time << ",\n";
+            out << "    \"repetitions\": " << options_.repetitions << "\n";
+            out << "  },\n";
+            out << "  \"results\": [\n";
+            for (size_t i = 0; i < results_.size(); ++i)
+            {
+                const Result &r = results_[i];
+                out << "    {\"name\": \"" << r.name << "\", \"params\": {";
+                for (size_t p = 0; p < r.params.size(); ++p)
+                    out << (p ? ", " : "") << "\"" << r.params[p].first << "\": " << r.params[p].second;
+                char nums[256];
+                std::snprintf(nums, sizeof(nums),
+                              "}, \"iterations\": %llu, \"ns_per_iter\": %.3f, \"ns_per_iter_min\": %.3f, "
+                              "\"ns_per_iter_max\": %.3f, \"items_per_sec\": %.1f",
+                              static_cast<unsigned long long>(r.iterations), r.median_ns, r.min_ns, r.max_ns,
+                              r.items_per_iteration * 1e9 / r.median_ns);
+                out << nums;
+                if (!r.counters.empty())
+                {
+                    out << ", \"counters\": {";
+                    for (size_t c = 0; c < r.counters.size(); ++c)
+                    {
+                        std::snprintf(nums, sizeof(nums), "%s\"%s\": %.3f", c ? ", " : "",
+                                      r.counters[c].first.c_str(), r.counters[c].second);
+                        out << nums;
+                    }
+                    out << "}";
+                }
+                out << "}" << (i + 1 < results_.size() ? "," : "") << "\n";
+            }
+            out << "  ]\n}\n";
+        }
+
+    private:
+        static double time(const std::function<void(uint64_t)> &body, uint64_t n)
+        {
+            auto start = std::chrono::steady_clock::now();
+            body(n);
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        Options options_;
+        std::vector<Result> results_;
+        bool last_ran_ = false;
+    };
+
+    constexpr int kStateDim = 4;
+    constexpr int kActions = 2;
+    constexpr size_t kBatch = 32;
+
+    void build_net(tiny_rl::Net &net)
+    {
+        net << tiny_dnn::fully_connected_layer(kStateDim, 64)
+            << tiny_dnn::relu_layer()
+            << tiny_dnn::fully_connected_layer(64, 64)
+            << tiny_dnn::relu_layer()
+            << tiny_dnn::fully_connected_layer(64, kActions);
+    }
+
+    tiny_rl::Experience make_experience(std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+        tiny_rl::Experience e;
+        e.state.resize(kStateDim);
+        e.next_state.resize(kStateDim);
+        for (int i = 0; i < kStateDim; ++i)
+        {
+            e.state[i] = u(rng);
+            e.next_state[i] = u(rng);
+        }
+        e.action = static_cast<int>(rng() % kActions);
+        e.reward = u(rng);
+        e.done = rng() % 20 == 0;
+        return e;
+    }
+
+    std::vector<tiny_dnn::vec_t> make_states(std::mt19937 &rng, size_t n)
+    {
+        std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+        std::vector<tiny_dnn::vec_t> states(n, tiny_dnn::vec_t(kStateDim));
+        for (auto &s : states)
+            for (auto &v : s)
+                v = u(rng);
+        return states;
+    }
+
+    void bench_sum_tree(Runner &runner)
+    {
+        for (size_t capacity : {size_t(1) << 10, size_t(1) << 14, size_t(1) << 17})
+        {
+            tiny_rl::SumTree tree(capacity);
+            std::mt19937 rng(1);
+            std::uniform_real_distribution<float> u(0.1f, 2.0f);
+            std::vector<float> values(4096);
+            for (auto &v : values)
+                v = u(rng);
+            for (size_t i = 0; i < capacity; ++i)
+                tree.set(i, values[i & 4095]);
+
+            runner.run("sum_tree/set", {{"capacity", (long long)capacity}}, 1, [&](uint64_t n)
+                       {
+                           for (uint64_t i = 0; i < n; ++i)
+                               tree.set((i * 7919) & (capacity - 1), values[i & 4095]);
+                       });
+
+            std::vector<float> queries(4096);
+            std::uniform_real_distribution<float> q(0.0f, tree.total());
+            for (auto &v : queries)
+                v = q(rng);
+            runner.run("sum_tree/get_leaf", {{"capacity", (long long)capacity}}, 1, [&](uint64_t n)
+                       {
+                           float p;
+                           size_t sum = 0;
+                           for (uint64_t i = 0; i < n; ++i)
+                               sum += tree.get_leaf(queries[i & 4095], p);
+                           keep(sum);
+                       });
+        }
+    }
+
+    void bench_replay(Runner &runner)
+    {
+        std::mt19937 rng(2);
+        std::vector<tiny_rl::Experience> pool;
+        for (int i = 0; i < 1024; ++i)
+            pool.push_back(make_experience(rng));
+
+        for (size_t capacity : {size_t(1) << 12, size_t(1) << 15, size_t(1) << 17})
+        {
+            tiny_rl::ReplayBuffer uniform(capacity);
+            for (size_t i = 0; i < capacity; ++i)
+                uniform.add(pool[i & 1023]);
+            runner.run("replay/add", {{"capacity", (long long)capacity}}, 1, [&](uint64_t n)
+                       {
+                           for (uint64_t i = 0; i < n; ++i)
+                               uniform.add(pool[i & 1023]);
+                       });
+            std::vector<tiny_rl::Experience> out;
+            runner.run("replay/sample", {{"capacity", (long long)capacity}, {"batch", (long long)kBatch}}, kBatch,
+                       [&](uint64_t n)
+                       {
+                           for (uint64_t i = 0; i < n; ++i)
+                               uniform.sample(out, kBatch);
+                           keep(out);
+                       });
+
+            tiny_rl::PrioritizedReplayBuffer prioritized(capacity);
+            for (size_t i = 0; i < capacity; ++i)
+                prioritized.add(pool[i & 1023]);
+            runner.run("prioritized_replay/add", {{"capacity", (long long)capacity}}, 1, [&](uint64_t n)
+                       {
+                           for (uint64_t i = 0; i < n; ++i)
+                               prioritized.add(pool[i & 1023]);
+                       });
+            tiny_rl::SampledBatch batch;
+            runner.run("prioritized_replay/sample_batch", {{"capacity", (long long)capacity}, {"batch", (long long)kBatch}},
+                       kBatch, [&](uint64_t n)
+                       {
+                           for (uint64_t i = 0; i < n; ++i)
+                               prioritized.sample_batch(batch, kBatch);
+                           keep(batch);
+                       });
+        }
+    }
+
+    void bench_q_network(Runner &runner)
+    {
+        tiny_rl::Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        std::mt19937 rng(3);
+
+        for (size_t batch : {size_t(1), kBatch, size_t(256)})
+        {
+            auto states = make_states(rng, batch);
+            runner.run("q_network/predict", {{"batch", (long long)batch}}, batch, [&](uint64_t n)
+                       {
+                           for (uint64_t i = 0; i < n; ++i)
+                               for (const auto &s : states)
+                                   keep(qnet.predict(s));
+                       });
+            runner.run("q_network/predict_batch", {{"batch", (long long)batch}}, batch, [&](uint64_t n)
+                       {
+                           for (uint64_t i = 0; i < n; ++i)
+                               keep(qnet.predict_batch(states));
+                       });
+        }
+
+        auto states = make_states(rng, kBatch);
+        auto next_states = make_states(rng, kBatch);
+        std::vector<int> actions(kBatch);
+        std::vector<float> rewards(kBatch);
+        std::vector<bool> dones(kBatch);
+        for (size_t i = 0; i < kBatch; ++i)
+        {
+            actions[i] = static_cast<int>(i % kActions);
+            rewards[i] = 1.0f;
+            dones[i] = i % 16 == 0;
+        }
+        runner.run("q_network/compute_td_targets", {{"batch", (long long)kBatch}}, kBatch, [&](uint64_t n)
+                   {
+                       for (uint64_t i = 0; i < n; ++i)
+                           keep(qnet.compute_td_targets(states, actions, rewards, next_states, dones, 0.99f));
+                   });
+    }
+
+    void bench_optimizer(Runner &runner)
+    {
+        std::mt19937 rng(4);
+        std::normal_distribution<float> g(0.0f, 1.0f);
+        for (size_t size : {size_t(4096), size_t(1) << 16, size_t(1) << 20})
+        {
+            tiny_dnn::vec_t W(size), dW(size);
+            for (size_t i = 0; i < size; ++i)
+            {
+                W[i] = g(rng);
+                dW[i] = g(rng);
+            }
+            for (int parallel : {0, 1})
+            {
+                tiny_rl::clipped_adam opt;
+                runner.run("clipped_adam/update", {{"weights", (long long)size}, {"parallel", parallel}}, size,
+                           [&](uint64_t n)
+                           {
+                               for (uint64_t i = 0; i < n; ++i)
+                                   opt.update(dW, W, parallel != 0);
+                               keep(W);
+                           });
+            }
+        }
+    }
+
+    void bench_cartpole(Runner &runner)
+    {
+        tiny_rl::CartPoleEnv env;
+        env.reset();
+        runner.run("cartpole/step", {}, 1, [&](uint64_t n)
+                   {
+                       for (uint64_t i = 0; i < n; ++i)
+                       {
+                           auto [state, reward, done] = env.step(static_cast<int>(i & 1));
+                           keep(state);
+                           if (done)
+                               env.reset();
+                       }
+                   });
+    }
+
+    template <typename Agent>
+    void bench_dqn_env_steps(Runner &runner, const std::string &name)
+    {
+        for (int num_envs : {1, 8})
+        {
+            tiny_rl::Net online, target;
+            build_net(online);
+            build_net(target);
+            tiny_rl::QNetwork qnet(online, target);
+            tiny_rl::DQNConfig config{0.99f, 1.0f, 0.995f, 0.05f, 0.001f, static_cast<int>(kBatch), 50000, 1000};
+            config.learn_start = 1000;
+            Agent agent(qnet, config);
+            tiny_rl::StepTrainer trainer(agent, []
+                                         { return std::make_shared<tiny_rl::CartPoleEnv>(); },
+                                         num_envs, 0);
+            tiny_rl::StepBudget warmup;
+            warmup.max_frames = config.learn_start;
+            trainer.run(warmup);
+
+            // one iteration = 256 env steps, with learning every train_frequency steps
+            const size_t frames = 256;
+            runner.run(name, {{"num_envs", num_envs}}, frames, [&](uint64_t n)
+                       {
+                           tiny_rl::StepBudget budget;
+                           budget.max_frames = n * frames;
+                           trainer.run(budget);
+                       });
+        }
+    }
+
+    void bench_dqn_end_to_end(Runner &runner)
+    {
+        bench_dqn_env_steps<tiny_rl::DQNAgent>(runner, "dqn/env_steps");
+        // same network and config with dimensions fixed at compile time
+        bench_dqn_env_steps<tiny_rl::StaticDQNAgent<4, 2, kBatch>>(runner, "static_dqn/env_steps");
+    }
+
+    // Replay pre-fill for the learner benchmark: the first `capacity`
+    // transitions of a recorded trace, or synthetic ones if there is none
+    void fill_replay(tiny_rl::DQNAgent &agent, const tiny_rl::OfflineDataset *trace, size_t capacity)
+    {
+        std::mt19937 rng(5);
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            tiny_rl::Experience e = trace ? trace->at(i) : make_experience(rng);
+            agent.store_experience(e.state, e.action, e.reward, e.next_state, e.done);
+        }
+    }
+
+    // Learner throughput with no env or actor in the loop; one iteration is
+    // one gradient step
+    void bench_dqn_learner(Runner &runner, const std::string &trace_path)
+    {
+        std::unique_ptr<tiny_rl::OfflineDataset> trace;
+        size_t capacity = size_t(1) << 15;
+        if (!trace_path.empty())
+        {
+            try
+            {
+                trace = std::make_unique<tiny_rl::OfflineDataset>(trace_path);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << e.what() << "\n";
+                std::exit(2);
+            }
+            if (trace->state_dim() != static_cast<size_t>(kStateDim))
+            {
+                std::cerr << trace_path << ": state_dim " << trace->state_dim()
+                          << " does not match the benchmark network (" << kStateDim << ")\n";
+                std::exit(2);
+            }
+            capacity = trace->size();
+        }
+
+        for (int prefetch : {0, 1})
+        {
+            tiny_rl::Net online, target;
+            build_net(online);
+            build_net(target);
+            tiny_rl::QNetwork qnet(online, target);
+            tiny_rl::DQNConfig config{0.99f, 0.0f, 1.0f, 0.0f, 0.001f, static_cast<int>(kBatch),
+                                      static_cast<int>(capacity), 1000};
+            config.prefetch_batches = prefetch != 0;
+            tiny_rl::DQNAgent agent(qnet, config);
+            fill_replay(agent, trace.get(), capacity);
+            for (int i = 0; i < 10; ++i)
+                agent.train_step();
+#if TINY_RL_PROFILE
+            tiny_rl::profiler::Registry::instance().collect(); // start a fresh window
+#endif
+
+            runner.run("dqn/learner",
+                       {{"replay", (long long)capacity}, {"batch", (long long)kBatch}, {"prefetch", prefetch}}, 1,
+                       [&](uint64_t n)
+                       {
+                           for (uint64_t i = 0; i < n; ++i)
+                               agent.train_step();
+                       });
+            if (!runner.ran())
+                continue;
+            runner.annotate("samples_per_sec", kBatch * 1e9 / runner.last_median_ns());
+
+#if TINY_RL_PROFILE
+            // every step trains exactly once, so the train count is the step count
+            auto phases = tiny_rl::profiler::Registry::instance().collect();
+            double steps = 0.0;
+            for (const auto &p : phases)
+                if (std::strcmp(p.name, "train") == 0)
+                    steps = static_cast<double>(p.count);
+            for (const auto &p : phases)
+                if (steps > 0.0)
+                    runner.annotate(std::string(p.name) + "_us_per_step", p.mean_us * p.count / steps);
+#endif
+        }
+    }
+
+    Options parse(int argc, char **argv)
+    {
+        Options o;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string
+            {
+                if (i + 1 >= argc)
+                {
+                    std::cerr << "missing value for " << arg << "\n";
+                    std::exit(2);
+                }
+                return argv[++i];
+            };
+            if (arg == "--filter")
+                o.filter = value();
+            else if (arg == "--min-time")
+                o.min_time = std::atof(value().c_str());
+            else if (arg == "--repetitions")
+                o.repetitions = std::atoi(value().c_str());
+            else if (arg == "--json")
+                o.json = value();
+            else if (arg == "--trace")
+                o.trace = value();
+            else if (arg == "--learner-only")
+                o.learner_only = true;
+            else
+            {
+                std::cerr << "usage: " << argv[0]
+                          << " [--filter substr] [--min-time s] [--repetitions n] [--json path]"
+                          << " [--trace path] [--learner-only]\n";
+                std::exit(arg == "--help" ? 0 : 2);
+            }
+        }
+        return o;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options = parse(argc, argv);
+    Runner runner(options);
+    if (!options.learner_only)
+    {
+        bench_sum_tree(runner);
+        bench_replay(runner);
+        bench_q_network(runner);
+        bench_optimizer(runner);
+        bench_cartpole(runner);
+        bench_dqn_end_to_end(runner);
+    }
+    bench_dqn_learner(runner, options.trace);
+    runner.write_json();
+    return 0;
+}
@@ -1,4 +1,7 @@
 #pragma once
+#include <string>
+#include <utility>
+#include <vector>
 #include "tiny_dnn/tiny_dnn.h"
 
 namespace tiny_rl
@@ -7,11 +10,54 @@ namespace tiny_rl
     {
     public:
         virtual int select_action(const tiny_dnn::vec_t &state) = 0;
+
+        // Select one action per state for environments stepped in lockstep.
+        // actions[i] belongs to states[i]; agents override this to batch inference.
+        virtual void select_actions(const std::vector<tiny_dnn::vec_t> &states, std::vector<int> &actions)
+        {
+            actions.resize(states.size());
+            for (size_t i = 0; i < states.size(); ++i)
+                actions[i] = select_action(states[i]);
+        }
         
         virtual void store_experience(const tiny_dnn::vec_t &state, int action, float reward,
                                       const tiny_dnn::vec_t &next_state, bool done) = 0;
 
-        
+        // Store one transition per environment, in the same order as select_actions
+        virtual void store_experiences(const std::vector<tiny_dnn::vec_t> &states,
+                                       const std::vector<int> &actions,
+                                       const std::vector<float> &rewards,
+                                       const std::vector<tiny_dnn::vec_t> &next_states,
+                                       const std::vector<bool> &dones)
+        {
+            for (size_t i = 0; i < states.size(); ++i)
+                store_experience(states[i], actions[i], rewards[i], next_states[i], dones[i]);
+        }
+
+
+        // Ownership-transferring store: the agent keeps the `state` buffer
+        // instead of copying it and swaps in a buffer of the same size with
+        // unspecified contents (e.g. one evicted from replay), which the
+        // caller can hand to the env for a later observation. next_state is
+        // still read only, the caller steps on from it.
+        virtual void store_experience(tiny_dnn::vec_t &&state, int action, float reward,
+                                      const tiny_dnn::vec_t &next_state, bool done)
+        {
+            store_experience(static_cast<const tiny_dnn::vec_t &>(state), action, reward, next_state, done);
+        }
+
+        // Batched form of the above; each states[i] is exchanged, the
+        // vector itself stays with the caller
+        virtual void store_experiences(std::vector<tiny_dnn::vec_t> &&states,
+                                       const std::vector<int> &actions,
+                                       const std::vector<float> &rewards,
+                                       const std::vector<tiny_dnn::vec_t> &next_states,
+                                       const std::vector<bool> &dones)
+        {
+            for (size_t i = 0; i < states.size(); ++i)
+                store_experience(std::move(states[i]), actions[i], rewards[i], next_states[i], dones[i]);
+        }
+
         virtual void learn() = 0;
 
         virtual void reset() {};
@@ -20,9 +66,9 @@ namespace tiny_rl
       
         virtual void seed(unsigned int seed) {};
 
-        // TODO - implement save and load methods
-        //virtual void save(const std::string &path) = 0;
-        //virtual void load(const std::string &path) = 0;
+        // Versioned binary checkpoint of networks, optimizer and agent state
+        virtual void save(const std::string &path) = 0;
+        virtual void load(const std::string &path) = 0;
 
         virtual ~BaseAgent() = default;
     };
@@ -1,13 +1,31 @@
 #pragma once
 #include <algorithm>
-#include <iostream>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
 #include "base_agent.h"
 #include "../core/q_network.h"
 #include "../core/replay_buffer.h"
 #include "../core/prioritized_replay_buffer.h"
+#include "../core/prefetch_sampler.h"
+#include "../core/data_parallel.h"
+#include "../core/flat_policy.h"
+#include "../core/obs_normalizer.h"
+#include "../core/target_cache.h"
+#include "../core/tensor_utils.h"
 #include "../optim/clipped_adam.h"
+#include "../utils/arena.h"
+#include "../utils/checkpoint.h"
 #include "../utils/config.h"
+#include "../utils/logger.h"
 
 namespace tiny_rl
 {
@@ -21,30 +39,81 @@ namespace tiny_rl
               rng(std::random_device{}()),
               env_steps_(0),
               train_steps_(0),
-              sample_buffer_()
+              updates_issued_(0)
         {
             optimizer.alpha = config.learning_rate;
             optimizer.b1 = 0.9f;
             optimizer.b2 = 0.999f;
             qnet.update_target_network(1.0f);
-            sample_buffer_.reserve(config.batch_size);
+            if (config.cache_target_values)
+                target_cache_ = std::make_unique<TargetValueCache>(config.memory_size, output_size(qnet.get_net()));
         }
 
         // Select action based on epsilon-greedy policy
         // Select a weighted random action with probability epsilon
         int select_action(const tiny_dnn::vec_t &state) override
         {
+            TINY_RL_PROFILE_SCOPE(kSelectAction);
             std::uniform_real_distribution<float> coin(0, 1);
             if (coin(rng) < config.epsilon)
             {
-                int num_actions = qnet.predict(state).size();
-                std::uniform_int_distribution<int> pick(0, num_actions - 1);
+                std::uniform_int_distribution<int> pick(0, num_actions(state) - 1);
                 return pick(rng);
             }
             auto q_values = qnet.predict(state);
             return qnet.argmax_action(q_values);
         }
 
+        // Batched epsilon-greedy: draw all coins first, then run the forward
+        // passes for the states that act greedily. The greedy index list is
+        // frame scratch on the thread arena; states are read in place.
+        void select_actions(const std::vector<tiny_dnn::vec_t> &states, std::vector<int> &actions) override
+        {
+            TINY_RL_PROFILE_SCOPE(kSelectAction);
+            ArenaScope scope(thread_arena());
+            std::uniform_real_distribution<float> coin(0, 1);
+            actions.assign(states.size(), -1);
+            size_t *greedy = thread_arena().allocate_array<size_t>(states.size());
+            size_t num_greedy = 0;
+            for (size_t i = 0; i < states.size(); ++i)
+                if (coin(rng) >= config.epsilon)
+                    greedy[num_greedy++] = i;
+
+            if (num_greedy > 1 && flat_net())
+            {
+                // greedy rows go through one batched forward pass
+                size_t dim = flat_net_->input_size();
+                size_t num_q = flat_net_->output_size();
+                float *obs = thread_arena().allocate_array<float>(num_greedy * dim);
+                for (size_t k = 0; k < num_greedy; ++k)
+                {
+                    if (states[greedy[k]].size() != dim)
+                        throw std::invalid_argument("DQNAgent::select_actions: state size does not match the network");
+                    std::copy_n(states[greedy[k]].data(), dim, obs + k * dim);
+                }
+                flat_net_->refresh();
+                const float *q = flat_net_->forward(obs, num_greedy, flat_scratch_);
+                for (size_t k = 0; k < num_greedy; ++k)
+                {
+                    const float *row = q + k * num_q;
+                    actions[greedy[k]] = static_cast<int>(std::max_element(row, row + num_q) - row);
+                }
+            }
+            else
+            {
+                for (size_t k = 0; k < num_greedy; ++k)
+                    actions[greedy[k]] = qnet.argmax_action(qnet.predict(states[greedy[k]]));
+            }
+
+            if (num_greedy < states.size())
+            {
+                std::uniform_int_distribution<int> pick(0, num_actions(states[0]) - 1);
+                for (auto &a : actions)
+                    if (a < 0)
+                        a = pick(rng);
+            }
+        }
+
         // Store the experience in the replay buffer
         void store_experience(
             const tiny_dnn::vec_t &state,
@@ -52,11 +121,42 @@ namespace tiny_rl
             const tiny_dnn::vec_t &next_state,
             bool done) override
         {
-            Experience exp{state, action, reward, next_state, done};
-            replay_buffer.add(exp);
+            {
+                std::lock_guard<std::mutex> lock(replay_mutex_);
+                replay_buffer.add(state, action, reward, next_state, done);
+            }
             ++env_steps_;
         }
 
+        // The state buffer becomes the replay slot's, the caller gets the
+        // slot's evicted buffer back
+        void store_experience(
+            tiny_dnn::vec_t &&state,
+            int action, float reward,
+            const tiny_dnn::vec_t &next_state,
+            bool done) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(replay_mutex_);
+                replay_buffer.add(std::move(state), action, reward, next_state, done);
+            }
+            ++env_steps_;
+        }
+
+        void store_experiences(std::vector<tiny_dnn::vec_t> &&states,
+                               const std::vector<int> &actions,
+                               const std::vector<float> &rewards,
+                               const std::vector<tiny_dnn::vec_t> &next_states,
+                               const std::vector<bool> &dones) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(replay_mutex_);
+                for (size_t i = 0; i < states.size(); ++i)
+                    replay_buffer.add(std::move(states[i]), actions[i], rewards[i], next_states[i], dones[i]);
+            }
+            env_steps_ += states.size();
+        }
+
         void on_episode_end() override
         {
             config.epsilon = std::max(config.epsilon_min,
@@ -65,112 +165,489 @@ namespace tiny_rl
 
         void learn() override
         {
-            // don't learn if the replay buffer is not full enough for batch_size
-            if (replay_buffer.size() < static_cast<size_t>(config.batch_size))
-                return;
-
             // don't learn until we have been through minimum amount of steps
             if (env_steps_ < static_cast<size_t>(config.learn_start))
                 return;
 
-            // don't learn if the environment steps are not a multiple of the train frequency
-            if (env_steps_ % config.train_frequency != 0)
-                return;
+            // one update for every train_frequency-th env step since learn_start,
+            // catching up when several steps were stored at once (batched envs)
+            size_t tf = static_cast<size_t>(config.train_frequency);
+            size_t skipped = config.learn_start > 0 ? (config.learn_start - 1) / tf : 0;
+            size_t due = env_steps_ / tf - skipped;
+            while (updates_issued_ < due)
+            {
+                ++updates_issued_;
+                train_step();
+            }
+        }
+
+        // One gradient update on a sampled minibatch, without the env-step
+        // gating of learn(). Safe to call from a learner thread while other
+        // threads call store_experience(). Returns false if the replay buffer
+        // does not hold a full batch yet.
+        bool train_step()
+        {
+            const SampledBatch *batch = &batch_;
+            {
+                std::lock_guard<std::mutex> lock(replay_mutex_);
+                // don't learn if the replay buffer is not full enough for batch_size
+                if (replay_buffer.size() < static_cast<size_t>(config.batch_size))
+                    return false;
+                if (!config.prefetch_batches)
+                    replay_buffer.sample_batch(batch_, config.batch_size);
+                else if (!sampler_)
+                    sampler_ = std::make_unique<PrefetchSampler>(replay_buffer, replay_mutex_, config.batch_size);
+            }
+            if (sampler_)
+                batch = &sampler_->acquire();
+
+            update(*batch, true);
+
+            // priorities go back only now, the batch slot is reused after release
+            if (sampler_)
+            {
+                sampler_->release(td_errors_);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(replay_mutex_);
+                replay_buffer.update_priorities(batch_.indices, td_errors_, batch_.slot_versions);
+            }
+            return true;
+        }
+
+        // One gradient update on a batch sampled elsewhere (e.g. a shared
+        // memory replay). No priorities are written back; td_errors() holds
+        // the batch's TD errors afterwards.
+        void train_step(const SampledBatch &batch)
+        {
+            update(batch, false);
+        }
+
+        const std::vector<float> &td_errors() const
+        {
+            return td_errors_;
+        }
+
+        QNetwork &network()
+        {
+            return qnet;
+        }
+
+        const DQNConfig &get_config() const
+        {
+            return config;
+        }
+
+        // Adopts the hyperparameters that can change mid-run: gamma, learning
+        // rate, epsilon decay and floor, target sync interval and train
+        // frequency. Sizes (batch, memory, learner threads) stay as built.
+        void retune(const DQNConfig &c)
+        {
+            if (c.train_frequency <= 0 || c.target_update_freq <= 0)
+                throw std::invalid_argument("DQNAgent::retune: train_frequency and target_update_freq must be positive");
+            config.gamma = c.gamma;
+            config.learning_rate = c.learning_rate;
+            config.epsilon_decay = c.epsilon_decay;
+            config.epsilon_min = c.epsilon_min;
+            config.target_update_freq = c.target_update_freq;
+            config.train_frequency = c.train_frequency;
+            optimizer.alpha = c.learning_rate;
+            // keep learn() from replaying the updates the new frequency
+            // would have issued so far
+            size_t skipped = config.learn_start > 0 ? (config.learn_start - 1) / config.train_frequency : 0;
+            size_t due = env_steps_ / config.train_frequency;
+            updates_issued_ = due > skipped ? due - skipped : 0;
+        }
+
+        // Takes `other`'s online and target weights and Adam moments, as the
+        // exploit step of population-based training does. Replay, counters
+        // and epsilon stay this agent's own.
+        void copy_learner_state(DQNAgent &other)
+        {
+            if (param_count(other.qnet.get_net()) != param_count(qnet.get_net()))
+                throw std::invalid_argument("DQNAgent::copy_learner_state: networks differ in shape");
+            copy_params(other.qnet.get_net(), qnet.get_net());
+            copy_params(other.qnet.get_target(), qnet.get_target());
+
+            std::vector<float> m, v;
+            other.optimizer.export_moments(other.qnet.get_net(), m, v);
+            optimizer.import_moments(qnet.get_net(), m.data(), v.data());
+            optimizer.b1_t = other.optimizer.b1_t;
+            optimizer.b2_t = other.optimizer.b2_t;
+            if (target_cache_)
+                target_cache_->invalidate();
+        }
+
+        size_t env_steps() const
+        {
+            return env_steps_;
+        }
+
+        size_t train_steps() const
+        {
+            return train_steps_;
+        }
+
+        ~DQNAgent()
+        {
+            if (checkpoint_thread_.joinable())
+                checkpoint_thread_.join();
+        }
 
-            std::vector<size_t> indices;
-            std::vector<float> is_weights;
-            replay_buffer.sample(sample_buffer_, indices, is_weights, config.batch_size);
+        // Networks, optimizer moments and counters are written before this
+        // returns; the replay buffer is streamed in chunks on a background
+        // thread while training continues. Slots overwritten during that
+        // window may be saved in either state. Call wait_for_checkpoint()
+        // to block until the file is complete.
+        void save(const std::string &path) override
+        {
+            wait_for_checkpoint();
+            auto writer = std::make_unique<CheckpointWriter>(path);
+
+            std::vector<float> params;
+            flatten_params(qnet.get_net(), params);
+            write_param_section(*writer, ckpt::kOnlineParams, params);
+            flatten_params(qnet.get_target(), params);
+            write_param_section(*writer, ckpt::kTargetParams, params);
+            write_optimizer_section(*writer, optimizer, std::vector<Net *>{&qnet.get_net()});
+            if (normalizer_)
+                normalizer_->save(*writer);
+
+            ckpt_counters counters{config.epsilon, 0, env_steps_, train_steps_, updates_issued_};
+            writer->write_section(ckpt::kAgentCounters, &counters, sizeof(counters));
+
+            // size and cursor are taken now so they agree with the counters
+            ckpt::ReplayHeader replay_header{};
+            {
+                std::lock_guard<std::mutex> lock(replay_mutex_);
+                replay_header.size = replay_buffer.size();
+                replay_header.pos = replay_buffer.position();
+                replay_header.state_dim = replay_header.size > 0 ? replay_buffer.slot(0).state.size() : 0;
+            }
+
+            checkpoint_thread_ = std::thread([this, w = std::move(writer), replay_header]
+                                             {
+                try
+                {
+                    write_replay(*w, replay_header);
+                    w->close();
+                }
+                catch (...)
+                {
+                    checkpoint_error_ = std::current_exception();
+                } });
+        }
+
+        // Blocks until the last save() is on disk, rethrows its error if any
+        void wait_for_checkpoint()
+        {
+            if (checkpoint_thread_.joinable())
+                checkpoint_thread_.join();
+            if (checkpoint_error_)
+                std::rethrow_exception(std::exchange(checkpoint_error_, nullptr));
+        }
+
+        // The file is mmap'd; parameters and optimizer state are copied out of
+        // the mapping, the replay buffer is rebuilt so learning resumes at once
+        void load(const std::string &path) override
+        {
+            wait_for_checkpoint();
+            sampler_.reset();
+            if (target_cache_)
+                target_cache_->invalidate();
+
+            CheckpointReader reader(path);
+            Net &net = qnet.get_net();
+            load_params(net, read_param_section(reader, ckpt::kOnlineParams, param_count(net)));
+            Net &target = qnet.get_target();
+            load_params(target, read_param_section(reader, ckpt::kTargetParams, param_count(target)));
+            read_optimizer_section(reader, optimizer, std::vector<Net *>{&net});
+            if (normalizer_ && reader.has(ckpt::kObsNormalizer))
+                normalizer_->load(reader);
+
+            auto [cdata, cbytes] = reader.section(ckpt::kAgentCounters);
+            if (cbytes != sizeof(ckpt_counters))
+                throw std::runtime_error("DQNAgent::load: bad counters section");
+            ckpt_counters counters;
+            std::memcpy(&counters, cdata, sizeof(counters));
+            config.epsilon = counters.epsilon;
+            env_steps_ = counters.env_steps;
+            train_steps_ = counters.train_steps;
+            updates_issued_ = counters.updates_issued;
+
+            if (reader.has(ckpt::kReplay))
+                read_replay(reader);
+        }
+
+        // Observation statistics to save and restore with this agent's
+        // checkpoints; the agent itself never applies them
+        void set_observation_normalizer(ObservationNormalizer *normalizer)
+        {
+            normalizer_ = normalizer;
+        }
+
+        // nullptr unless DQNConfig::cache_target_values is set
+        const TargetValueCache *target_cache() const
+        {
+            return target_cache_.get();
+        }
+
+        size_t replay_size()
+        {
+            std::lock_guard<std::mutex> lock(replay_mutex_);
+            return replay_buffer.size();
+        }
+
+    private:
+        struct ckpt_counters
+        {
+            float epsilon;
+            uint32_t reserved;
+            uint64_t env_steps;
+            uint64_t train_steps;
+            uint64_t updates_issued;
+        };
+
+        static constexpr size_t kReplayChunk = 4096;
+
+        // Output width of the network, measured once
+        int num_actions(const tiny_dnn::vec_t &state)
+        {
+            if (num_actions_ == 0)
+                num_actions_ = static_cast<int>(qnet.predict(state).size());
+            return num_actions_;
+        }
+
+        // Width of the last layer that reports one, i.e. the number of actions
+        static size_t output_size(Net &net)
+        {
+            for (size_t l = net.depth(); l-- > 0;)
+                if (net[l]->out_data_size() > 0)
+                    return net[l]->out_data_size();
+            throw std::invalid_argument("DQNAgent: network has no output layer");
+        }
+
+        // Flat copy of the online network for batched acting, built on first
+        // use; null when the network has layers the flat path cannot run
+        FlatNetCopy *flat_net()
+        {
+            if (!flat_net_ && !flat_unsupported_)
+            {
+                try
+                {
+                    flat_net_ = std::make_unique<FlatNetCopy>(qnet.get_net());
+                }
+                catch (const std::invalid_argument &)
+                {
+                    flat_unsupported_ = true;
+                }
+            }
+            return flat_net_.get();
+        }
+
+        void write_replay(CheckpointWriter &w, const ckpt::ReplayHeader &header)
+        {
+            size_t dim = header.state_dim;
+            size_t record = 2 * dim + 4;
+
+            w.begin_section(ckpt::kReplay);
+            w.append(&header, sizeof(header));
 
-            float avg_done = std::accumulate(dones_.begin(), dones_.end(), 0.0f) / dones_.size();
-            if (avg_done > 0.8f)
+            std::vector<float> chunk;
+            for (size_t begin = 0; begin < header.size; begin += kReplayChunk)
             {
-                std::cout << "[BUF] done_ratio " << avg_done << std::endl;
+                size_t end = std::min<size_t>(header.size, begin + kReplayChunk);
+                chunk.resize((end - begin) * record);
+                {
+                    // hold the lock only while copying, never while writing
+                    std::lock_guard<std::mutex> lock(replay_mutex_);
+                    float *out = chunk.data();
+                    for (size_t i = begin; i < end; ++i, out += record)
+                    {
+                        const Experience &exp = replay_buffer.slot(i);
+                        std::copy(exp.state.begin(), exp.state.end(), out);
+                        std::copy(exp.next_state.begin(), exp.next_state.end(), out + dim);
+                        int32_t action = exp.action;
+                        uint32_t done = exp.done ? 1u : 0u;
+                        std::memcpy(out + 2 * dim, &action, sizeof(action));
+                        out[2 * dim + 1] = exp.reward;
+                        std::memcpy(out + 2 * dim + 2, &done, sizeof(done));
+                        out[2 * dim + 3] = replay_buffer.priority(i);
+                    }
+                }
+                w.append(chunk.data(), chunk.size() * sizeof(float));
             }
+            w.end_section();
+        }
+
+        void read_replay(const CheckpointReader &reader)
+        {
+            auto [data, bytes] = reader.section(ckpt::kReplay);
+            ckpt::ReplayHeader header;
+            std::memcpy(&header, data, sizeof(header));
+            size_t dim = header.state_dim;
+            size_t record = 2 * dim + 4;
+            if (bytes != sizeof(header) + header.size * record * sizeof(float))
+                throw std::runtime_error("DQNAgent::load: bad replay section");
 
-            states_.clear();
-            next_states_.clear();
-            actions_.clear();
-            rewards_.clear();
-            dones_.clear();
+            std::lock_guard<std::mutex> lock(replay_mutex_);
+            if (header.size > replay_buffer.capacity())
+                throw std::runtime_error("DQNAgent::load: replay does not fit memory_size");
 
-            for (const auto &exp : sample_buffer_)
+            replay_buffer.clear();
+            const float *in = reinterpret_cast<const float *>(data + sizeof(header));
+            for (size_t i = 0; i < header.size; ++i, in += record)
             {
-                states_.push_back(exp.state);
-                actions_.push_back(exp.action);
-                rewards_.push_back(exp.reward);
-                next_states_.push_back(exp.next_state);
-                dones_.push_back(exp.done);
+                Experience exp;
+                exp.state.assign(in, in + dim);
+                exp.next_state.assign(in + dim, in + 2 * dim);
+                int32_t action;
+                uint32_t done;
+                std::memcpy(&action, in + 2 * dim, sizeof(action));
+                std::memcpy(&done, in + 2 * dim + 2, sizeof(done));
+                exp.action = action;
+                exp.reward = in[2 * dim + 1];
+                exp.done = done != 0;
+                replay_buffer.restore_slot(i, std::move(exp), in[2 * dim + 3]);
             }
+            replay_buffer.restore_cursor(header.pos, header.size);
+        }
 
-            auto td_targets = qnet.compute_td_targets(
-                states_, actions_, rewards_, next_states_, dones_, config.gamma);
+        // Target Q(s', .) rows for a batch, from the cache where still valid
+        void fill_next_target_q(const SampledBatch &batch)
+        {
+            size_t n = batch.next_states.size();
+            next_q_.resize(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                const float *row = target_cache_->find(batch.indices[i], batch.slot_versions[i]);
+                if (row)
+                {
+                    next_q_[i].assign(row, row + target_cache_->num_actions());
+                    continue;
+                }
 
-            qnet.train(states_, td_targets, optimizer, config.batch_size);
+                next_q_[i] = qnet.predict(batch.next_states[i], true);
+                target_cache_->put(batch.indices[i], batch.slot_versions[i], next_q_[i]);
+            }
+        }
 
-            std::vector<float> td_errors(config.batch_size);
-            for(size_t i = 0; i < static_cast<size_t>(config.batch_size); ++i) {
-                float q_old = qnet.predict(states_[i])[actions_[i]];
-                td_errors[i] = std::fabs(td_targets[i][actions_[i]] - q_old);
+        // Targets, gradient step, TD errors and target sync for one batch
+        void update(const SampledBatch &batch, bool own_replay)
+        {
+            const auto &states = batch.states;
+            const auto &actions = batch.actions;
+
+            // rows are reused across updates
+            auto &td_targets = td_targets_;
+            // the cache is keyed by slots of our own replay buffer
+            if (config.cache_target_values && own_replay)
+            {
+                fill_next_target_q(batch);
+                qnet.compute_td_targets(
+                    states, actions, batch.rewards, batch.next_states, batch.dones, next_q_, config.gamma, td_targets);
+            }
+            else
+            {
+                qnet.compute_td_targets(
+                    states, actions, batch.rewards, batch.next_states, batch.dones, config.gamma, td_targets);
             }
 
-            replay_buffer.update_priorities(indices, td_errors);
+            if (config.learner_threads > 1)
+            {
+                if (!parallel_learner_)
+                    parallel_learner_ = std::make_unique<DataParallelLearner>(qnet.get_net(), config.learner_threads);
+                parallel_learner_->train(states, td_targets, optimizer);
+            }
+            else
+            {
+                qnet.train(states, td_targets, optimizer, config.batch_size);
+            }
+
+            {
+                TINY_RL_PROFILE_SCOPE(kPriorityUpdate);
+                td_errors_.resize(states.size());
+                for(size_t i = 0; i < states.size(); ++i) {
+                    float q_old = qnet.predict(states[i])[actions[i]];
+                    td_errors_[i] = std::fabs(td_targets[i][actions[i]] - q_old);
+                }
+            }
 
             if (train_steps_ % config.target_update_freq == 0 && train_steps_ > 0)
             {
-                std::cout
-                    << "Updating target network"
-                    << std::endl;
+                log_metric(Metric::kTargetSync, train_steps_, 1.0f);
                 qnet.update_target_network(1.0f);
+                if (target_cache_)
+                    target_cache_->invalidate();
             }
 
             ++train_steps_;
 
-            static size_t dbg_step = 0;
-            if (++dbg_step % 500 == 0)
-            { // print every 500 grad steps
-                /* 1a. running loss (MSE) */
-                float batch_loss = 0.0f;
-                for (size_t i = 0; i < states_.size(); ++i)
-                    batch_loss += tiny_dnn::mse::f(td_targets[i], qnet.predict(states_[i]));
-                batch_loss /= states_.size();
-
-                /* 1b. maximum |Q| in the online network */
-                float q_abs_max = 0.0f;
-                for (auto &q : qnet.predict_batch(states_))
-                    for (float v : q)
-                        q_abs_max = std::max(q_abs_max, std::fabs(v));
-
-                /* 1c. L2-norm of all weights */
-                float w_norm = 0.0f;
-                for (size_t l = 0; l < qnet.get_net().depth(); ++l)
-                    for (auto &W : qnet.get_net()[l]->weights())
-                        for (float v : *W)
-                            w_norm += v * v;
-                w_norm = std::sqrt(w_norm);
-
-                std::cout << "[DBG] step " << train_steps_
-                          << "  loss " << batch_loss
-                          << "  |Q|_max " << q_abs_max
-                          << "  ||W||_2 " << w_norm
-                          << "  eps " << config.epsilon
-                          << std::endl;
+            if (config.log_interval > 0 && train_steps_ % config.log_interval == 0 && metrics_logger())
+                log_learner_metrics(batch, td_targets);
+        }
+
+        // Loss, |Q| max, weight norm and friends for the batch just trained on;
+        // costs extra forward passes, so only every log_interval steps
+        void log_learner_metrics(const SampledBatch &batch, const std::vector<tiny_dnn::vec_t> &td_targets)
+        {
+            const auto &states = batch.states;
+            auto q_values = qnet.predict_batch(states);
+
+            float batch_loss = 0.0f;
+            float q_abs_max = 0.0f;
+            for (size_t i = 0; i < states.size(); ++i)
+            {
+                batch_loss += tiny_dnn::mse::f(td_targets[i], q_values[i]);
+                for (float v : q_values[i])
+                    q_abs_max = std::max(q_abs_max, std::fabs(v));
             }
+            batch_loss /= states.size();
+
+            float w_norm = 0.0f;
+            for (size_t l = 0; l < qnet.get_net().depth(); ++l)
+                for (auto &W : qnet.get_net()[l]->weights())
+                    for (float v : *W)
+                        w_norm += v * v;
+            w_norm = std::sqrt(w_norm);
+
+            float done_ratio = std::accumulate(batch.dones.begin(), batch.dones.end(), 0.0f) / batch.dones.size();
+
+            log_metric(Metric::kLoss, train_steps_, batch_loss);
+            log_metric(Metric::kQAbsMax, train_steps_, q_abs_max);
+            log_metric(Metric::kWeightNorm, train_steps_, w_norm);
+            log_metric(Metric::kEpsilon, train_steps_, config.epsilon);
+            log_metric(Metric::kDoneRatio, train_steps_, done_ratio);
+            if (target_cache_)
+                log_metric(Metric::kTargetCacheHitRate, train_steps_, target_cache_->hit_rate());
         }
 
-    private:
         QNetwork &qnet;
         DQNConfig config;
         tiny_rl::clipped_adam optimizer;
         PrioritizedReplayBuffer replay_buffer;
+        std::mutex replay_mutex_;
         std::mt19937 rng;
-        size_t env_steps_;
+        std::atomic<size_t> env_steps_;
         size_t train_steps_;
+        size_t updates_issued_;
+
+        SampledBatch batch_;
+        std::vector<float> td_errors_;
+        std::vector<tiny_dnn::vec_t> td_targets_;
+        std::vector<tiny_dnn::vec_t> next_q_;
+        std::unique_ptr<TargetValueCache> target_cache_;
+        std::unique_ptr<DataParallelLearner> parallel_learner_;
+        std::unique_ptr<FlatNetCopy> flat_net_;
+        FlatScratch flat_scratch_;
+        bool flat_unsupported_ = false;
+        ObservationNormalizer *normalizer_ = nullptr;
+        std::thread checkpoint_thread_;
+        std::exception_ptr checkpoint_error_;
+        int num_actions_ = 0;
 
-        std::vector<Experience> sample_buffer_;
-        std::vector<tiny_dnn::vec_t> states_;
-        std::vector<tiny_dnn::vec_t> next_states_;
-        std::vector<int> actions_;
-        std::vector<float> rewards_;
-        std::vector<bool> dones_;
+        // declared last so pending sampler tasks finish before the buffer goes away
+        std::unique_ptr<PrefetchSampler> sampler_;
     };
 }
\ No newline at end of file
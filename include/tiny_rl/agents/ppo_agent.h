@@ -2,14 +2,23 @@
 #pragma once
 
 #include <algorithm>
-#include <iostream>
+#include <cstring>
+#include <memory>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
 
 #include "base_agent.h"
 #include "../core/actor_critic_network.h"
+#include "../core/flat_policy.h"
 #include "../core/rollout_buffer.h"
+#include "../core/tensor_utils.h"
 #include "../optim/clipped_adam.h"
+#include "../utils/arena.h"
+#include "../utils/checkpoint.h"
 #include "../utils/config.h"
+#include "../utils/logger.h"
 
 namespace tiny_rl
 {
@@ -40,24 +49,115 @@ namespace tiny_rl
             return action;
         }
 
+        // Batched categorical sampling: all states go through the trunk and
+        // both heads in one flat forward pass each, then one uniform draw per
+        // state is inverted through the cumulative action probabilities
+        void select_actions(const std::vector<tiny_dnn::vec_t> &states, std::vector<int> &actions) override
+        {
+            std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+            size_t n = states.size();
+            actions.resize(n);
+            last_log_probs_.resize(n);
+            last_values_.resize(n);
+            if (n == 0)
+                return;
+
+            if (!flat_nets())
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    auto [probs, value] = ac_net.predict(states[i]);
+                    actions[i] = sample_action(probs.data(), probs.size(), uni(rng));
+                    last_log_probs_[i] = std::log(probs[actions[i]] + 1e-8f);
+                    last_values_[i] = value;
+                }
+                return;
+            }
+
+            ArenaScope scope(thread_arena());
+            size_t dim = flat_base_->input_size();
+            float *obs = thread_arena().allocate_array<float>(n * dim);
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (states[i].size() != dim)
+                    throw std::invalid_argument("PPOAgent::select_actions: state size does not match the network");
+                std::copy_n(states[i].data(), dim, obs + i * dim);
+            }
+            flat_base_->refresh();
+            flat_policy_->refresh();
+            flat_value_->refresh();
+
+            // both heads overwrite the ping-pong buffers, so park the trunk output
+            const float *features = flat_base_->forward(obs, n, flat_scratch_);
+            size_t width = flat_base_->output_size();
+            flat_scratch_.features.assign(features, features + n * width);
+
+            size_t num_actions = flat_policy_->output_size();
+            float *probs = thread_arena().allocate_array<float>(num_actions);
+            const float *logits = flat_policy_->forward(flat_scratch_.features.data(), n, flat_scratch_);
+            for (size_t i = 0; i < n; ++i)
+            {
+                // softmax over the logits, as ActorCriticNetwork::predict
+                std::copy_n(logits + i * num_actions, num_actions, probs);
+                apply_activation(flat::kSoftmax, probs, num_actions);
+                actions[i] = sample_action(probs, num_actions, uni(rng));
+                last_log_probs_[i] = std::log(probs[actions[i]] + 1e-8f);
+            }
+
+            const float *values = flat_value_->forward(flat_scratch_.features.data(), n, flat_scratch_);
+            for (size_t i = 0; i < n; ++i)
+                last_values_[i] = values[i * flat_value_->output_size()];
+        }
+
         void store_experience(const tiny_dnn::vec_t &state,
                               int action,
                               float reward,
                               const tiny_dnn::vec_t &,
                               bool done) override
         {
-            RolloutEntry entry;
-            entry.state = state;
-            entry.action = action;
-            entry.reward = reward;
-            entry.done = done;
-            entry.log_prob = last_log_prob_;
-            entry.value = last_value_;
+            rollout_buffer.add(state, action, reward, done, last_log_prob_, last_value_);
+            ++env_steps_;
+        }
 
-            rollout_buffer.add(entry);
+        // The state buffer moves into the rollout, a pooled one comes back
+        void store_experience(tiny_dnn::vec_t &&state,
+                              int action,
+                              float reward,
+                              const tiny_dnn::vec_t &,
+                              bool done) override
+        {
+            rollout_buffer.add(std::move(state), action, reward, done, last_log_prob_, last_value_);
             ++env_steps_;
         }
 
+        // Entries from N lockstep envs are interleaved in the rollout buffer,
+        // env i at positions i, i + N, ...; GAE walks each lane separately
+        void store_experiences(const std::vector<tiny_dnn::vec_t> &states,
+                               const std::vector<int> &actions,
+                               const std::vector<float> &rewards,
+                               const std::vector<tiny_dnn::vec_t> &,
+                               const std::vector<bool> &dones) override
+        {
+            size_t n = states.size();
+            begin_lanes(n);
+            for (size_t i = 0; i < n; ++i)
+                rollout_buffer.add(states[i], actions[i], rewards[i], dones[i], last_log_probs_[i], last_values_[i]);
+            env_steps_ += n;
+        }
+
+        void store_experiences(std::vector<tiny_dnn::vec_t> &&states,
+                               const std::vector<int> &actions,
+                               const std::vector<float> &rewards,
+                               const std::vector<tiny_dnn::vec_t> &,
+                               const std::vector<bool> &dones) override
+        {
+            size_t n = states.size();
+            begin_lanes(n);
+            for (size_t i = 0; i < n; ++i)
+                rollout_buffer.add(std::move(states[i]), actions[i], rewards[i], dones[i], last_log_probs_[i], last_values_[i]);
+            env_steps_ += n;
+        }
+
         void learn() override
         {
             // only train once buffer is full
@@ -66,33 +166,29 @@ namespace tiny_rl
 
             compute_gae_and_returns();
 
+            // the batch columns are members so their storage survives updates
             const auto &data = rollout_buffer.data();
             size_t N = data.size();
-            std::vector<tiny_dnn::vec_t> states;
-            states.reserve(N);
-            std::vector<int> actions;
-            actions.reserve(N);
-            std::vector<float> old_log_probs;
-            old_log_probs.reserve(N);
-            std::vector<float> advantages;
-            advantages.reserve(N);
-            std::vector<float> returns;
-            returns.reserve(N);
-
-            for (const auto &e : data)
+            batch_states_.resize(N);
+            batch_actions_.resize(N);
+            batch_log_probs_.resize(N);
+            batch_advantages_.resize(N);
+            batch_returns_.resize(N);
+            for (size_t i = 0; i < N; ++i)
             {
-                states.push_back(e.state);
-                actions.push_back(e.action);
-                old_log_probs.push_back(e.log_prob);
-                advantages.push_back(e.advantage);
-                returns.push_back(e.return_);
+                const auto &e = data[i];
+                batch_states_[i].assign(e.state.begin(), e.state.end());
+                batch_actions_[i] = e.action;
+                batch_log_probs_[i] = e.log_prob;
+                batch_advantages_[i] = e.advantage;
+                batch_returns_[i] = e.return_;
             }
 
-            ac_net.train(states,
-                         actions,
-                         old_log_probs,
-                         advantages,
-                         returns,
+            ac_net.train(batch_states_,
+                         batch_actions_,
+                         batch_log_probs_,
+                         batch_advantages_,
+                         batch_returns_,
                          optimizer,
                          config.clip_epsilon,
                          config.entropy_coeff,
@@ -100,9 +196,9 @@ namespace tiny_rl
                          config.mini_epochs);
 
             rollout_buffer.clear();
+            rollout_stride_ = 1;
             ++train_steps_;
-            if (train_steps_ % 500 == 0)
-                std::cout << "[PPOAgent] Completed update #" << train_steps_ << std::endl;
+            log_metric(Metric::kPolicyUpdate, train_steps_, 1.0f);
         }
 
         void on_episode_end() override
@@ -112,6 +208,7 @@ namespace tiny_rl
         void reset() override
         {
             rollout_buffer.clear();
+            rollout_stride_ = 1;
         }
 
         void seed(unsigned int seed) override
@@ -119,20 +216,118 @@ namespace tiny_rl
             rng.seed(seed);
         }
 
+        // The rollout buffer is on-policy and short-lived, so only the three
+        // networks, optimizer moments and counters are checkpointed
+        void save(const std::string &path) override
+        {
+            CheckpointWriter writer(path);
+            std::vector<float> params;
+            flatten_params(ac_net.get_base(), params);
+            write_param_section(writer, ckpt::kBaseParams, params);
+            flatten_params(ac_net.get_policy(), params);
+            write_param_section(writer, ckpt::kPolicyParams, params);
+            flatten_params(ac_net.get_value(), params);
+            write_param_section(writer, ckpt::kValueParams, params);
+            write_optimizer_section(writer, optimizer, nets());
+
+            uint64_t counters[2] = {env_steps_, train_steps_};
+            writer.write_section(ckpt::kAgentCounters, counters, sizeof(counters));
+            writer.close();
+        }
+
+        void load(const std::string &path) override
+        {
+            CheckpointReader reader(path);
+            Net &base = ac_net.get_base();
+            load_params(base, read_param_section(reader, ckpt::kBaseParams, param_count(base)));
+            Net &policy = ac_net.get_policy();
+            load_params(policy, read_param_section(reader, ckpt::kPolicyParams, param_count(policy)));
+            Net &value = ac_net.get_value();
+            load_params(value, read_param_section(reader, ckpt::kValueParams, param_count(value)));
+            read_optimizer_section(reader, optimizer, nets());
+
+            auto [data, bytes] = reader.section(ckpt::kAgentCounters);
+            uint64_t counters[2];
+            if (bytes != sizeof(counters))
+                throw std::runtime_error("PPOAgent::load: bad counters section");
+            std::memcpy(counters, data, sizeof(counters));
+            env_steps_ = counters[0];
+            train_steps_ = counters[1];
+            reset();
+        }
+
     private:
+        void begin_lanes(size_t n)
+        {
+            if (config.buffer_capacity % n != 0)
+                throw std::invalid_argument("PPOConfig::buffer_capacity must be a multiple of the number of envs");
+            if (last_log_probs_.size() != n || last_values_.size() != n)
+                throw std::logic_error("PPOAgent::store_experiences: call select_actions() on the same envs first");
+            rollout_stride_ = n;
+        }
+
+        // Inverse CDF draw; `u` in [0, 1), rounding falls to the last action
+        static int sample_action(const float *probs, size_t num_actions, float u)
+        {
+            float cdf = 0.0f;
+            for (size_t a = 0; a < num_actions; ++a)
+            {
+                cdf += probs[a];
+                if (u < cdf)
+                    return static_cast<int>(a);
+            }
+            return static_cast<int>(num_actions) - 1;
+        }
+
+        // Flat copies of trunk and heads for batched acting, built on first
+        // use; false when a network has layers the flat path cannot run
+        bool flat_nets()
+        {
+            if (!flat_base_ && !flat_unsupported_)
+            {
+                // all three or none: members are set only once every copy is built
+                try
+                {
+                    auto base = std::make_unique<FlatNetCopy>(ac_net.get_base());
+                    auto policy = std::make_unique<FlatNetCopy>(ac_net.get_policy());
+                    auto value = std::make_unique<FlatNetCopy>(ac_net.get_value());
+                    flat_base_ = std::move(base);
+                    flat_policy_ = std::move(policy);
+                    flat_value_ = std::move(value);
+                }
+                catch (const std::invalid_argument &)
+                {
+                    flat_unsupported_ = true;
+                }
+            }
+            return flat_base_ != nullptr;
+        }
+
+        std::vector<Net *> nets()
+        {
+            return {&ac_net.get_base(), &ac_net.get_policy(), &ac_net.get_value()};
+        }
+
         void compute_gae_and_returns()
         {
             auto &data = rollout_buffer.mutable_data();
-            float gae = 0.0f;
-            float next_value = data.back().value;
+            int stride = static_cast<int>(rollout_stride_);
+            int size = static_cast<int>(data.size());
 
-            for (int t = static_cast<int>(data.size()) - 1; t >= 0; --t)
+            for (int lane = 0; lane < stride; ++lane)
             {
-                float delta = data[t].reward + (data[t].done ? 0.0f : config.gamma * next_value) - data[t].value;
-                gae = delta + config.gamma * config.lambda * (data[t].done ? 0.0f : gae);
-                data[t].advantage = gae;
-                data[t].return_ = gae + data[t].value;
-                next_value = data[t].value;
+                int last = lane + ((size - 1 - lane) / stride) * stride;
+                float gae = 0.0f;
+                float next_value = data[last].value;
+
+                for (int t = last; t >= 0; t -= stride)
+                {
+                    float delta = data[t].reward + (data[t].done ? 0.0f : config.gamma * next_value) - data[t].value;
+                    gae = delta + config.gamma * config.lambda * (data[t].done ? 0.0f : gae);
+                    data[t].advantage = gae;
+                    data[t].return_ = gae + data[t].value;
+                    next_value = data[t].value;
+                }
             }
         }
 
@@ -145,5 +340,19 @@ namespace tiny_rl
         size_t train_steps_;
         float last_log_prob_;
         float last_value_;
+        std::vector<float> last_log_probs_;
+        std::vector<float> last_values_;
+        size_t rollout_stride_ = 1;
+        std::unique_ptr<FlatNetCopy> flat_base_;
+        std::unique_ptr<FlatNetCopy> flat_policy_;
+        std::unique_ptr<FlatNetCopy> flat_value_;
+        FlatScratch flat_scratch_;
+        bool flat_unsupported_ = false;
+
+        std::vector<tiny_dnn::vec_t> batch_states_;
+        std::vector<int> batch_actions_;
+        std::vector<float> batch_log_probs_;
+        std::vector<float> batch_advantages_;
+        std::vector<float> batch_returns_;
     };
 }
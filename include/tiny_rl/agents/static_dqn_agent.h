@@ -0,0 +1,426 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "base_agent.h"
+#include "../core/flat_policy.h"
+#include "../core/prioritized_replay_buffer.h"
+#include "../core/q_network.h"
+#include "../core/tensor_utils.h"
+#include "../optim/clipped_adam.h"
+#include "../utils/arena.h"
+#include "../utils/checkpoint.h"
+#include "../utils/config.h"
+#include "../utils/logger.h"
+
+/*
+ DQN agent with observation width, action count and batch size fixed at
+ compile time, for deployments that pin a model's shape. DQNAgent stays
+ the runtime-configured default; use this one when the dimensions are
+ known per build.
+
+ Replay slots are fixed-width records and all batch scratch (states,
+ targets, TD errors, sampled indices) lives in fixed-size 64-byte aligned
+ arrays, so gathers, TD targets, argmax and error loops have constant trip
+ counts the compiler unrolls and vectorizes. Forward passes run on flat
+ copies of the online and target weights (flat_policy.h) instead of
+ tiny_dnn predict(); the online copy is refreshed after every gradient
+ step and the target copy at every target sync. The gradient step itself
+ still goes through tiny_dnn, fed from persistent vectors.
+
+ Hyperparameters come from DQNConfig, whose batch_size must equal
+ BatchSize. Checkpoints use the same sections as DQNAgent minus the replay
+ buffer, so either agent can load the other's networks.
+*/
+
+namespace tiny_rl
+{
+    template <size_t ObsDim, size_t NumActions, size_t BatchSize>
+    class StaticDQNAgent : public BaseAgent
+    {
+        static_assert(ObsDim > 0 && NumActions > 0 && BatchSize > 0, "StaticDQNAgent: dimensions must be positive");
+
+    public:
+        static constexpr size_t kObsDim = ObsDim;
+        static constexpr size_t kNumActions = NumActions;
+        static constexpr size_t kBatchSize = BatchSize;
+
+        using BaseAgent::store_experience;
+
+        StaticDQNAgent(QNetwork &qnet, DQNConfig config)
+            : qnet_(qnet),
+              config_(config),
+              replay_(static_cast<size_t>(config.memory_size)),
+              priorities_(static_cast<size_t>(config.memory_size), 0.0f),
+              tree_(static_cast<size_t>(config.memory_size)),
+              rng_(std::random_device{}()),
+              train_states_(BatchSize, tiny_dnn::vec_t(ObsDim)),
+              train_targets_(BatchSize, tiny_dnn::vec_t(NumActions))
+        {
+            if (config.batch_size != static_cast<int>(BatchSize))
+                throw std::invalid_argument("StaticDQNAgent: DQNConfig::batch_size must equal BatchSize");
+            if (config.memory_size < static_cast<int>(BatchSize))
+                throw std::invalid_argument("StaticDQNAgent: memory_size must hold at least one batch");
+
+            append_flat_layout(qnet_.get_net(), layers_, weight_bytes_);
+            if (layers_.empty() || layers_.front().in != ObsDim || layers_.back().out != NumActions)
+                throw std::invalid_argument("StaticDQNAgent: network shape does not match ObsDim/NumActions");
+            online_weights_ = allocate_weights(weight_bytes_);
+            target_weights_ = allocate_weights(weight_bytes_);
+
+            optimizer_.alpha = config.learning_rate;
+            optimizer_.b1 = 0.9f;
+            optimizer_.b2 = 0.999f;
+            qnet_.update_target_network(1.0f);
+            refresh_online();
+            refresh_target();
+        }
+
+        int select_action(const tiny_dnn::vec_t &state) override
+        {
+            TINY_RL_PROFILE_SCOPE(kSelectAction);
+            std::uniform_real_distribution<float> coin(0, 1);
+            if (coin(rng_) < config_.epsilon)
+            {
+                std::uniform_int_distribution<int> pick(0, static_cast<int>(NumActions) - 1);
+                return pick(rng_);
+            }
+            return argmax(forward(online_weights_.get(), state.data(), 1));
+        }
+
+        // Greedy rows are packed into one contiguous block on the thread
+        // arena and pushed through a single batched forward pass
+        void select_actions(const std::vector<tiny_dnn::vec_t> &states, std::vector<int> &actions) override
+        {
+            TINY_RL_PROFILE_SCOPE(kSelectAction);
+            ArenaScope scope(thread_arena());
+            std::uniform_real_distribution<float> coin(0, 1);
+            std::uniform_int_distribution<int> pick(0, static_cast<int>(NumActions) - 1);
+            size_t n = states.size();
+            actions.resize(n);
+            size_t *rows = thread_arena().allocate_array<size_t>(n);
+            float *obs = thread_arena().allocate_array<float>(n * ObsDim);
+            size_t greedy = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (coin(rng_) < config_.epsilon)
+                {
+                    actions[i] = pick(rng_);
+                    continue;
+                }
+                std::copy_n(states[i].data(), ObsDim, obs + greedy * ObsDim);
+                rows[greedy++] = i;
+            }
+            if (greedy == 0)
+                return;
+            const float *q = forward(online_weights_.get(), obs, greedy);
+            for (size_t k = 0; k < greedy; ++k)
+                actions[rows[k]] = argmax(q + k * NumActions);
+        }
+
+        void store_experience(const tiny_dnn::vec_t &state, int action, float reward,
+                              const tiny_dnn::vec_t &next_state, bool done) override
+        {
+            TINY_RL_PROFILE_SCOPE(kReplayAdd);
+            if (state.size() != ObsDim || next_state.size() != ObsDim)
+                throw std::invalid_argument("StaticDQNAgent: observation size does not match ObsDim");
+            Transition &slot = replay_[pos_];
+            std::copy_n(state.data(), ObsDim, slot.state);
+            std::copy_n(next_state.data(), ObsDim, slot.next_state);
+            slot.action = action;
+            slot.reward = reward;
+            slot.done = done ? 1 : 0;
+
+            // running max of every priority assigned, an O(1) stand-in for
+            // DQNAgent's scan; it never undershoots the current max
+            priorities_[pos_] = max_priority_;
+            tree_.set(pos_, std::pow(max_priority_, kAlpha));
+            pos_ = (pos_ + 1) % replay_.size();
+            size_ = std::min(size_ + 1, replay_.size());
+            ++env_steps_;
+        }
+
+        void on_episode_end() override
+        {
+            config_.epsilon = std::max(config_.epsilon_min, config_.epsilon * config_.epsilon_decay);
+        }
+
+        // Same gating as DQNAgent::learn()
+        void learn() override
+        {
+            if (env_steps_ < static_cast<size_t>(config_.learn_start))
+                return;
+            size_t tf = static_cast<size_t>(config_.train_frequency);
+            size_t skipped = config_.learn_start > 0 ? (config_.learn_start - 1) / tf : 0;
+            size_t due = env_steps_ / tf - skipped;
+            while (updates_issued_ < due)
+            {
+                ++updates_issued_;
+                train_step();
+            }
+        }
+
+        // One gradient update on a sampled minibatch; false until replay holds a batch
+        bool train_step()
+        {
+            if (size_ < BatchSize)
+                return false;
+            sample();
+            update();
+            return true;
+        }
+
+        void seed(unsigned int seed) override
+        {
+            rng_.seed(seed);
+        }
+
+        void save(const std::string &path) override
+        {
+            CheckpointWriter writer(path);
+            std::vector<float> params;
+            flatten_params(qnet_.get_net(), params);
+            write_param_section(writer, ckpt::kOnlineParams, params);
+            flatten_params(qnet_.get_target(), params);
+            write_param_section(writer, ckpt::kTargetParams, params);
+            write_optimizer_section(writer, optimizer_, std::vector<Net *>{&qnet_.get_net()});
+            Counters counters{config_.epsilon, 0, env_steps_, train_steps_, updates_issued_};
+            writer.write_section(ckpt::kAgentCounters, &counters, sizeof(counters));
+            writer.close();
+        }
+
+        // Replay contents are not restored; a replay section is ignored
+        void load(const std::string &path) override
+        {
+            CheckpointReader reader(path);
+            Net &net = qnet_.get_net();
+            load_params(net, read_param_section(reader, ckpt::kOnlineParams, param_count(net)));
+            Net &target = qnet_.get_target();
+            load_params(target, read_param_section(reader, ckpt::kTargetParams, param_count(target)));
+            read_optimizer_section(reader, optimizer_, std::vector<Net *>{&net});
+
+            auto [data, bytes] = reader.section(ckpt::kAgentCounters);
+            if (bytes != sizeof(Counters))
+                throw std::runtime_error("StaticDQNAgent::load: bad counters section");
+            Counters counters;
+            std::memcpy(&counters, data, sizeof(counters));
+            config_.epsilon = counters.epsilon;
+            env_steps_ = counters.env_steps;
+            train_steps_ = counters.train_steps;
+            updates_issued_ = counters.updates_issued;
+            refresh_online();
+            refresh_target();
+        }
+
+        // TD errors of the last batch, one per row
+        const std::array<float, BatchSize> &td_errors() const
+        {
+            return td_errors_;
+        }
+
+        const DQNConfig &get_config() const
+        {
+            return config_;
+        }
+
+        QNetwork &network()
+        {
+            return qnet_;
+        }
+
+        size_t env_steps() const
+        {
+            return env_steps_;
+        }
+
+        size_t train_steps() const
+        {
+            return train_steps_;
+        }
+
+        size_t replay_size() const
+        {
+            return size_;
+        }
+
+    private:
+        static constexpr float kAlpha = 0.6f;
+        static constexpr float kPriorityEpsilon = 1e-6f;
+
+        struct Transition
+        {
+            float state[ObsDim];
+            float next_state[ObsDim];
+            int32_t action;
+            float reward;
+            uint8_t done;
+        };
+
+        // Same layout as DQNAgent's counters section
+        struct Counters
+        {
+            float epsilon;
+            uint32_t reserved;
+            uint64_t env_steps;
+            uint64_t train_steps;
+            uint64_t updates_issued;
+        };
+
+        struct FreeDeleter
+        {
+            void operator()(char *p) const { std::free(p); }
+        };
+        using Weights = std::unique_ptr<char, FreeDeleter>;
+
+        static Weights allocate_weights(size_t bytes)
+        {
+            void *p = nullptr;
+            if (posix_memalign(&p, flat::kAlign, std::max<size_t>(bytes, flat::kAlign)) != 0)
+                throw std::bad_alloc();
+            return Weights(static_cast<char *>(p));
+        }
+
+        void refresh_online()
+        {
+            write_flat_weights(qnet_.get_net(), layers_.data(), online_weights_.get());
+        }
+
+        void refresh_target()
+        {
+            write_flat_weights(qnet_.get_target(), layers_.data(), target_weights_.get());
+        }
+
+        // `rows` observations in, rows x NumActions Q-values out; the result
+        // lives in scratch_ until the next call
+        const float *forward(const char *weights, const float *obs, size_t rows)
+        {
+            return flat_forward_batch(layers_.data(), layers_.size(), weights, obs, rows, scratch_);
+        }
+
+        static int argmax(const float *q)
+        {
+            int best = 0;
+            for (size_t a = 1; a < NumActions; ++a)
+                if (q[a] > q[best])
+                    best = static_cast<int>(a);
+            return best;
+        }
+
+        // Proportional prioritized sampling, one draw per equal-mass segment
+        void sample()
+        {
+            TINY_RL_PROFILE_SCOPE(kReplaySample);
+            float segment = tree_.total() / BatchSize;
+            for (size_t i = 0; i < BatchSize; ++i)
+            {
+                std::uniform_real_distribution<float> dist(segment * i, segment * (i + 1));
+                float p_alpha;
+                size_t index = std::min(tree_.get_leaf(dist(rng_), p_alpha), size_ - 1);
+                indices_[i] = index;
+
+                const Transition &t = replay_[index];
+                std::copy_n(t.state, ObsDim, &states_[i * ObsDim]);
+                std::copy_n(t.next_state, ObsDim, &next_states_[i * ObsDim]);
+                actions_[i] = t.action;
+                rewards_[i] = t.reward;
+                not_done_[i] = t.done ? 0.0f : 1.0f;
+            }
+        }
+
+        void update()
+        {
+            {
+                TINY_RL_PROFILE_SCOPE(kTdTargets);
+                // double DQN: the online network picks a', the target network rates it
+                const float *next_online = forward(online_weights_.get(), next_states_.data(), BatchSize);
+                for (size_t i = 0; i < BatchSize; ++i)
+                    best_next_[i] = argmax(next_online + i * NumActions);
+
+                const float *next_target = forward(target_weights_.get(), next_states_.data(), BatchSize);
+                for (size_t i = 0; i < BatchSize; ++i)
+                    next_values_[i] = next_target[i * NumActions + best_next_[i]];
+
+                const float *q = forward(online_weights_.get(), states_.data(), BatchSize);
+                std::copy_n(q, BatchSize * NumActions, targets_.data());
+                for (size_t i = 0; i < BatchSize; ++i)
+                    targets_[i * NumActions + actions_[i]] = rewards_[i] + config_.gamma * not_done_[i] * next_values_[i];
+            }
+
+            for (size_t i = 0; i < BatchSize; ++i)
+            {
+                std::copy_n(&states_[i * ObsDim], ObsDim, train_states_[i].data());
+                std::copy_n(&targets_[i * NumActions], NumActions, train_targets_[i].data());
+            }
+            qnet_.train(train_states_, train_targets_, optimizer_, static_cast<int>(BatchSize));
+            refresh_online();
+
+            const float *q = forward(online_weights_.get(), states_.data(), BatchSize);
+            for (size_t i = 0; i < BatchSize; ++i)
+            {
+                size_t k = i * NumActions + actions_[i];
+                td_errors_[i] = std::fabs(targets_[k] - q[k]);
+            }
+            for (size_t i = 0; i < BatchSize; ++i)
+            {
+                float p = td_errors_[i] + kPriorityEpsilon;
+                priorities_[indices_[i]] = p;
+                max_priority_ = std::max(max_priority_, p);
+                tree_.set(indices_[i], std::pow(p, kAlpha));
+            }
+
+            if (train_steps_ % config_.target_update_freq == 0 && train_steps_ > 0)
+            {
+                log_metric(Metric::kTargetSync, train_steps_, 1.0f);
+                qnet_.update_target_network(1.0f);
+                refresh_target();
+            }
+            ++train_steps_;
+        }
+
+        QNetwork &qnet_;
+        DQNConfig config_;
+        tiny_rl::clipped_adam optimizer_;
+
+        std::vector<Transition> replay_;
+        std::vector<float> priorities_;
+        SumTree tree_;
+        float max_priority_ = 1.0f;
+        size_t pos_ = 0;
+        size_t size_ = 0;
+
+        std::mt19937 rng_;
+        size_t env_steps_ = 0;
+        size_t train_steps_ = 0;
+        size_t updates_issued_ = 0;
+
+        std::vector<FlatLayerDesc> layers_;
+        uint64_t weight_bytes_ = 0;
+        Weights online_weights_;
+        Weights target_weights_;
+        FlatScratch scratch_;
+
+        alignas(64) std::array<float, BatchSize * ObsDim> states_{};
+        alignas(64) std::array<float, BatchSize * ObsDim> next_states_{};
+        alignas(64) std::array<float, BatchSize * NumActions> targets_{};
+        alignas(64) std::array<float, BatchSize> rewards_{};
+        alignas(64) std::array<float, BatchSize> not_done_{};
+        alignas(64) std::array<float, BatchSize> next_values_{};
+        alignas(64) std::array<float, BatchSize> td_errors_{};
+        std::array<int, BatchSize> actions_{};
+        std::array<int, BatchSize> best_next_{};
+        std::array<size_t, BatchSize> indices_{};
+
+        // tiny_dnn's train() only takes vectors; filled in place each update
+        std::vector<tiny_dnn::vec_t> train_states_;
+        std::vector<tiny_dnn::vec_t> train_targets_;
+    };
+}
@@ -58,6 +58,22 @@ namespace tiny_rl
         {
         }
 
+        // getters
+        tiny_dnn::network<tiny_dnn::sequential> &get_base()
+        {
+            return base_net;
+        }
+
+        tiny_dnn::network<tiny_dnn::sequential> &get_policy()
+        {
+            return policy_head;
+        }
+
+        tiny_dnn::network<tiny_dnn::sequential> &get_value()
+        {
+            return value_head;
+        }
+
     private:
         tiny_dnn::network<tiny_dnn::sequential> &base_net;
         tiny_dnn::network<tiny_dnn::sequential> &policy_head;
@@ -0,0 +1,287 @@
+#pragma once
+#include <tiny_dnn/tiny_dnn.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include "flat_policy.h"
+#include "tensor_utils.h"
+#include "../utils/profiler.h"
+#include "../utils/thread_pool.h"
+
+/*
+ Synchronous data-parallel training of an MLP on an MSE loss. Each step
+ splits the minibatch into K contiguous shards; K pool tasks run forward
+ and backward on their shard against a flat copy of the parameters and
+ accumulate into private gradient buffers. The buffers are then summed by
+ a pairwise tree (0+1, 2+3, then 0+2, ...) with the parameter vector cut
+ into chunks that are reduced in parallel, and the result feeds one
+ optimizer step on the tiny_dnn network.
+
+ The gradient is the one tiny_dnn's train() computes for a single batch:
+ d/dy of mse (2 (y - t) / n) averaged over the batch. Shard boundaries and
+ the reduction tree depend only on K, so for a fixed K the result is
+ bitwise reproducible regardless of scheduling.
+
+ Like the flat policy format, only fully connected layers and elementwise
+ activations (plus softmax) are supported.
+*/
+
+namespace tiny_rl
+{
+    // Multiply `delta` by the activation's derivative, given the activation's outputs
+    inline void flat_activation_backward(uint32_t act, const float *y, float *delta, size_t n, float leaky_slope = 0.0f)
+    {
+        switch (act)
+        {
+        case flat::kRelu:
+            for (size_t i = 0; i < n; ++i)
+                delta[i] = y[i] > 0.0f ? delta[i] : 0.0f;
+            break;
+        case flat::kLeakyRelu:
+            for (size_t i = 0; i < n; ++i)
+                delta[i] = y[i] > 0.0f ? delta[i] : leaky_slope * delta[i];
+            break;
+        case flat::kTanh:
+            for (size_t i = 0; i < n; ++i)
+                delta[i] *= 1.0f - y[i] * y[i];
+            break;
+        case flat::kSigmoid:
+            for (size_t i = 0; i < n; ++i)
+                delta[i] *= y[i] * (1.0f - y[i]);
+            break;
+        case flat::kSoftmax:
+        {
+            float dot = 0.0f;
+            for (size_t i = 0; i < n; ++i)
+                dot += delta[i] * y[i];
+            for (size_t i = 0; i < n; ++i)
+                delta[i] = y[i] * (delta[i] - dot);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    class DataParallelLearner
+    {
+    public:
+        DataParallelLearner(Net &net, size_t num_workers)
+            : net_(net),
+              num_workers_(std::max<size_t>(num_workers, 1)),
+              bytes_(0)
+        {
+            append_flat_layout(net_, layers_, bytes_);
+            if (layers_.empty())
+                throw std::invalid_argument("DataParallelLearner: network has no layers");
+            params_ = allocate(bytes_);
+            grads_.resize(num_workers_);
+            for (auto &g : grads_)
+                g = allocate(bytes_);
+            workers_.resize(num_workers_);
+        }
+
+        DataParallelLearner(const DataParallelLearner &) = delete;
+        DataParallelLearner &operator=(const DataParallelLearner &) = delete;
+
+        ~DataParallelLearner()
+        {
+            std::free(params_);
+            for (auto *g : grads_)
+                std::free(g);
+        }
+
+        size_t num_workers() const
+        {
+            return num_workers_;
+        }
+
+        // One optimizer step on the whole batch; returns the mean MSE loss
+        // before the update
+        float train(const std::vector<tiny_dnn::vec_t> &inputs,
+                    const std::vector<tiny_dnn::vec_t> &targets,
+                    tiny_dnn::optimizer &opt)
+        {
+            size_t batch = inputs.size();
+            if (batch == 0 || targets.size() != batch)
+                throw std::invalid_argument("DataParallelLearner: inputs and targets must be non-empty and match");
+
+            TINY_RL_PROFILE_SCOPE(kTrain);
+            write_flat_weights(net_, layers_.data(), params_);
+
+            ThreadPool &pool = shared_thread_pool();
+            pool.parallel_for(num_workers_, 1, [&](size_t begin, size_t end)
+                              {
+                                  for (size_t k = begin; k < end; ++k)
+                                      run_shard(k, batch * k / num_workers_, batch * (k + 1) / num_workers_,
+                                                inputs, targets);
+                              });
+
+            // chunked pairwise tree: grads_[0] ends up with the sum over shards
+            size_t floats = bytes_ / sizeof(float);
+            pool.parallel_for(floats, kReduceChunk, [&](size_t begin, size_t end)
+                              {
+                                  for (size_t stride = 1; stride < num_workers_; stride *= 2)
+                                      for (size_t k = 0; k + stride < num_workers_; k += 2 * stride)
+                                      {
+                                          float *dst = reinterpret_cast<float *>(grads_[k]);
+                                          const float *src = reinterpret_cast<const float *>(grads_[k + stride]);
+                                          for (size_t i = begin; i < end; ++i)
+                                              dst[i] += src[i];
+                                      }
+                              });
+
+            apply(opt, 1.0f / static_cast<float>(batch));
+
+            double loss = 0.0;
+            for (const auto &w : workers_)
+                loss += w.loss;
+            return static_cast<float>(loss / batch);
+        }
+
+    private:
+        static constexpr size_t kReduceChunk = 4096;
+
+        struct Worker
+        {
+            std::vector<std::vector<float>> acts; // acts[0] = inputs, acts[l + 1] = output of layer l
+            std::vector<float> delta;
+            std::vector<float> delta_prev;
+            double loss = 0.0;
+        };
+
+        static char *allocate(uint64_t bytes)
+        {
+            void *p = nullptr;
+            if (posix_memalign(&p, flat::kAlign, std::max<uint64_t>(bytes, flat::kAlign)) != 0)
+                throw std::bad_alloc();
+            return static_cast<char *>(p);
+        }
+
+        void run_shard(size_t k, size_t begin, size_t end,
+                       const std::vector<tiny_dnn::vec_t> &inputs,
+                       const std::vector<tiny_dnn::vec_t> &targets)
+        {
+            Worker &w = workers_[k];
+            float *grad = reinterpret_cast<float *>(grads_[k]);
+            std::fill(grad, grad + bytes_ / sizeof(float), 0.0f);
+            w.loss = 0.0;
+            size_t rows = end - begin;
+            if (rows == 0)
+                return;
+
+            size_t L = layers_.size();
+            w.acts.resize(L + 1);
+            size_t in = layers_.front().in;
+            w.acts[0].resize(rows * in);
+            for (size_t n = 0; n < rows; ++n)
+                std::copy(inputs[begin + n].begin(), inputs[begin + n].end(), w.acts[0].begin() + n * in);
+            for (size_t l = 0; l < L; ++l)
+            {
+                w.acts[l + 1].resize(rows * layers_[l].out);
+                flat_dense_forward(layers_[l], params_, w.acts[l].data(), rows, w.acts[l + 1].data());
+            }
+
+            // d mse / dy = 2 (y - t) / n, per row
+            size_t out = layers_.back().out;
+            const std::vector<float> &y = w.acts[L];
+            w.delta.resize(rows * out);
+            for (size_t n = 0; n < rows; ++n)
+            {
+                const auto &t = targets[begin + n];
+                float sq = 0.0f;
+                for (size_t o = 0; o < out; ++o)
+                {
+                    float diff = y[n * out + o] - t[o];
+                    sq += diff * diff;
+                    w.delta[n * out + o] = 2.0f * diff / out;
+                }
+                w.loss += sq / out;
+            }
+
+            for (size_t l = L; l-- > 0;)
+            {
+                const FlatLayerDesc &d = layers_[l];
+                const float *x = w.acts[l].data();
+                for (size_t n = 0; n < rows; ++n)
+                    flat_activation_backward(d.activation, w.acts[l + 1].data() + n * d.out, w.delta.data() + n * d.out, d.out,
+                                             d.leaky_slope);
+
+                float *gW = grad + d.weight_offset / sizeof(float);
+                for (size_t n = 0; n < rows; ++n)
+                {
+                    const float *dn = w.delta.data() + n * d.out;
+                    for (uint32_t c = 0; c < d.in; ++c)
+                    {
+                        const float xc = x[n * d.in + c];
+                        float *g = gW + static_cast<size_t>(c) * d.out;
+                        for (uint32_t o = 0; o < d.out; ++o)
+                            g[o] += xc * dn[o];
+                    }
+                }
+                if (d.has_bias)
+                {
+                    float *gb = grad + d.bias_offset / sizeof(float);
+                    for (size_t n = 0; n < rows; ++n)
+                        for (uint32_t o = 0; o < d.out; ++o)
+                            gb[o] += w.delta[n * d.out + o];
+                }
+
+                if (l == 0)
+                    break;
+                const float *W = reinterpret_cast<const float *>(params_ + d.weight_offset);
+                w.delta_prev.assign(rows * d.in, 0.0f);
+                for (size_t n = 0; n < rows; ++n)
+                {
+                    const float *dn = w.delta.data() + n * d.out;
+                    float *pn = w.delta_prev.data() + n * d.in;
+                    for (uint32_t c = 0; c < d.in; ++c)
+                    {
+                        const float *row = W + static_cast<size_t>(c) * d.out;
+                        float s = 0.0f;
+                        for (uint32_t o = 0; o < d.out; ++o)
+                            s += row[o] * dn[o];
+                        pn[c] = s;
+                    }
+                }
+                w.delta.swap(w.delta_prev);
+            }
+        }
+
+        // Feed the averaged gradient to the optimizer in tiny_dnn's layer order
+        void apply(tiny_dnn::optimizer &opt, float scale)
+        {
+            const float *grad = reinterpret_cast<const float *>(grads_[0]);
+            size_t k = 0;
+            for (size_t l = 0; l < net_.depth(); ++l)
+            {
+                if (net_[l]->layer_type() != "fully-connected")
+                    continue;
+                const FlatLayerDesc &d = layers_[k++];
+                auto params = net_[l]->weights();
+                uint64_t offsets[2] = {d.weight_offset, d.bias_offset};
+                for (size_t p = 0; p < params.size(); ++p)
+                {
+                    const float *g = grad + offsets[p] / sizeof(float);
+                    dW_.resize(params[p]->size());
+                    for (size_t i = 0; i < dW_.size(); ++i)
+                        dW_[i] = g[i] * scale;
+                    opt.update(dW_, *params[p], true);
+                }
+            }
+        }
+
+        Net &net_;
+        size_t num_workers_;
+        std::vector<FlatLayerDesc> layers_;
+        uint64_t bytes_;
+        char *params_;
+        std::vector<char *> grads_;
+        std::vector<Worker> workers_;
+        tiny_dnn::vec_t dW_;
+    };
+}
@@ -0,0 +1,605 @@
+#pragma once
+#include <tiny_dnn/tiny_dnn.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "q_network.h"
+#include "actor_critic_network.h"
+
+/*
+ Self-describing flat policy format for inference hosts. A file holds
+
+   FlatPolicyHeader (64 B) | FlatLayerDesc[num_layers] | weight blocks
+
+ with every weight and bias block starting on a 64-byte boundary. Each
+ FlatLayerDesc is one fully connected layer plus the activation that
+ follows it. FlatPolicy mmaps the file and runs inference straight from
+ the mapped pages, so loading does no parsing or copying and all
+ processes serving the same file share one page-cache copy.
+
+ Only fully connected layers and elementwise activations (plus softmax)
+ are supported, which covers every network built in this repo.
+*/
+
+namespace tiny_rl
+{
+    namespace flat
+    {
+        constexpr char kMagic[8] = {'T', 'R', 'L', 'F', 'L', 'A', 'T', '\0'};
+        constexpr uint32_t kVersion = 2;
+        constexpr uint64_t kAlign = 64;
+
+        enum Kind : uint32_t
+        {
+            kQNetwork = 1,
+            kActorCritic = 2,
+        };
+
+        enum Activation : uint32_t
+        {
+            kIdentity = 0,
+            kRelu = 1,
+            kTanh = 2,
+            kSigmoid = 3,
+            kSoftmax = 4,
+            kLeakyRelu = 5,
+        };
+
+        inline uint64_t align_up(uint64_t x)
+        {
+            return (x + kAlign - 1) & ~(kAlign - 1);
+        }
+
+        // tiny_dnn keeps the leaky-relu slope private, so read it back by
+        // running the activation on -1
+        inline float leaky_slope(tiny_dnn::layer *layer)
+        {
+            auto *act = dynamic_cast<tiny_dnn::activation_layer *>(layer);
+            if (!act)
+                throw std::invalid_argument("flat policy: leaky relu is not an activation layer");
+            tiny_dnn::vec_t x{-1.0f}, y(1);
+            act->forward_activation(x, y);
+            return -y[0];
+        }
+    }
+
+    struct FlatPolicyHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t kind;
+        uint32_t num_layers;
+        uint32_t trunk_layers;  // Q-network: all layers; actor-critic: shared base
+        uint32_t policy_layers; // actor-critic only
+        uint32_t value_layers;  // actor-critic only
+        uint32_t input_size;
+        uint32_t output_size;   // number of actions
+        uint64_t file_bytes;
+        uint8_t reserved[16];
+    };
+    static_assert(sizeof(FlatPolicyHeader) == 64, "FlatPolicyHeader must stay 64 bytes");
+
+    struct FlatLayerDesc
+    {
+        uint32_t in;
+        uint32_t out;
+        uint16_t activation;
+        uint16_t has_bias;
+        float leaky_slope;      // negative slope of kLeakyRelu, 0 otherwise
+        uint64_t weight_offset; // from the start of the weight base, W[c * out + o]
+        uint64_t bias_offset;
+    };
+    static_assert(sizeof(FlatLayerDesc) == 32, "FlatLayerDesc must stay 32 bytes");
+
+    // Ping-pong activations for flat_forward, reuse one per thread
+    struct FlatScratch
+    {
+        std::vector<float> a;
+        std::vector<float> b;
+        std::vector<float> features; // actor-critic trunk output, read by both heads
+    };
+
+    // Describe `net` as flat layers, assigning weight offsets starting at
+    // `offset` (which is advanced past the last block)
+    inline void append_flat_layout(tiny_dnn::network<tiny_dnn::sequential> &net,
+                                   std::vector<FlatLayerDesc> &layers,
+                                   uint64_t &offset)
+    {
+        for (size_t l = 0; l < net.depth(); ++l)
+        {
+            auto *layer = net[l];
+            std::string type = layer->layer_type();
+            if (type == "fully-connected")
+            {
+                auto params = layer->weights();
+                FlatLayerDesc d{};
+                d.in = static_cast<uint32_t>(layer->in_data_size());
+                d.out = static_cast<uint32_t>(layer->out_data_size());
+                d.activation = flat::kIdentity;
+                d.has_bias = params.size() > 1 ? 1 : 0;
+                offset = flat::align_up(offset);
+                d.weight_offset = offset;
+                offset += params[0]->size() * sizeof(float);
+                if (d.has_bias)
+                {
+                    offset = flat::align_up(offset);
+                    d.bias_offset = offset;
+                    offset += params[1]->size() * sizeof(float);
+                }
+                layers.push_back(d);
+                continue;
+            }
+
+            uint32_t act;
+            if (type == "relu-activation")
+                act = flat::kRelu;
+            else if (type == "tanh-activation")
+                act = flat::kTanh;
+            else if (type == "sigmoid-activation")
+                act = flat::kSigmoid;
+            else if (type == "softmax-activation")
+                act = flat::kSoftmax;
+            else if (type == "leaky-relu-activation")
+                act = flat::kLeakyRelu;
+            else
+                throw std::invalid_argument("flat policy: unsupported layer type " + type);
+
+            if (layers.empty() || layers.back().activation != flat::kIdentity)
+                throw std::invalid_argument("flat policy: activation must follow a fully connected layer");
+            layers.back().activation = static_cast<uint16_t>(act);
+            if (act == flat::kLeakyRelu)
+                layers.back().leaky_slope = flat::leaky_slope(layer);
+        }
+        offset = flat::align_up(offset);
+    }
+
+    // Copy the parameters of `net` into the blocks described by `layers`
+    inline void write_flat_weights(tiny_dnn::network<tiny_dnn::sequential> &net,
+                                   const FlatLayerDesc *layers,
+                                   char *base)
+    {
+        size_t k = 0;
+        for (size_t l = 0; l < net.depth(); ++l)
+        {
+            if (net[l]->layer_type() != "fully-connected")
+                continue;
+            auto params = net[l]->weights();
+            const FlatLayerDesc &d = layers[k++];
+            std::copy(params[0]->begin(), params[0]->end(), reinterpret_cast<float *>(base + d.weight_offset));
+            if (d.has_bias)
+                std::copy(params[1]->begin(), params[1]->end(), reinterpret_cast<float *>(base + d.bias_offset));
+        }
+    }
+
+    inline void apply_activation(uint32_t act, float *x, size_t n, float leaky_slope = 0.0f)
+    {
+        switch (act)
+        {
+        case flat::kRelu:
+            for (size_t i = 0; i < n; ++i)
+                x[i] = x[i] > 0.0f ? x[i] : 0.0f;
+            break;
+        case flat::kLeakyRelu:
+            for (size_t i = 0; i < n; ++i)
+                x[i] = x[i] > 0.0f ? x[i] : leaky_slope * x[i];
+            break;
+        case flat::kTanh:
+            for (size_t i = 0; i < n; ++i)
+                x[i] = std::tanh(x[i]);
+            break;
+        case flat::kSigmoid:
+            for (size_t i = 0; i < n; ++i)
+                x[i] = 1.0f / (1.0f + std::exp(-x[i]));
+            break;
+        case flat::kSoftmax:
+        {
+            float max = *std::max_element(x, x + n);
+            float sum = 0.0f;
+            for (size_t i = 0; i < n; ++i)
+            {
+                x[i] = std::exp(x[i] - max);
+                sum += x[i];
+            }
+            for (size_t i = 0; i < n; ++i)
+                x[i] /= sum;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // One flat layer on `batch` row-major inputs: y = act(x W + b).
+    // Each weight row is loaded once and applied to every input in the batch.
+    inline void flat_dense_forward(const FlatLayerDesc &d, const char *base,
+                                   const float *x, size_t batch, float *y)
+    {
+        const float *W = reinterpret_cast<const float *>(base + d.weight_offset);
+        for (size_t n = 0; n < batch; ++n)
+        {
+            float *yn = y + n * d.out;
+            if (d.has_bias)
+                std::copy_n(reinterpret_cast<const float *>(base + d.bias_offset), d.out, yn);
+            else
+                std::fill(yn, yn + d.out, 0.0f);
+        }
+
+        // row-major over inputs so the inner loop is contiguous
+        for (uint32_t c = 0; c < d.in; ++c)
+        {
+            const float *row = W + static_cast<size_t>(c) * d.out;
+            for (size_t n = 0; n < batch; ++n)
+            {
+                const float xc = x[n * d.in + c];
+                float *yo = y + n * d.out;
+                for (uint32_t o = 0; o < d.out; ++o)
+                    yo[o] += xc * row[o];
+            }
+        }
+        for (size_t n = 0; n < batch; ++n)
+            apply_activation(d.activation, y + n * d.out, d.out, d.leaky_slope);
+    }
+
+    // Run `count` flat layers on `batch` row-major inputs; returns a pointer
+    // to the batch of outputs, which lives in `scratch` until the next call.
+    inline const float *flat_forward_batch(const FlatLayerDesc *layers, size_t count, const char *base,
+                                           const float *in, size_t batch, FlatScratch &scratch)
+    {
+        const float *x = in;
+        bool use_a = true;
+        for (size_t l = 0; l < count; ++l)
+        {
+            const FlatLayerDesc &d = layers[l];
+            std::vector<float> &y = use_a ? scratch.a : scratch.b;
+            use_a = !use_a;
+            y.resize(batch * d.out);
+            flat_dense_forward(d, base, x, batch, y.data());
+            x = y.data();
+        }
+        return x;
+    }
+
+    inline const float *flat_forward(const FlatLayerDesc *layers, size_t count, const char *base,
+                                     const float *in, FlatScratch &scratch)
+    {
+        return flat_forward_batch(layers, count, base, in, 1, scratch);
+    }
+
+    // In-process flat copy of one network, for agents that act on many envs
+    // at once. refresh() copies the current weights (one pass over the
+    // parameters, cheaper than a single forward), forward() runs a batch.
+    class FlatNetCopy
+    {
+    public:
+        explicit FlatNetCopy(tiny_dnn::network<tiny_dnn::sequential> &net)
+            : net_(net)
+        {
+            uint64_t bytes = 0;
+            append_flat_layout(net_, layers_, bytes);
+            if (layers_.empty())
+                throw std::invalid_argument("FlatNetCopy: network has no layers");
+            weights_.resize(bytes / sizeof(float));
+        }
+
+        void refresh()
+        {
+            write_flat_weights(net_, layers_.data(), reinterpret_cast<char *>(weights_.data()));
+        }
+
+        const float *forward(const float *in, size_t batch, FlatScratch &scratch) const
+        {
+            return flat_forward_batch(layers_.data(), layers_.size(),
+                                      reinterpret_cast<const char *>(weights_.data()), in, batch, scratch);
+        }
+
+        size_t input_size() const
+        {
+            return layers_.front().in;
+        }
+
+        size_t output_size() const
+        {
+            return layers_.back().out;
+        }
+
+    private:
+        tiny_dnn::network<tiny_dnn::sequential> &net_;
+        std::vector<FlatLayerDesc> layers_;
+        std::vector<float> weights_; // offsets are multiples of kAlign, so float-aligned
+    };
+
+    namespace flat
+    {
+        inline void write_file(const std::string &path, const std::vector<char> &bytes)
+        {
+            std::string tmp = path + ".tmp";
+            std::FILE *f = std::fopen(tmp.c_str(), "wb");
+            if (!f)
+                throw std::runtime_error("flat policy: cannot open " + tmp);
+            bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+            ok = std::fclose(f) == 0 && ok;
+            if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+            {
+                std::remove(tmp.c_str());
+                throw std::runtime_error("flat policy: failed to write " + path);
+            }
+        }
+
+        // Lay out header, descriptors and weights for a list of networks
+        inline std::vector<char> pack(FlatPolicyHeader header,
+                                      const std::vector<tiny_dnn::network<tiny_dnn::sequential> *> &nets,
+                                      std::vector<uint32_t> &layer_counts)
+        {
+            std::vector<FlatLayerDesc> layers;
+            uint64_t weights_bytes = 0;
+            for (auto *net : nets)
+            {
+                size_t before = layers.size();
+                append_flat_layout(*net, layers, weights_bytes);
+                layer_counts.push_back(static_cast<uint32_t>(layers.size() - before));
+            }
+
+            uint64_t weights_base = align_up(sizeof(FlatPolicyHeader) + layers.size() * sizeof(FlatLayerDesc));
+            for (auto &d : layers)
+            {
+                d.weight_offset += weights_base;
+                if (d.has_bias)
+                    d.bias_offset += weights_base;
+            }
+
+            header.num_layers = static_cast<uint32_t>(layers.size());
+            header.file_bytes = weights_base + weights_bytes;
+            std::vector<char> bytes(header.file_bytes, 0);
+            std::memcpy(bytes.data(), &header, sizeof(header));
+            std::memcpy(bytes.data() + sizeof(header), layers.data(), layers.size() * sizeof(FlatLayerDesc));
+
+            size_t first = 0;
+            for (size_t n = 0; n < nets.size(); ++n)
+            {
+                write_flat_weights(*nets[n], layers.data() + first, bytes.data());
+                first += layer_counts[n];
+            }
+            return bytes;
+        }
+
+        inline FlatPolicyHeader make_header(uint32_t kind)
+        {
+            FlatPolicyHeader header{};
+            std::memcpy(header.magic, kMagic, sizeof(header.magic));
+            header.version = kVersion;
+            header.kind = kind;
+            return header;
+        }
+    }
+
+    // Export the online network of a QNetwork
+    inline void export_flat_policy(QNetwork &qnet, const std::string &path)
+    {
+        std::vector<uint32_t> counts;
+        auto header = flat::make_header(flat::kQNetwork);
+        auto bytes = flat::pack(header, {&qnet.get_net()}, counts);
+
+        auto *h = reinterpret_cast<FlatPolicyHeader *>(bytes.data());
+        const auto *layers = reinterpret_cast<const FlatLayerDesc *>(bytes.data() + sizeof(FlatPolicyHeader));
+        if (h->num_layers == 0)
+            throw std::invalid_argument("flat policy: network has no layers");
+        h->trunk_layers = counts[0];
+        h->input_size = layers[0].in;
+        h->output_size = layers[h->num_layers - 1].out;
+        flat::write_file(path, bytes);
+    }
+
+    // Export base, policy head and value head of an ActorCriticNetwork
+    inline void export_flat_policy(ActorCriticNetwork &ac_net, const std::string &path)
+    {
+        std::vector<uint32_t> counts;
+        auto header = flat::make_header(flat::kActorCritic);
+        auto bytes = flat::pack(header, {&ac_net.get_base(), &ac_net.get_policy(), &ac_net.get_value()}, counts);
+
+        auto *h = reinterpret_cast<FlatPolicyHeader *>(bytes.data());
+        const auto *layers = reinterpret_cast<const FlatLayerDesc *>(bytes.data() + sizeof(FlatPolicyHeader));
+        if (counts[0] == 0 || counts[1] == 0 || counts[2] == 0)
+            throw std::invalid_argument("flat policy: every actor-critic part needs a layer");
+        h->trunk_layers = counts[0];
+        h->policy_layers = counts[1];
+        h->value_layers = counts[2];
+        h->input_size = layers[0].in;
+        h->output_size = layers[counts[0] + counts[1] - 1].out;
+        flat::write_file(path, bytes);
+    }
+
+    // Read-only, mmap-backed policy. Safe to share between threads as long
+    // as each thread passes its own FlatScratch.
+    class FlatPolicy
+    {
+    public:
+        explicit FlatPolicy(const std::string &path)
+            : data_(nullptr), size_(0)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("FlatPolicy: cannot open " + path);
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FlatPolicyHeader)))
+            {
+                ::close(fd);
+                throw std::runtime_error("FlatPolicy: file too small " + path);
+            }
+            size_ = static_cast<size_t>(st.st_size);
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                throw std::runtime_error("FlatPolicy: mmap failed for " + path);
+            data_ = static_cast<const char *>(p);
+
+            try
+            {
+                validate();
+            }
+            catch (...)
+            {
+                ::munmap(const_cast<char *>(data_), size_);
+                throw;
+            }
+        }
+
+        FlatPolicy(const FlatPolicy &) = delete;
+        FlatPolicy &operator=(const FlatPolicy &) = delete;
+
+        ~FlatPolicy()
+        {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+
+        const FlatPolicyHeader &header() const
+        {
+            return *header_;
+        }
+
+        size_t input_size() const
+        {
+            return header_->input_size;
+        }
+
+        size_t num_actions() const
+        {
+            return header_->output_size;
+        }
+
+        // Q-values (Q-network) or action probabilities (actor-critic)
+        const float *forward(const float *obs, FlatScratch &scratch) const
+        {
+            const float *features = flat_forward(layers_, header_->trunk_layers, data_, obs, scratch);
+            if (header_->kind == flat::kQNetwork)
+                return features;
+
+            keep_features(features, scratch);
+            const float *logits = flat_forward(layers_ + header_->trunk_layers, header_->policy_layers,
+                                               data_, scratch.features.data(), scratch);
+            std::vector<float> &probs = logits == scratch.a.data() ? scratch.a : scratch.b;
+            apply_activation(flat::kSoftmax, probs.data(), header_->output_size);
+            return probs.data();
+        }
+
+        // Batched forward over `batch` row-major observations; returns
+        // batch * num_actions outputs valid until the next call on `scratch`
+        const float *forward_batch(const float *obs, size_t batch, FlatScratch &scratch) const
+        {
+            const float *features = flat_forward_batch(layers_, header_->trunk_layers, data_, obs, batch, scratch);
+            if (header_->kind == flat::kQNetwork)
+                return features;
+
+            keep_features(features, scratch, batch);
+            const float *logits = flat_forward_batch(layers_ + header_->trunk_layers, header_->policy_layers,
+                                                     data_, scratch.features.data(), batch, scratch);
+            std::vector<float> &probs = logits == scratch.a.data() ? scratch.a : scratch.b;
+            for (size_t n = 0; n < batch; ++n)
+                apply_activation(flat::kSoftmax, probs.data() + n * header_->output_size, header_->output_size);
+            return probs.data();
+        }
+
+        // State value from the value head, actor-critic files only
+        float value(const float *obs, FlatScratch &scratch) const
+        {
+            if (header_->kind != flat::kActorCritic)
+                throw std::logic_error("FlatPolicy::value needs an actor-critic export");
+            const float *features = flat_forward(layers_, header_->trunk_layers, data_, obs, scratch);
+            keep_features(features, scratch);
+            const float *v = flat_forward(layers_ + header_->trunk_layers + header_->policy_layers,
+                                          header_->value_layers, data_, scratch.features.data(), scratch);
+            return v[0];
+        }
+
+        // Greedy action: argmax Q or the most probable action
+        int act(const float *obs, FlatScratch &scratch) const
+        {
+            const float *out = forward(obs, scratch);
+            return static_cast<int>(std::max_element(out, out + header_->output_size) - out);
+        }
+
+    private:
+        void validate()
+        {
+            header_ = reinterpret_cast<const FlatPolicyHeader *>(data_);
+            if (std::memcmp(header_->magic, flat::kMagic, sizeof(header_->magic)) != 0)
+                throw std::runtime_error("FlatPolicy: bad magic");
+            if (header_->version != flat::kVersion)
+                throw std::runtime_error("FlatPolicy: unsupported version");
+            if (header_->file_bytes != size_)
+                throw std::runtime_error("FlatPolicy: size mismatch");
+            if (sizeof(FlatPolicyHeader) + header_->num_layers * sizeof(FlatLayerDesc) > size_)
+                throw std::runtime_error("FlatPolicy: truncated layer table");
+            if (uint64_t(header_->trunk_layers) + header_->policy_layers + header_->value_layers != header_->num_layers)
+                throw std::runtime_error("FlatPolicy: layer counts do not add up");
+
+            bool actor_critic = header_->kind == flat::kActorCritic;
+            if (header_->kind != flat::kQNetwork && !actor_critic)
+                throw std::runtime_error("FlatPolicy: unknown kind");
+            if (header_->trunk_layers == 0 ||
+                (actor_critic ? header_->policy_layers == 0 || header_->value_layers == 0
+                              : header_->policy_layers != 0 || header_->value_layers != 0))
+                throw std::runtime_error("FlatPolicy: bad layer counts for kind");
+
+            layers_ = reinterpret_cast<const FlatLayerDesc *>(data_ + sizeof(FlatPolicyHeader));
+            for (uint32_t l = 0; l < header_->num_layers; ++l)
+            {
+                const FlatLayerDesc &d = layers_[l];
+                if (d.in == 0 || d.out == 0 || d.activation > flat::kLeakyRelu)
+                    throw std::runtime_error("FlatPolicy: bad layer descriptor");
+                // offsets first, so the end computations cannot wrap
+                if (d.weight_offset > size_ || (d.has_bias && d.bias_offset > size_))
+                    throw std::runtime_error("FlatPolicy: weight block out of range");
+                uint64_t w_end = d.weight_offset + uint64_t(d.in) * d.out * sizeof(float);
+                uint64_t b_end = d.has_bias ? d.bias_offset + uint64_t(d.out) * sizeof(float) : 0;
+                if (w_end > size_ || b_end > size_ || d.weight_offset % flat::kAlign != 0)
+                    throw std::runtime_error("FlatPolicy: weight block out of range");
+            }
+
+            // each part is a chain, both heads read the trunk output, and the
+            // header sizes match the ends; scratch buffers are sized from these
+            uint32_t trunk = header_->trunk_layers;
+            check_chain(0, trunk, header_->input_size);
+            uint32_t features = layers_[trunk - 1].out;
+            uint32_t outputs = features;
+            if (actor_critic)
+            {
+                check_chain(trunk, header_->policy_layers, features);
+                check_chain(trunk + header_->policy_layers, header_->value_layers, features);
+                outputs = layers_[trunk + header_->policy_layers - 1].out;
+            }
+            if (outputs != header_->output_size)
+                throw std::runtime_error("FlatPolicy: output size does not match the layers");
+        }
+
+        void check_chain(uint32_t first, uint32_t count, uint32_t in) const
+        {
+            for (uint32_t l = first; l < first + count; ++l)
+            {
+                if (layers_[l].in != in)
+                    throw std::runtime_error("FlatPolicy: layer shapes do not chain");
+                in = layers_[l].out;
+            }
+        }
+
+        // heads overwrite the ping-pong buffers, so park the trunk output
+        void keep_features(const float *features, FlatScratch &scratch, size_t batch = 1) const
+        {
+            size_t n = layers_[header_->trunk_layers - 1].out * batch;
+            scratch.features.assign(features, features + n);
+        }
+
+        const char *data_;
+        size_t size_;
+        const FlatPolicyHeader *header_ = nullptr;
+        const FlatLayerDesc *layers_ = nullptr;
+    };
+}
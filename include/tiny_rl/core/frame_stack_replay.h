@@ -0,0 +1,226 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "prioritized_replay_buffer.h"
+#include "../utils/profiler.h"
+
+/*
+ Replay for frame-stacked observations that keeps every frame once.
+ A transition stores only its newest frame with the action, reward and
+ done flag that led to it; the stacked state and next_state are rebuilt
+ at sample time from the `stack` slots before it. Where that walk back
+ crosses the start of an episode the first frame repeats, which matches
+ what FrameStackEnv shows after a reset. Against Experience slots holding
+ two stacked copies this stores about 2 * stack times fewer floats.
+
+ Index arithmetic only works within one env's stream of frames, so each
+ env writes to its own stream (an equal share of the capacity): call
+ begin_episode() with the reset frame, then add() with every next frame.
+ For stacked observations the frame is the last frame_size values.
+
+ Sampling is uniform over the stored transitions of all streams, with
+ is_weights = 1, ready for DQNAgent::train_step(const SampledBatch &).
+ Once a stream has wrapped, its oldest `stack` transitions are not
+ sampled, since their history is already overwritten. Not thread-safe;
+ callers that share it across threads lock around it.
+*/
+
+namespace tiny_rl
+{
+    class FrameStackReplayBuffer
+    {
+    public:
+        FrameStackReplayBuffer(size_t capacity, size_t frame_size, size_t stack, size_t num_streams = 1)
+            : frame_(frame_size),
+              stack_(stack),
+              slots_(num_streams ? capacity / num_streams : 0),
+              streams_(num_streams)
+        {
+            if (frame_size == 0 || stack == 0 || num_streams == 0)
+                throw std::invalid_argument("FrameStackReplayBuffer: frame_size, stack and num_streams must be positive");
+            if (slots_ <= stack_)
+                throw std::invalid_argument("FrameStackReplayBuffer: each stream needs more than `stack` slots");
+            for (auto &s : streams_)
+            {
+                s.frames.resize(slots_ * frame_);
+                s.actions.resize(slots_);
+                s.rewards.resize(slots_);
+                s.dones.resize(slots_);
+                s.firsts.resize(slots_);
+                s.versions.resize(slots_);
+            }
+        }
+
+        // The reset frame of a new episode on `stream`
+        void begin_episode(size_t stream, const float *frame)
+        {
+            TINY_RL_PROFILE_SCOPE(kReplayAdd);
+            Stream &s = streams_.at(stream);
+            write(s, frame, 0, 0.0f, false, true);
+        }
+
+        // One transition on `stream`: the action taken, its reward and the
+        // frame it led to
+        void add(size_t stream, int action, float reward, const float *next_frame, bool done)
+        {
+            TINY_RL_PROFILE_SCOPE(kReplayAdd);
+            Stream &s = streams_.at(stream);
+            if (s.count == 0)
+                throw std::logic_error("FrameStackReplayBuffer::add: begin_episode() first");
+            write(s, next_frame, action, reward, done, false);
+        }
+
+        // Transitions held, across streams
+        size_t size() const
+        {
+            size_t n = 0;
+            for (const auto &s : streams_)
+                n += std::min<uint64_t>(s.count, slots_) - s.firsts_held;
+            return n;
+        }
+
+        size_t capacity() const
+        {
+            return slots_ * streams_.size();
+        }
+
+        // Bytes of frame and transition storage, for comparing layouts
+        size_t memory_bytes() const
+        {
+            return capacity() * (frame_ * sizeof(float) + sizeof(int) + sizeof(float) + 2 * sizeof(uint8_t) + sizeof(uint32_t));
+        }
+
+        size_t frame_size() const
+        {
+            return frame_;
+        }
+
+        size_t stack() const
+        {
+            return stack_;
+        }
+
+        // Uniform sample with replacement into `batch`, states and
+        // next_states stacked to stack * frame_size. Returns false while
+        // fewer than batch_size transitions are held.
+        template <typename Rng>
+        bool sample_batch(SampledBatch &batch, size_t batch_size, Rng &rng)
+        {
+            TINY_RL_PROFILE_SCOPE(kReplaySample);
+            if (batch_size == 0 || size() < batch_size)
+                return false;
+
+            // candidates are logical positions [lo, count) of each stream
+            uint64_t total = 0;
+            for (const auto &s : streams_)
+                total += s.count - lowest(s);
+            std::uniform_int_distribution<uint64_t> pick(0, total - 1);
+
+            batch.states.resize(batch_size);
+            batch.next_states.resize(batch_size);
+            batch.actions.resize(batch_size);
+            batch.rewards.resize(batch_size);
+            batch.dones.resize(batch_size);
+            batch.indices.resize(batch_size);
+            batch.is_weights.assign(batch_size, 1.0f);
+            batch.slot_versions.resize(batch_size);
+
+            size_t attempts = 64 * batch_size;
+            for (size_t i = 0; i < batch_size;)
+            {
+                if (attempts-- == 0)
+                    return false;
+                uint64_t r = pick(rng);
+                size_t stream = 0;
+                for (uint64_t span; r >= (span = streams_[stream].count - lowest(streams_[stream])); ++stream)
+                    r -= span;
+                const Stream &s = streams_[stream];
+                uint64_t j = lowest(s) + r;
+                size_t slot = j % slots_;
+                // an episode's reset frame ends no transition
+                if (s.firsts[slot])
+                    continue;
+
+                batch.states[i].resize(stack_ * frame_);
+                batch.next_states[i].resize(stack_ * frame_);
+                gather(s, j - 1, batch.states[i].data());
+                gather(s, j, batch.next_states[i].data());
+                batch.actions[i] = s.actions[slot];
+                batch.rewards[i] = s.rewards[slot];
+                batch.dones[i] = s.dones[slot] != 0;
+                batch.indices[i] = stream * slots_ + slot;
+                batch.slot_versions[i] = s.versions[slot];
+                ++i;
+            }
+            return true;
+        }
+
+        void clear()
+        {
+            for (auto &s : streams_)
+            {
+                s.count = 0;
+                s.firsts_held = 0;
+            }
+        }
+
+    private:
+        struct Stream
+        {
+            std::vector<float> frames; // slots * frame_size
+            std::vector<int> actions;
+            std::vector<float> rewards;
+            std::vector<uint8_t> dones;
+            std::vector<uint8_t> firsts; // slot holds an episode's reset frame
+            std::vector<uint32_t> versions;
+            uint64_t count = 0;          // frames ever written; logical position L is slot L % slots
+            size_t firsts_held = 0;
+        };
+
+        void write(Stream &s, const float *frame, int action, float reward, bool done, bool first)
+        {
+            size_t slot = s.count % slots_;
+            if (s.count >= slots_ && s.firsts[slot])
+                --s.firsts_held;
+            std::copy(frame, frame + frame_, s.frames.begin() + slot * frame_);
+            s.actions[slot] = action;
+            s.rewards[slot] = reward;
+            s.dones[slot] = done ? 1 : 0;
+            s.firsts[slot] = first ? 1 : 0;
+            ++s.versions[slot];
+            if (first)
+                ++s.firsts_held;
+            ++s.count;
+        }
+
+        // Oldest logical position whose state stack is still intact
+        uint64_t lowest(const Stream &s) const
+        {
+            if (s.count <= slots_)
+                return std::min<uint64_t>(s.count, 1);
+            return s.count - slots_ + stack_;
+        }
+
+        // The `stack` frames ending at logical position `last`, oldest first,
+        // repeating an episode's first frame where the stack reaches past it
+        void gather(const Stream &s, uint64_t last, float *out) const
+        {
+            uint64_t pos = last;
+            for (size_t k = stack_; k-- > 0;)
+            {
+                size_t slot = pos % slots_;
+                std::copy(s.frames.begin() + slot * frame_, s.frames.begin() + (slot + 1) * frame_, out + k * frame_);
+                if (!s.firsts[slot])
+                    --pos;
+            }
+        }
+
+        size_t frame_;
+        size_t stack_;
+        size_t slots_;
+        std::vector<Stream> streams_;
+    };
+}
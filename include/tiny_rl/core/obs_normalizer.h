@@ -0,0 +1,277 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "tiny_dnn/tiny_dnn.h"
+#include "../utils/checkpoint.h"
+
+/*
+ Running per-feature observation normalizer, x' = clip((x - mean) / std).
+
+ process() is fused: one pass over a batch of rows normalizes each value
+ with the current statistics and accumulates the batch's shifted sums,
+ which are then merged into the running mean and M2 with Chan's parallel
+ form of Welford's update. merge() combines normalizers that saw disjoint
+ data (e.g. one per worker) the same way. The per-row loops run over flat
+ float arrays with precomputed scale and shift so the compiler vectorizes
+ them.
+
+ freeze() stops updates, e.g. for evaluation or serving; save()/load() put
+ the statistics and the frozen flag into a checkpoint section so inference
+ reproduces the training-time scaling exactly.
+*/
+
+namespace tiny_rl
+{
+    namespace ckpt
+    {
+        // kObsNormalizer: this header, then mean[dim] and m2[dim] as doubles
+        struct ObsNormalizerHeader
+        {
+            uint32_t dim;
+            uint32_t frozen;
+            double count;
+            float clip;
+            float epsilon;
+        };
+    }
+
+    class ObservationNormalizer
+    {
+    public:
+        explicit ObservationNormalizer(size_t dim, float clip = 10.0f, float epsilon = 1e-8f)
+            : dim_(dim),
+              clip_(clip),
+              epsilon_(epsilon),
+              count_(0.0),
+              frozen_(false),
+              mean_(dim, 0.0),
+              m2_(dim, 0.0),
+              scale_(dim, 1.0f),
+              shift_(dim, 0.0f),
+              s1_(dim),
+              s2_(dim)
+        {
+            if (dim == 0)
+                throw std::invalid_argument("ObservationNormalizer: dim must be positive");
+        }
+
+        // Normalizes `rows` contiguous observations in place, then folds
+        // their raw values into the statistics unless frozen
+        void process(float *x, size_t rows)
+        {
+            if (frozen_ || rows == 0)
+            {
+                normalize(x, rows);
+                return;
+            }
+            std::fill(s1_.begin(), s1_.end(), 0.0);
+            std::fill(s2_.begin(), s2_.end(), 0.0);
+            for (size_t r = 0; r < rows; ++r)
+                accumulate_and_normalize(x + r * dim_);
+            fold(static_cast<double>(rows));
+        }
+
+        void process(std::vector<tiny_dnn::vec_t> &batch)
+        {
+            if (frozen_ || batch.empty())
+            {
+                normalize(batch);
+                return;
+            }
+            std::fill(s1_.begin(), s1_.end(), 0.0);
+            std::fill(s2_.begin(), s2_.end(), 0.0);
+            for (auto &row : batch)
+            {
+                check(row.size());
+                accumulate_and_normalize(row.data());
+            }
+            fold(static_cast<double>(batch.size()));
+        }
+
+        void process(std::vector<float> &obs)
+        {
+            check(obs.size());
+            process(obs.data(), 1);
+        }
+
+        void process(tiny_dnn::vec_t &obs)
+        {
+            check(obs.size());
+            process(obs.data(), 1);
+        }
+
+        // Normalization only; the statistics are left alone
+        void normalize(float *x, size_t rows) const
+        {
+            for (size_t r = 0; r < rows; ++r)
+                apply(x + r * dim_);
+        }
+
+        void normalize(std::vector<tiny_dnn::vec_t> &batch) const
+        {
+            for (auto &row : batch)
+            {
+                check(row.size());
+                apply(row.data());
+            }
+        }
+
+        // Adds the statistics of a normalizer that saw other data
+        void merge(const ObservationNormalizer &other)
+        {
+            if (other.dim_ != dim_)
+                throw std::invalid_argument("ObservationNormalizer::merge: dimension mismatch");
+            if (other.count_ == 0.0)
+                return;
+            double n = count_ + other.count_;
+            for (size_t j = 0; j < dim_; ++j)
+            {
+                double delta = other.mean_[j] - mean_[j];
+                mean_[j] += delta * other.count_ / n;
+                m2_[j] += other.m2_[j] + delta * delta * count_ * other.count_ / n;
+            }
+            count_ = n;
+            refresh();
+        }
+
+        void freeze()
+        {
+            frozen_ = true;
+        }
+
+        void unfreeze()
+        {
+            frozen_ = false;
+        }
+
+        bool frozen() const
+        {
+            return frozen_;
+        }
+
+        size_t dim() const
+        {
+            return dim_;
+        }
+
+        double count() const
+        {
+            return count_;
+        }
+
+        double mean(size_t j) const
+        {
+            return mean_[j];
+        }
+
+        double variance(size_t j) const
+        {
+            return count_ > 0.0 ? m2_[j] / count_ : 1.0;
+        }
+
+        void save(CheckpointWriter &w) const
+        {
+            ckpt::ObsNormalizerHeader header{static_cast<uint32_t>(dim_), frozen_ ? 1u : 0u, count_, clip_, epsilon_};
+            w.begin_section(ckpt::kObsNormalizer);
+            w.append(&header, sizeof(header));
+            w.append(mean_.data(), dim_ * sizeof(double));
+            w.append(m2_.data(), dim_ * sizeof(double));
+            w.end_section();
+        }
+
+        void load(const CheckpointReader &r)
+        {
+            auto [data, bytes] = r.section(ckpt::kObsNormalizer);
+            ckpt::ObsNormalizerHeader header;
+            if (bytes < sizeof(header))
+                throw std::runtime_error("ObservationNormalizer::load: bad section");
+            std::memcpy(&header, data, sizeof(header));
+            if (header.dim != dim_ || bytes != sizeof(header) + 2 * dim_ * sizeof(double))
+                throw std::runtime_error("ObservationNormalizer::load: dimension mismatch");
+            std::memcpy(mean_.data(), data + sizeof(header), dim_ * sizeof(double));
+            std::memcpy(m2_.data(), data + sizeof(header) + dim_ * sizeof(double), dim_ * sizeof(double));
+            count_ = header.count;
+            frozen_ = header.frozen != 0;
+            clip_ = header.clip;
+            epsilon_ = header.epsilon;
+            refresh();
+        }
+
+    private:
+        void check(size_t n) const
+        {
+            if (n != dim_)
+                throw std::invalid_argument("ObservationNormalizer: observation size does not match");
+        }
+
+        void apply(float *__restrict x) const
+        {
+            const float *__restrict scale = scale_.data();
+            const float *__restrict shift = shift_.data();
+            const float lo = -clip_, hi = clip_;
+            for (size_t j = 0; j < dim_; ++j)
+                x[j] = std::min(std::max(x[j] * scale[j] + shift[j], lo), hi);
+        }
+
+        // Sums are taken around the current mean so the batch variance
+        // below does not cancel catastrophically
+        void accumulate_and_normalize(float *__restrict x)
+        {
+            const float *__restrict scale = scale_.data();
+            const float *__restrict shift = shift_.data();
+            const double *__restrict mean = mean_.data();
+            double *__restrict s1 = s1_.data();
+            double *__restrict s2 = s2_.data();
+            const float lo = -clip_, hi = clip_;
+            for (size_t j = 0; j < dim_; ++j)
+            {
+                double d = static_cast<double>(x[j]) - mean[j];
+                s1[j] += d;
+                s2[j] += d * d;
+                x[j] = std::min(std::max(x[j] * scale[j] + shift[j], lo), hi);
+            }
+        }
+
+        // Chan et al.: merge a batch of n rows with mean K + s1/n and
+        // M2 = s2 - s1^2/n, where K is the running mean
+        void fold(double n)
+        {
+            double total = count_ + n;
+            for (size_t j = 0; j < dim_; ++j)
+            {
+                double delta = s1_[j] / n; // batch mean minus running mean
+                double batch_m2 = s2_[j] - s1_[j] * delta;
+                mean_[j] += delta * n / total;
+                m2_[j] += batch_m2 + delta * delta * count_ * n / total;
+            }
+            count_ = total;
+            refresh();
+        }
+
+        void refresh()
+        {
+            for (size_t j = 0; j < dim_; ++j)
+            {
+                double inv_std = 1.0 / std::sqrt(variance(j) + epsilon_);
+                scale_[j] = static_cast<float>(inv_std);
+                shift_[j] = static_cast<float>(-mean_[j] * inv_std);
+            }
+        }
+
+        size_t dim_;
+        float clip_;
+        float epsilon_;
+        double count_;
+        bool frozen_;
+        std::vector<double> mean_;
+        std::vector<double> m2_;
+        std::vector<float> scale_; // 1 / sqrt(var + eps)
+        std::vector<float> shift_; // -mean * scale
+        std::vector<double> s1_;   // batch scratch
+        std::vector<double> s2_;
+    };
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "tiny_dnn/tiny_dnn.h"
+#include "../utils/arena.h"
+
+/*
+ Free list of observation-width tiny_dnn::vec_t buffers. Storage that
+ hands observations around (rollout and replay slots, trainer staging)
+ returns buffers here instead of freeing them and takes them back on the
+ next fill, so a warmed-up loop recycles the same allocations. A miss
+ allocates a fresh buffer and is counted in thread_allocation_counts().
+
+ Not thread-safe; give each thread or buffer its own pool.
+*/
+
+namespace tiny_rl
+{
+    class ObsPool
+    {
+    public:
+        // `prealloc` buffers are allocated up front and do not count as misses
+        explicit ObsPool(size_t width, size_t prealloc = 0)
+            : width_(width), misses_(0)
+        {
+            free_.reserve(prealloc);
+            for (size_t i = 0; i < prealloc; ++i)
+                free_.emplace_back(width_);
+        }
+
+        // A buffer of width() elements with unspecified contents
+        tiny_dnn::vec_t acquire()
+        {
+            if (free_.empty())
+            {
+                ++misses_;
+                ++thread_allocation_counts().pool_misses;
+                return tiny_dnn::vec_t(width_);
+            }
+            tiny_dnn::vec_t v = std::move(free_.back());
+            free_.pop_back();
+            v.resize(width_);
+            return v;
+        }
+
+        // Buffers too small to hold an observation are simply dropped
+        void release(tiny_dnn::vec_t &&v)
+        {
+            if (v.capacity() >= width_)
+                free_.push_back(std::move(v));
+        }
+
+        size_t width() const
+        {
+            return width_;
+        }
+
+        size_t available() const
+        {
+            return free_.size();
+        }
+
+        uint64_t misses() const
+        {
+            return misses_;
+        }
+
+    private:
+        size_t width_;
+        uint64_t misses_;
+        std::vector<tiny_dnn::vec_t> free_;
+    };
+}
@@ -0,0 +1,569 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "prioritized_replay_buffer.h"
+#include "../utils/thread_pool.h"
+
+/*
+ Recorded transitions for offline training. A dataset file is a header
+ followed by self-contained chunks, each holding up to chunk_rows
+ transitions column by column:
+
+   FileHeader | ChunkHeader | obs | next_obs | action | reward | done | episode_start | ChunkHeader | ...
+
+ Every header and column starts on a 64-byte boundary. episode_start marks
+ the first transition of each episode, so episodes cut short without a
+ terminal state can still be told apart. Chunks are appended whole, so a
+ file from a run that crashed is readable up to its last complete chunk.
+
+ TransitionRecorder fills a chunk in memory and hands full chunks to a
+ background writer thread. OfflineDataset mmaps one or more files and
+ indexes their chunks; OfflineBatchLoader draws shuffled minibatches from
+ it on the shared thread pool while the caller trains on the previous one.
+*/
+
+namespace tiny_rl
+{
+    namespace dataset
+    {
+        constexpr char kMagic[8] = {'T', 'R', 'L', 'D', 'A', 'T', 'A', '\0'};
+        constexpr uint32_t kVersion = 1;
+        constexpr uint32_t kChunkMagic = 0x4b4e4843; // "CHNK"
+        constexpr uint64_t kAlign = 64;
+
+        struct FileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t state_dim;
+            uint8_t reserved[48];
+        };
+
+        struct ChunkHeader
+        {
+            uint32_t magic;
+            uint32_t rows;
+            uint64_t payload_bytes; // columns including padding
+            uint8_t reserved[48];
+        };
+
+        static_assert(sizeof(FileHeader) == kAlign && sizeof(ChunkHeader) == kAlign,
+                      "dataset headers must stay one cache line");
+
+        inline uint64_t align_up(uint64_t x)
+        {
+            return (x + kAlign - 1) & ~(kAlign - 1);
+        }
+
+        // Byte offsets of each column from the start of a chunk's payload
+        struct ChunkLayout
+        {
+            uint64_t obs, next_obs, action, reward, done, episode_start, bytes;
+
+            ChunkLayout(uint64_t rows, uint64_t dim)
+            {
+                obs = 0;
+                next_obs = align_up(obs + rows * dim * sizeof(float));
+                action = align_up(next_obs + rows * dim * sizeof(float));
+                reward = align_up(action + rows * sizeof(int32_t));
+                done = align_up(reward + rows * sizeof(float));
+                episode_start = align_up(done + rows);
+                bytes = align_up(episode_start + rows);
+            }
+        };
+    }
+
+    class TransitionRecorder
+    {
+    public:
+        // max_pending bounds the chunks queued for the writer; record()
+        // waits for the disk only once that many are outstanding
+        TransitionRecorder(const std::string &path, size_t state_dim,
+                           size_t chunk_rows = 4096, size_t max_pending = 4)
+            : path_(path),
+              dim_(state_dim),
+              chunk_rows_(chunk_rows),
+              max_pending_(std::max<size_t>(max_pending, 1)),
+              layout_(chunk_rows, state_dim),
+              file_(nullptr),
+              rows_(0),
+              episode_start_(true),
+              recorded_(0),
+              failed_(false),
+              stop_(false)
+        {
+            // checked before opening, which truncates an existing file
+            if (state_dim == 0 || chunk_rows == 0)
+                throw std::invalid_argument("TransitionRecorder: state_dim and chunk_rows must be positive");
+            file_ = std::fopen(path.c_str(), "wb");
+            if (!file_)
+                throw std::runtime_error("TransitionRecorder: cannot open " + path);
+            dataset::FileHeader header{};
+            std::memcpy(header.magic, dataset::kMagic, sizeof(header.magic));
+            header.version = dataset::kVersion;
+            header.state_dim = static_cast<uint32_t>(state_dim);
+            if (std::fwrite(&header, sizeof(header), 1, file_) != 1)
+            {
+                std::fclose(file_);
+                throw std::runtime_error("TransitionRecorder: write failed for " + path);
+            }
+            current_ = take_buffer();
+            writer_ = std::thread([this]
+                                  { run(); });
+        }
+
+        TransitionRecorder(const TransitionRecorder &) = delete;
+        TransitionRecorder &operator=(const TransitionRecorder &) = delete;
+
+        ~TransitionRecorder()
+        {
+            try
+            {
+                close();
+            }
+            catch (...)
+            {
+            }
+        }
+
+        void record(const tiny_dnn::vec_t &state, int action, float reward,
+                    const tiny_dnn::vec_t &next_state, bool done)
+        {
+            if (state.size() != dim_ || next_state.size() != dim_)
+                throw std::invalid_argument("TransitionRecorder: state size does not match the dataset");
+            char *c = current_.data();
+            std::memcpy(c + layout_.obs + rows_ * dim_ * sizeof(float), state.data(), dim_ * sizeof(float));
+            std::memcpy(c + layout_.next_obs + rows_ * dim_ * sizeof(float), next_state.data(), dim_ * sizeof(float));
+            int32_t a = action;
+            std::memcpy(c + layout_.action + rows_ * sizeof(int32_t), &a, sizeof(a));
+            std::memcpy(c + layout_.reward + rows_ * sizeof(float), &reward, sizeof(reward));
+            c[layout_.done + rows_] = done ? 1 : 0;
+            c[layout_.episode_start + rows_] = episode_start_ ? 1 : 0;
+            episode_start_ = done;
+            ++recorded_;
+            if (++rows_ == chunk_rows_)
+                submit();
+        }
+
+        void record(const Experience &exp)
+        {
+            record(exp.state, exp.action, exp.reward, exp.next_state, exp.done);
+        }
+
+        // The next transition starts a new episode even though the last one
+        // was not terminal (time limits, resets from outside)
+        void end_episode()
+        {
+            episode_start_ = true;
+        }
+
+        // Writes the partial chunk, waits for the writer and closes the file
+        void close()
+        {
+            if (!file_)
+                return;
+            if (rows_ > 0)
+                submit();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            work_.notify_one();
+            writer_.join();
+            bool ok = std::fclose(file_) == 0 && !failed_;
+            file_ = nullptr;
+            if (!ok)
+                throw std::runtime_error("TransitionRecorder: write failed for " + path_);
+        }
+
+        size_t recorded() const
+        {
+            return recorded_;
+        }
+
+    private:
+        struct Pending
+        {
+            std::vector<char> data;
+            uint32_t rows;
+        };
+
+        std::vector<char> take_buffer()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_.empty())
+                return std::vector<char>(layout_.bytes);
+            std::vector<char> buf = std::move(free_.back());
+            free_.pop_back();
+            return buf;
+        }
+
+        void submit()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                done_.wait(lock, [this]
+                           { return pending_.size() < max_pending_; });
+                pending_.push_back({std::move(current_), static_cast<uint32_t>(rows_)});
+            }
+            work_.notify_one();
+            rows_ = 0;
+            current_ = take_buffer();
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true)
+            {
+                work_.wait(lock, [this]
+                           { return stop_ || !pending_.empty(); });
+                if (pending_.empty())
+                    return;
+                Pending chunk = std::move(pending_.front());
+                pending_.pop_front();
+                lock.unlock();
+                write_chunk(chunk);
+                lock.lock();
+                free_.push_back(std::move(chunk.data));
+                done_.notify_one();
+            }
+        }
+
+        // Copies each column's filled rows out of the full-size chunk buffer
+        void write_chunk(const Pending &chunk)
+        {
+            dataset::ChunkLayout out(chunk.rows, dim_);
+            dataset::ChunkHeader header{};
+            header.magic = dataset::kChunkMagic;
+            header.rows = chunk.rows;
+            header.payload_bytes = out.bytes;
+
+            staging_.assign(out.bytes, 0);
+            const char *in = chunk.data.data();
+            uint64_t rows = chunk.rows;
+            std::memcpy(&staging_[out.obs], in + layout_.obs, rows * dim_ * sizeof(float));
+            std::memcpy(&staging_[out.next_obs], in + layout_.next_obs, rows * dim_ * sizeof(float));
+            std::memcpy(&staging_[out.action], in + layout_.action, rows * sizeof(int32_t));
+            std::memcpy(&staging_[out.reward], in + layout_.reward, rows * sizeof(float));
+            std::memcpy(&staging_[out.done], in + layout_.done, rows);
+            std::memcpy(&staging_[out.episode_start], in + layout_.episode_start, rows);
+
+            if (std::fwrite(&header, sizeof(header), 1, file_) != 1 ||
+                std::fwrite(staging_.data(), 1, staging_.size(), file_) != staging_.size())
+                failed_ = true;
+        }
+
+        std::string path_;
+        size_t dim_;
+        size_t chunk_rows_;
+        size_t max_pending_;
+        dataset::ChunkLayout layout_;
+        std::FILE *file_;
+
+        // producer side
+        std::vector<char> current_;
+        size_t rows_;
+        bool episode_start_;
+        size_t recorded_;
+
+        // writer thread
+        std::vector<char> staging_;
+        std::atomic<bool> failed_;
+
+        std::mutex mutex_;
+        std::condition_variable work_;
+        std::condition_variable done_;
+        std::deque<Pending> pending_;
+        std::vector<std::vector<char>> free_;
+        bool stop_;
+        std::thread writer_;
+    };
+
+    class OfflineDataset
+    {
+    public:
+        explicit OfflineDataset(const std::vector<std::string> &paths)
+            : dim_(0), size_(0)
+        {
+            // the destructor does not run if this throws
+            try
+            {
+                for (const auto &path : paths)
+                    map_file(path);
+                if (size_ == 0)
+                    throw std::runtime_error("OfflineDataset: no transitions in the given files");
+            }
+            catch (...)
+            {
+                unmap_all();
+                throw;
+            }
+        }
+
+        explicit OfflineDataset(const std::string &path)
+            : OfflineDataset(std::vector<std::string>{path})
+        {
+        }
+
+        OfflineDataset(const OfflineDataset &) = delete;
+        OfflineDataset &operator=(const OfflineDataset &) = delete;
+
+        ~OfflineDataset()
+        {
+            unmap_all();
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+        size_t state_dim() const
+        {
+            return dim_;
+        }
+
+        size_t episodes() const
+        {
+            size_t n = 0;
+            for (const auto &c : chunks_)
+                for (uint32_t r = 0; r < c.rows; ++r)
+                    n += c.episode_start[r];
+            return n;
+        }
+
+        // Copies transition i into row `row` of `batch` (columns pre-sized)
+        void gather(size_t i, SampledBatch &batch, size_t row) const
+        {
+            auto it = std::upper_bound(chunk_begin_.begin(), chunk_begin_.end(), i);
+            const Chunk &c = chunks_[(it - chunk_begin_.begin()) - 1];
+            size_t r = i - *(it - 1);
+            batch.states[row].assign(c.obs + r * dim_, c.obs + (r + 1) * dim_);
+            batch.next_states[row].assign(c.next_obs + r * dim_, c.next_obs + (r + 1) * dim_);
+            batch.actions[row] = c.action[r];
+            batch.rewards[row] = c.reward[r];
+            batch.dones[row] = c.done[r] != 0;
+            batch.indices[row] = i;
+        }
+
+        Experience at(size_t i) const
+        {
+            SampledBatch one;
+            resize(one, 1);
+            gather(i, one, 0);
+            return Experience{std::move(one.states[0]), one.actions[0], one.rewards[0],
+                              std::move(one.next_states[0]), static_cast<bool>(one.dones[0])};
+        }
+
+        static void resize(SampledBatch &batch, size_t n)
+        {
+            batch.states.resize(n);
+            batch.next_states.resize(n);
+            batch.actions.resize(n);
+            batch.rewards.resize(n);
+            batch.dones.resize(n);
+            batch.indices.resize(n);
+            batch.is_weights.assign(n, 1.0f);
+            batch.slot_versions.assign(n, 0);
+        }
+
+    private:
+        struct Chunk
+        {
+            const float *obs;
+            const float *next_obs;
+            const int32_t *action;
+            const float *reward;
+            const uint8_t *done;
+            const uint8_t *episode_start;
+            uint32_t rows;
+        };
+
+        void map_file(const std::string &path)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("OfflineDataset: cannot open " + path);
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(dataset::FileHeader)))
+            {
+                ::close(fd);
+                throw std::runtime_error("OfflineDataset: file too small " + path);
+            }
+            size_t bytes = static_cast<size_t>(st.st_size);
+            void *p = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                throw std::runtime_error("OfflineDataset: mmap failed for " + path);
+            // recorded first, so a throw below still unmaps it
+            maps_.push_back({p, bytes});
+            // minibatches touch pages all over the file
+            ::madvise(p, bytes, MADV_RANDOM);
+
+            const char *base = static_cast<const char *>(p);
+            const auto *header = reinterpret_cast<const dataset::FileHeader *>(base);
+            if (std::memcmp(header->magic, dataset::kMagic, sizeof(header->magic)) != 0 ||
+                header->version != dataset::kVersion)
+                throw std::runtime_error("OfflineDataset: bad header in " + path);
+            if (dim_ == 0)
+                dim_ = header->state_dim;
+            else if (dim_ != header->state_dim)
+                throw std::runtime_error("OfflineDataset: state size differs in " + path);
+
+            // a trailing partial chunk (crashed writer) is ignored
+            size_t off = sizeof(dataset::FileHeader);
+            while (off + sizeof(dataset::ChunkHeader) <= bytes)
+            {
+                const auto *ch = reinterpret_cast<const dataset::ChunkHeader *>(base + off);
+                if (ch->magic != dataset::kChunkMagic)
+                    throw std::runtime_error("OfflineDataset: corrupt chunk in " + path);
+                dataset::ChunkLayout layout(ch->rows, dim_);
+                off += sizeof(dataset::ChunkHeader);
+                if (ch->payload_bytes != layout.bytes || layout.bytes > bytes - off)
+                    break;
+                const char *payload = base + off;
+                chunks_.push_back({reinterpret_cast<const float *>(payload + layout.obs),
+                                   reinterpret_cast<const float *>(payload + layout.next_obs),
+                                   reinterpret_cast<const int32_t *>(payload + layout.action),
+                                   reinterpret_cast<const float *>(payload + layout.reward),
+                                   reinterpret_cast<const uint8_t *>(payload + layout.done),
+                                   reinterpret_cast<const uint8_t *>(payload + layout.episode_start),
+                                   ch->rows});
+                chunk_begin_.push_back(size_);
+                size_ += ch->rows;
+                off += layout.bytes;
+            }
+        }
+
+        void unmap_all()
+        {
+            for (const auto &m : maps_)
+                ::munmap(m.first, m.second);
+            maps_.clear();
+        }
+
+        size_t dim_;
+        size_t size_;
+        std::vector<Chunk> chunks_;
+        std::vector<size_t> chunk_begin_; // global index of each chunk's first row
+        std::vector<std::pair<void *, size_t>> maps_;
+    };
+
+    // Shuffled minibatches over an OfflineDataset, one epoch per
+    // permutation. While the caller trains on batch k, a shared-pool task
+    // gathers batch k+1. acquire() and release() must alternate and be
+    // called from one thread.
+    class OfflineBatchLoader
+    {
+    public:
+        OfflineBatchLoader(const OfflineDataset &data, size_t batch_size, uint64_t seed = 0)
+            : data_(data),
+              batch_size_(batch_size),
+              rng_(seed),
+              order_(data.size()),
+              cursor_(0),
+              epoch_(0),
+              pool_(shared_thread_pool()),
+              ready_{false, false},
+              read_(0),
+              in_flight_(0)
+        {
+            if (batch_size == 0 || batch_size > data.size())
+                throw std::invalid_argument("OfflineBatchLoader: batch_size must be in [1, dataset size]");
+            std::iota(order_.begin(), order_.end(), size_t(0));
+            std::shuffle(order_.begin(), order_.end(), rng_);
+            in_flight_ = 1;
+            pool_.submit([this]
+                         { fill(0); fill(1); in_flight_.fetch_sub(1); });
+        }
+
+        OfflineBatchLoader(const OfflineBatchLoader &) = delete;
+        OfflineBatchLoader &operator=(const OfflineBatchLoader &) = delete;
+
+        ~OfflineBatchLoader()
+        {
+            pool_.help_until([this]
+                             { return in_flight_.load() == 0; });
+        }
+
+        // Blocks until the next batch is ready; valid until release()
+        const SampledBatch &acquire()
+        {
+            pool_.help_until([this]
+                             { return ready_[read_].load(std::memory_order_acquire); });
+            return slots_[read_];
+        }
+
+        void release()
+        {
+            size_t slot = read_;
+            ready_[slot].store(false, std::memory_order_relaxed);
+            read_ ^= 1;
+            // fills stay in order so a seed always yields the same batches
+            pool_.help_until([this]
+                             { return ready_[read_].load(std::memory_order_acquire); });
+            in_flight_.fetch_add(1);
+            pool_.submit([this, slot]
+                         { fill(slot); in_flight_.fetch_sub(1); });
+        }
+
+        // Completed passes over the data by the batches gathered so far
+        size_t epoch() const
+        {
+            return epoch_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void fill(size_t slot)
+        {
+            SampledBatch &batch = slots_[slot];
+            OfflineDataset::resize(batch, batch_size_);
+            for (size_t row = 0; row < batch_size_; ++row)
+            {
+                if (cursor_ == order_.size())
+                {
+                    std::shuffle(order_.begin(), order_.end(), rng_);
+                    cursor_ = 0;
+                    epoch_.fetch_add(1, std::memory_order_relaxed);
+                }
+                data_.gather(order_[cursor_++], batch, row);
+            }
+            ready_[slot].store(true, std::memory_order_release);
+        }
+
+        const OfflineDataset &data_;
+        size_t batch_size_;
+
+        // touched only by fill(), which never runs concurrently with itself
+        std::mt19937_64 rng_;
+        std::vector<size_t> order_;
+        size_t cursor_;
+        std::atomic<size_t> epoch_;
+
+        ThreadPool &pool_;
+        std::array<SampledBatch, 2> slots_;
+        std::array<std::atomic<bool>, 2> ready_;
+        size_t read_;
+        std::atomic<int> in_flight_;
+    };
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+#include <stdexcept>
+#include "flat_policy.h"
+#include "tensor_utils.h"
+
+/*
+ Versioned parameter snapshots with lock-free readers (RCU style).
+
+ The learner is the only writer: publish() copies the online network into a
+ back buffer nobody is reading, then swaps it in with one atomic store.
+ Readers call acquire() and run inference on the returned snapshot without
+ taking a lock; the snapshot stays valid until the handle is dropped. A
+ buffer is recycled for a later version only once no reader holds it.
+
+ Readers pin a slot by bumping its reader count and then re-checking that
+ it is still current; the writer only reuses slots it sees with a zero
+ count. Both sides use sequentially consistent atomics, so a reader either
+ sees its slot still current (and the writer sees the count) or retries.
+*/
+
+namespace tiny_rl
+{
+    // An immutable view of one published version
+    struct ParamSnapshot
+    {
+        uint64_t version;
+        const FlatLayerDesc *layers;
+        size_t num_layers;
+        const char *base;
+        size_t input_size;
+        size_t num_actions;
+
+        const float *forward(const float *obs, FlatScratch &scratch) const
+        {
+            return flat_forward(layers, num_layers, base, obs, scratch);
+        }
+
+        const float *forward_batch(const float *obs, size_t batch, FlatScratch &scratch) const
+        {
+            return flat_forward_batch(layers, num_layers, base, obs, batch, scratch);
+        }
+
+        int act(const float *obs, FlatScratch &scratch) const
+        {
+            const float *q = forward(obs, scratch);
+            return static_cast<int>(std::max_element(q, q + num_actions) - q);
+        }
+    };
+
+    class ParamPublisher
+    {
+        struct Slot
+        {
+            std::atomic<int> readers{0};
+            ParamSnapshot snapshot{};
+            char *weights = nullptr;
+        };
+
+    public:
+        // Handle that keeps a snapshot alive; cheap to move, not copyable
+        class Ref
+        {
+        public:
+            Ref() = default;
+            Ref(Slot *slot) : slot_(slot) {}
+            Ref(Ref &&other) noexcept : slot_(other.slot_) { other.slot_ = nullptr; }
+            Ref &operator=(Ref &&other) noexcept
+            {
+                std::swap(slot_, other.slot_);
+                return *this;
+            }
+            Ref(const Ref &) = delete;
+            Ref &operator=(const Ref &) = delete;
+            ~Ref()
+            {
+                if (slot_)
+                    slot_->readers.fetch_sub(1);
+            }
+
+            const ParamSnapshot *operator->() const { return &slot_->snapshot; }
+            const ParamSnapshot &operator*() const { return slot_->snapshot; }
+            explicit operator bool() const { return slot_ != nullptr; }
+
+        private:
+            Slot *slot_ = nullptr;
+        };
+
+        // `net` fixes the layout; every published network must match it.
+        // More slots let readers hold snapshots longer without stalling publish().
+        explicit ParamPublisher(Net &net, size_t num_slots = 4)
+            : slots_(std::max<size_t>(num_slots, 2)),
+              current_(-1),
+              version_(0)
+        {
+            append_flat_layout(net, layers_, weight_bytes_);
+            if (layers_.empty())
+                throw std::invalid_argument("ParamPublisher: network has no layers");
+            for (auto &slot : slots_)
+            {
+                void *p = nullptr;
+                if (posix_memalign(&p, flat::kAlign, weight_bytes_) != 0)
+                    throw std::bad_alloc();
+                slot.weights = static_cast<char *>(p);
+                slot.snapshot = ParamSnapshot{0, layers_.data(), layers_.size(), slot.weights,
+                                              layers_.front().in, layers_.back().out};
+            }
+            publish(net);
+        }
+
+        ParamPublisher(const ParamPublisher &) = delete;
+        ParamPublisher &operator=(const ParamPublisher &) = delete;
+
+        ~ParamPublisher()
+        {
+            for (auto &slot : slots_)
+                std::free(slot.weights);
+        }
+
+        // Writer side, one thread only. Returns false without publishing if
+        // every back buffer is still pinned by a reader.
+        bool publish(Net &net)
+        {
+            int cur = current_.load();
+            for (size_t i = 0; i < slots_.size(); ++i)
+            {
+                if (static_cast<int>(i) == cur || slots_[i].readers.load() != 0)
+                    continue;
+                Slot &slot = slots_[i];
+                write_flat_weights(net, layers_.data(), slot.weights);
+                slot.snapshot.version = ++version_;
+                current_.store(static_cast<int>(i));
+                return true;
+            }
+            return false;
+        }
+
+        // Reader side, lock-free; the snapshot stays valid while the Ref lives
+        Ref acquire() const
+        {
+            while (true)
+            {
+                int i = current_.load();
+                Slot &slot = slots_[i];
+                slot.readers.fetch_add(1);
+                if (current_.load() == i)
+                    return Ref(&slot);
+                slot.readers.fetch_sub(1);
+            }
+        }
+
+        uint64_t version() const
+        {
+            return acquire()->version;
+        }
+
+        size_t input_size() const
+        {
+            return layers_.front().in;
+        }
+
+        size_t num_actions() const
+        {
+            return layers_.back().out;
+        }
+
+    private:
+        mutable std::vector<Slot> slots_;
+        std::vector<FlatLayerDesc> layers_;
+        uint64_t weight_bytes_ = 0;
+        std::atomic<int> current_;
+        uint64_t version_;
+    };
+}
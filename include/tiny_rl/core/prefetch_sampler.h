@@ -0,0 +1,100 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "prioritized_replay_buffer.h"
+#include "../utils/thread_pool.h"
+
+/*
+ Background minibatch sampler with double buffering. While the learner
+ trains on batch k, a task on the shared thread pool draws batch k+1
+ (priority sampling, gather into the batch columns, IS weights) into the
+ other slot. Priority updates for batch k are applied in release(), before
+ its slot is handed back, so batch k+2 is always drawn with them in place.
+
+ acquire() and release() must alternate and be called from one thread.
+ A caller that has to wait runs other pool tasks meanwhile.
+*/
+
+namespace tiny_rl
+{
+    class PrefetchSampler
+    {
+    public:
+        // replay_mutex must guard every other access to `buffer`
+        PrefetchSampler(PrioritizedReplayBuffer &buffer, std::mutex &replay_mutex, size_t batch_size)
+            : buffer_(buffer),
+              replay_mutex_(replay_mutex),
+              batch_size_(batch_size),
+              pool_(shared_thread_pool()),
+              ready_{false, false},
+              read_(0),
+              in_flight_(0)
+        {
+            // slot 1 is filled after slot 0 so the batches come out in order
+            in_flight_ = 1;
+            pool_.submit([this]
+                         { fill(0); fill(1); in_flight_.fetch_sub(1); });
+        }
+
+        PrefetchSampler(const PrefetchSampler &) = delete;
+        PrefetchSampler &operator=(const PrefetchSampler &) = delete;
+
+        ~PrefetchSampler()
+        {
+            pool_.help_until([this]
+                             { return in_flight_.load() == 0; });
+        }
+
+        // Blocks until the next batch is ready; valid until release()
+        const SampledBatch &acquire()
+        {
+            pool_.help_until([this]
+                             { return ready_[read_].load(std::memory_order_acquire); });
+            return slots_[read_];
+        }
+
+        // Applies the priority updates for the acquired batch and queues a
+        // refill of its slot. Slots overwritten since the batch was drawn
+        // are skipped, their new transition keeps its max priority.
+        void release(const std::vector<float> &td_errors)
+        {
+            {
+                std::lock_guard<std::mutex> lock(replay_mutex_);
+                const SampledBatch &batch = slots_[read_];
+                buffer_.update_priorities(batch.indices, td_errors, batch.slot_versions);
+            }
+            size_t slot = read_;
+            ready_[slot].store(false, std::memory_order_relaxed);
+            read_ ^= 1;
+            // draw k+2 only after k+1, as a single sampler thread would; the
+            // next acquire() waits for k+1 anyway
+            pool_.help_until([this]
+                             { return ready_[read_].load(std::memory_order_acquire); });
+            in_flight_.fetch_add(1);
+            pool_.submit([this, slot]
+                         { fill(slot); in_flight_.fetch_sub(1); });
+        }
+
+    private:
+        void fill(size_t slot)
+        {
+            {
+                std::lock_guard<std::mutex> lock(replay_mutex_);
+                buffer_.sample_batch(slots_[slot], batch_size_);
+            }
+            ready_[slot].store(true, std::memory_order_release);
+        }
+
+        PrioritizedReplayBuffer &buffer_;
+        std::mutex &replay_mutex_;
+        size_t batch_size_;
+        ThreadPool &pool_;
+
+        std::array<SampledBatch, 2> slots_;
+        std::array<std::atomic<bool>, 2> ready_;
+        size_t read_;
+        std::atomic<int> in_flight_;
+    };
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <cstdint>
 #include <random>
 #include <cmath>
 #include <algorithm>
@@ -70,6 +71,20 @@ namespace tiny_rl
         std::vector<float> tree_;
     };
 
+    // A sampled minibatch laid out column by column, ready for
+    // QNetwork::compute_td_targets and QNetwork::train
+    struct SampledBatch
+    {
+        std::vector<tiny_dnn::vec_t> states;
+        std::vector<tiny_dnn::vec_t> next_states;
+        std::vector<int> actions;
+        std::vector<float> rewards;
+        std::vector<bool> dones;
+        std::vector<size_t> indices;
+        std::vector<float> is_weights;
+        std::vector<uint32_t> slot_versions; // bumped each time a slot is overwritten
+    };
+
     class PrioritizedReplayBuffer
     {
     public:
@@ -80,6 +95,7 @@ namespace tiny_rl
             : tree_(capacity),
               buffer_(capacity),
               priorities_(capacity, 0.0f),
+              slot_versions_(capacity, 0),
               capacity_(capacity),
               alpha_(alpha),
               beta_(beta),
@@ -92,16 +108,38 @@ namespace tiny_rl
         // add experience with max-priority so new samples get seen at least once
         void add(const Experience &exp)
         {
-            buffer_[pos_] = exp;
-
-            float max_p = (size_ > 0) ? *std::max_element(priorities_.begin(), priorities_.begin() + size_) : 1.0f;
+            add(exp.state, exp.action, exp.reward, exp.next_state, exp.done);
+        }
 
-            priorities_[pos_] = max_p;
-            tree_.set(pos_, std::pow(max_p, alpha_));
+        // Copies into the slot's own buffers, so once the ring has wrapped
+        // adding does not allocate
+        void add(const tiny_dnn::vec_t &state, int action, float reward,
+                 const tiny_dnn::vec_t &next_state, bool done)
+        {
+            TINY_RL_PROFILE_SCOPE(kReplayAdd);
+            Experience &slot = buffer_[pos_];
+            slot.state.assign(state.begin(), state.end());
+            slot.action = action;
+            slot.reward = reward;
+            slot.next_state.assign(next_state.begin(), next_state.end());
+            slot.done = done;
+            advance();
+        }
 
-            pos_ = (pos_ + 1) % capacity_;
-            if (size_ < capacity_)
-                ++size_;
+        // Takes `state`'s buffer for the slot; `state` gets the evicted one,
+        // resized to match, so the caller can refill it
+        void add(tiny_dnn::vec_t &&state, int action, float reward,
+                 const tiny_dnn::vec_t &next_state, bool done)
+        {
+            TINY_RL_PROFILE_SCOPE(kReplayAdd);
+            Experience &slot = buffer_[pos_];
+            slot.state.swap(state);
+            state.resize(slot.state.size());
+            slot.action = action;
+            slot.reward = reward;
+            slot.next_state.assign(next_state.begin(), next_state.end());
+            slot.done = done;
+            advance();
         }
 
         void sample(
@@ -110,8 +148,143 @@ namespace tiny_rl
             std::vector<float> &is_weights,
             size_t batch_size)
         {
+            TINY_RL_PROFILE_SCOPE(kReplaySample);
+            draw(indices, is_weights, batch_size);
+
             out.clear();
             out.reserve(batch_size);
+            for (size_t index : indices)
+                out.push_back(buffer_[index]);
+        }
+
+        // Like sample(), but gathers straight into the columns of a batch.
+        // The batch's vectors are reused, so once warm this does not allocate.
+        void sample_batch(SampledBatch &batch, size_t batch_size)
+        {
+            TINY_RL_PROFILE_SCOPE(kReplaySample);
+            draw(batch.indices, batch.is_weights, batch_size);
+
+            batch.states.resize(batch_size);
+            batch.next_states.resize(batch_size);
+            batch.actions.resize(batch_size);
+            batch.rewards.resize(batch_size);
+            batch.dones.resize(batch_size);
+            batch.slot_versions.resize(batch_size);
+            for (size_t i = 0; i < batch_size; ++i)
+            {
+                const Experience &exp = buffer_[batch.indices[i]];
+                batch.slot_versions[i] = slot_versions_[batch.indices[i]];
+                batch.states[i].assign(exp.state.begin(), exp.state.end());
+                batch.next_states[i].assign(exp.next_state.begin(), exp.next_state.end());
+                batch.actions[i] = exp.action;
+                batch.rewards[i] = exp.reward;
+                batch.dones[i] = exp.done;
+            }
+        }
+
+        void update_priorities(
+            const std::vector<size_t> &indices,
+            const std::vector<float> &td_errors)
+        {
+            TINY_RL_PROFILE_SCOPE(kPriorityUpdate);
+            const float epsilon = 1e-6f;
+            for (size_t i = 0; i < indices.size(); ++i)
+            {
+                size_t index = indices[i];
+                float p = std::fabs(td_errors[i]) + epsilon;
+                priorities_[index] = p;
+                tree_.set(index, std::pow(p, alpha_));
+            }
+        }
+
+        // As above, but skips slots overwritten since the batch was sampled,
+        // so a recycled slot keeps the max priority it was added with
+        void update_priorities(
+            const std::vector<size_t> &indices,
+            const std::vector<float> &td_errors,
+            const std::vector<uint32_t> &slot_versions)
+        {
+            TINY_RL_PROFILE_SCOPE(kPriorityUpdate);
+            const float epsilon = 1e-6f;
+            for (size_t i = 0; i < indices.size(); ++i)
+            {
+                size_t index = indices[i];
+                if (slot_versions_[index] != slot_versions[i])
+                    continue;
+                float p = std::fabs(td_errors[i]) + epsilon;
+                priorities_[index] = p;
+                tree_.set(index, std::pow(p, alpha_));
+            }
+        }
+
+        size_t size() const noexcept
+        {
+            return size_;
+        }
+
+        size_t capacity() const noexcept
+        {
+            return capacity_;
+        }
+
+        // next slot add() will write to
+        size_t position() const noexcept
+        {
+            return pos_;
+        }
+
+        // Raw slot access, used for checkpointing
+        const Experience &slot(size_t index) const
+        {
+            return buffer_[index];
+        }
+
+        float priority(size_t index) const
+        {
+            return priorities_[index];
+        }
+
+        // Rebuild a slot from a checkpoint, keeping the sum tree consistent
+        void restore_slot(size_t index, Experience &&exp, float priority)
+        {
+            buffer_[index] = std::move(exp);
+            ++slot_versions_[index];
+            priorities_[index] = priority;
+            tree_.set(index, std::pow(priority, alpha_));
+        }
+
+        void restore_cursor(size_t pos, size_t size)
+        {
+            pos_ = pos % capacity_;
+            size_ = std::min(size, capacity_);
+        }
+
+        void clear() noexcept
+        {
+            size_ = pos_ = 0;
+            std::fill(priorities_.begin(), priorities_.end(), 0.0f);
+            tree_.reset();
+        }
+
+    private:
+        // Gives the slot just written max priority and moves the cursor on
+        void advance()
+        {
+            ++slot_versions_[pos_];
+
+            float max_p = (size_ > 0) ? *std::max_element(priorities_.begin(), priorities_.begin() + size_) : 1.0f;
+
+            priorities_[pos_] = max_p;
+            tree_.set(pos_, std::pow(max_p, alpha_));
+
+            pos_ = (pos_ + 1) % capacity_;
+            if (size_ < capacity_)
+                ++size_;
+        }
+
+        // proportional prioritized sampling: one draw per equal-mass segment
+        void draw(std::vector<size_t> &indices, std::vector<float> &is_weights, size_t batch_size)
+        {
             indices.clear();
             indices.reserve(batch_size);
             is_weights.clear();
@@ -132,8 +305,8 @@ namespace tiny_rl
                 }
             }
             float min_prob = min_p_alpha / total_p;
+            float max_w = std::pow(N * min_prob, -beta_);
 
-            std::uniform_real_distribution<float> uni_dist(0.0f, 1.0f);
             for (size_t i = 0; i < batch_size; ++i)
             {
                 float a = segment * i;
@@ -143,46 +316,25 @@ namespace tiny_rl
 
                 float p_alpha;
                 size_t index = tree_.get_leaf(s, p_alpha);
-
+                // rounding drift in the tree sums can walk past the filled
+                // slots into empty ones while the buffer is not yet full
+                if (index >= N)
+                {
+                    index = N - 1;
+                    p_alpha = std::pow(priorities_[index], alpha_);
+                }
                 indices.push_back(index);
-                out.push_back(buffer_[index]);
 
                 float prob = p_alpha / total_p;
                 float w = std::pow(N * prob, -beta_);
-                float max_w = std::pow(N * min_prob, -beta_);
                 is_weights.push_back(w / max_w);
             }
         }
 
-        void update_priorities(
-            const std::vector<size_t> &indices,
-            const std::vector<float> &td_errors)
-        {
-            const float epsilon = 1e-6f;
-            for (size_t i = 0; i < indices.size(); ++i)
-            {
-                size_t index = indices[i];
-                float p = std::fabs(td_errors[i]) + epsilon;
-                priorities_[index] = p;
-                tree_.set(index, std::pow(p, alpha_));
-            }
-        }
-
-        size_t size() const noexcept
-        {
-            return size_;
-        }
-        void clear() noexcept
-        {
-            size_ = pos_ = 0;
-            std::fill(priorities_.begin(), priorities_.end(), 0.0f);
-            tree_.reset();
-        }
-
-    private:
         SumTree tree_;
         std::vector<Experience> buffer_;
         std::vector<float> priorities_;
+        std::vector<uint32_t> slot_versions_;
         size_t capacity_;
         float alpha_, beta_;
         size_t pos_, size_;
@@ -2,6 +2,7 @@
 #include <tiny_dnn/tiny_dnn.h>
 #include <iostream>
 #include <memory>
+#include "../utils/profiler.h"
 
 namespace tiny_rl
 {
@@ -60,6 +61,7 @@ namespace tiny_rl
         void train(const std::vector<tiny_dnn::vec_t> &states, const std::vector<tiny_dnn::vec_t> &td_targets, tiny_dnn::optimizer &opt, const int batch_size = 32, const int epochs = 1)
         {
             assert(states.size() == td_targets.size());
+            TINY_RL_PROFILE_SCOPE(kTrain);
             net.train<tiny_dnn::mse>(opt, states, td_targets, batch_size, epochs);
             // clip_weights(net);
         }
@@ -93,6 +95,37 @@ namespace tiny_rl
             const std::vector<tiny_dnn::vec_t> &next_states,
             const std::vector<bool> &dones,
             float gamma = 0.99f)
+        {
+            std::vector<tiny_dnn::vec_t> td_targets;
+            compute_td_targets(states, actions, rewards, next_states, dones, gamma, td_targets);
+            return td_targets;
+        }
+
+        // Same as above, with the target network's Q(s', .) rows supplied by
+        // the caller (e.g. from a TargetValueCache) instead of recomputed
+        std::vector<tiny_dnn::vec_t> compute_td_targets(
+            const std::vector<tiny_dnn::vec_t> &states,
+            const std::vector<int> &actions,
+            const std::vector<float> &rewards,
+            const std::vector<tiny_dnn::vec_t> &next_states,
+            const std::vector<bool> &dones,
+            const std::vector<tiny_dnn::vec_t> &next_q,
+            float gamma)
+        {
+            std::vector<tiny_dnn::vec_t> td_targets;
+            compute_td_targets(states, actions, rewards, next_states, dones, next_q, gamma, td_targets);
+            return td_targets;
+        }
+
+        // Into `td_targets`, whose rows are reused from call to call
+        void compute_td_targets(
+            const std::vector<tiny_dnn::vec_t> &states,
+            const std::vector<int> &actions,
+            const std::vector<float> &rewards,
+            const std::vector<tiny_dnn::vec_t> &next_states,
+            const std::vector<bool> &dones,
+            float gamma,
+            std::vector<tiny_dnn::vec_t> &td_targets)
         {
             size_t N = states.size();
             assert(actions.size() == N);
@@ -100,10 +133,33 @@ namespace tiny_rl
             assert(next_states.size() == N);
             assert(dones.size() == N);
 
-            auto current_q = predict_batch(states, false);
-            auto next_q = predict_batch(next_states, true);
+            std::vector<tiny_dnn::vec_t> next_q;
+            {
+                TINY_RL_PROFILE_SCOPE(kTdTargets);
+                next_q = predict_batch(next_states, true);
+            }
+            compute_td_targets(states, actions, rewards, next_states, dones, next_q, gamma, td_targets);
+        }
+
+        void compute_td_targets(
+            const std::vector<tiny_dnn::vec_t> &states,
+            const std::vector<int> &actions,
+            const std::vector<float> &rewards,
+            const std::vector<tiny_dnn::vec_t> &next_states,
+            const std::vector<bool> &dones,
+            const std::vector<tiny_dnn::vec_t> &next_q,
+            float gamma,
+            std::vector<tiny_dnn::vec_t> &td_targets)
+        {
+            assert(next_q.size() == states.size());
+            TINY_RL_PROFILE_SCOPE(kTdTargets);
+            td_targets.resize(states.size());
+            for (size_t i = 0; i < states.size(); ++i)
+            {
+                auto current_q = net.predict(states[i]);
+                td_targets[i].assign(current_q.begin(), current_q.end());
+            }
 
-            std::vector<tiny_dnn::vec_t> td_targets = current_q;
             for (size_t i = 0; i < rewards.size(); ++i)
             {
                 auto next_online = predict(next_states[i], false);
@@ -114,12 +170,12 @@ namespace tiny_rl
                 assert(actions[i] >= 0 &&
                        static_cast<size_t>(actions[i]) < td_targets[i].size());
             }
-            return td_targets;
         }
 
         // Update target network weights (soft or hard update)
         void update_target_network(float tau = 1.0f)
         {
+            TINY_RL_PROFILE_SCOPE(kTargetUpdate);
             if (tau >= 1.0f)
                 tau = 1.0f;
             for (size_t l = 0; l < net.depth(); ++l)
@@ -5,6 +5,7 @@
 #include <cassert>
 #include <algorithm>
 #include "tiny_dnn/tiny_dnn.h"
+#include "../utils/profiler.h"
 
 namespace tiny_rl
 {
@@ -32,19 +33,50 @@ namespace tiny_rl
 
         void add(Experience &&exp)
         {
+            TINY_RL_PROFILE_SCOPE(kReplayAdd);
             buffer_[pos_] = std::move(exp);
             advance_();
         }
 
         void add(const Experience &exp)
         {
-            buffer_[pos_] = exp;
+            add(exp.state, exp.action, exp.reward, exp.next_state, exp.done);
+        }
+
+        // Copies into the slot's own buffers; no allocation once wrapped
+        void add(const tiny_dnn::vec_t &state, int action, float reward,
+                 const tiny_dnn::vec_t &next_state, bool done)
+        {
+            TINY_RL_PROFILE_SCOPE(kReplayAdd);
+            Experience &slot = buffer_[pos_];
+            slot.state.assign(state.begin(), state.end());
+            slot.action = action;
+            slot.reward = reward;
+            slot.next_state.assign(next_state.begin(), next_state.end());
+            slot.done = done;
+            advance_();
+        }
+
+        // Takes `state`'s buffer for the slot and hands back the evicted
+        // one, resized to match
+        void add(tiny_dnn::vec_t &&state, int action, float reward,
+                 const tiny_dnn::vec_t &next_state, bool done)
+        {
+            TINY_RL_PROFILE_SCOPE(kReplayAdd);
+            Experience &slot = buffer_[pos_];
+            slot.state.swap(state);
+            state.resize(slot.state.size());
+            slot.action = action;
+            slot.reward = reward;
+            slot.next_state.assign(next_state.begin(), next_state.end());
+            slot.done = done;
             advance_();
         }
 
         // Randomly sample a batch of experiences from the buffer
         void sample(std::vector<Experience> &out, size_t batch_size)
         {
+            TINY_RL_PROFILE_SCOPE(kReplaySample);
             assert(size_ > 0);
             assert(batch_size <= size_);
 
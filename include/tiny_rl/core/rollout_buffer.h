@@ -1,9 +1,12 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <utility>
 #include <stdexcept>
 #include <cstddef>
 #include <tiny_dnn/tiny_dnn.h>
+#include "obs_pool.h"
 
 namespace tiny_rl
 {
@@ -30,18 +33,50 @@ namespace tiny_rl
 
         void add(const RolloutEntry &entry)
         {
-            if (buffer_.size() < capacity_)
-            {
-                buffer_.push_back(entry);
-            }
-            else
-            {
+            add(entry.state, entry.action, entry.reward, entry.done, entry.log_prob, entry.value);
+        }
+
+        // The state is copied into a buffer recycled from the previous
+        // rollout, so after the first rollout adding does not allocate
+        void add(const tiny_dnn::vec_t &state, int action, float reward, bool done, float log_prob, float value)
+        {
+            if (buffer_.size() >= capacity_)
                 throw std::runtime_error("RolloutBuffer is full");
-            }
+            if (!pool_)
+                pool_ = std::make_unique<ObsPool>(state.size());
+
+            RolloutEntry &entry = buffer_.emplace_back();
+            entry.state = pool_->acquire();
+            entry.state.assign(state.begin(), state.end());
+            entry.action = action;
+            entry.reward = reward;
+            entry.done = done;
+            entry.log_prob = log_prob;
+            entry.value = value;
+        }
+
+        // Keeps `state`'s buffer and refills the argument from the pool
+        void add(tiny_dnn::vec_t &&state, int action, float reward, bool done, float log_prob, float value)
+        {
+            if (buffer_.size() >= capacity_)
+                throw std::runtime_error("RolloutBuffer is full");
+            if (!pool_)
+                pool_ = std::make_unique<ObsPool>(state.size());
+
+            RolloutEntry &entry = buffer_.emplace_back();
+            entry.state = std::exchange(state, pool_->acquire());
+            entry.action = action;
+            entry.reward = reward;
+            entry.done = done;
+            entry.log_prob = log_prob;
+            entry.value = value;
         }
 
         void clear()
         {
+            if (pool_)
+                for (auto &entry : buffer_)
+                    pool_->release(std::move(entry.state));
             buffer_.clear();
         }
 
@@ -68,5 +103,6 @@ namespace tiny_rl
     private:
         std::vector<RolloutEntry> buffer_;
         size_t capacity_;
+        std::unique_ptr<ObsPool> pool_; // state buffers of cleared entries
     };
 }
\ No newline at end of file
@@ -0,0 +1,380 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "prioritized_replay_buffer.h"
+
+/*
+ Transition arena in POSIX shared memory, written by many actor processes
+ and sampled in place by one learner. Layout:
+
+   ShmReplayHeader | parameter block | slot 0 | slot 1 | ...
+
+ Every slot is a fixed-size record on its own cache lines:
+   seq | state[dim] | next_state[dim] | action | reward | done
+
+ Insertion (MPSC): a producer claims a ticket with one fetch_add on
+ `reserved`, then marks slot ticket % capacity busy (odd seq 2 * ticket
+ + 1) with a CAS from any even seq an earlier ticket left behind, writes
+ the record and publishes it as 2 * ticket + 2. A ticket that was never
+ written (its producer died first) leaves nothing to wait for. A producer
+ that laps a slot still being written waits for that writer instead of
+ writing over it; if the slot stays busy (its writer died mid-record) or
+ a later lap already took it, the record is dropped and counted in
+ `dropped`. The learner reads
+ seq, copies the record, and re-reads seq; a changed or odd seq means a
+ producer lapped it, so it picks another slot.
+
+ The parameter block carries the learner's flat weights to the actors
+ under the same seqlock scheme. All atomics are lock-free, so they work
+ across processes.
+*/
+
+namespace tiny_rl
+{
+    namespace shm
+    {
+        constexpr char kMagic[8] = {'T', 'R', 'L', 'S', 'H', 'M', 'R', '\0'};
+        constexpr uint32_t kVersion = 2;
+        constexpr uint64_t kLine = 64;
+        // claim attempts on a busy slot before a producer drops its record
+        constexpr int kClaimSpins = 1 << 16;
+
+        inline uint64_t align_up(uint64_t x)
+        {
+            return (x + kLine - 1) & ~(kLine - 1);
+        }
+    }
+
+    struct ShmReplayHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t state_dim;
+        uint64_t capacity;
+        uint64_t slot_bytes;
+        uint64_t params_offset;
+        uint64_t params_bytes;
+        uint64_t slots_offset;
+        uint64_t total_bytes;
+
+        alignas(64) std::atomic<uint64_t> reserved;  // tickets handed out
+        std::atomic<uint64_t> committed;             // records fully written
+        std::atomic<uint64_t> dropped;               // records given up on a busy slot
+        std::atomic<uint64_t> episodes;
+        std::atomic<int64_t> reward_milli;           // sum of episode returns * 1000
+        std::atomic<uint32_t> stop;
+        std::atomic<uint64_t> actor_crashes;         // counted by whoever restarts actors
+        alignas(64) std::atomic<uint64_t> params_seq; // odd while the learner writes
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared-memory replay needs lock-free 64-bit atomics");
+
+    class ShmReplay
+    {
+    public:
+        // Creates the segment; the creator unlinks it on destruction
+        ShmReplay(const std::string &name, size_t capacity, size_t state_dim, size_t params_bytes)
+            : name_(name), owner_(true)
+        {
+            if (capacity == 0 || state_dim == 0)
+                throw std::invalid_argument("ShmReplay: capacity and state_dim must be positive");
+            uint64_t slot_bytes = shm::align_up(sizeof(uint64_t) + 2 * state_dim * sizeof(float) + 3 * sizeof(uint32_t));
+            uint64_t params_offset = shm::align_up(sizeof(ShmReplayHeader));
+            uint64_t slots_offset = shm::align_up(params_offset + params_bytes);
+            uint64_t total = slots_offset + capacity * slot_bytes;
+
+            ::shm_unlink(name_.c_str()); // stale segment from a crashed run
+            int fd = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0)
+                throw std::runtime_error("ShmReplay: shm_open failed for " + name_);
+            if (::ftruncate(fd, static_cast<off_t>(total)) != 0)
+            {
+                ::close(fd);
+                ::shm_unlink(name_.c_str());
+                throw std::runtime_error("ShmReplay: cannot size " + name_);
+            }
+            map(fd, total);
+
+            // ftruncate zero-fills, so every seq starts at 0 (never written)
+            header_ = new (base_) ShmReplayHeader{};
+            std::memcpy(header_->magic, shm::kMagic, sizeof(header_->magic));
+            header_->version = shm::kVersion;
+            header_->state_dim = static_cast<uint32_t>(state_dim);
+            header_->capacity = capacity;
+            header_->slot_bytes = slot_bytes;
+            header_->params_offset = params_offset;
+            header_->params_bytes = params_bytes;
+            header_->slots_offset = slots_offset;
+            header_->total_bytes = total;
+        }
+
+        // Attaches to a segment created by another process
+        explicit ShmReplay(const std::string &name)
+            : name_(name), owner_(false)
+        {
+            int fd = ::shm_open(name_.c_str(), O_RDWR, 0600);
+            if (fd < 0)
+                throw std::runtime_error("ShmReplay: no segment named " + name_);
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ShmReplayHeader)))
+            {
+                ::close(fd);
+                throw std::runtime_error("ShmReplay: segment too small " + name_);
+            }
+            map(fd, static_cast<size_t>(st.st_size));
+            header_ = reinterpret_cast<ShmReplayHeader *>(base_);
+            if (std::memcmp(header_->magic, shm::kMagic, sizeof(header_->magic)) != 0 ||
+                header_->version != shm::kVersion || header_->total_bytes != bytes_)
+            {
+                ::munmap(base_, bytes_);
+                throw std::runtime_error("ShmReplay: bad header in " + name_);
+            }
+        }
+
+        ShmReplay(const ShmReplay &) = delete;
+        ShmReplay &operator=(const ShmReplay &) = delete;
+
+        ~ShmReplay()
+        {
+            ::munmap(base_, bytes_);
+            if (owner_)
+                ::shm_unlink(name_.c_str());
+        }
+
+        // Producer side, any number of processes
+        void add(const float *state, int action, float reward, const float *next_state, bool done)
+        {
+            uint64_t ticket = header_->reserved.fetch_add(1, std::memory_order_relaxed);
+            uint64_t capacity = header_->capacity;
+            char *slot = slot_ptr(ticket % capacity);
+            auto *seq = reinterpret_cast<std::atomic<uint64_t> *>(slot);
+
+            // any earlier ticket's even seq is free to take, so a ticket that
+            // never wrote (dead producer, dropped record) does not block the slot;
+            // an odd seq from an earlier ticket is a write still in flight
+            const uint64_t claimed = 2 * ticket + 1;
+            uint64_t current = seq->load(std::memory_order_relaxed);
+            int spins = 0;
+            while (true)
+            {
+                if (current >= claimed || ((current & 1) && ++spins == shm::kClaimSpins))
+                {
+                    header_->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                if (current & 1)
+                {
+                    std::this_thread::yield();
+                    current = seq->load(std::memory_order_relaxed);
+                    continue;
+                }
+                if (seq->compare_exchange_weak(current, claimed, std::memory_order_acquire,
+                                               std::memory_order_relaxed))
+                    break;
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+
+            size_t dim = header_->state_dim;
+            float *f = reinterpret_cast<float *>(slot + sizeof(uint64_t));
+            std::memcpy(f, state, dim * sizeof(float));
+            std::memcpy(f + dim, next_state, dim * sizeof(float));
+            int32_t a = action;
+            uint32_t d = done ? 1 : 0;
+            std::memcpy(f + 2 * dim, &a, sizeof(a));
+            std::memcpy(f + 2 * dim + 1, &reward, sizeof(reward));
+            std::memcpy(f + 2 * dim + 2, &d, sizeof(d));
+
+            seq->store(2 * ticket + 2, std::memory_order_release);
+            header_->committed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void end_episode(float episode_return)
+        {
+            header_->reward_milli.fetch_add(static_cast<int64_t>(episode_return * 1000.0f), std::memory_order_relaxed);
+            header_->episodes.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Learner side: uniform sample copied into `batch` (is_weights = 1).
+        // Returns false while fewer than batch_size records are committed.
+        template <typename Rng>
+        bool sample_batch(SampledBatch &batch, size_t batch_size, Rng &rng)
+        {
+            size_t filled = size();
+            if (filled < batch_size)
+                return false;
+            std::uniform_int_distribution<size_t> pick(0, filled - 1);
+            size_t dim = header_->state_dim;
+
+            batch.states.resize(batch_size);
+            batch.next_states.resize(batch_size);
+            batch.actions.resize(batch_size);
+            batch.rewards.resize(batch_size);
+            batch.dones.resize(batch_size);
+            batch.indices.resize(batch_size);
+            batch.is_weights.assign(batch_size, 1.0f);
+            batch.slot_versions.resize(batch_size);
+            // slots left empty by dropped records are skipped, within reason
+            size_t attempts = 64 * batch_size;
+            for (size_t i = 0; i < batch_size; ++i)
+            {
+                while (true)
+                {
+                    if (attempts-- == 0)
+                        return false;
+                    size_t index = pick(rng);
+                    const char *slot = slot_ptr(index);
+                    auto *seq = reinterpret_cast<const std::atomic<uint64_t> *>(slot);
+                    uint64_t before = seq->load(std::memory_order_acquire);
+                    if (before == 0 || (before & 1))
+                        continue;
+
+                    const float *f = reinterpret_cast<const float *>(slot + sizeof(uint64_t));
+                    batch.states[i].assign(f, f + dim);
+                    batch.next_states[i].assign(f + dim, f + 2 * dim);
+                    int32_t a;
+                    uint32_t d;
+                    std::memcpy(&a, f + 2 * dim, sizeof(a));
+                    std::memcpy(&batch.rewards[i], f + 2 * dim + 1, sizeof(float));
+                    std::memcpy(&d, f + 2 * dim + 2, sizeof(d));
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (seq->load(std::memory_order_relaxed) != before)
+                        continue; // overwritten while copying
+
+                    batch.actions[i] = a;
+                    batch.dones[i] = d != 0;
+                    batch.indices[i] = index;
+                    batch.slot_versions[i] = static_cast<uint32_t>(before / 2);
+                    break;
+                }
+            }
+            return true;
+        }
+
+        // Learner side: copy a new parameter version into the block
+        void publish_params(const void *params)
+        {
+            uint64_t seq = header_->params_seq.load(std::memory_order_relaxed);
+            header_->params_seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(base_ + header_->params_offset, params, header_->params_bytes);
+            header_->params_seq.store(seq + 2, std::memory_order_release);
+        }
+
+        // Actor side: copies the parameters into `out` if a version newer
+        // than `seen` is complete; returns true and updates `seen` if so
+        bool fetch_params(void *out, uint64_t &seen) const
+        {
+            uint64_t before = header_->params_seq.load(std::memory_order_acquire);
+            if (before == seen || (before & 1) || before == 0)
+                return false;
+            std::memcpy(out, base_ + header_->params_offset, header_->params_bytes);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header_->params_seq.load(std::memory_order_relaxed) != before)
+                return false;
+            seen = before;
+            return true;
+        }
+
+        size_t size() const
+        {
+            return static_cast<size_t>(std::min<uint64_t>(header_->committed.load(std::memory_order_relaxed), header_->capacity));
+        }
+
+        size_t capacity() const
+        {
+            return header_->capacity;
+        }
+
+        size_t state_dim() const
+        {
+            return header_->state_dim;
+        }
+
+        size_t params_bytes() const
+        {
+            return header_->params_bytes;
+        }
+
+        uint64_t transitions() const
+        {
+            return header_->committed.load(std::memory_order_relaxed);
+        }
+
+        // Records dropped because their slot was still busy, see add()
+        uint64_t dropped() const
+        {
+            return header_->dropped.load(std::memory_order_relaxed);
+        }
+
+        uint64_t episodes() const
+        {
+            return header_->episodes.load(std::memory_order_relaxed);
+        }
+
+        // Sum of episode returns reported since the last call
+        double take_reward_sum()
+        {
+            return header_->reward_milli.exchange(0, std::memory_order_relaxed) / 1000.0;
+        }
+
+        // Actor processes that died abnormally, as recorded with count_crashes()
+        uint64_t actor_crashes() const
+        {
+            return header_->actor_crashes.load(std::memory_order_relaxed);
+        }
+
+        void count_crashes(uint64_t n)
+        {
+            header_->actor_crashes.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void request_stop()
+        {
+            header_->stop.store(1, std::memory_order_release);
+        }
+
+        bool stop_requested() const
+        {
+            return header_->stop.load(std::memory_order_acquire) != 0;
+        }
+
+    private:
+        void map(int fd, size_t bytes)
+        {
+            void *p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+            {
+                if (owner_)
+                    ::shm_unlink(name_.c_str());
+                throw std::runtime_error("ShmReplay: mmap failed for " + name_);
+            }
+            base_ = static_cast<char *>(p);
+            bytes_ = bytes;
+        }
+
+        char *slot_ptr(size_t index) const
+        {
+            return base_ + header_->slots_offset + index * header_->slot_bytes;
+        }
+
+        std::string name_;
+        bool owner_;
+        char *base_ = nullptr;
+        size_t bytes_ = 0;
+        ShmReplayHeader *header_ = nullptr;
+    };
+}
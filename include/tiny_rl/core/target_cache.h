@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <tiny_dnn/tiny_dnn.h>
+
+/*
+ Cache of target-network Q(s', .) rows keyed by replay slot. The target
+ network only changes on a hard update, so a row stays valid until the
+ next invalidate() (which just bumps a generation counter) or until the
+ slot is recycled, which the replay buffer reports through its per-slot
+ version. Rows are filled lazily the first time a slot is sampled.
+
+ Not thread-safe: meant to be used by the learner thread only.
+*/
+
+namespace tiny_rl
+{
+    class TargetValueCache
+    {
+    public:
+        TargetValueCache(size_t capacity, size_t num_actions)
+            : num_actions_(num_actions),
+              values_(capacity * num_actions, 0.0f),
+              generations_(capacity, 0),
+              versions_(capacity, 0),
+              generation_(1),
+              hits_(0),
+              misses_(0)
+        {
+        }
+
+        // Returns the cached row for `slot` or nullptr if it is stale
+        const float *find(size_t slot, uint32_t slot_version)
+        {
+            if (generations_[slot] == generation_ && versions_[slot] == slot_version)
+            {
+                ++hits_;
+                return &values_[slot * num_actions_];
+            }
+            ++misses_;
+            return nullptr;
+        }
+
+        void put(size_t slot, uint32_t slot_version, const tiny_dnn::vec_t &q)
+        {
+            std::copy(q.begin(), q.begin() + num_actions_, values_.begin() + slot * num_actions_);
+            generations_[slot] = generation_;
+            versions_[slot] = slot_version;
+        }
+
+        // Drop every row at once, call after each hard target update
+        void invalidate()
+        {
+            ++generation_;
+        }
+
+        size_t num_actions() const
+        {
+            return num_actions_;
+        }
+
+        size_t hits() const
+        {
+            return hits_;
+        }
+
+        size_t misses() const
+        {
+            return misses_;
+        }
+
+        // Fraction of lookups that skipped a target-network forward pass
+        double hit_rate() const
+        {
+            size_t total = hits_ + misses_;
+            return total > 0 ? static_cast<double>(hits_) / total : 0.0;
+        }
+
+        void reset_stats()
+        {
+            hits_ = misses_ = 0;
+        }
+
+    private:
+        size_t num_actions_;
+        std::vector<float> values_;
+        std::vector<uint32_t> generations_;
+        std::vector<uint32_t> versions_;
+        uint32_t generation_;
+        size_t hits_;
+        size_t misses_;
+    };
+}
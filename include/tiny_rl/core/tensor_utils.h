@@ -0,0 +1,64 @@
+#pragma once
+#include <tiny_dnn/tiny_dnn.h>
+#include <vector>
+#include <cstddef>
+#include <cassert>
+
+namespace tiny_rl
+{
+    using Net = tiny_dnn::network<tiny_dnn::sequential>;
+
+    // Total number of parameters (weights and biases) across all layers
+    inline size_t param_count(Net &net)
+    {
+        size_t n = 0;
+        for (size_t l = 0; l < net.depth(); ++l)
+            for (auto *w : net[l]->weights())
+                n += w->size();
+        return n;
+    }
+
+    // Copy every parameter of the network into one contiguous array,
+    // layer by layer in the same order update_target_network walks them
+    inline void flatten_params(Net &net, std::vector<float> &out)
+    {
+        out.resize(param_count(net));
+        size_t k = 0;
+        for (size_t l = 0; l < net.depth(); ++l)
+            for (auto *w : net[l]->weights())
+                for (float v : *w)
+                    out[k++] = v;
+    }
+
+    // Inverse of flatten_params, returns how many floats were consumed
+    inline size_t load_params(Net &net, const float *data)
+    {
+        size_t k = 0;
+        for (size_t l = 0; l < net.depth(); ++l)
+            for (auto *w : net[l]->weights())
+                for (auto &v : *w)
+                    v = data[k++];
+        return k;
+    }
+
+    // dst <- tau * src + (1 - tau) * dst for two networks of the same shape
+    inline void copy_params(Net &src, Net &dst, float tau = 1.0f)
+    {
+        assert(src.depth() == dst.depth());
+        for (size_t l = 0; l < src.depth(); ++l)
+        {
+            auto src_params = src[l]->weights();
+            auto dst_params = dst[l]->weights();
+            for (size_t p = 0; p < src_params.size(); ++p)
+            {
+                auto &s = *src_params[p];
+                auto &d = *dst_params[p];
+                if (tau >= 1.0f)
+                    std::copy(s.begin(), s.end(), d.begin());
+                else
+                    for (size_t i = 0; i < s.size(); ++i)
+                        d[i] = tau * s[i] + (1.0f - tau) * d[i];
+            }
+        }
+    }
+}
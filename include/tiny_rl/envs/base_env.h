@@ -1,9 +1,29 @@
 #pragma once
 #include <vector>
 #include <tuple>
+#include <utility>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
 
 namespace tiny_rl
 {
+    // Fixed-size, trivially copyable copy of an environment's dynamic state.
+    // Each environment decides how to pack its fields into the arrays; the
+    // blob can be memcpy'd, stored in arrays or sent between threads freely.
+    struct EnvSnapshot
+    {
+        static constexpr size_t kMaxReals = 12;
+        static constexpr size_t kMaxInts = 4;
+
+        std::array<float, kMaxReals> reals{};
+        std::array<int32_t, kMaxInts> ints{};
+    };
+    static_assert(std::is_trivially_copyable<EnvSnapshot>::value,
+                  "EnvSnapshot must stay a POD blob");
+
     class BaseEnv
     {
     public:
@@ -13,13 +33,42 @@ namespace tiny_rl
         // Takes an action and returns the next state, reward, and done flag
         virtual std::tuple<std::vector<float>, float, bool> step(int action) = 0;
 
+        // Allocation-free step(): writes the state_size() observation values
+        // to `obs` and returns the reward and done flag. The default goes
+        // through step(); environments meant for the hot loop override it.
+        virtual std::pair<float, bool> step_into(int action, float *obs)
+        {
+            auto [next_state, reward, done] = step(action);
+            std::copy(next_state.begin(), next_state.end(), obs);
+            return {reward, done};
+        }
+
+        // Allocation-free reset(), same contract as step_into()
+        virtual void reset_into(float *obs)
+        {
+            auto state = reset();
+            std::copy(state.begin(), state.end(), obs);
+        }
+
         // Retuns the size of the state vector
         virtual int state_size() const = 0;
 
         // Returns the number of possible actions
         virtual int action_size() const = 0;
 
+        // Captures the current dynamic state so it can be restored later
+        virtual EnvSnapshot snapshot() const
+        {
+            throw std::logic_error("snapshot() is not supported by this environment");
+        }
+
+        // Restores a state captured with snapshot() and returns its observation
+        virtual std::vector<float> restore(const EnvSnapshot &)
+        {
+            throw std::logic_error("restore() is not supported by this environment");
+        }
+
         virtual ~BaseEnv() = default;
     };
 
-}
\ No newline at end of file
+}
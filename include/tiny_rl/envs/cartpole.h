@@ -16,7 +16,9 @@ namespace tiny_rl
     class CartPoleEnv : public BaseEnv
     {
     public:
-        CartPoleEnv() : step_(0)
+        // With normalize = false observations are the raw physical state,
+        // for use behind an ObservationNormalizer
+        explicit CartPoleEnv(bool normalize = true) : step_(0), normalize_(normalize)
         {
             // Cartpole constants, carried from OpenAI Gym
             gravity_ = 9.8f;
@@ -38,21 +40,34 @@ namespace tiny_rl
 
         const std::vector<float> get_state() const
         {
-            return normalize_state(state_);
+            return observation();
         }
 
         virtual std::vector<float> reset() override
         {
-            state_ = {
-                0.0f,
-                0.0f,
-                (rand() % 1000 - 500) / 10000.0f, // pole angle is slightly randomized, for the start
-                0.0f};
+            std::vector<float> obs(state_.size());
+            reset_into(obs.data());
+            return obs;
+        }
+
+        virtual void reset_into(float *obs) override
+        {
+            state_[0] = 0.0f;
+            state_[1] = 0.0f;
+            state_[2] = (rand() % 1000 - 500) / 10000.0f; // pole angle is slightly randomized, for the start
+            state_[3] = 0.0f;
             step_ = 0;
-            return normalize_state(state_);
+            write_observation(obs);
         }
 
         virtual std::tuple<std::vector<float>, float, bool> step(int action) override
+        {
+            std::vector<float> obs(state_.size());
+            auto [reward, done] = step_into(action, obs.data());
+            return {std::move(obs), reward, done};
+        }
+
+        virtual std::pair<float, bool> step_into(int action, float *obs) override
         {
             float x = state_[0];
             float x_dot = state_[1];
@@ -74,7 +89,10 @@ namespace tiny_rl
             theta_dot += tau_ * theta_acc;
             theta += tau_ * theta_dot;
 
-            state_ = {x, x_dot, theta, theta_dot};
+            state_[0] = x;
+            state_[1] = x_dot;
+            state_[2] = theta;
+            state_[3] = theta_dot;
             step_++;
 
             // Terminal conditions: | pole angle | > 12 degrees or | cart position | > 2.4
@@ -83,7 +101,8 @@ namespace tiny_rl
                         step_ >= 500;
 
             float reward = 1.0f;
-            return {normalize_state(state_), reward, done};
+            write_observation(obs);
+            return {reward, done};
         }
 
         virtual int state_size() const override
@@ -96,14 +115,43 @@ namespace tiny_rl
             return 2; // can only move the card left or right
         }
 
+        // The physics constants never change, so the raw state and the
+        // step counter are all that is needed to resume an episode
+        virtual EnvSnapshot snapshot() const override
+        {
+            EnvSnapshot snap;
+            for (size_t i = 0; i < state_.size(); ++i)
+                snap.reals[i] = state_[i];
+            snap.ints[0] = step_;
+            return snap;
+        }
+
+        virtual std::vector<float> restore(const EnvSnapshot &snap) override
+        {
+            for (size_t i = 0; i < state_.size(); ++i)
+                state_[i] = snap.reals[i];
+            step_ = snap.ints[0];
+            return observation();
+        }
+
     private:
-        std::vector<float> normalize_state(const std::vector<float> &s) const
+        std::vector<float> observation() const
+        {
+            std::vector<float> obs(state_.size());
+            write_observation(obs.data());
+            return obs;
+        }
+
+        void write_observation(float *obs) const
         {
-            return {s[0] / 2.4f, s[1] / 3.0f, s[2] / 0.209f, s[3] / 4.0f};
+            static const float bounds[4] = {2.4f, 3.0f, 0.209f, 4.0f};
+            for (size_t i = 0; i < 4; ++i)
+                obs[i] = normalize_ ? state_[i] / bounds[i] : state_[i];
         }
 
         std::vector<float> state_;
         int step_;
+        bool normalize_;
         float gravity_;
         float mass_cart_;
         float mass_pole_;
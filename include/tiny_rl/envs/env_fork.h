@@ -0,0 +1,92 @@
+#pragma once
+#include "base_env.h"
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cassert>
+
+/*
+ A fixed set of environment copies used for lookahead rollouts. The copies
+ are created once; every rollout restores them from an EnvSnapshot, so
+ thousands of short rollouts from the same state need no new allocations
+ for the environments themselves.
+*/
+
+namespace tiny_rl
+{
+    class EnvForkPool
+    {
+    public:
+        // policy(fork_index, observation) -> action
+        using Policy = std::function<int(size_t, const std::vector<float> &)>;
+
+        EnvForkPool(const std::function<std::shared_ptr<BaseEnv>()> &factory, size_t num_forks)
+            : returns_(num_forks, 0.0f),
+              lengths_(num_forks, 0)
+        {
+            forks_.reserve(num_forks);
+            for (size_t i = 0; i < num_forks; ++i)
+                forks_.push_back(factory());
+        }
+
+        size_t size() const
+        {
+            return forks_.size();
+        }
+
+        BaseEnv &fork(size_t i)
+        {
+            return *forks_[i];
+        }
+
+        // Restores every fork to `root` and rolls it out for at most `horizon`
+        // steps. If `first_actions` is non-empty, fork i takes first_actions[i]
+        // as its first action (one entry per fork), which is the usual way of
+        // scoring candidate actions. Returns the discounted return of each fork.
+        const std::vector<float> &rollout(const EnvSnapshot &root,
+                                          int horizon,
+                                          const Policy &policy,
+                                          float gamma = 1.0f,
+                                          const std::vector<int> &first_actions = {})
+        {
+            assert(first_actions.empty() || first_actions.size() == forks_.size());
+
+            for (size_t i = 0; i < forks_.size(); ++i)
+            {
+                BaseEnv &env = *forks_[i];
+                std::vector<float> obs = env.restore(root);
+
+                float total = 0.0f;
+                float discount = 1.0f;
+                int t = 0;
+                while (t < horizon)
+                {
+                    int action = (t == 0 && !first_actions.empty())
+                                     ? first_actions[i]
+                                     : policy(i, obs);
+                    auto [next_obs, reward, done] = env.step(action);
+                    total += discount * reward;
+                    discount *= gamma;
+                    obs = std::move(next_obs);
+                    ++t;
+                    if (done)
+                        break;
+                }
+                returns_[i] = total;
+                lengths_[i] = t;
+            }
+            return returns_;
+        }
+
+        // Number of steps each fork actually took during the last rollout
+        const std::vector<int> &lengths() const
+        {
+            return lengths_;
+        }
+
+    private:
+        std::vector<std::shared_ptr<BaseEnv>> forks_;
+        std::vector<float> returns_;
+        std::vector<int> lengths_;
+    };
+}
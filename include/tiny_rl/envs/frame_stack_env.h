@@ -0,0 +1,140 @@
+#pragma once
+#include "base_env.h"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+/*
+ Environment wrapper that observes the last `stack` frames of the wrapped
+ env, oldest first, so state_size() is stack * frame_size(). The frames
+ live in a ring owned by the wrapper; every frame is written twice, at
+ its slot and at slot + stack, so the newest `stack` frames are always
+ one contiguous run and each step is a single copy into the caller's
+ buffer. After a reset the ring holds the first frame `stack` times.
+
+ The newest frame is the last frame_size() values of every observation;
+ FrameStackReplayBuffer stores just that part.
+*/
+
+namespace tiny_rl
+{
+    class FrameStackEnv : public BaseEnv
+    {
+    public:
+        FrameStackEnv(std::shared_ptr<BaseEnv> env, int stack)
+            : env_(std::move(env)),
+              stack_(checked_stack(stack)),
+              frame_(static_cast<size_t>(env_->state_size())),
+              ring_(2 * stack_ * frame_),
+              head_(0)
+        {
+        }
+
+        std::vector<float> reset() override
+        {
+            std::vector<float> obs(state_size());
+            reset_into(obs.data());
+            return obs;
+        }
+
+        std::tuple<std::vector<float>, float, bool> step(int action) override
+        {
+            std::vector<float> obs(state_size());
+            auto [reward, done] = step_into(action, obs.data());
+            return {std::move(obs), reward, done};
+        }
+
+        std::pair<float, bool> step_into(int action, float *obs) override
+        {
+            head_ = (head_ + 1) % stack_;
+            float *frame = slot(head_);
+            auto result = env_->step_into(action, frame);
+            std::copy(frame, frame + frame_, slot(head_ + stack_));
+            write(obs);
+            return result;
+        }
+
+        void reset_into(float *obs) override
+        {
+            head_ = stack_ - 1;
+            env_->reset_into(slot(0));
+            fill_from(slot(0));
+            write(obs);
+        }
+
+        int state_size() const override
+        {
+            return static_cast<int>(stack_ * frame_);
+        }
+
+        int action_size() const override
+        {
+            return env_->action_size();
+        }
+
+        // Observation width of the wrapped env
+        int frame_size() const
+        {
+            return static_cast<int>(frame_);
+        }
+
+        int stack() const
+        {
+            return static_cast<int>(stack_);
+        }
+
+        EnvSnapshot snapshot() const override
+        {
+            return env_->snapshot();
+        }
+
+        // The snapshot holds no frame history, so the ring restarts as
+        // after a reset, filled with the restored frame
+        std::vector<float> restore(const EnvSnapshot &snap) override
+        {
+            auto frame = env_->restore(snap);
+            head_ = stack_ - 1;
+            fill_from(frame.data());
+            std::vector<float> obs(state_size());
+            write(obs.data());
+            return obs;
+        }
+
+    private:
+        // runs before ring_ is sized from it
+        static size_t checked_stack(int stack)
+        {
+            if (stack < 1)
+                throw std::invalid_argument("FrameStackEnv: stack must be at least 1");
+            return static_cast<size_t>(stack);
+        }
+
+        float *slot(size_t i)
+        {
+            return ring_.data() + i * frame_;
+        }
+
+        void fill_from(const float *frame)
+        {
+            if (frame != slot(0))
+                std::copy(frame, frame + frame_, slot(0));
+            for (size_t i = 1; i < 2 * stack_; ++i)
+                std::copy(slot(0), slot(0) + frame_, slot(i));
+        }
+
+        // slots head+1 .. head+stack hold the frames oldest to newest
+        void write(float *obs)
+        {
+            const float *begin = slot(head_ + 1);
+            std::copy(begin, begin + stack_ * frame_, obs);
+        }
+
+        std::shared_ptr<BaseEnv> env_;
+        size_t stack_;
+        size_t frame_;
+        std::vector<float> ring_; // 2 * stack frames, mirrored
+        size_t head_;             // slot of the newest frame, < stack
+    };
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include "base_env.h"
+#include <vector>
+#include <tuple>
+#include <algorithm>
+
+/*
+ A small deterministic grid world. The agent starts in the top-left
+ corner and has to reach the goal in the bottom-right corner. Every
+ move costs a little, reaching the goal pays out 1.
+*/
+
+namespace tiny_rl
+{
+    class GridWorldEnv : public BaseEnv
+    {
+    public:
+        GridWorldEnv(int width = 5, int height = 5, int max_steps = 100)
+            : width_(width),
+              height_(height),
+              max_steps_(max_steps),
+              x_(0),
+              y_(0),
+              step_(0)
+        {
+        }
+
+        virtual std::vector<float> reset() override
+        {
+            x_ = 0;
+            y_ = 0;
+            step_ = 0;
+            return observation();
+        }
+
+        virtual void reset_into(float *obs) override
+        {
+            x_ = 0;
+            y_ = 0;
+            step_ = 0;
+            write_observation(obs);
+        }
+
+        // Actions: 0 = up, 1 = right, 2 = down, 3 = left
+        virtual std::tuple<std::vector<float>, float, bool> step(int action) override
+        {
+            auto [reward, done] = move(action);
+            return {observation(), reward, done};
+        }
+
+        virtual std::pair<float, bool> step_into(int action, float *obs) override
+        {
+            auto result = move(action);
+            write_observation(obs);
+            return result;
+        }
+
+        virtual int state_size() const override
+        {
+            return 2; // normalized x and y position
+        }
+
+        virtual int action_size() const override
+        {
+            return 4;
+        }
+
+        virtual EnvSnapshot snapshot() const override
+        {
+            EnvSnapshot snap;
+            snap.ints[0] = x_;
+            snap.ints[1] = y_;
+            snap.ints[2] = step_;
+            return snap;
+        }
+
+        virtual std::vector<float> restore(const EnvSnapshot &snap) override
+        {
+            x_ = snap.ints[0];
+            y_ = snap.ints[1];
+            step_ = snap.ints[2];
+            return observation();
+        }
+
+    private:
+        std::pair<float, bool> move(int action)
+        {
+            switch (action)
+            {
+            case 0:
+                y_ = std::max(0, y_ - 1);
+                break;
+            case 1:
+                x_ = std::min(width_ - 1, x_ + 1);
+                break;
+            case 2:
+                y_ = std::min(height_ - 1, y_ + 1);
+                break;
+            case 3:
+                x_ = std::max(0, x_ - 1);
+                break;
+            default:
+                break;
+            }
+            step_++;
+
+            bool at_goal = x_ == width_ - 1 && y_ == height_ - 1;
+            bool done = at_goal || step_ >= max_steps_;
+            float reward = at_goal ? 1.0f : -0.01f;
+            return {reward, done};
+        }
+
+        std::vector<float> observation() const
+        {
+            std::vector<float> obs(2);
+            write_observation(obs.data());
+            return obs;
+        }
+
+        void write_observation(float *obs) const
+        {
+            obs[0] = width_ > 1 ? static_cast<float>(x_) / (width_ - 1) : 0.0f;
+            obs[1] = height_ > 1 ? static_cast<float>(y_) / (height_ - 1) : 0.0f;
+        }
+
+        int width_;
+        int height_;
+        int max_steps_;
+        int x_;
+        int y_;
+        int step_;
+    };
+}
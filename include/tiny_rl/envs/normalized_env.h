@@ -0,0 +1,85 @@
+#pragma once
+#include "base_env.h"
+#include "../core/obs_normalizer.h"
+#include <memory>
+#include <tuple>
+#include <vector>
+
+/*
+ Environment wrapper that passes every observation through an
+ ObservationNormalizer, updating it unless it is frozen. Several wrappers
+ may share one normalizer as long as they are stepped from one thread; for
+ envs stepped in parallel, give StepTrainer the normalizer instead so whole
+ batches are normalized at once.
+*/
+
+namespace tiny_rl
+{
+    class NormalizedEnv : public BaseEnv
+    {
+    public:
+        NormalizedEnv(std::shared_ptr<BaseEnv> env, std::shared_ptr<ObservationNormalizer> normalizer)
+            : env_(std::move(env)), normalizer_(std::move(normalizer))
+        {
+        }
+
+        std::vector<float> reset() override
+        {
+            auto obs = env_->reset();
+            normalizer_->process(obs);
+            return obs;
+        }
+
+        std::tuple<std::vector<float>, float, bool> step(int action) override
+        {
+            auto result = env_->step(action);
+            normalizer_->process(std::get<0>(result));
+            return result;
+        }
+
+        std::pair<float, bool> step_into(int action, float *obs) override
+        {
+            auto result = env_->step_into(action, obs);
+            normalizer_->process(obs, 1);
+            return result;
+        }
+
+        void reset_into(float *obs) override
+        {
+            env_->reset_into(obs);
+            normalizer_->process(obs, 1);
+        }
+
+        int state_size() const override
+        {
+            return env_->state_size();
+        }
+
+        int action_size() const override
+        {
+            return env_->action_size();
+        }
+
+        EnvSnapshot snapshot() const override
+        {
+            return env_->snapshot();
+        }
+
+        // Restored observations are scaled but not counted again
+        std::vector<float> restore(const EnvSnapshot &snap) override
+        {
+            auto obs = env_->restore(snap);
+            normalizer_->normalize(obs.data(), 1);
+            return obs;
+        }
+
+        ObservationNormalizer &normalizer()
+        {
+            return *normalizer_;
+        }
+
+    private:
+        std::shared_ptr<BaseEnv> env_;
+        std::shared_ptr<ObservationNormalizer> normalizer_;
+    };
+}
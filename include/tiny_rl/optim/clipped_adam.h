@@ -1,6 +1,10 @@
 #pragma once
 #include "../external/tiny-dnn/tiny_dnn/optimizers/optimizer.h"
+#include "../utils/profiler.h"
+#include "../utils/thread_pool.h"
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 namespace tiny_rl
 {
@@ -9,33 +13,102 @@ namespace tiny_rl
         explicit clipped_adam(float_t max_norm = float_t(5.0))
             : max_norm_(max_norm) {}
 
+        // Same arithmetic as tiny_dnn::adam::update with the clip scale folded
+        // into the gradient. With `parallelize`, vectors of at least
+        // kParallelMin weights are split over the shared thread pool; the norm
+        // is summed per fixed chunk either way, so results do not depend on
+        // the flag or on the pool size.
         void update(const tiny_dnn::vec_t &dW,
                     tiny_dnn::vec_t &W,
                     bool parallelize) override
         {
+            TINY_RL_PROFILE_SCOPE(kOptimizer);
+            const size_t n = W.size();
+            const size_t chunks = (n + kChunk - 1) / kChunk;
+            ThreadPool *pool = (parallelize && n >= kParallelMin) ? &shared_thread_pool() : nullptr;
 
             // L2-norm of gradient
+            partial_.assign(chunks, float_t(0));
+            auto sum_squares = [&](size_t begin, size_t end)
+            {
+                float_t sq = float_t(0);
+                for (size_t i = begin; i < end; ++i)
+                    sq += dW[i] * dW[i];
+                partial_[begin / kChunk] = sq;
+            };
+            if (pool)
+                pool->parallel_for(n, kChunk, sum_squares);
+            else
+                for (size_t c = 0; c < chunks; ++c)
+                    sum_squares(c * kChunk, std::min(n, (c + 1) * kChunk));
+
             float_t sq = float_t(0);
-            for (float_t g : dW)
-                sq += g * g;
+            for (float_t p : partial_)
+                sq += p;
             float_t norm = std::sqrt(sq);
+            float_t scale = norm > max_norm_ ? max_norm_ / (norm + 1e-8f) : float_t(1);
 
-            if (norm > max_norm_)
+            // moments are looked up before fanning out, the lookup may insert
+            tiny_dnn::vec_t &mt = get<0>(W);
+            tiny_dnn::vec_t &vt = get<1>(W);
+            auto step = [&](size_t begin, size_t end)
             {
-                float_t scale = max_norm_ / (norm + 1e-8f);
-                tiny_dnn::vec_t clipped(dW.size());
-                for (size_t i = 0; i < dW.size(); ++i)
-                    clipped[i] = dW[i] * scale;
-
-                tiny_dnn::adam::update(clipped, W, parallelize);
-            }
+                for (size_t i = begin; i < end; ++i)
+                {
+                    float_t g = dW[i] * scale;
+                    mt[i] = b1 * mt[i] + (float_t(1) - b1) * g;
+                    vt[i] = b2 * vt[i] + (float_t(1) - b2) * g * g;
+                    W[i] -= alpha * (mt[i] / (float_t(1) - b1_t)) / std::sqrt((vt[i] / (float_t(1) - b2_t)) + eps);
+                }
+            };
+            if (pool)
+                pool->parallel_for(n, kChunk, step);
             else
-            {
-                tiny_dnn::adam::update(dW, W, parallelize);
-            }
+                step(0, n);
+
+            b1_t *= b1;
+            b2_t *= b2;
+        }
+
+        // Adam moments of every parameter vector in `net`, flattened in the
+        // same order as flatten_params, for checkpointing
+        template <typename NetT>
+        void export_moments(NetT &net, std::vector<float> &m, std::vector<float> &v)
+        {
+            m.clear();
+            v.clear();
+            for (size_t l = 0; l < net.depth(); ++l)
+                for (auto *w : net[l]->weights())
+                {
+                    const auto &mt = this->template get<0>(*w);
+                    const auto &vt = this->template get<1>(*w);
+                    m.insert(m.end(), mt.begin(), mt.end());
+                    v.insert(v.end(), vt.begin(), vt.end());
+                }
         }
 
+        template <typename NetT>
+        void import_moments(NetT &net, const float *m, const float *v)
+        {
+            size_t k = 0;
+            for (size_t l = 0; l < net.depth(); ++l)
+                for (auto *w : net[l]->weights())
+                {
+                    auto &mt = this->template get<0>(*w);
+                    auto &vt = this->template get<1>(*w);
+                    std::copy(m + k, m + k + w->size(), mt.begin());
+                    std::copy(v + k, v + k + w->size(), vt.begin());
+                    k += w->size();
+                }
+        }
+
+        static constexpr size_t kChunk = 4096;
+        static constexpr size_t kParallelMin = 4 * kChunk;
+
         float_t max_norm_;
+
+    private:
+        std::vector<float_t> partial_;
     };
 
 }
@@ -0,0 +1,607 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../core/flat_policy.h"
+#include "../core/param_snapshot.h"
+#include "../utils/histogram.h"
+
+/*
+ Local policy server. Simulators on the same host connect over a Unix
+ domain socket and send observations; a batcher thread coalesces pending
+ requests into one forward pass of up to max_batch rows, or fewer once the
+ oldest request has waited max_delay_us. Replies carry the greedy action
+ and, if asked for, the full output row (Q-values or action probabilities).
+
+ Wire format, native endianness (same host only):
+   request:  RequestHeader  | float obs[obs_size]
+   response: ResponseHeader | float values[num_values]
+ A request whose obs_size does not match the policy gets action = -1;
+ one larger than kMaxObsSize closes the connection.
+
+ Replies are written only by the batcher, with non-blocking sends: what a
+ slow client has not read yet waits in its connection's output buffer
+ and is flushed as the socket drains, so one stalled client never holds
+ up the others. A client whose backlog passes kMaxPendingBytes is
+ dropped.
+
+ The server can also follow a live ParamPublisher instead of a fixed
+ FlatPolicy: each batch pins the latest snapshot, so weights change between
+ batches without a restart and never in the middle of one.
+*/
+
+namespace tiny_rl
+{
+    namespace serving
+    {
+        enum RequestType : uint32_t
+        {
+            kAction = 1,
+            kValues = 2,
+        };
+
+        struct RequestHeader
+        {
+            uint32_t type;
+            uint32_t obs_size;
+        };
+
+        struct ResponseHeader
+        {
+            int32_t action;
+            uint32_t num_values;
+        };
+
+        // Largest obs_size read off the wire, in floats; anything above is
+        // treated as a corrupt stream rather than drained
+        constexpr uint32_t kMaxObsSize = 1u << 20;
+        // Unread reply bytes a client may fall behind by before it is dropped
+        constexpr size_t kMaxPendingBytes = size_t(1) << 22;
+
+        inline bool read_full(int fd, void *buf, size_t bytes)
+        {
+            char *p = static_cast<char *>(buf);
+            while (bytes > 0)
+            {
+                ssize_t n = ::recv(fd, p, bytes, 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                p += n;
+                bytes -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        inline bool write_full(int fd, const void *buf, size_t bytes)
+        {
+            const char *p = static_cast<const char *>(buf);
+            while (bytes > 0)
+            {
+                ssize_t n = ::send(fd, p, bytes, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                p += n;
+                bytes -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        // Reads and discards `bytes` bytes
+        inline bool skip_full(int fd, size_t bytes)
+        {
+            char sink[4096];
+            while (bytes > 0)
+            {
+                size_t n = std::min(bytes, sizeof(sink));
+                if (!read_full(fd, sink, n))
+                    return false;
+                bytes -= n;
+            }
+            return true;
+        }
+
+        inline sockaddr_un make_address(const std::string &path)
+        {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(addr.sun_path))
+                throw std::invalid_argument("socket path too long: " + path);
+            std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            return addr;
+        }
+    }
+
+    struct PolicyServerConfig
+    {
+        std::string socket_path = "/tmp/tiny_rl_policy.sock";
+        size_t max_batch = 32;
+        int max_delay_us = 500; // longest a request waits for the batch to fill
+    };
+
+    struct PolicyServerStats
+    {
+        uint64_t requests = 0;
+        uint64_t batches = 0;
+        uint64_t latency_p50_us = 0;
+        uint64_t latency_p90_us = 0;
+        uint64_t latency_p99_us = 0;
+        uint64_t latency_max_us = 0;
+        std::vector<uint64_t> batch_sizes; // batch_sizes[n] = number of batches of size n
+    };
+
+    class PolicyServer
+    {
+    public:
+        PolicyServer(const FlatPolicy &policy, PolicyServerConfig config = {})
+            : policy_(&policy),
+              publisher_(nullptr),
+              input_size_(policy.input_size()),
+              num_actions_(policy.num_actions()),
+              config_(std::move(config)),
+              listen_fd_(-1),
+              running_(false),
+              batch_sizes_(config_.max_batch + 1, 0)
+        {
+            check_config();
+        }
+
+        // Serve whatever version `publisher` holds when each batch starts
+        PolicyServer(const ParamPublisher &publisher, PolicyServerConfig config = {})
+            : policy_(nullptr),
+              publisher_(&publisher),
+              input_size_(publisher.input_size()),
+              num_actions_(publisher.num_actions()),
+              config_(std::move(config)),
+              listen_fd_(-1),
+              running_(false),
+              batch_sizes_(config_.max_batch + 1, 0)
+        {
+            check_config();
+        }
+
+        PolicyServer(const PolicyServer &) = delete;
+        PolicyServer &operator=(const PolicyServer &) = delete;
+
+        ~PolicyServer()
+        {
+            stop();
+        }
+
+        void start()
+        {
+            if (running_)
+                return;
+            sockaddr_un addr = serving::make_address(config_.socket_path);
+            ::unlink(config_.socket_path.c_str());
+            listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listen_fd_ < 0)
+                throw std::runtime_error("PolicyServer: socket() failed");
+            if (::bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+                ::listen(listen_fd_, 64) != 0)
+            {
+                ::close(listen_fd_);
+                listen_fd_ = -1;
+                throw std::runtime_error("PolicyServer: cannot listen on " + config_.socket_path);
+            }
+
+            running_ = true;
+            batcher_ = std::thread([this]
+                                   { batch_loop(); });
+            acceptor_ = std::thread([this]
+                                    { accept_loop(); });
+        }
+
+        void stop()
+        {
+            if (!running_.exchange(false))
+                return;
+
+            ::shutdown(listen_fd_, SHUT_RDWR);
+            acceptor_.join();
+            ::close(listen_fd_);
+            listen_fd_ = -1;
+
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex_);
+                for (auto &c : clients_)
+                    ::shutdown(c->fd, SHUT_RDWR);
+            }
+            for (auto &r : readers_)
+                r.thread.join();
+            readers_.clear();
+            clients_.clear();
+
+            queue_cv_.notify_all();
+            batcher_.join();
+            queue_.clear();
+            backlog_.clear();
+            ::unlink(config_.socket_path.c_str());
+        }
+
+        PolicyServerStats stats() const
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            PolicyServerStats s;
+            s.requests = latency_us_.count();
+            s.batches = batches_;
+            s.latency_p50_us = latency_us_.percentile(0.50);
+            s.latency_p90_us = latency_us_.percentile(0.90);
+            s.latency_p99_us = latency_us_.percentile(0.99);
+            s.latency_max_us = latency_us_.max();
+            s.batch_sizes = batch_sizes_;
+            return s;
+        }
+
+    private:
+        // a zero max_batch would leave the batcher taking nothing, forever
+        void check_config() const
+        {
+            if (config_.max_batch == 0)
+                throw std::invalid_argument("PolicyServer: max_batch must be positive");
+            if (config_.max_delay_us < 0)
+                throw std::invalid_argument("PolicyServer: max_delay_us must not be negative");
+        }
+
+        using clock = std::chrono::steady_clock;
+
+        struct Connection
+        {
+            explicit Connection(int fd) : fd(fd) {}
+            ~Connection() { ::close(fd); }
+            int fd;
+            // replies not yet accepted by the socket, batcher thread only
+            std::vector<char> out;
+            size_t out_pos = 0;
+        };
+
+        struct Request
+        {
+            std::shared_ptr<Connection> conn;
+            uint32_t type;
+            std::vector<float> obs; // empty for a rejected request
+            clock::time_point arrived;
+        };
+
+        struct Reader
+        {
+            std::thread thread;
+            bool done = false;
+        };
+
+        void accept_loop()
+        {
+            while (running_)
+            {
+                int fd = ::accept(listen_fd_, nullptr, nullptr);
+                if (fd < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return; // listening socket shut down
+                }
+                reap_readers();
+                auto conn = std::make_shared<Connection>(fd);
+                std::lock_guard<std::mutex> lock(clients_mutex_);
+                clients_.push_back(conn);
+                auto reader = readers_.emplace(readers_.end());
+                reader->thread = std::thread([this, conn, reader]
+                                             { read_loop(conn, reader); });
+            }
+        }
+
+        // Joins the readers of clients that have gone away
+        void reap_readers()
+        {
+            std::list<Reader> finished;
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex_);
+                for (auto it = readers_.begin(); it != readers_.end();)
+                {
+                    auto next = std::next(it);
+                    if (it->done)
+                        finished.splice(finished.end(), readers_, it);
+                    it = next;
+                }
+            }
+            for (auto &r : finished)
+                r.thread.join();
+        }
+
+        // One reader per client; requests from a client are answered in order
+        void read_loop(std::shared_ptr<Connection> conn, std::list<Reader>::iterator self)
+        {
+            serve_client(conn);
+            // the socket closes once queued requests drop their references too
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            clients_.erase(std::remove(clients_.begin(), clients_.end(), conn), clients_.end());
+            self->done = true;
+        }
+
+        void serve_client(const std::shared_ptr<Connection> &conn)
+        {
+            while (running_)
+            {
+                serving::RequestHeader header;
+                if (!serving::read_full(conn->fd, &header, sizeof(header)))
+                    return;
+                if (header.obs_size > serving::kMaxObsSize)
+                    return;
+
+                Request req{conn, header.type, {}, clock::now()};
+                if (header.obs_size == input_size_)
+                {
+                    req.obs.resize(input_size_);
+                    if (!serving::read_full(conn->fd, req.obs.data(), input_size_ * sizeof(float)))
+                        return;
+                }
+                else if (!serving::skip_full(conn->fd, header.obs_size * sizeof(float)))
+                {
+                    return;
+                }
+
+                // rejects queue up too, so only the batcher writes to the socket
+                {
+                    std::lock_guard<std::mutex> lock(queue_mutex_);
+                    queue_.push_back(std::move(req));
+                }
+                queue_cv_.notify_one();
+            }
+        }
+
+        void batch_loop()
+        {
+            FlatScratch scratch;
+            std::vector<Request> batch;
+            std::vector<size_t> rows;
+            std::vector<float> obs;
+            size_t in = input_size_;
+            size_t out = num_actions_;
+            auto max_delay = std::chrono::microseconds(config_.max_delay_us);
+            // how often a backlogged client's socket is retried
+            auto flush_interval = std::chrono::microseconds(200);
+
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(queue_mutex_);
+                    while (running_ && queue_.empty())
+                    {
+                        if (backlog_.empty())
+                        {
+                            queue_cv_.wait(lock);
+                        }
+                        else
+                        {
+                            queue_cv_.wait_for(lock, flush_interval);
+                            lock.unlock();
+                            flush_backlog();
+                            lock.lock();
+                        }
+                    }
+                    if (!running_)
+                        return;
+
+                    // wait for a full batch, but never past the oldest deadline
+                    auto deadline = queue_.front().arrived + max_delay;
+                    queue_cv_.wait_until(lock, deadline, [this]
+                                         { return !running_ || queue_.size() >= config_.max_batch; });
+                    if (!running_)
+                        return;
+
+                    size_t n = std::min(queue_.size(), config_.max_batch);
+                    batch.clear();
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        batch.push_back(std::move(queue_.front()));
+                        queue_.pop_front();
+                    }
+                }
+
+                rows.clear();
+                for (size_t i = 0; i < batch.size(); ++i)
+                    if (!batch[i].obs.empty())
+                        rows.push_back(i);
+                obs.resize(rows.size() * in);
+                for (size_t r = 0; r < rows.size(); ++r)
+                    std::copy(batch[rows[r]].obs.begin(), batch[rows[r]].obs.end(), obs.begin() + r * in);
+
+                // the pinned snapshot must outlive the replies that read `values`
+                ParamPublisher::Ref snapshot;
+                const float *values = nullptr;
+                if (!rows.empty() && publisher_)
+                {
+                    snapshot = publisher_->acquire();
+                    values = snapshot->forward_batch(obs.data(), rows.size(), scratch);
+                }
+                else if (!rows.empty())
+                {
+                    values = policy_->forward_batch(obs.data(), rows.size(), scratch);
+                }
+
+                for (size_t i = 0, r = 0; i < batch.size(); ++i)
+                {
+                    serving::ResponseHeader reply{-1, 0};
+                    const float *row = nullptr;
+                    if (!batch[i].obs.empty())
+                    {
+                        row = values + r++ * out;
+                        reply.action = static_cast<int32_t>(std::max_element(row, row + out) - row);
+                        reply.num_values = batch[i].type == serving::kValues ? static_cast<uint32_t>(out) : 0;
+                    }
+                    send_reply(batch[i].conn, reply, row);
+                }
+                if (!backlog_.empty())
+                    flush_backlog();
+
+                auto now = clock::now();
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                if (!rows.empty())
+                {
+                    ++batches_;
+                    ++batch_sizes_[rows.size()];
+                }
+                for (const auto &req : batch)
+                    latency_us_.record(std::chrono::duration_cast<std::chrono::microseconds>(now - req.arrived).count());
+            }
+        }
+
+        // Appends the reply to the connection's output and sends what the
+        // socket takes without blocking
+        void send_reply(const std::shared_ptr<Connection> &conn, const serving::ResponseHeader &reply, const float *values)
+        {
+            bool idle = conn->out_pos == conn->out.size();
+            if (idle)
+            {
+                conn->out.clear();
+                conn->out_pos = 0;
+            }
+            const char *h = reinterpret_cast<const char *>(&reply);
+            conn->out.insert(conn->out.end(), h, h + sizeof(reply));
+            const char *v = reinterpret_cast<const char *>(values);
+            conn->out.insert(conn->out.end(), v, v + reply.num_values * sizeof(float));
+            if (!flush(*conn))
+                ::shutdown(conn->fd, SHUT_RDWR);
+            else if (idle && conn->out_pos < conn->out.size())
+                backlog_.push_back(conn);
+        }
+
+        // False once the client is gone or too far behind
+        bool flush(Connection &conn)
+        {
+            while (conn.out_pos < conn.out.size())
+            {
+                ssize_t n = ::send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos,
+                                   MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return conn.out.size() - conn.out_pos <= serving::kMaxPendingBytes;
+                if (n <= 0)
+                    return false;
+                conn.out_pos += static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        // Retries backlogged clients whose sockets have room again
+        void flush_backlog()
+        {
+            std::vector<pollfd> fds;
+            for (const auto &c : backlog_)
+                fds.push_back({c->fd, POLLOUT, 0});
+            if (::poll(fds.data(), fds.size(), 0) <= 0)
+                return;
+            size_t kept = 0;
+            for (size_t i = 0; i < backlog_.size(); ++i)
+            {
+                auto &conn = backlog_[i];
+                if (fds[i].revents != 0 && !flush(*conn))
+                    ::shutdown(conn->fd, SHUT_RDWR);
+                else if (conn->out_pos < conn->out.size())
+                    backlog_[kept++] = std::move(conn);
+            }
+            backlog_.resize(kept);
+        }
+
+        const FlatPolicy *policy_;
+        const ParamPublisher *publisher_;
+        size_t input_size_;
+        size_t num_actions_;
+        PolicyServerConfig config_;
+        int listen_fd_;
+        std::atomic<bool> running_;
+
+        std::thread acceptor_;
+        std::thread batcher_;
+        std::mutex clients_mutex_;
+        std::vector<std::shared_ptr<Connection>> clients_;
+        std::list<Reader> readers_;
+
+        std::mutex queue_mutex_;
+        std::condition_variable queue_cv_;
+        std::deque<Request> queue_;
+        std::vector<std::shared_ptr<Connection>> backlog_; // clients with unsent replies, batcher only
+
+        mutable std::mutex stats_mutex_;
+        LogHistogram latency_us_;
+        uint64_t batches_ = 0;
+        std::vector<uint64_t> batch_sizes_;
+    };
+
+    // Blocking client for PolicyServer, one request in flight at a time
+    class PolicyClient
+    {
+    public:
+        explicit PolicyClient(const std::string &socket_path)
+            : fd_(::socket(AF_UNIX, SOCK_STREAM, 0))
+        {
+            if (fd_ < 0)
+                throw std::runtime_error("PolicyClient: socket() failed");
+            sockaddr_un addr = serving::make_address(socket_path);
+            if (::connect(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+            {
+                ::close(fd_);
+                throw std::runtime_error("PolicyClient: cannot connect to " + socket_path);
+            }
+        }
+
+        PolicyClient(const PolicyClient &) = delete;
+        PolicyClient &operator=(const PolicyClient &) = delete;
+
+        ~PolicyClient()
+        {
+            ::close(fd_);
+        }
+
+        int act(const std::vector<float> &obs)
+        {
+            std::vector<float> unused;
+            return request(serving::kAction, obs, unused);
+        }
+
+        // Returns the greedy action and fills `values` with the output row
+        int values(const std::vector<float> &obs, std::vector<float> &values)
+        {
+            return request(serving::kValues, obs, values);
+        }
+
+    private:
+        int request(uint32_t type, const std::vector<float> &obs, std::vector<float> &values)
+        {
+            serving::RequestHeader header{type, static_cast<uint32_t>(obs.size())};
+            if (!serving::write_full(fd_, &header, sizeof(header)) ||
+                !serving::write_full(fd_, obs.data(), obs.size() * sizeof(float)))
+                throw std::runtime_error("PolicyClient: send failed");
+
+            serving::ResponseHeader reply;
+            if (!serving::read_full(fd_, &reply, sizeof(reply)))
+                throw std::runtime_error("PolicyClient: connection closed");
+            values.resize(reply.num_values);
+            if (reply.num_values > 0 && !serving::read_full(fd_, values.data(), reply.num_values * sizeof(float)))
+                throw std::runtime_error("PolicyClient: connection closed");
+            return reply.action;
+        }
+
+        int fd_;
+    };
+}
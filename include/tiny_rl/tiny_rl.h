@@ -3,17 +3,39 @@
 // core
 #include "core/replay_buffer.h"
 #include "core/q_network.h"
+#include "core/flat_policy.h"
+#include "core/param_snapshot.h"
+#include "core/data_parallel.h"
+#include "core/shm_replay.h"
+#include "core/offline_dataset.h"
+#include "core/obs_normalizer.h"
+#include "core/obs_pool.h"
+#include "core/frame_stack_replay.h"
 
 // agents
 #include "agents/base_agent.h"
 #include "agents/dqn_agent.h"
+#include "agents/static_dqn_agent.h"
 #include "utils/config.h"
+#include "utils/thread_pool.h"
+#include "utils/profiler.h"
+#include "utils/logger.h"
+#include "utils/arena.h"
 
 // trainers
 #include "trainers/base_trainer.h"
 #include "trainers/dqn_trainer.h"
+#include "trainers/actor_learner_dqn_trainer.h"
+#include "trainers/throughput_tuner.h"
+#include "trainers/async_evaluator.h"
+#include "trainers/population_trainer.h"
+#include "trainers/step_trainer.h"
+#include "trainers/multi_process_dqn_trainer.h"
 
 // envs
 #include "envs/gridworld.h"
 #include "envs/cartpole.h"
+#include "envs/env_fork.h"
+#include "envs/normalized_env.h"
+#include "envs/frame_stack_env.h"
 
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <tuple>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include "base_trainer.h"
+#include "async_evaluator.h"
+#include "../agents/dqn_agent.h"
+#include "../core/param_snapshot.h"
+#include "../envs/base_env.h"
+#include "../utils/config.h"
+#include "../utils/logger.h"
+#include "../utils/thread_pool.h"
+#include "tiny_dnn/tiny_dnn.h"
+
+/*
+ Decoupled actor/learner training for DQN. Actor threads step their own
+ environments and select actions on the latest parameter snapshot, which
+ the learner publishes every publish_interval gradient steps through a
+ lock-free ParamPublisher. The calling thread is the learner: it trains
+ continuously on the shared replay buffer, throttled to replay_ratio
+ updates per env step.
+
+ Actors are long-running loops, so they get their own threads rather than
+ pool tasks; actor_cpus and learner_cpu pin them so they neither migrate
+ across sockets nor share cores with the pool workers.
+*/
+
+namespace tiny_rl
+{
+    struct ActorLearnerStats
+    {
+        size_t env_steps = 0;
+        size_t grad_steps = 0;
+        size_t episodes = 0;
+        double elapsed_sec = 0.0;
+        double actor_steps_per_sec = 0.0;
+        double learner_steps_per_sec = 0.0;
+        double learner_busy_sec = 0.0;      // time the learner spent in train_step()
+        double learner_utilization = 0.0;   // learner_busy_sec / elapsed_sec
+    };
+
+    class ActorLearnerDQNTrainer : public BaseTrainer
+    {
+    public:
+        using EnvFactory = std::function<std::shared_ptr<BaseEnv>()>;
+
+        ActorLearnerDQNTrainer(DQNAgent &agent,
+                               EnvFactory env_factory,
+                               ActorLearnerConfig config = {})
+            : BaseTrainer(agent, env_factory()),
+              agent_(agent),
+              env_factory_(std::move(env_factory)),
+              config_(config),
+              publisher_(agent.network().get_net()),
+              stop_(false),
+              publish_pending_(false),
+              evaluator_(nullptr),
+              episodes_done_(0),
+              grad_steps_(0)
+        {
+            if (config_.publish_interval <= 0)
+                throw std::invalid_argument("ActorLearnerDQNTrainer: publish_interval must be positive");
+        }
+
+        // Run until `episodes` episodes have finished across all actors
+        void train(int episodes) override
+        {
+            run(static_cast<size_t>(std::max(episodes, 0)), 0.0);
+        }
+
+        // Run for a fixed wall-clock time, however many episodes that takes
+        void train_for(double seconds)
+        {
+            run(std::numeric_limits<size_t>::max(), seconds);
+        }
+
+        // The learner hands snapshots of the online network to `evaluator`
+        // every interval_steps env steps (nullptr stops evaluating)
+        void evaluate_with(AsyncEvaluator *evaluator)
+        {
+            evaluator_ = evaluator;
+        }
+
+        const ActorLearnerStats &stats() const
+        {
+            return stats_;
+        }
+
+    private:
+        void run(size_t episodes, double seconds)
+        {
+            stop_ = false;
+            episodes_done_ = 0;
+            grad_steps_ = 0;
+            learner_busy_ = std::chrono::steady_clock::duration::zero();
+            size_t start_env_steps = agent_.env_steps();
+            size_t learn_start = static_cast<size_t>(agent_.get_config().learn_start);
+
+            publisher_.publish(agent_.network().get_net());
+
+            std::vector<int> caller_cpus;
+            if (config_.learner_cpu >= 0)
+            {
+                caller_cpus = thread_affinity();
+                set_thread_affinity({config_.learner_cpu});
+            }
+
+            std::vector<std::thread> actors;
+            int num_actors = std::max(1, config_.num_actors);
+            for (int i = 0; i < num_actors; ++i)
+            {
+                auto env_i = i == 0 ? env : env_factory_();
+                actors.emplace_back([this, env_i, i]
+                                    { actor_loop(env_i, static_cast<unsigned>(i)); });
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                        std::chrono::duration<double>(seconds));
+            size_t next_report = config_.report_interval;
+
+            while (episodes_done_ < episodes && (seconds <= 0.0 || std::chrono::steady_clock::now() < deadline))
+            {
+                size_t steps = agent_.env_steps() - start_env_steps;
+                bool throttled = config_.replay_ratio > 0.0f &&
+                                 grad_steps_ >= config_.replay_ratio * (steps > learn_start ? steps - learn_start : 0);
+                if (steps < learn_start || throttled || !timed_train_step())
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+                else if (++grad_steps_ % config_.publish_interval == 0 || publish_pending_)
+                {
+                    // retried next step if every back buffer is still pinned
+                    publish_pending_ = !publisher_.publish(agent_.network().get_net());
+                }
+                if (evaluator_)
+                    evaluator_->maybe_evaluate(agent_.env_steps());
+
+                if (config_.report_interval > 0 && episodes_done_ >= next_report)
+                {
+                    report(start, start_env_steps);
+                    // actors can cross several intervals per iteration; report once
+                    next_report = (episodes_done_ / config_.report_interval + 1) * config_.report_interval;
+                }
+            }
+
+            stop_ = true;
+            for (auto &t : actors)
+                t.join();
+            if (!caller_cpus.empty())
+                set_thread_affinity(caller_cpus);
+
+            stats_ = snapshot_stats(start, start_env_steps);
+        }
+
+        bool timed_train_step()
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            bool trained = agent_.train_step();
+            learner_busy_ += std::chrono::steady_clock::now() - t0;
+            return trained;
+        }
+
+        void actor_loop(std::shared_ptr<BaseEnv> actor_env, unsigned id)
+        {
+            if (!config_.actor_cpus.empty())
+                set_thread_affinity({config_.actor_cpus[id % config_.actor_cpus.size()]});
+
+            FlatScratch scratch;
+            std::mt19937 rng(std::random_device{}() + id);
+            std::uniform_real_distribution<float> coin(0, 1);
+            std::uniform_int_distribution<int> pick(0, actor_env->action_size() - 1);
+            const DQNConfig &cfg = agent_.get_config();
+            float epsilon = cfg.epsilon;
+
+            // the env writes into these; state buffers are handed to the
+            // replay buffer, which returns evicted ones in exchange
+            tiny_dnn::vec_t state(actor_env->state_size());
+            tiny_dnn::vec_t next_state(actor_env->state_size());
+            actor_env->reset_into(state.data());
+            float total_reward = 0.0f;
+
+            while (!stop_)
+            {
+                int action;
+                if (coin(rng) < epsilon)
+                {
+                    action = pick(rng);
+                }
+                else
+                {
+                    TINY_RL_PROFILE_SCOPE(kSelectAction);
+                    action = publisher_.acquire()->act(state.data(), scratch);
+                }
+
+                auto [reward, terminal] = step_env(*actor_env, action, next_state.data());
+                agent_.store_experience(std::move(state), action, reward, next_state, terminal);
+                total_reward += reward;
+
+                if (terminal)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(report_mutex_);
+                        reward_sum_ += total_reward;
+                        ++reward_count_;
+                    }
+                    log_metric(Metric::kEpisodeReward, ++episodes_done_, total_reward);
+                    epsilon = std::max(cfg.epsilon_min, epsilon * cfg.epsilon_decay);
+                    total_reward = 0.0f;
+                    actor_env->reset_into(state.data());
+                }
+                else
+                {
+                    state.swap(next_state);
+                }
+            }
+        }
+
+        ActorLearnerStats snapshot_stats(std::chrono::steady_clock::time_point start, size_t start_env_steps) const
+        {
+            ActorLearnerStats s;
+            s.env_steps = agent_.env_steps() - start_env_steps;
+            s.grad_steps = grad_steps_;
+            s.episodes = episodes_done_;
+            s.elapsed_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            s.learner_busy_sec = std::chrono::duration<double>(learner_busy_).count();
+            if (s.elapsed_sec > 0.0)
+            {
+                s.actor_steps_per_sec = s.env_steps / s.elapsed_sec;
+                s.learner_steps_per_sec = s.grad_steps / s.elapsed_sec;
+                s.learner_utilization = s.learner_busy_sec / s.elapsed_sec;
+            }
+            return s;
+        }
+
+        void report(std::chrono::steady_clock::time_point start, size_t start_env_steps)
+        {
+            float avg_reward;
+            {
+                std::lock_guard<std::mutex> lock(report_mutex_);
+                avg_reward = reward_count_ > 0 ? reward_sum_ / reward_count_ : 0.0f;
+                reward_sum_ = 0.0f;
+                reward_count_ = 0;
+            }
+            auto s = snapshot_stats(start, start_env_steps);
+            std::cout << "Episode: " << s.episodes
+                      << " average reward: " << avg_reward
+                      << " actor steps/s: " << s.actor_steps_per_sec
+                      << " learner steps/s: " << s.learner_steps_per_sec
+                      << "\n";
+            TINY_RL_PROFILE_REPORT(std::cout);
+        }
+
+        DQNAgent &agent_;
+        EnvFactory env_factory_;
+        ActorLearnerConfig config_;
+        ParamPublisher publisher_;
+
+        std::atomic<bool> stop_;
+        bool publish_pending_;
+        AsyncEvaluator *evaluator_;
+
+        std::atomic<size_t> episodes_done_;
+        size_t grad_steps_;
+        std::chrono::steady_clock::duration learner_busy_{};
+        std::mutex report_mutex_;
+        float reward_sum_ = 0.0f;
+        size_t reward_count_ = 0;
+        ActorLearnerStats stats_;
+    };
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "../core/flat_policy.h"
+#include "../core/param_snapshot.h"
+#include "../core/tensor_utils.h"
+#include "../envs/base_env.h"
+#include "../utils/config.h"
+#include "../utils/logger.h"
+
+/*
+ Greedy evaluation of frozen weight snapshots on background threads.
+
+ The training thread calls maybe_evaluate(env_steps) (the trainers do this
+ once they are given an evaluator); every interval_steps it copies the
+ online network into a ParamPublisher slot, which is a flat memcpy, and
+ returns. num_threads evaluation threads, each with its own env from the
+ factory, then split the round's episodes between them and play them
+ greedily on that snapshot, so the learner keeps training and the numbers
+ describe one fixed set of weights. While a round is still running a new
+ snapshot is skipped rather than queued.
+
+ When the last episode of a round finishes, mean and 10th/50th/90th
+ percentile returns go out through log_metric() with the env step count of
+ the snapshot, and last_result() holds the full summary. Envs that
+ normalize observations should do so with frozen statistics.
+*/
+
+namespace tiny_rl
+{
+    struct EvaluationResult
+    {
+        uint64_t step = 0;    // env steps when the snapshot was taken
+        uint64_t version = 0; // snapshot version within this evaluator
+        int episodes = 0;
+        float mean = 0.0f;
+        float stddev = 0.0f;
+        float min = 0.0f;
+        float p10 = 0.0f;
+        float p50 = 0.0f;
+        float p90 = 0.0f;
+        float max = 0.0f;
+        double mean_length = 0.0;
+        double seconds = 0.0; // wall time of the round
+    };
+
+    class AsyncEvaluator
+    {
+    public:
+        using EnvFactory = std::function<std::shared_ptr<BaseEnv>()>;
+
+        // `net` is read only from the thread that calls evaluate() and
+        // maybe_evaluate(), which must be the one that trains it
+        AsyncEvaluator(Net &net, EnvFactory env_factory, EvaluationConfig config = {})
+            : net_(net),
+              config_(config),
+              publisher_(net),
+              next_due_(static_cast<uint64_t>(std::max(config.interval_steps, 0))),
+              busy_(false),
+              stop_(false),
+              generation_(0),
+              next_episode_(0),
+              remaining_threads_(0),
+              completed_(0)
+        {
+            if (config_.episodes <= 0 || config_.max_episode_steps <= 0)
+                throw std::invalid_argument("AsyncEvaluator: episodes and max_episode_steps must be positive");
+
+            size_t n = static_cast<size_t>(std::max(config_.num_threads, 1));
+            for (size_t i = 0; i < n; ++i)
+            {
+                envs_.push_back(env_factory());
+                if (static_cast<size_t>(envs_.back()->state_size()) != publisher_.input_size() ||
+                    static_cast<size_t>(envs_.back()->action_size()) != publisher_.num_actions())
+                    throw std::invalid_argument("AsyncEvaluator: env does not match the network's input or output size");
+            }
+            returns_.resize(config_.episodes);
+            lengths_.resize(config_.episodes);
+            for (size_t i = 0; i < n; ++i)
+                threads_.emplace_back([this, i]
+                                      { worker(i); });
+        }
+
+        AsyncEvaluator(const AsyncEvaluator &) = delete;
+        AsyncEvaluator &operator=(const AsyncEvaluator &) = delete;
+
+        // Abandons a running round once its current episodes end; its
+        // partial returns are neither logged nor kept
+        ~AsyncEvaluator()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            start_cv_.notify_all();
+            for (auto &t : threads_)
+                t.join();
+        }
+
+        // Starts a round once `step` reaches the next interval boundary;
+        // never waits. A round that cannot start yet is retried next call.
+        bool maybe_evaluate(uint64_t step)
+        {
+            if (config_.interval_steps <= 0 || step < next_due_)
+                return false;
+            if (!evaluate(step))
+                return false;
+            next_due_ = step + static_cast<uint64_t>(config_.interval_steps);
+            return true;
+        }
+
+        // Snapshots the network now and plays the round in the background.
+        // Returns false, taking no snapshot, while a round is still running.
+        bool evaluate(uint64_t step)
+        {
+            if (busy_.load(std::memory_order_acquire))
+                return false;
+            if (!publisher_.publish(net_))
+                return false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                snapshot_ = publisher_.acquire();
+                round_step_ = step;
+                round_start_ = std::chrono::steady_clock::now();
+                next_episode_.store(0);
+                remaining_threads_.store(static_cast<int>(threads_.size()));
+                busy_.store(true, std::memory_order_release);
+                ++generation_;
+            }
+            start_cv_.notify_all();
+            return true;
+        }
+
+        // Blocks until the running round, if any, has been published
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cv_.wait(lock, [this]
+                          { return !busy_.load(std::memory_order_acquire); });
+        }
+
+        bool busy() const
+        {
+            return busy_.load(std::memory_order_acquire);
+        }
+
+        // Summary of the latest finished round
+        EvaluationResult last_result() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return last_;
+        }
+
+        // Rounds finished so far
+        size_t completed() const
+        {
+            return completed_.load();
+        }
+
+        const EvaluationConfig &config() const
+        {
+            return config_;
+        }
+
+    private:
+        void worker(size_t id)
+        {
+            BaseEnv &env = *envs_[id];
+            FlatScratch scratch;
+            std::vector<float> obs(env.state_size());
+            uint64_t seen = 0;
+            while (true)
+            {
+                const ParamSnapshot *snapshot;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    start_cv_.wait(lock, [&]
+                                   { return stop_ || generation_ != seen; });
+                    if (stop_)
+                        return;
+                    seen = generation_;
+                    snapshot = &*snapshot_;
+                }
+
+                int e;
+                while ((e = next_episode_.fetch_add(1)) < config_.episodes && !stop_)
+                    play(env, *snapshot, obs.data(), scratch, static_cast<size_t>(e));
+                if (remaining_threads_.fetch_sub(1) == 1)
+                    finish();
+            }
+        }
+
+        void play(BaseEnv &env, const ParamSnapshot &snapshot, float *obs, FlatScratch &scratch, size_t episode)
+        {
+            env.reset_into(obs);
+            float total = 0.0f;
+            int steps = 0;
+            while (steps < config_.max_episode_steps)
+            {
+                auto [reward, done] = env.step_into(snapshot.act(obs, scratch), obs);
+                total += reward;
+                ++steps;
+                if (done)
+                    break;
+            }
+            returns_[episode] = total;
+            lengths_[episode] = steps;
+        }
+
+        // Runs on whichever thread ended the round last
+        void finish()
+        {
+            if (stop_)
+            {
+                // an abandoned round has unplayed episodes; publish nothing
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    snapshot_ = ParamPublisher::Ref();
+                    busy_.store(false, std::memory_order_release);
+                }
+                done_cv_.notify_all();
+                return;
+            }
+
+            std::vector<float> sorted(returns_);
+            std::sort(sorted.begin(), sorted.end());
+            double sum = 0.0, sum_sq = 0.0, length = 0.0;
+            for (size_t i = 0; i < sorted.size(); ++i)
+            {
+                sum += sorted[i];
+                sum_sq += static_cast<double>(sorted[i]) * sorted[i];
+                length += lengths_[i];
+            }
+            double n = static_cast<double>(sorted.size());
+
+            EvaluationResult r;
+            r.episodes = static_cast<int>(sorted.size());
+            r.mean = static_cast<float>(sum / n);
+            r.stddev = static_cast<float>(std::sqrt(std::max(sum_sq / n - (sum / n) * (sum / n), 0.0)));
+            r.min = sorted.front();
+            r.max = sorted.back();
+            r.p10 = percentile(sorted, 0.10);
+            r.p50 = percentile(sorted, 0.50);
+            r.p90 = percentile(sorted, 0.90);
+            r.mean_length = length / n;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                r.step = round_step_;
+                r.version = snapshot_->version;
+                r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - round_start_).count();
+            }
+
+            // before the round counts as done, so wait() also covers the records
+            log_metric(Metric::kEvalReturnMean, r.step, r.mean);
+            log_metric(Metric::kEvalReturnP10, r.step, r.p10);
+            log_metric(Metric::kEvalReturnP50, r.step, r.p50);
+            log_metric(Metric::kEvalReturnP90, r.step, r.p90);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                last_ = r;
+                snapshot_ = ParamPublisher::Ref(); // unpin the slot
+                completed_.fetch_add(1);
+                busy_.store(false, std::memory_order_release);
+            }
+            done_cv_.notify_all();
+        }
+
+        // Linear interpolation between the closest ranks
+        static float percentile(const std::vector<float> &sorted, double q)
+        {
+            double pos = q * (sorted.size() - 1);
+            size_t lo = static_cast<size_t>(pos);
+            size_t hi = std::min(lo + 1, sorted.size() - 1);
+            double frac = pos - lo;
+            return static_cast<float>(sorted[lo] + (sorted[hi] - sorted[lo]) * frac);
+        }
+
+        Net &net_;
+        EvaluationConfig config_;
+        ParamPublisher publisher_;
+        uint64_t next_due_; // training thread only
+
+        std::vector<std::shared_ptr<BaseEnv>> envs_;
+        std::vector<std::thread> threads_;
+        std::vector<float> returns_; // one slot per episode of the round
+        std::vector<int> lengths_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable start_cv_;
+        std::condition_variable done_cv_;
+        ParamPublisher::Ref snapshot_;
+        uint64_t round_step_ = 0;
+        std::chrono::steady_clock::time_point round_start_;
+        EvaluationResult last_;
+
+        std::atomic<bool> busy_;
+        std::atomic<bool> stop_;
+        uint64_t generation_;
+        std::atomic<int> next_episode_;
+        std::atomic<int> remaining_threads_;
+        std::atomic<size_t> completed_;
+    };
+}
@@ -1,8 +1,12 @@
 #pragma once
 #include <memory>
 #include <iostream>
+#include <tuple>
+#include <utility>
+#include <vector>
 #include "../envs/base_env.h"
 #include "../agents/base_agent.h"
+#include "../utils/profiler.h"
 
 namespace tiny_rl
 {
@@ -17,6 +21,20 @@ namespace tiny_rl
         virtual void train(int episodes) = 0;
 
     protected:
+        // env.step(action), timed as the env_step phase when profiling
+        static std::tuple<std::vector<float>, float, bool> step_env(BaseEnv &env, int action)
+        {
+            TINY_RL_PROFILE_SCOPE(kEnvStep);
+            return env.step(action);
+        }
+
+        // Same, writing the observation into `obs` instead of a new vector
+        static std::pair<float, bool> step_env(BaseEnv &env, int action, float *obs)
+        {
+            TINY_RL_PROFILE_SCOPE(kEnvStep);
+            return env.step_into(action, obs);
+        }
+
         BaseAgent &agent;
         std::shared_ptr<BaseEnv> env;
     };
@@ -8,8 +8,11 @@
 #include <mutex>
 #include <condition_variable>
 #include "base_trainer.h"
+#include "async_evaluator.h"
 #include "../agents/dqn_agent.h"
+#include "../core/offline_dataset.h"
 #include "../envs/base_env.h"
+#include "../utils/logger.h"
 #include "tiny_dnn/tiny_dnn.h"
 
 namespace tiny_rl
@@ -19,7 +22,20 @@ namespace tiny_rl
     public:
         DQNTrainer(DQNAgent &agent,
                    std::shared_ptr<BaseEnv> env)
-            : BaseTrainer(agent, env), agent_(agent), paused_(false) {}
+            : BaseTrainer(agent, env), agent_(agent), recorder_(nullptr), evaluator_(nullptr), paused_(false) {}
+
+        // Also append every transition to `recorder` (nullptr stops recording)
+        void record_to(TransitionRecorder *recorder)
+        {
+            recorder_ = recorder;
+        }
+
+        // Hand snapshots of the online network to `evaluator` every
+        // interval_steps env steps (nullptr stops evaluating)
+        void evaluate_with(AsyncEvaluator *evaluator)
+        {
+            evaluator_ = evaluator;
+        }
 
         // Run episodes
         void train(int episodes) override
@@ -31,13 +47,17 @@ namespace tiny_rl
             std::thread input_thread([this, &stop_input_thread]()
                                      { this->monitor_input(stop_input_thread); });
 
+            // the env writes into these in place; store_experience() takes
+            // the state buffer and hands back a recycled one of the same size
+            tiny_dnn::vec_t state(env->state_size());
+            tiny_dnn::vec_t next_state(env->state_size());
+
             for (int ep = 1; ep <= episodes; ++ep)
             {
                 // Check if paused before starting a new episode
                 check_pause_status();
 
-                auto raw_state = env->reset();
-                tiny_dnn::vec_t state(raw_state.begin(), raw_state.end());
+                env->reset_into(state.data());
 
                 float total_reward = 0.0f;
                 bool done = false;
@@ -45,24 +65,29 @@ namespace tiny_rl
                 while (!done)
                 {
                     int action = agent_.select_action(state);
-                    auto [next_raw_state, reward, terminal] = env->step(action);
-                    tiny_dnn::vec_t next_state(next_raw_state.begin(), next_raw_state.end());
+                    auto [reward, terminal] = step_env(*env, action, next_state.data());
 
-                    agent_.store_experience(state, action, reward, next_state, terminal);
+                    if (recorder_)
+                        recorder_->record(state, action, reward, next_state, terminal);
+                    agent_.store_experience(std::move(state), action, reward, next_state, terminal);
                     agent_.learn();
+                    if (evaluator_)
+                        evaluator_->maybe_evaluate(agent_.env_steps());
 
-                    state = std::move(next_state);
+                    state.swap(next_state);
                     total_reward += reward;
                     done = terminal;
                 }
                 agent_.on_episode_end();
+                log_metric(Metric::kEpisodeReward, ep, total_reward);
                 avg_reward_100 += total_reward;
 
                 if (ep % 100 == 0)
                 {
                     std::cout << "Episode: " << ep
                               << " average reward: " << avg_reward_100 / 100
-                              << std::endl;
+                              << "\n";
+                    TINY_RL_PROFILE_REPORT(std::cout);
 
                     avg_reward_100 = 0.0f;
                 }
@@ -78,6 +103,8 @@ namespace tiny_rl
 
     private:
         DQNAgent &agent_;
+        TransitionRecorder *recorder_;
+        AsyncEvaluator *evaluator_;
         std::atomic<bool> paused_;
         std::mutex pause_mutex_;
         std::condition_variable pause_cv_;
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "base_trainer.h"
+#include "../agents/dqn_agent.h"
+#include "../core/flat_policy.h"
+#include "../core/shm_replay.h"
+#include "../envs/base_env.h"
+#include "../utils/config.h"
+#include "../utils/process_launcher.h"
+#include "tiny_dnn/tiny_dnn.h"
+
+/*
+ DQN with actors in separate processes, so a crashing environment takes
+ down one actor instead of the run. The calling process is the replay
+ server and the learner: it owns a ShmReplay arena, forks num_actors actor
+ processes into it, and trains on batches sampled in place from the arena.
+ Actors act on flat weights the learner republishes every
+ publish_interval gradient steps; crashed actors are restarted.
+
+ The actors are forked by a spawner process that train() forks first,
+ before the learner runs anything, and that never starts a thread. It
+ restarts crashed actors and counts them in the arena. A fork from the
+ learner mid-run could copy a mutex held by one of its pool, logger or
+ evaluator threads into the child, which would then deadlock.
+*/
+
+namespace tiny_rl
+{
+    struct MultiProcessStats
+    {
+        size_t env_steps = 0;
+        size_t grad_steps = 0;
+        size_t episodes = 0;
+        size_t actor_crashes = 0;
+        double elapsed_sec = 0.0;
+        double actor_steps_per_sec = 0.0;
+        double learner_steps_per_sec = 0.0;
+    };
+
+    class MultiProcessDQNTrainer : public BaseTrainer
+    {
+    public:
+        using EnvFactory = std::function<std::shared_ptr<BaseEnv>()>;
+
+        // env_factory runs inside each actor process
+        MultiProcessDQNTrainer(DQNAgent &agent, EnvFactory env_factory, MultiProcessConfig config = {})
+            : BaseTrainer(agent, env_factory()),
+              agent_(agent),
+              env_factory_(std::move(env_factory)),
+              config_(std::move(config)),
+              bytes_(0)
+        {
+            if (config_.publish_interval <= 0)
+                throw std::invalid_argument("MultiProcessDQNTrainer: publish_interval must be positive");
+            append_flat_layout(agent_.network().get_net(), layers_, bytes_);
+            void *p = nullptr;
+            if (posix_memalign(&p, flat::kAlign, std::max<uint64_t>(bytes_, flat::kAlign)) != 0)
+                throw std::bad_alloc();
+            params_ = static_cast<char *>(p);
+        }
+
+        ~MultiProcessDQNTrainer()
+        {
+            std::free(params_);
+        }
+
+        // Run until `episodes` episodes have finished across all actors
+        void train(int episodes) override
+        {
+            ShmReplay replay(config_.shm_name, config_.capacity, env->state_size(), bytes_);
+            publish(replay);
+
+            // the spawner forks and restarts the actors, see above
+            ProcessLauncher launcher([this, &replay](int)
+                                     { return spawner_main(replay); });
+            launcher.spawn(1);
+
+            const DQNConfig &cfg = agent_.get_config();
+            size_t learn_start = std::max<size_t>(cfg.learn_start, cfg.batch_size);
+            std::mt19937 rng(std::random_device{}());
+            SampledBatch batch;
+            size_t grad_steps = 0;
+            size_t reported = 0;
+            auto start = std::chrono::steady_clock::now();
+
+            while (replay.episodes() < static_cast<uint64_t>(episodes))
+            {
+                launcher.poll(false);
+                if (launcher.running() == 0)
+                    break; // every actor is gone, or the spawner itself died
+
+                size_t steps = replay.transitions();
+                bool throttled = config_.replay_ratio > 0.0f &&
+                                 grad_steps >= config_.replay_ratio * (steps > learn_start ? steps - learn_start : 0);
+                if (steps < learn_start || throttled || !replay.sample_batch(batch, cfg.batch_size, rng))
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+                else
+                {
+                    agent_.train_step(batch);
+                    if (++grad_steps % config_.publish_interval == 0)
+                        publish(replay);
+                }
+
+                if (config_.report_interval > 0 && replay.episodes() >= reported + config_.report_interval)
+                {
+                    stats_ = snapshot_stats(replay, grad_steps, start);
+                    double avg_reward = replay.take_reward_sum() / (stats_.episodes - reported);
+                    std::cout << "Episode: " << stats_.episodes
+                              << " average reward: " << avg_reward
+                              << " actor steps/s: " << stats_.actor_steps_per_sec
+                              << " learner steps/s: " << stats_.learner_steps_per_sec
+                              << " actor crashes: " << stats_.actor_crashes
+                              << "\n";
+                    TINY_RL_PROFILE_REPORT(std::cout); // learner process only
+                    reported = stats_.episodes;
+                }
+            }
+
+            replay.request_stop();
+            // long enough for the spawner to join its own actors first
+            launcher.join(std::chrono::milliseconds(4000));
+            stats_ = snapshot_stats(replay, grad_steps, start);
+        }
+
+        const MultiProcessStats &stats() const
+        {
+            return stats_;
+        }
+
+    private:
+        void publish(ShmReplay &replay)
+        {
+            write_flat_weights(agent_.network().get_net(), layers_.data(), params_);
+            replay.publish_params(params_);
+        }
+
+        // Runs in the spawner process, which has no other threads, so its
+        // forks are safe at any time; exits once stopped or, without
+        // respawning, once every actor has exited
+        int spawner_main(ShmReplay &replay)
+        {
+            ProcessLauncher actors([this, &replay](int id)
+                                   { return actor_main(replay, id); });
+            actors.spawn(std::max(1, config_.num_actors));
+            while (!replay.stop_requested() && actors.running() > 0)
+            {
+                replay.count_crashes(actors.poll(config_.respawn_actors));
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            actors.join();
+            return 0;
+        }
+
+        // Runs in the forked actor
+        int actor_main(ShmReplay &replay, int id)
+        {
+            auto actor_env = env_factory_();
+            std::vector<char> local(bytes_ + flat::kAlign);
+            char *weights = reinterpret_cast<char *>(flat::align_up(reinterpret_cast<uintptr_t>(local.data())));
+            uint64_t seen = 0;
+            FlatScratch scratch;
+
+            std::mt19937 rng(std::random_device{}() + id);
+            std::uniform_real_distribution<float> coin(0, 1);
+            std::uniform_int_distribution<int> pick(0, actor_env->action_size() - 1);
+            const DQNConfig &cfg = agent_.get_config();
+            float epsilon = cfg.epsilon;
+            size_t num_actions = layers_.back().out;
+
+            std::vector<float> state(actor_env->state_size());
+            std::vector<float> next_state(actor_env->state_size());
+            actor_env->reset_into(state.data());
+            float total_reward = 0.0f;
+
+            while (!replay.stop_requested())
+            {
+                replay.fetch_params(weights, seen);
+
+                int action;
+                if (seen == 0 || coin(rng) < epsilon)
+                {
+                    action = pick(rng);
+                }
+                else
+                {
+                    const float *q = flat_forward(layers_.data(), layers_.size(), weights, state.data(), scratch);
+                    action = static_cast<int>(std::max_element(q, q + num_actions) - q);
+                }
+
+                auto [reward, terminal] = step_env(*actor_env, action, next_state.data());
+                replay.add(state.data(), action, reward, next_state.data(), terminal);
+                total_reward += reward;
+
+                if (terminal)
+                {
+                    replay.end_episode(total_reward);
+                    epsilon = std::max(cfg.epsilon_min, epsilon * cfg.epsilon_decay);
+                    total_reward = 0.0f;
+                    actor_env->reset_into(state.data());
+                }
+                else
+                {
+                    state.swap(next_state);
+                }
+            }
+            return 0;
+        }
+
+        MultiProcessStats snapshot_stats(const ShmReplay &replay, size_t grad_steps,
+                                         std::chrono::steady_clock::time_point start) const
+        {
+            MultiProcessStats s;
+            s.env_steps = replay.transitions();
+            s.grad_steps = grad_steps;
+            s.episodes = replay.episodes();
+            s.actor_crashes = replay.actor_crashes();
+            s.elapsed_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (s.elapsed_sec > 0.0)
+            {
+                s.actor_steps_per_sec = s.env_steps / s.elapsed_sec;
+                s.learner_steps_per_sec = s.grad_steps / s.elapsed_sec;
+            }
+            return s;
+        }
+
+        DQNAgent &agent_;
+        EnvFactory env_factory_;
+        MultiProcessConfig config_;
+        std::vector<FlatLayerDesc> layers_;
+        uint64_t bytes_;
+        char *params_;
+        MultiProcessStats stats_;
+    };
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+#include "../agents/dqn_agent.h"
+#include "../core/q_network.h"
+#include "../core/tensor_utils.h"
+#include "../envs/base_env.h"
+#include "../utils/config.h"
+#include "../utils/profiler.h"
+#include "../utils/thread_pool.h"
+
+/*
+ Hyperparameter sweeps and population-based training for DQN in one
+ process. Each member is a DQNAgent with its own networks, replay buffer
+ and env, built from one DQNConfig of the sweep. Instead of one process
+ (and a full set of threads) per config, members are time-sliced on the
+ shared thread pool: every round each member runs slice_steps env steps,
+ one pool task per member, and the round ends when all of them have. No
+ member gets ahead of the others, and the pool hands out members as cores
+ free up, so cheap and expensive configs share the cores evenly.
+
+ With exploit_interval > 0, every exploit_interval env steps per member
+ the members are ranked by their mean return over the last score_window
+ episodes. The bottom `truncation` fraction copies weights, target network,
+ Adam moments and hyperparameters from a random member of the top fraction
+ (exploit), then scales learning rate, 1 - gamma and the target sync
+ interval by 1 +/- perturb (explore). Replay buffers are never copied.
+
+ results() reports every member's current hyperparameters, score and
+ lineage, best first.
+*/
+
+namespace tiny_rl
+{
+    struct PopulationMemberResult
+    {
+        size_t id = 0;
+        DQNConfig config{};         // hyperparameters it trains with now
+        float score = 0.0f;         // mean of the last score_window returns, -inf before any
+        size_t episodes = 0;
+        size_t env_steps = 0;
+        size_t exploits = 0;        // times it copied another member
+        long parent = -1;           // member it last copied, -1 = none
+    };
+
+    struct PopulationReport
+    {
+        std::vector<PopulationMemberResult> members; // best score first
+        size_t env_steps = 0;                        // across all members
+        double elapsed_sec = 0.0;
+        double env_steps_per_sec = 0.0;
+        float score_mean = 0.0f;                     // over members with a score
+        float score_max = 0.0f;
+    };
+
+    class PopulationTrainer
+    {
+    public:
+        using NetBuilder = std::function<void(Net &)>;
+        using EnvFactory = std::function<std::shared_ptr<BaseEnv>()>;
+
+        // One member per entry of `configs`; build_net is called twice per
+        // member, for the online and target networks
+        PopulationTrainer(NetBuilder build_net,
+                          EnvFactory env_factory,
+                          const std::vector<DQNConfig> &configs,
+                          PopulationConfig config = {})
+            : config_(config),
+              rng_(config.seed ? config.seed : std::random_device{}()),
+              elapsed_sec_(0.0)
+        {
+            if (configs.empty())
+                throw std::invalid_argument("PopulationTrainer: needs at least one config");
+            if (config_.slice_steps <= 0 || config_.score_window <= 0)
+                throw std::invalid_argument("PopulationTrainer: slice_steps and score_window must be positive");
+            if (config_.truncation < 0.0f || config_.truncation > 0.5f)
+                throw std::invalid_argument("PopulationTrainer: truncation must be in [0, 0.5]");
+
+            for (size_t i = 0; i < configs.size(); ++i)
+            {
+                auto m = std::make_unique<Member>();
+                m->id = i;
+                build_net(m->online);
+                build_net(m->target);
+                m->qnet = std::make_unique<QNetwork>(m->online, m->target);
+                m->agent = std::make_unique<DQNAgent>(*m->qnet, configs[i]);
+                m->env = env_factory();
+                m->state.resize(m->env->state_size());
+                m->next_state.resize(m->env->state_size());
+                m->env->reset_into(m->state.data());
+                m->returns.assign(config_.score_window, 0.0f);
+                members_.push_back(std::move(m));
+            }
+        }
+
+        // Runs every member for `env_steps` more env steps
+        void run(size_t env_steps, bool report = false)
+        {
+            auto start = std::chrono::steady_clock::now();
+            size_t slice = static_cast<size_t>(config_.slice_steps);
+            size_t interval = static_cast<size_t>(std::max(config_.exploit_interval, 0));
+            ThreadPool &pool = shared_thread_pool();
+
+            for (size_t done = 0; done < env_steps;)
+            {
+                size_t steps = std::min(slice, env_steps - done);
+                pool.parallel_for(members_.size(), 1, [&](size_t begin, size_t end)
+                                  {
+                                      for (size_t i = begin; i < end; ++i)
+                                          run_slice(*members_[i], steps);
+                                  });
+                done += steps;
+                steps_per_member_ += steps;
+
+                if (interval > 0 && steps_per_member_ >= next_exploit_ + interval)
+                {
+                    next_exploit_ = steps_per_member_ - steps_per_member_ % interval;
+                    exploit_and_explore();
+                    if (report)
+                        print(results());
+                }
+            }
+            elapsed_sec_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        PopulationReport results() const
+        {
+            PopulationReport r;
+            size_t scored = 0;
+            double sum = 0.0;
+            r.score_max = -std::numeric_limits<float>::infinity();
+            for (const auto &m : members_)
+            {
+                PopulationMemberResult res;
+                res.id = m->id;
+                res.config = m->agent->get_config();
+                res.score = score(*m);
+                res.episodes = m->episodes;
+                res.env_steps = m->agent->env_steps();
+                res.exploits = m->exploits;
+                res.parent = m->parent;
+                r.env_steps += res.env_steps;
+                if (m->episodes > 0)
+                {
+                    ++scored;
+                    sum += res.score;
+                    r.score_max = std::max(r.score_max, res.score);
+                }
+                r.members.push_back(res);
+            }
+            std::stable_sort(r.members.begin(), r.members.end(), [](const auto &a, const auto &b)
+                             { return a.score > b.score; });
+            r.score_mean = scored ? static_cast<float>(sum / scored) : r.score_max;
+            r.elapsed_sec = elapsed_sec_;
+            r.env_steps_per_sec = elapsed_sec_ > 0.0 ? r.env_steps / elapsed_sec_ : 0.0;
+            return r;
+        }
+
+        size_t size() const
+        {
+            return members_.size();
+        }
+
+        // Member `id`'s agent, e.g. to save the winner
+        DQNAgent &agent(size_t id)
+        {
+            return *members_.at(id)->agent;
+        }
+
+    private:
+        struct Member
+        {
+            size_t id = 0;
+            Net online, target;
+            std::unique_ptr<QNetwork> qnet;
+            std::unique_ptr<DQNAgent> agent;
+            std::shared_ptr<BaseEnv> env;
+            tiny_dnn::vec_t state;
+            tiny_dnn::vec_t next_state;
+            float episode_return = 0.0f;
+            size_t episodes = 0;
+            std::vector<float> returns; // ring of the last score_window episode returns
+            size_t exploits = 0;
+            long parent = -1;
+        };
+
+        // Only ever runs on one thread at a time per member
+        static void run_slice(Member &m, size_t steps)
+        {
+            DQNAgent &agent = *m.agent;
+            for (size_t t = 0; t < steps; ++t)
+            {
+                int action = agent.select_action(m.state);
+                float reward;
+                bool done;
+                {
+                    TINY_RL_PROFILE_SCOPE(kEnvStep);
+                    std::tie(reward, done) = m.env->step_into(action, m.next_state.data());
+                }
+                agent.store_experience(std::move(m.state), action, reward, m.next_state, done);
+                agent.learn();
+                m.episode_return += reward;
+                if (done)
+                {
+                    agent.on_episode_end();
+                    m.returns[m.episodes % m.returns.size()] = m.episode_return;
+                    ++m.episodes;
+                    m.episode_return = 0.0f;
+                    m.env->reset_into(m.state.data());
+                }
+                else
+                {
+                    m.state.swap(m.next_state);
+                }
+            }
+        }
+
+        static float score(const Member &m)
+        {
+            if (m.episodes == 0)
+                return -std::numeric_limits<float>::infinity();
+            size_t n = std::min(m.episodes, m.returns.size());
+            float sum = 0.0f;
+            for (size_t i = 0; i < n; ++i)
+                sum += m.returns[i];
+            return sum / n;
+        }
+
+        void exploit_and_explore()
+        {
+            size_t n = members_.size();
+            size_t cut = static_cast<size_t>(config_.truncation * n);
+            if (cut == 0)
+                return;
+
+            std::vector<Member *> ranked;
+            for (auto &m : members_)
+                ranked.push_back(m.get());
+            std::stable_sort(ranked.begin(), ranked.end(), [](const Member *a, const Member *b)
+                             { return score(*a) > score(*b); });
+
+            std::uniform_int_distribution<size_t> pick_top(0, cut - 1);
+            for (size_t k = n - cut; k < n; ++k)
+            {
+                Member &dst = *ranked[k];
+                Member &src = *ranked[pick_top(rng_)];
+                if (score(src) <= score(dst))
+                    continue;
+                dst.agent->copy_learner_state(*src.agent);
+                dst.agent->retune(perturb(src.agent->get_config()));
+                // the old returns scored the weights it just dropped
+                dst.episodes = 0;
+                ++dst.exploits;
+                dst.parent = static_cast<long>(src.id);
+            }
+        }
+
+        DQNConfig perturb(DQNConfig c)
+        {
+            auto factor = [&]
+            {
+                return std::bernoulli_distribution(0.5)(rng_) ? 1.0f + config_.perturb : 1.0f - config_.perturb;
+            };
+            c.learning_rate *= factor();
+            c.gamma = std::clamp(1.0f - (1.0f - c.gamma) * factor(), 0.0f, 0.9999f);
+            c.target_update_freq = std::max(1, static_cast<int>(std::lround(c.target_update_freq * factor())));
+            return c;
+        }
+
+        static void print(const PopulationReport &r)
+        {
+            char line[256];
+            std::snprintf(line, sizeof(line), "[pbt] env steps %zu (%.0f/s) score mean %.2f max %.2f\n",
+                          r.env_steps, r.env_steps_per_sec, r.score_mean, r.score_max);
+            std::cout << line;
+            for (const auto &m : r.members)
+            {
+                std::snprintf(line, sizeof(line),
+                              "[pbt]   member %zu score %.2f lr %.3g gamma %.4f target sync %d exploits %zu parent %ld\n",
+                              m.id, m.score, m.config.learning_rate, m.config.gamma, m.config.target_update_freq,
+                              m.exploits, m.parent);
+                std::cout << line;
+            }
+        }
+
+        PopulationConfig config_;
+        std::vector<std::unique_ptr<Member>> members_;
+        std::mt19937 rng_;
+        size_t steps_per_member_ = 0;
+        size_t next_exploit_ = 0;
+        double elapsed_sec_;
+    };
+}
@@ -9,6 +9,7 @@
 #include "base_trainer.h"
 #include "../agents/ppo_agent.h"
 #include "../envs/base_env.h"
+#include "../utils/logger.h"
 #include "tiny_dnn/tiny_dnn.h"
 
 namespace tiny_rl
@@ -50,34 +51,38 @@ namespace tiny_rl
                     }
                 } });
 
+            // the env writes into these in place; store_experience() takes
+            // the state buffer and hands back a recycled one of the same size
+            tiny_dnn::vec_t state(env->state_size());
+            tiny_dnn::vec_t next_state(env->state_size());
+
             for (int ep = 1; ep <= episodes; ++ep)
             {
                 check_pause_status();
-                auto raw_state = env->reset();
-                tiny_dnn::vec_t state(raw_state.begin(), raw_state.end());
+                env->reset_into(state.data());
 
                 float total_reward = 0.0f;
                 bool done = false;
                 while (!done)
                 {
                     int action = agent_.select_action(state);
-                    auto [next_raw_state, reward, terminal] = env->step(action);
-                    tiny_dnn::vec_t next_state(next_raw_state.begin(), next_raw_state.end());
+                    auto [reward, terminal] = step_env(*env, action, next_state.data());
 
-                    agent_.store_experience(state, action, reward, next_state, terminal);
+                    agent_.store_experience(std::move(state), action, reward, next_state, terminal);
                     agent_.learn();
 
-                    state = std::move(next_state);
+                    state.swap(next_state);
                     total_reward += reward;
                     done = terminal;
                 }
                 agent_.on_episode_end();
+                log_metric(Metric::kEpisodeReward, ep, total_reward);
                 avg_reward_100 += total_reward;
                 if (ep % 100 == 0)
                 {
                     std::cout << "Episode: " << ep
                               << " average reward: " << avg_reward_100 / 100
-                              << std::endl;
+                              << "\n";
 
                     avg_reward_100 = 0.0f;
                 }
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <iostream>
+#include <tuple>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <cstdint>
+#include "base_trainer.h"
+#include "async_evaluator.h"
+#include "../agents/base_agent.h"
+#include "../core/obs_normalizer.h"
+#include "../envs/base_env.h"
+#include "../utils/arena.h"
+#include "../utils/logger.h"
+#include "../utils/thread_pool.h"
+#include "tiny_dnn/tiny_dnn.h"
+
+/*
+ Step-driven trainer. Advances num_envs environments in lockstep, asks the
+ agent for all actions with one select_actions() call, and auto-resets each
+ env when its episode ends. Training stops on a frame budget, a wall-clock
+ budget or an episode count, whichever comes first.
+
+ With envs_per_task > 0 the env steps of one frame are split into tasks of
+ that many envs on the shared thread pool; leave it at 0 for cheap envs,
+ where stepping on the calling thread beats the dispatch cost.
+
+ Envs write observations straight into the trainer's per-env buffers
+ (BaseEnv::step_into), which are then handed to the agent's replay or
+ rollout storage without another copy of the state. Each frame runs inside an ArenaScope on the
+ calling thread's arena. last_frame_allocations() reports what the last
+ frame allocated on the calling thread, so a warmed-up loop can be
+ checked for zero mallocs.
+*/
+
+namespace tiny_rl
+{
+    struct StepBudget
+    {
+        size_t max_frames = 0;    // total env steps across all envs, 0 = unlimited
+        double max_seconds = 0.0; // wall-clock limit, 0 = unlimited
+        size_t max_episodes = 0;  // finished episodes across all envs, 0 = unlimited
+    };
+
+    class StepTrainer : public BaseTrainer
+    {
+    public:
+        using EnvFactory = std::function<std::shared_ptr<BaseEnv>()>;
+
+        StepTrainer(BaseAgent &agent, EnvFactory env_factory, int num_envs, int report_interval = 100,
+                    size_t envs_per_task = 0)
+            : BaseTrainer(agent, env_factory()),
+              report_interval_(report_interval),
+              envs_per_task_(envs_per_task),
+              frames_(0),
+              episodes_(0),
+              normalizer_(nullptr),
+              evaluator_(nullptr)
+        {
+            envs_.push_back(env);
+            for (int i = 1; i < num_envs; ++i)
+                envs_.push_back(env_factory());
+
+            size_t n = envs_.size();
+            size_t dim = static_cast<size_t>(env->state_size());
+            states_.assign(n, tiny_dnn::vec_t(dim));
+            next_states_.assign(n, tiny_dnn::vec_t(dim));
+            rewards_.resize(n);
+            dones_.resize(n);
+            terminals_.resize(n);
+            episode_returns_.assign(n, 0.0f);
+            episode_lengths_.assign(n, 0);
+        }
+
+        // Normalize (and keep statistics over) every observation the envs
+        // return, one batch per frame; nullptr turns it off
+        void set_observation_normalizer(ObservationNormalizer *normalizer)
+        {
+            normalizer_ = normalizer;
+        }
+
+        // Hand snapshots of `evaluator`'s network to it every interval_steps
+        // frames; nullptr turns it off
+        void evaluate_with(AsyncEvaluator *evaluator)
+        {
+            evaluator_ = evaluator;
+        }
+
+        void train(int episodes) override
+        {
+            StepBudget budget;
+            budget.max_episodes = static_cast<size_t>(episodes);
+            run(budget);
+        }
+
+        void run(const StepBudget &budget)
+        {
+            size_t n = envs_.size();
+            for (size_t i = 0; i < n; ++i)
+            {
+                envs_[i]->reset_into(states_[i].data());
+                episode_returns_[i] = 0.0f;
+                episode_lengths_[i] = 0;
+            }
+            if (normalizer_)
+                normalizer_->process(states_);
+
+            auto start = std::chrono::steady_clock::now();
+            size_t frame_limit = budget.max_frames ? budget.max_frames : std::numeric_limits<size_t>::max();
+            size_t episode_limit = budget.max_episodes ? budget.max_episodes : std::numeric_limits<size_t>::max();
+            size_t start_frames = frames_;
+            size_t start_episodes = episodes_;
+            float avg_reward = 0.0f;
+            size_t reported = 0;
+
+            while (frames_ - start_frames < frame_limit && episodes_ - start_episodes < episode_limit)
+            {
+                if (budget.max_seconds > 0.0 && elapsed(start) >= budget.max_seconds)
+                    break;
+
+                ArenaScope frame(thread_arena());
+                AllocationCounts frame_start = thread_allocation_counts();
+
+                agent.select_actions(states_, actions_);
+                if (envs_per_task_ > 0)
+                    shared_thread_pool().parallel_for(n, envs_per_task_, [this](size_t begin, size_t end)
+                                                      { step_envs(begin, end); });
+                else
+                    step_envs(0, n);
+                if (normalizer_)
+                    normalizer_->process(next_states_);
+                // vector<bool> packs bits, so tasks write bytes and this copies them over
+                for (size_t i = 0; i < n; ++i)
+                    dones_[i] = terminals_[i] != 0;
+
+                // the agent keeps states_' buffers and refills them with recycled ones
+                agent.store_experiences(std::move(states_), actions_, rewards_, next_states_, dones_);
+                agent.learn();
+                frames_ += n;
+                if (evaluator_)
+                    evaluator_->maybe_evaluate(frames_);
+
+                for (size_t i = 0; i < n; ++i)
+                {
+                    episode_returns_[i] += rewards_[i];
+                    ++episode_lengths_[i];
+                    if (!dones_[i])
+                    {
+                        states_[i].swap(next_states_[i]);
+                        continue;
+                    }
+
+                    agent.on_episode_end();
+                    ++episodes_;
+                    log_metric(Metric::kEpisodeReward, episodes_, episode_returns_[i]);
+                    avg_reward += episode_returns_[i];
+                    if (report_interval_ > 0 && ++reported % report_interval_ == 0)
+                    {
+                        std::cout << "Episode: " << episodes_
+                                  << " frames: " << frames_
+                                  << " average reward: " << avg_reward / report_interval_
+                                  << " frames/s: " << (frames_ - start_frames) / elapsed(start)
+                                  << "\n";
+                        TINY_RL_PROFILE_REPORT(std::cout);
+                        avg_reward = 0.0f;
+                    }
+
+                    envs_[i]->reset_into(states_[i].data());
+                    if (normalizer_)
+                        normalizer_->process(states_[i]);
+                    episode_returns_[i] = 0.0f;
+                    episode_lengths_[i] = 0;
+                }
+                last_frame_allocations_ = thread_allocation_counts() - frame_start;
+            }
+        }
+
+        size_t frames() const
+        {
+            return frames_;
+        }
+
+        size_t episodes() const
+        {
+            return episodes_;
+        }
+
+        size_t num_envs() const
+        {
+            return envs_.size();
+        }
+
+        // Allocations the calling thread made during the last frame; env
+        // steps run on pool threads (envs_per_task > 0) are not included
+        const AllocationCounts &last_frame_allocations() const
+        {
+            return last_frame_allocations_;
+        }
+
+    private:
+        void step_envs(size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                auto [reward, terminal] = step_env(*envs_[i], actions_[i], next_states_[i].data());
+                rewards_[i] = reward;
+                terminals_[i] = terminal ? 1 : 0;
+            }
+        }
+
+        static double elapsed(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        std::vector<std::shared_ptr<BaseEnv>> envs_;
+        int report_interval_;
+        size_t envs_per_task_;
+        size_t frames_;
+        size_t episodes_;
+
+        std::vector<tiny_dnn::vec_t> states_;
+        std::vector<tiny_dnn::vec_t> next_states_;
+        std::vector<int> actions_;
+        std::vector<float> rewards_;
+        std::vector<bool> dones_;
+        std::vector<uint8_t> terminals_;
+        std::vector<float> episode_returns_;
+        std::vector<int> episode_lengths_;
+        ObservationNormalizer *normalizer_;
+        AsyncEvaluator *evaluator_;
+        AllocationCounts last_frame_allocations_;
+    };
+}
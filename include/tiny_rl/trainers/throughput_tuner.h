@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "actor_learner_dqn_trainer.h"
+#include "../agents/dqn_agent.h"
+#include "../core/q_network.h"
+#include "../core/tensor_utils.h"
+#include "../envs/base_env.h"
+#include "../utils/config.h"
+
+/*
+ Calibration sweep for actor/learner DQN throughput. Every combination of
+ batch size, learner thread count and replay-ratio throttle in the
+ ThroughputTunerConfig gets a short ActorLearnerDQNTrainer run on fresh
+ networks, with the actors taking whatever the thread budget leaves after
+ the learner. Each trial records env steps/s, gradient steps/s, the
+ update-to-data ratio it actually sustained and how busy the learner was.
+
+ The pick is the trial that keeps the learner busiest while still meeting
+ target_update_to_data, i.e. where the actors produce data just as fast as
+ the learner consumes it; near-ties go to the higher env step rate. If no
+ trial meets the target, the one that came closest wins and meets_target
+ is false. TunedConfig::save() writes the pick as key = value lines that
+ load() and apply() turn back into DQNConfig / ActorLearnerConfig fields,
+ so production runs can pin it.
+*/
+
+namespace tiny_rl
+{
+    struct TunerTrial
+    {
+        int batch_size = 0;
+        int learner_threads = 0;
+        int num_actors = 0;
+        float replay_ratio = 0.0f;
+        double env_steps_per_sec = 0.0;
+        double grad_steps_per_sec = 0.0;
+        double update_to_data = 0.0; // measured gradient updates per env step
+        double learner_utilization = 0.0;
+        bool meets_target = false;
+    };
+
+    struct TunedConfig
+    {
+        int batch_size = 32;
+        int train_frequency = 4; // env steps per update, for the single-threaded trainers
+        int learner_threads = 1;
+        int num_actors = 2;
+        float replay_ratio = 0.25f;
+
+        // measured in the chosen trial; saved as comments, not loaded
+        double env_steps_per_sec = 0.0;
+        double grad_steps_per_sec = 0.0;
+        double learner_utilization = 0.0;
+        bool meets_target = false;
+
+        void apply(DQNConfig &dqn, ActorLearnerConfig &actor_learner) const
+        {
+            dqn.batch_size = batch_size;
+            dqn.train_frequency = train_frequency;
+            dqn.learner_threads = learner_threads;
+            actor_learner.num_actors = num_actors;
+            actor_learner.replay_ratio = replay_ratio;
+        }
+
+        void save(const std::string &path) const
+        {
+            std::ofstream out(path);
+            if (!out)
+                throw std::runtime_error("TunedConfig::save: cannot open " + path);
+            out << "# throughput tuning result\n"
+                << "# env_steps_per_sec = " << env_steps_per_sec << "\n"
+                << "# grad_steps_per_sec = " << grad_steps_per_sec << "\n"
+                << "# learner_utilization = " << learner_utilization << "\n"
+                << "# meets_target = " << (meets_target ? "true" : "false") << "\n"
+                << "batch_size = " << batch_size << "\n"
+                << "train_frequency = " << train_frequency << "\n"
+                << "learner_threads = " << learner_threads << "\n"
+                << "num_actors = " << num_actors << "\n"
+                << "replay_ratio = " << replay_ratio << "\n";
+            if (!out)
+                throw std::runtime_error("TunedConfig::save: write failed for " + path);
+        }
+
+        // Keys left out of the file keep their defaults; unknown keys throw
+        static TunedConfig load(const std::string &path)
+        {
+            std::ifstream in(path);
+            if (!in)
+                throw std::runtime_error("TunedConfig::load: cannot open " + path);
+            TunedConfig c;
+            std::string line;
+            while (std::getline(in, line))
+            {
+                size_t first = line.find_first_not_of(" \t");
+                if (first == std::string::npos || line[first] == '#')
+                    continue;
+                size_t eq = line.find('=');
+                if (eq == std::string::npos)
+                    throw std::runtime_error("TunedConfig::load: expected key = value in " + path + ": " + line);
+                std::string key = trim(line.substr(0, eq));
+                std::istringstream value(line.substr(eq + 1));
+                if (key == "batch_size")
+                    value >> c.batch_size;
+                else if (key == "train_frequency")
+                    value >> c.train_frequency;
+                else if (key == "learner_threads")
+                    value >> c.learner_threads;
+                else if (key == "num_actors")
+                    value >> c.num_actors;
+                else if (key == "replay_ratio")
+                    value >> c.replay_ratio;
+                else
+                    throw std::runtime_error("TunedConfig::load: unknown key '" + key + "' in " + path);
+                if (!value)
+                    throw std::runtime_error("TunedConfig::load: bad value for '" + key + "' in " + path);
+            }
+            return c;
+        }
+
+    private:
+        static std::string trim(const std::string &s)
+        {
+            size_t b = s.find_first_not_of(" \t");
+            size_t e = s.find_last_not_of(" \t\r");
+            return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+        }
+    };
+
+    class ThroughputTuner
+    {
+    public:
+        using NetBuilder = std::function<void(Net &)>;
+        using EnvFactory = std::function<std::shared_ptr<BaseEnv>()>;
+
+        // build_net is called twice per trial, for the online and target networks
+        ThroughputTuner(NetBuilder build_net,
+                        EnvFactory env_factory,
+                        DQNConfig base,
+                        ActorLearnerConfig base_actor_learner = {},
+                        ThroughputTunerConfig config = {})
+            : build_net_(std::move(build_net)),
+              env_factory_(std::move(env_factory)),
+              base_(base),
+              base_actor_learner_(std::move(base_actor_learner)),
+              config_(std::move(config))
+        {
+            if (config_.batch_sizes.empty() || config_.learner_threads.empty())
+                throw std::invalid_argument("ThroughputTuner: batch_sizes and learner_threads must not be empty");
+            if (config_.target_update_to_data <= 0.0f)
+                throw std::invalid_argument("ThroughputTuner: target_update_to_data must be positive");
+        }
+
+        // Runs every trial of the sweep and returns the pick
+        TunedConfig run(bool report = true)
+        {
+            std::vector<float> ratios = config_.replay_ratios;
+            if (ratios.empty())
+                ratios.push_back(config_.target_update_to_data);
+
+            trials_.clear();
+            for (int batch : config_.batch_sizes)
+                for (int learners : config_.learner_threads)
+                    for (float ratio : ratios)
+                    {
+                        trials_.push_back(run_trial(batch, learners, ratio));
+                        if (report)
+                            print(trials_.back());
+                    }
+
+            const TunerTrial *best = &trials_.front();
+            for (const auto &t : trials_)
+                if (better(t, *best))
+                    best = &t;
+
+            TunedConfig c;
+            c.batch_size = best->batch_size;
+            c.train_frequency = std::max(1, static_cast<int>(std::lround(1.0f / config_.target_update_to_data)));
+            c.learner_threads = best->learner_threads;
+            c.num_actors = best->num_actors;
+            c.replay_ratio = best->replay_ratio;
+            c.env_steps_per_sec = best->env_steps_per_sec;
+            c.grad_steps_per_sec = best->grad_steps_per_sec;
+            c.learner_utilization = best->learner_utilization;
+            c.meets_target = best->meets_target;
+            return c;
+        }
+
+        const std::vector<TunerTrial> &trials() const
+        {
+            return trials_;
+        }
+
+    private:
+        TunerTrial run_trial(int batch, int learners, float ratio)
+        {
+            int budget = config_.thread_budget > 0
+                             ? config_.thread_budget
+                             : std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+
+            Net online, target;
+            build_net_(online);
+            build_net_(target);
+            QNetwork qnet(online, target);
+
+            DQNConfig dqn = base_;
+            dqn.batch_size = batch;
+            dqn.learner_threads = learners;
+            // every train_for() call waits for learn_start fresh env steps,
+            // so keep it to one batch here
+            dqn.learn_start = batch;
+            DQNAgent agent(qnet, dqn);
+
+            ActorLearnerConfig al = base_actor_learner_;
+            al.num_actors = std::max(1, budget - learners);
+            al.replay_ratio = ratio;
+            al.report_interval = 0;
+            ActorLearnerDQNTrainer trainer(agent, env_factory_, al);
+
+            trainer.train_for(config_.warmup_seconds);
+            trainer.train_for(config_.trial_seconds);
+            const ActorLearnerStats &s = trainer.stats();
+
+            TunerTrial t;
+            t.batch_size = batch;
+            t.learner_threads = learners;
+            t.num_actors = al.num_actors;
+            t.replay_ratio = ratio;
+            t.env_steps_per_sec = s.actor_steps_per_sec;
+            t.grad_steps_per_sec = s.learner_steps_per_sec;
+            t.update_to_data = s.env_steps > 0 ? static_cast<double>(s.grad_steps) / s.env_steps : 0.0;
+            t.learner_utilization = s.learner_utilization;
+            t.meets_target = t.update_to_data >= (1.0 - config_.tolerance) * config_.target_update_to_data;
+            return t;
+        }
+
+        // Feasible beats infeasible; among feasible trials the busier learner
+        // wins, with utilizations within 2% counted as a tie broken by env
+        // steps/s; among infeasible ones the closest ratio wins
+        static bool better(const TunerTrial &a, const TunerTrial &b)
+        {
+            if (a.meets_target != b.meets_target)
+                return a.meets_target;
+            if (!a.meets_target)
+                return a.update_to_data > b.update_to_data;
+            if (std::fabs(a.learner_utilization - b.learner_utilization) > 0.02)
+                return a.learner_utilization > b.learner_utilization;
+            return a.env_steps_per_sec > b.env_steps_per_sec;
+        }
+
+        static void print(const TunerTrial &t)
+        {
+            char line[256];
+            std::snprintf(line, sizeof(line),
+                          "[tune] batch %d learners %d actors %d ratio %.3g: env steps/s %.0f grad steps/s %.0f "
+                          "update/data %.3f learner busy %.0f%%%s\n",
+                          t.batch_size, t.learner_threads, t.num_actors, t.replay_ratio, t.env_steps_per_sec,
+                          t.grad_steps_per_sec, t.update_to_data, t.learner_utilization * 100.0,
+                          t.meets_target ? "" : " (below target)");
+            std::cout << line;
+        }
+
+        NetBuilder build_net_;
+        EnvFactory env_factory_;
+        DQNConfig base_;
+        ActorLearnerConfig base_actor_learner_;
+        ThroughputTunerConfig config_;
+        std::vector<TunerTrial> trials_;
+    };
+}
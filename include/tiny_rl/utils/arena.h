@@ -0,0 +1,271 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+/*
+ Allocation layer for the per-step hot path.
+
+ MonotonicArena is a bump allocator for scratch memory whose lifetime is
+ one env step or one learner update. An ArenaScope marks the arena on
+ entry and rewinds it on exit; blocks are kept, so once the arena has
+ grown to the high-water mark of a step, later steps allocate nothing.
+ thread_arena() hands out one arena per thread.
+
+ Every allocation that reaches the heap on behalf of this layer (a new
+ arena block, an ObsPool miss) is counted per thread in
+ thread_allocation_counts(). Defining TINY_RL_DEFINE_ALLOCATION_HOOKS()
+ at namespace scope in exactly one translation unit also counts every
+ operator new and posix_memalign (the allocator behind tiny_dnn::vec_t)
+ in `heap`, which is what tests use to assert that a warmed-up step does
+ not touch malloc at all.
+*/
+
+namespace tiny_rl
+{
+    struct AllocationCounts
+    {
+        uint64_t heap = 0;         // operator new / posix_memalign, with the hooks installed
+        uint64_t arena_blocks = 0; // blocks MonotonicArena had to request
+        uint64_t pool_misses = 0;  // ObsPool::acquire() calls that found the pool empty
+    };
+
+    inline AllocationCounts operator-(const AllocationCounts &a, const AllocationCounts &b)
+    {
+        return {a.heap - b.heap, a.arena_blocks - b.arena_blocks, a.pool_misses - b.pool_misses};
+    }
+
+    // Counters of the calling thread; snapshot before and after a step
+    inline AllocationCounts &thread_allocation_counts()
+    {
+        thread_local AllocationCounts counts;
+        return counts;
+    }
+
+    namespace detail
+    {
+        inline bool &allocation_hooks_flag()
+        {
+            static bool installed = false;
+            return installed;
+        }
+
+        // Called from the global allocation hooks, so it must not allocate
+        inline void count_heap_allocation() noexcept
+        {
+            ++thread_allocation_counts().heap;
+        }
+    }
+
+    // True if TINY_RL_DEFINE_ALLOCATION_HOOKS() is linked in, i.e. `heap` counts are real
+    inline bool allocation_hooks_installed()
+    {
+        return detail::allocation_hooks_flag();
+    }
+
+    class MonotonicArena
+    {
+    public:
+        struct Mark
+        {
+            size_t block;
+            size_t offset;
+        };
+
+        explicit MonotonicArena(size_t block_bytes = 64 * 1024)
+            : block_bytes_(block_bytes), current_(0), offset_(0)
+        {
+        }
+
+        MonotonicArena(const MonotonicArena &) = delete;
+        MonotonicArena &operator=(const MonotonicArena &) = delete;
+
+        void *allocate(size_t bytes, size_t align = alignof(std::max_align_t))
+        {
+            for (; current_ < blocks_.size(); ++current_, offset_ = 0)
+            {
+                Block &b = blocks_[current_];
+                uintptr_t base = reinterpret_cast<uintptr_t>(b.data.get());
+                size_t start = ((base + offset_ + align - 1) & ~(uintptr_t(align) - 1)) - base;
+                if (start + bytes <= b.size)
+                {
+                    offset_ = start + bytes;
+                    return b.data.get() + start;
+                }
+            }
+
+            // a block sized for the request, later steps reuse it
+            size_t size = std::max(block_bytes_, bytes + align);
+            blocks_.push_back(Block{std::unique_ptr<unsigned char[]>(new unsigned char[size]), size});
+            ++thread_allocation_counts().arena_blocks;
+            return allocate(bytes, align);
+        }
+
+        template <typename T>
+        T *allocate_array(size_t n)
+        {
+            return static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+        }
+
+        Mark mark() const
+        {
+            return {current_, offset_};
+        }
+
+        // Frees everything allocated since `m`; blocks stay for reuse
+        void rewind(Mark m)
+        {
+            current_ = m.block;
+            offset_ = m.offset;
+        }
+
+        void reset()
+        {
+            rewind({0, 0});
+        }
+
+        size_t blocks() const
+        {
+            return blocks_.size();
+        }
+
+        size_t bytes_reserved() const
+        {
+            size_t n = 0;
+            for (const auto &b : blocks_)
+                n += b.size;
+            return n;
+        }
+
+    private:
+        struct Block
+        {
+            std::unique_ptr<unsigned char[]> data;
+            size_t size;
+        };
+
+        size_t block_bytes_;
+        std::vector<Block> blocks_;
+        size_t current_;
+        size_t offset_;
+    };
+
+    // Rewinds the arena to where it was when the scope opened
+    class ArenaScope
+    {
+    public:
+        explicit ArenaScope(MonotonicArena &arena) : arena_(arena), mark_(arena.mark()) {}
+        ~ArenaScope() { arena_.rewind(mark_); }
+
+        ArenaScope(const ArenaScope &) = delete;
+        ArenaScope &operator=(const ArenaScope &) = delete;
+
+    private:
+        MonotonicArena &arena_;
+        MonotonicArena::Mark mark_;
+    };
+
+    // std allocator over an arena; deallocate() is a no-op, memory comes
+    // back when the enclosing ArenaScope closes
+    template <typename T>
+    class ArenaAllocator
+    {
+    public:
+        using value_type = T;
+
+        explicit ArenaAllocator(MonotonicArena &arena) noexcept : arena_(&arena) {}
+
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other) noexcept : arena_(other.arena()) {}
+
+        T *allocate(size_t n)
+        {
+            return arena_->allocate_array<T>(n);
+        }
+
+        void deallocate(T *, size_t) noexcept {}
+
+        MonotonicArena *arena() const noexcept
+        {
+            return arena_;
+        }
+
+        template <typename U>
+        bool operator==(const ArenaAllocator<U> &other) const noexcept
+        {
+            return arena_ == other.arena();
+        }
+
+        template <typename U>
+        bool operator!=(const ArenaAllocator<U> &other) const noexcept
+        {
+            return arena_ != other.arena();
+        }
+
+    private:
+        MonotonicArena *arena_;
+    };
+
+    template <typename T>
+    using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+    // Per-thread scratch arena for step- and update-scoped memory
+    inline MonotonicArena &thread_arena()
+    {
+        thread_local MonotonicArena arena;
+        return arena;
+    }
+}
+
+#if defined(__GLIBC__)
+// tiny_dnn::vec_t allocates through posix_memalign, so count that too
+#define TINY_RL_DETAIL_POSIX_MEMALIGN_HOOK()                                       \
+    extern "C" int posix_memalign(void **out, std::size_t align, std::size_t n)    \
+    {                                                                              \
+        ::tiny_rl::detail::count_heap_allocation();                                \
+        std::size_t size = (n + align - 1) / align * align;                        \
+        void *p = std::aligned_alloc(align, size ? size : align);                  \
+        if (!p)                                                                    \
+            return ENOMEM;                                                         \
+        *out = p;                                                                  \
+        return 0;                                                                  \
+    }
+#else
+#define TINY_RL_DETAIL_POSIX_MEMALIGN_HOOK()
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC pairs the replaced new/delete with malloc/free and warns spuriously
+#define TINY_RL_DETAIL_HOOKS_BEGIN() \
+    _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wmismatched-new-delete\"")
+#define TINY_RL_DETAIL_HOOKS_END() _Pragma("GCC diagnostic pop")
+#else
+#define TINY_RL_DETAIL_HOOKS_BEGIN()
+#define TINY_RL_DETAIL_HOOKS_END()
+#endif
+
+// Replaces the global allocation functions with counting ones; expand in
+// exactly one translation unit of a program, at namespace scope
+#define TINY_RL_DEFINE_ALLOCATION_HOOKS()                                          \
+    TINY_RL_DETAIL_HOOKS_BEGIN()                                                   \
+    void *operator new(std::size_t n)                                              \
+    {                                                                              \
+        ::tiny_rl::detail::count_heap_allocation();                                \
+        if (void *p = std::malloc(n ? n : 1))                                      \
+            return p;                                                              \
+        throw std::bad_alloc();                                                    \
+    }                                                                              \
+    void *operator new[](std::size_t n) { return ::operator new(n); }              \
+    void operator delete(void *p) noexcept { std::free(p); }                       \
+    void operator delete[](void *p) noexcept { std::free(p); }                     \
+    void operator delete(void *p, std::size_t) noexcept { std::free(p); }          \
+    void operator delete[](void *p, std::size_t) noexcept { std::free(p); }        \
+    TINY_RL_DETAIL_HOOKS_END()                                                     \
+    TINY_RL_DETAIL_POSIX_MEMALIGN_HOOK()                                           \
+    static const bool tiny_rl_allocation_hooks_installed_ =                        \
+        (::tiny_rl::detail::allocation_hooks_flag() = true);
@@ -0,0 +1,309 @@
+#pragma once
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ Versioned binary checkpoint container. A file is a fixed header followed by
+ a sequence of sections, each a small header plus a flat blob:
+
+   FileHeader | SectionHeader | bytes... | SectionHeader | bytes... | ...
+
+ Writers stream into "<path>.tmp" and rename on close(), so a crash never
+ leaves a truncated checkpoint under the real name. Readers mmap the file
+ and hand out pointers straight into the mapping.
+*/
+
+namespace tiny_rl
+{
+    namespace ckpt
+    {
+        constexpr char kMagic[8] = {'T', 'R', 'L', 'C', 'K', 'P', 'T', '\0'};
+        constexpr uint32_t kVersion = 1;
+
+        enum SectionId : uint32_t
+        {
+            kOnlineParams = 1,
+            kTargetParams = 2,
+            kOptimizerState = 3,
+            kAgentCounters = 4,
+            kReplay = 5,
+            kPolicyParams = 6,
+            kValueParams = 7,
+            kBaseParams = 8,
+            kObsNormalizer = 9,
+        };
+
+        struct FileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t reserved;
+        };
+
+        struct SectionHeader
+        {
+            uint32_t id;
+            uint32_t reserved;
+            uint64_t bytes;
+        };
+
+        struct OptimizerStateHeader
+        {
+            float b1_t;
+            float b2_t;
+            uint64_t count; // floats in each of the m and v blocks
+        };
+
+        // kReplay: this header, then `size` fixed-width records of
+        // state[dim], next_state[dim], action, reward, done, priority
+        struct ReplayHeader
+        {
+            uint64_t size;
+            uint64_t pos;
+            uint32_t state_dim;
+            uint32_t reserved;
+        };
+    }
+
+    class CheckpointWriter
+    {
+    public:
+        explicit CheckpointWriter(const std::string &path)
+            : path_(path),
+              tmp_path_(path + ".tmp"),
+              file_(std::fopen(tmp_path_.c_str(), "wb")),
+              open_section_(-1)
+        {
+            if (!file_)
+                throw std::runtime_error("CheckpointWriter: cannot open " + tmp_path_);
+            ckpt::FileHeader header{};
+            std::memcpy(header.magic, ckpt::kMagic, sizeof(header.magic));
+            header.version = ckpt::kVersion;
+            write_raw(&header, sizeof(header));
+        }
+
+        CheckpointWriter(const CheckpointWriter &) = delete;
+        CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+        ~CheckpointWriter()
+        {
+            if (file_)
+            {
+                std::fclose(file_);
+                std::remove(tmp_path_.c_str());
+            }
+        }
+
+        void write_section(uint32_t id, const void *data, uint64_t bytes)
+        {
+            begin_section(id);
+            append(data, bytes);
+            end_section();
+        }
+
+        // Streaming sections: the size is patched in by end_section()
+        void begin_section(uint32_t id)
+        {
+            ckpt::SectionHeader header{id, 0, 0};
+            open_section_ = std::ftell(file_);
+            section_bytes_ = 0;
+            write_raw(&header, sizeof(header));
+        }
+
+        void append(const void *data, uint64_t bytes)
+        {
+            write_raw(data, bytes);
+            section_bytes_ += bytes;
+        }
+
+        void end_section()
+        {
+            long end = std::ftell(file_);
+            std::fseek(file_, open_section_ + offsetof(ckpt::SectionHeader, bytes), SEEK_SET);
+            write_raw(&section_bytes_, sizeof(section_bytes_));
+            std::fseek(file_, end, SEEK_SET);
+            open_section_ = -1;
+        }
+
+        // Flush and atomically move the file into place
+        void close()
+        {
+            if (std::fclose(file_) != 0)
+            {
+                file_ = nullptr;
+                throw std::runtime_error("CheckpointWriter: failed to flush " + tmp_path_);
+            }
+            file_ = nullptr;
+            if (std::rename(tmp_path_.c_str(), path_.c_str()) != 0)
+                throw std::runtime_error("CheckpointWriter: cannot rename to " + path_);
+        }
+
+    private:
+        void write_raw(const void *data, uint64_t bytes)
+        {
+            if (bytes > 0 && std::fwrite(data, 1, bytes, file_) != bytes)
+                throw std::runtime_error("CheckpointWriter: write failed for " + tmp_path_);
+        }
+
+        std::string path_;
+        std::string tmp_path_;
+        std::FILE *file_;
+        long open_section_;
+        uint64_t section_bytes_ = 0;
+    };
+
+    class CheckpointReader
+    {
+    public:
+        explicit CheckpointReader(const std::string &path)
+            : data_(nullptr), size_(0)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("CheckpointReader: cannot open " + path);
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ckpt::FileHeader)))
+            {
+                ::close(fd);
+                throw std::runtime_error("CheckpointReader: file too small " + path);
+            }
+            size_ = static_cast<size_t>(st.st_size);
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                throw std::runtime_error("CheckpointReader: mmap failed for " + path);
+            data_ = static_cast<const char *>(p);
+
+            const auto *header = reinterpret_cast<const ckpt::FileHeader *>(data_);
+            if (std::memcmp(header->magic, ckpt::kMagic, sizeof(header->magic)) != 0)
+                throw_and_unmap("CheckpointReader: bad magic in " + path);
+            if (header->version != ckpt::kVersion)
+                throw_and_unmap("CheckpointReader: unsupported version in " + path);
+
+            size_t off = sizeof(ckpt::FileHeader);
+            while (off + sizeof(ckpt::SectionHeader) <= size_)
+            {
+                const auto *sh = reinterpret_cast<const ckpt::SectionHeader *>(data_ + off);
+                off += sizeof(ckpt::SectionHeader);
+                if (sh->bytes > size_ - off)
+                    throw_and_unmap("CheckpointReader: truncated section in " + path);
+                sections_.push_back({sh->id, {data_ + off, sh->bytes}});
+                off += sh->bytes;
+            }
+        }
+
+        CheckpointReader(const CheckpointReader &) = delete;
+        CheckpointReader &operator=(const CheckpointReader &) = delete;
+
+        ~CheckpointReader()
+        {
+            if (data_)
+                ::munmap(const_cast<char *>(data_), size_);
+        }
+
+        bool has(uint32_t id) const
+        {
+            for (const auto &s : sections_)
+                if (s.first == id)
+                    return true;
+            return false;
+        }
+
+        // Pointer into the mapping and size of a section, throws if missing
+        std::pair<const char *, uint64_t> section(uint32_t id) const
+        {
+            for (const auto &s : sections_)
+                if (s.first == id)
+                    return s.second;
+            throw std::runtime_error("CheckpointReader: missing section " + std::to_string(id));
+        }
+
+    private:
+        void throw_and_unmap(const std::string &msg)
+        {
+            ::munmap(const_cast<char *>(data_), size_);
+            data_ = nullptr;
+            throw std::runtime_error(msg);
+        }
+
+        const char *data_;
+        size_t size_;
+        std::vector<std::pair<uint32_t, std::pair<const char *, uint64_t>>> sections_;
+    };
+
+    // Flat parameter blob: uint64 count followed by `count` floats
+    inline void write_param_section(CheckpointWriter &w, uint32_t id, const std::vector<float> &params)
+    {
+        uint64_t count = params.size();
+        w.begin_section(id);
+        w.append(&count, sizeof(count));
+        w.append(params.data(), count * sizeof(float));
+        w.end_section();
+    }
+
+    inline const float *read_param_section(const CheckpointReader &r, uint32_t id, size_t expected)
+    {
+        auto [data, bytes] = r.section(id);
+        uint64_t count;
+        std::memcpy(&count, data, sizeof(count));
+        if (count != expected || bytes != sizeof(count) + count * sizeof(float))
+            throw std::runtime_error("checkpoint: parameter count mismatch in section " + std::to_string(id));
+        return reinterpret_cast<const float *>(data + sizeof(count));
+    }
+
+    // Adam moments of several networks, in order: header, all m, all v
+    template <typename Opt, typename NetT>
+    void write_optimizer_section(CheckpointWriter &w, Opt &opt, const std::vector<NetT *> &nets)
+    {
+        std::vector<float> m, v, net_m, net_v;
+        for (auto *net : nets)
+        {
+            opt.export_moments(*net, net_m, net_v);
+            m.insert(m.end(), net_m.begin(), net_m.end());
+            v.insert(v.end(), net_v.begin(), net_v.end());
+        }
+        ckpt::OptimizerStateHeader header{opt.b1_t, opt.b2_t, m.size()};
+        w.begin_section(ckpt::kOptimizerState);
+        w.append(&header, sizeof(header));
+        w.append(m.data(), m.size() * sizeof(float));
+        w.append(v.data(), v.size() * sizeof(float));
+        w.end_section();
+    }
+
+    template <typename Opt, typename NetT>
+    void read_optimizer_section(const CheckpointReader &r, Opt &opt, const std::vector<NetT *> &nets)
+    {
+        auto [data, bytes] = r.section(ckpt::kOptimizerState);
+        ckpt::OptimizerStateHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        if (bytes != sizeof(header) + 2 * header.count * sizeof(float))
+            throw std::runtime_error("checkpoint: optimizer section has the wrong size");
+
+        const float *m = reinterpret_cast<const float *>(data + sizeof(header));
+        const float *v = m + header.count;
+        size_t k = 0;
+        for (auto *net : nets)
+        {
+            size_t n = 0;
+            for (size_t l = 0; l < net->depth(); ++l)
+                for (auto *w : (*net)[l]->weights())
+                    n += w->size();
+            if (k + n > header.count)
+                throw std::runtime_error("checkpoint: optimizer state does not match the networks");
+            opt.import_moments(*net, m + k, v + k);
+            k += n;
+        }
+        opt.b1_t = header.b1_t;
+        opt.b2_t = header.b2_t;
+    }
+}
\ No newline at end of file
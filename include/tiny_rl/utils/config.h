@@ -1,4 +1,7 @@
 #pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
 
 namespace tiny_rl
 {
@@ -14,6 +17,10 @@ namespace tiny_rl
         int target_update_freq;
         int learn_start = 500;        // env steps before training begins
         int train_frequency = 4;    // how many steps between gradient updates
+        bool prefetch_batches = false; // sample the next batch on a background thread while training
+        bool cache_target_values = false; // reuse target Q(s') per replay slot between hard target updates
+        int learner_threads = 1;       // > 1 splits each minibatch over this many data-parallel shards
+        int log_interval = 500;        // gradient steps between learner metric records
     };
 
     struct PPOConfig
@@ -27,4 +34,77 @@ namespace tiny_rl
         int mini_epochs = 4;
         int buffer_capacity = 2048;
     };
-}
\ No newline at end of file
+
+    struct ActorLearnerConfig
+    {
+        int num_actors = 2;
+        float replay_ratio = 0.25f;   // gradient updates per env step, <= 0 disables throttling
+        int publish_interval = 100;   // learner steps between weight publishes to the actors
+        int report_interval = 100;    // episodes between throughput reports
+        std::vector<int> actor_cpus;  // actor i runs on actor_cpus[i % size()], empty = unpinned
+        int learner_cpu = -1;         // CPU for the learner (calling) thread, -1 = unpinned
+    };
+
+    struct ThroughputTunerConfig
+    {
+        std::vector<int> batch_sizes = {32, 64, 128};
+        std::vector<int> learner_threads = {1, 2}; // data-parallel learner shards; actors get the rest of thread_budget
+        std::vector<float> replay_ratios;          // learner throttles to try, empty = just target_update_to_data
+        int thread_budget = 0;                     // actors + learner threads per trial, 0 = hardware threads
+        float target_update_to_data = 0.25f;       // gradient updates per env step the chosen setup must sustain
+        float tolerance = 0.1f;                    // fraction the measured ratio may fall short of the target
+        double warmup_seconds = 0.5;               // per trial, fills replay before measuring
+        double trial_seconds = 2.0;                // measured part of each trial
+    };
+
+    struct EvaluationConfig
+    {
+        int interval_steps = 10000;    // env steps between snapshots; 0 = only explicit evaluate() calls
+        int episodes = 10;             // greedy episodes per evaluation
+        int num_threads = 1;           // evaluation threads, each with its own env
+        int max_episode_steps = 10000; // cut an episode off after this many steps
+    };
+
+    struct PopulationConfig
+    {
+        int slice_steps = 1000;       // env steps each member runs per scheduling round
+        int exploit_interval = 20000; // env steps per member between exploit/explore, 0 = plain sweep
+        float truncation = 0.25f;     // bottom fraction that copies from the top fraction
+        float perturb = 0.2f;         // explore scales each tuned hyperparameter by 1 +/- perturb
+        int score_window = 10;        // recent episodes a member's score averages over
+        unsigned seed = 0;            // exploit/explore draws, 0 = random
+    };
+
+    struct MultiProcessConfig
+    {
+        int num_actors = 2;
+        std::string shm_name = "/tiny_rl_replay"; // POSIX shared-memory segment name
+        size_t capacity = 100000;     // transitions in the shared arena
+        float replay_ratio = 0.25f;   // gradient updates per env step, <= 0 disables throttling
+        int publish_interval = 100;   // learner steps between weight publishes to the actors
+        int report_interval = 100;    // episodes between throughput reports
+        bool respawn_actors = true;   // restart actor processes that crash
+    };
+
+    struct ThreadPoolConfig
+    {
+        size_t num_threads = 0;   // 0 = one per available CPU, minus one for the caller
+        bool pin_threads = false; // pin worker i to cpus[i % cpus.size()]
+        std::vector<int> cpus;    // CPUs to spread workers over, empty = all allowed
+        int numa_node = -1;       // with no explicit cpus, use this node's CPUs
+    };
+
+    enum class MetricsFormat
+    {
+        kJsonl,
+        kCsv,
+    };
+
+    struct MetricsLoggerConfig
+    {
+        std::string path = "metrics.jsonl";
+        MetricsFormat format = MetricsFormat::kJsonl;
+        size_t ring_capacity = 4096;  // records per producing thread, rounded up to a power of two
+        int flush_interval_ms = 100;  // how often the writer thread drains the rings
+    };
+}
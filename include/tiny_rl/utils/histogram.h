@@ -0,0 +1,119 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
+namespace tiny_rl
+{
+    // Log-linear histogram of non-negative integer samples (latencies in
+    // ns/us, batch sizes, ...). Values below 8 are exact, above that each
+    // power of two is split into 8 buckets, so any percentile is within
+    // 12.5% of the true value. Fixed size, no allocation, not thread-safe.
+    class LogHistogram
+    {
+    public:
+        static constexpr int kSubBuckets = 8;
+        static constexpr int kBuckets = kSubBuckets + 61 * kSubBuckets;
+
+        void record(uint64_t value)
+        {
+            ++counts_[bucket(value)];
+            ++count_;
+            sum_ += value;
+            max_ = std::max(max_, value);
+        }
+
+        void merge(const LogHistogram &other)
+        {
+            for (int i = 0; i < kBuckets; ++i)
+                counts_[i] += other.counts_[i];
+            count_ += other.count_;
+            sum_ += other.sum_;
+            max_ = std::max(max_, other.max_);
+        }
+
+        // Folds in raw bucket counts kept elsewhere (e.g. updated atomically
+        // by another thread), indexed like bucket()
+        void merge_buckets(const uint64_t *counts, uint64_t sum, uint64_t max)
+        {
+            for (int i = 0; i < kBuckets; ++i)
+            {
+                counts_[i] += counts[i];
+                count_ += counts[i];
+            }
+            sum_ += sum;
+            max_ = std::max(max_, max);
+        }
+
+        // Removes an earlier snapshot of this histogram, leaving the samples
+        // recorded since; the max is kept as is
+        void subtract(const LogHistogram &earlier)
+        {
+            for (int i = 0; i < kBuckets; ++i)
+                counts_[i] -= earlier.counts_[i];
+            count_ -= earlier.count_;
+            sum_ -= earlier.sum_;
+        }
+
+        void reset()
+        {
+            counts_.fill(0);
+            count_ = sum_ = max_ = 0;
+        }
+
+        // p in [0, 1]; returns the upper bound of the bucket holding it
+        uint64_t percentile(double p) const
+        {
+            if (count_ == 0)
+                return 0;
+            uint64_t rank = static_cast<uint64_t>(p * (count_ - 1)) + 1;
+            uint64_t seen = 0;
+            for (int i = 0; i < kBuckets; ++i)
+            {
+                seen += counts_[i];
+                if (seen >= rank)
+                    return std::min(bucket_upper(i), max_);
+            }
+            return max_;
+        }
+
+        uint64_t count() const
+        {
+            return count_;
+        }
+
+        uint64_t max() const
+        {
+            return max_;
+        }
+
+        double mean() const
+        {
+            return count_ > 0 ? static_cast<double>(sum_) / count_ : 0.0;
+        }
+
+        static int bucket(uint64_t v)
+        {
+            if (v < kSubBuckets)
+                return static_cast<int>(v);
+            int msb = 63 - __builtin_clzll(v);
+            int shift = msb - 3;
+            return kSubBuckets + shift * kSubBuckets + static_cast<int>((v >> shift) & (kSubBuckets - 1));
+        }
+
+    private:
+        static uint64_t bucket_upper(int b)
+        {
+            if (b < kSubBuckets)
+                return static_cast<uint64_t>(b);
+            int shift = (b - kSubBuckets) / kSubBuckets;
+            uint64_t sub = (b - kSubBuckets) % kSubBuckets;
+            return ((kSubBuckets + sub) << shift) + ((uint64_t(1) << shift) - 1);
+        }
+
+        std::array<uint64_t, kBuckets> counts_{};
+        uint64_t count_ = 0;
+        uint64_t sum_ = 0;
+        uint64_t max_ = 0;
+    };
+}
@@ -0,0 +1,298 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "config.h"
+
+/*
+ Asynchronous metrics logger. Training threads call log_metric(), which
+ writes one fixed-size record into a ring owned by the calling thread: no
+ lock, no allocation after the thread's first record, no I/O. A background
+ thread wakes every flush_interval_ms, drains all rings and appends the
+ records to a JSONL or CSV file. A full ring drops the record and counts
+ it rather than wait for the writer.
+
+ Records from different threads are written in drain order, not strictly
+ by time; the `t` column carries the producer's timestamp.
+*/
+
+namespace tiny_rl
+{
+    enum class Metric : uint32_t
+    {
+        kLoss,
+        kQAbsMax,
+        kWeightNorm,
+        kEpsilon,
+        kEpisodeReward,
+        kDoneRatio,
+        kTargetCacheHitRate,
+        kTargetSync,
+        kPolicyUpdate,
+        kEvalReturnMean, // greedy evaluation of a weight snapshot, step = env steps at the snapshot
+        kEvalReturnP10,
+        kEvalReturnP50,
+        kEvalReturnP90,
+        kNumMetrics,
+    };
+
+    inline const char *metric_name(Metric metric)
+    {
+        static const char *names[] = {
+            "loss", "q_abs_max", "weight_norm", "epsilon", "episode_reward",
+            "done_ratio", "target_cache_hit_rate", "target_sync", "policy_update",
+            "eval_return_mean", "eval_return_p10", "eval_return_p50", "eval_return_p90"};
+        uint32_t i = static_cast<uint32_t>(metric);
+        return i < static_cast<uint32_t>(Metric::kNumMetrics) ? names[i] : "unknown";
+    }
+
+    struct MetricRecord
+    {
+        uint64_t time_ns; // since the logger started
+        uint64_t step;
+        Metric metric;
+        uint32_t thread;  // producer ring index
+        float value;
+    };
+
+    class MetricsLogger
+    {
+    public:
+        explicit MetricsLogger(MetricsLoggerConfig config = {})
+            : config_(std::move(config)),
+              id_(next_id().fetch_add(1, std::memory_order_relaxed) + 1),
+              mask_(round_up_pow2(config_.ring_capacity) - 1),
+              start_(std::chrono::steady_clock::now()),
+              out_(config_.path, std::ios::out | std::ios::trunc),
+              stop_(false)
+        {
+            if (!out_)
+                throw std::runtime_error("MetricsLogger: cannot open " + config_.path);
+            if (config_.format == MetricsFormat::kCsv)
+                out_ << "t,thread,step,metric,value\n";
+            writer_ = std::thread([this]
+                                  { run(); });
+        }
+
+        MetricsLogger(const MetricsLogger &) = delete;
+        MetricsLogger &operator=(const MetricsLogger &) = delete;
+
+        // Stop all producers first; remaining records are written before closing
+        ~MetricsLogger()
+        {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                stop_ = true;
+            }
+            wake_.notify_one();
+            writer_.join();
+
+            Ring *ring = rings_.load(std::memory_order_acquire);
+            while (ring)
+            {
+                Ring *next = ring->next;
+                delete ring;
+                ring = next;
+            }
+        }
+
+        // Hot path: never blocks
+        void log(Metric metric, uint64_t step, float value)
+        {
+            Ring &ring = local_ring();
+            uint64_t head = ring.head.load(std::memory_order_relaxed);
+            if (head - ring.tail.load(std::memory_order_acquire) > mask_)
+            {
+                ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            MetricRecord &r = ring.records[head & mask_];
+            r.time_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                  std::chrono::steady_clock::now() - start_)
+                                                  .count());
+            r.step = step;
+            r.metric = metric;
+            r.thread = ring.index;
+            r.value = value;
+            ring.head.store(head + 1, std::memory_order_release);
+        }
+
+        // Records discarded because a ring was full
+        uint64_t dropped() const
+        {
+            uint64_t n = 0;
+            for (Ring *ring = rings_.load(std::memory_order_acquire); ring; ring = ring->next)
+                n += ring->dropped.load(std::memory_order_relaxed);
+            return n;
+        }
+
+        uint64_t written() const
+        {
+            return written_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Ring
+        {
+            Ring(size_t capacity, uint32_t index, std::thread::id owner)
+                : records(new MetricRecord[capacity]), index(index), owner(owner)
+            {
+            }
+
+            alignas(64) std::atomic<uint64_t> head{0}; // producer
+            alignas(64) std::atomic<uint64_t> tail{0}; // writer thread
+            std::atomic<uint64_t> dropped{0};
+            std::unique_ptr<MetricRecord[]> records;
+            const uint32_t index;
+            const std::thread::id owner;
+            Ring *next = nullptr;
+        };
+
+        static std::atomic<uint64_t> &next_id()
+        {
+            static std::atomic<uint64_t> id{0};
+            return id;
+        }
+
+        static size_t round_up_pow2(size_t n)
+        {
+            size_t p = 1;
+            while (p < n)
+                p <<= 1;
+            return p;
+        }
+
+        Ring &local_ring()
+        {
+            struct Cache
+            {
+                uint64_t logger_id = 0;
+                Ring *ring = nullptr;
+            };
+            thread_local Cache cache;
+            if (cache.logger_id != id_)
+            {
+                cache.ring = find_or_add_ring();
+                cache.logger_id = id_;
+            }
+            return *cache.ring;
+        }
+
+        // Rings are never removed, so a thread reusing a dead thread's id
+        // simply takes over its ring; new rings are pushed with a CAS
+        Ring *find_or_add_ring()
+        {
+            auto self = std::this_thread::get_id();
+            Ring *head = rings_.load(std::memory_order_acquire);
+            for (Ring *ring = head; ring; ring = ring->next)
+                if (ring->owner == self)
+                    return ring;
+
+            Ring *ring = new Ring(mask_ + 1, num_rings_.fetch_add(1, std::memory_order_relaxed), self);
+            ring->next = head;
+            while (!rings_.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_acquire))
+            {
+            }
+            return ring;
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            while (true)
+            {
+                bool stop = wake_.wait_for(lock, std::chrono::milliseconds(config_.flush_interval_ms), [this]
+                                           { return stop_; });
+                lock.unlock();
+                drain(); // one last pass after stop
+                if (stop)
+                    return;
+                lock.lock();
+            }
+        }
+
+        void drain()
+        {
+            uint64_t n = 0;
+            for (Ring *ring = rings_.load(std::memory_order_acquire); ring; ring = ring->next)
+            {
+                uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+                uint64_t head = ring->head.load(std::memory_order_acquire);
+                for (; tail != head; ++tail, ++n)
+                    write(ring->records[tail & mask_]);
+                ring->tail.store(tail, std::memory_order_release);
+            }
+            if (n > 0)
+            {
+                out_.flush();
+                written_.fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+
+        void write(const MetricRecord &r)
+        {
+            char line[192];
+            double t = r.time_ns * 1e-9;
+            int len;
+            if (config_.format == MetricsFormat::kCsv)
+                len = std::snprintf(line, sizeof(line), "%.6f,%u,%llu,%s,%.9g\n",
+                                    t, r.thread, static_cast<unsigned long long>(r.step),
+                                    metric_name(r.metric), r.value);
+            else
+                len = std::snprintf(line, sizeof(line),
+                                    "{\"t\":%.6f,\"thread\":%u,\"step\":%llu,\"metric\":\"%s\",\"value\":%.9g}\n",
+                                    t, r.thread, static_cast<unsigned long long>(r.step),
+                                    metric_name(r.metric), r.value);
+            out_.write(line, len);
+        }
+
+        MetricsLoggerConfig config_;
+        const uint64_t id_;
+        const size_t mask_;
+        const std::chrono::steady_clock::time_point start_;
+        std::ofstream out_;
+
+        std::atomic<Ring *> rings_{nullptr};
+        std::atomic<uint32_t> num_rings_{0};
+        std::atomic<uint64_t> written_{0};
+
+        std::mutex wake_mutex_; // writer thread only; producers never touch it
+        std::condition_variable wake_;
+        bool stop_;
+        std::thread writer_;
+    };
+
+    namespace detail
+    {
+        inline std::atomic<MetricsLogger *> &installed_logger()
+        {
+            static std::atomic<MetricsLogger *> logger{nullptr};
+            return logger;
+        }
+    }
+
+    // Routes log_metric() to `logger`; nullptr turns metric logging off.
+    // Uninstall before destroying the logger.
+    inline void set_metrics_logger(MetricsLogger *logger)
+    {
+        detail::installed_logger().store(logger, std::memory_order_release);
+    }
+
+    inline MetricsLogger *metrics_logger()
+    {
+        return detail::installed_logger().load(std::memory_order_acquire);
+    }
+
+    inline void log_metric(Metric metric, uint64_t step, float value)
+    {
+        if (MetricsLogger *logger = metrics_logger())
+            logger->log(metric, step, value);
+    }
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ Local launcher for actor processes. spawn() forks one child per actor id
+ and runs the entry point there; the child leaves with _exit() so it never
+ runs the parent's destructors (thread pools, shared-memory owners, ...).
+ Fork before starting work that holds locks in other threads of the
+ parent; the child only inherits the forking thread. poll(true) forks
+ again whenever a child dies, so to restart children while the parent
+ runs threads, do it from a single-threaded child that owns the launcher.
+*/
+
+namespace tiny_rl
+{
+    class ProcessLauncher
+    {
+    public:
+        // entry(actor_id) runs in the child; its return value is the exit code
+        using Entry = std::function<int(int)>;
+
+        explicit ProcessLauncher(Entry entry)
+            : entry_(std::move(entry))
+        {
+        }
+
+        ProcessLauncher(const ProcessLauncher &) = delete;
+        ProcessLauncher &operator=(const ProcessLauncher &) = delete;
+
+        ~ProcessLauncher()
+        {
+            terminate();
+        }
+
+        void spawn(int num_actors)
+        {
+            for (int id = 0; id < num_actors; ++id)
+            {
+                pids_.push_back(-1);
+                start(id);
+            }
+        }
+
+        // Reaps actors that died and restarts them if `respawn`; returns how
+        // many exited abnormally (signal or non-zero status) in this call
+        int poll(bool respawn)
+        {
+            int failures = 0;
+            for (size_t id = 0; id < pids_.size(); ++id)
+            {
+                if (pids_[id] <= 0)
+                    continue;
+                int status = 0;
+                pid_t r = ::waitpid(pids_[id], &status, WNOHANG);
+                if (r != pids_[id])
+                    continue;
+                pids_[id] = -1;
+                if (WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0))
+                {
+                    ++failures;
+                    ++crashes_;
+                    if (respawn)
+                        start(static_cast<int>(id));
+                }
+            }
+            return failures;
+        }
+
+        // Waits up to `timeout` for every actor to exit, then kills the rest
+        void join(std::chrono::milliseconds timeout = std::chrono::milliseconds(2000))
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            while (running() > 0 && std::chrono::steady_clock::now() < deadline)
+            {
+                poll(false);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            terminate();
+        }
+
+        size_t running() const
+        {
+            size_t n = 0;
+            for (pid_t p : pids_)
+                n += p > 0;
+            return n;
+        }
+
+        size_t crashes() const
+        {
+            return crashes_;
+        }
+
+    private:
+        void start(int id)
+        {
+            std::cout.flush();
+            std::fflush(nullptr); // or buffered output is printed twice
+            pid_t pid = ::fork();
+            if (pid < 0)
+                throw std::runtime_error("ProcessLauncher: fork failed");
+            if (pid == 0)
+            {
+                int code = 1;
+                try
+                {
+                    code = entry_(id);
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "actor " << id << ": " << e.what() << std::endl;
+                }
+                std::cout.flush();
+                std::fflush(nullptr);
+                ::_exit(code);
+            }
+            pids_[id] = pid;
+        }
+
+        void terminate()
+        {
+            for (pid_t &p : pids_)
+            {
+                if (p <= 0)
+                    continue;
+                ::kill(p, SIGKILL);
+                ::waitpid(p, nullptr, 0);
+                p = -1;
+            }
+        }
+
+        Entry entry_;
+        std::vector<pid_t> pids_;
+        size_t crashes_ = 0;
+    };
+}
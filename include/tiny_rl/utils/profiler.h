@@ -0,0 +1,268 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "histogram.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ Hot-path profiler. TINY_RL_PROFILE_SCOPE(kPhase) times the rest of the
+ enclosing scope into the calling thread's histogram for that phase. Each
+ thread owns its histograms and bumps buckets with relaxed atomic stores,
+ so recording takes no lock and never contends; summaries read them from
+ any thread. Timestamps come from the TSC where available (converted to
+ time with a ratio measured against steady_clock) and steady_clock
+ elsewhere.
+
+ Build with -DTINY_RL_PROFILE=1 to enable. Otherwise the macros expand to
+ nothing and the instrumented code is unchanged.
+*/
+
+#ifndef TINY_RL_PROFILE
+#define TINY_RL_PROFILE 0
+#endif
+
+namespace tiny_rl
+{
+    namespace profiler
+    {
+        enum Phase : uint32_t
+        {
+            kEnvStep,
+            kSelectAction,
+            kReplayAdd,
+            kReplaySample,
+            kTdTargets,
+            kTrain,     // forward/backward and weight update
+            kOptimizer, // nested inside kTrain
+            kPriorityUpdate, // TD errors and replay priority write-back
+            kTargetUpdate,
+            kNumPhases,
+        };
+
+        inline const char *phase_name(uint32_t phase)
+        {
+            static const char *names[kNumPhases] = {
+                "env_step", "select_action", "replay_add", "replay_sample",
+                "td_targets", "train", "optimizer", "priority_update", "target_update"};
+            return phase < kNumPhases ? names[phase] : "unknown";
+        }
+
+        inline uint64_t ticks()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now().time_since_epoch())
+                                             .count());
+#endif
+        }
+
+        struct PhaseSummary
+        {
+            const char *name;
+            uint64_t count;
+            double per_sec;  // calls per second over the window
+            double p50_us;
+            double p99_us;
+            double mean_us;
+            double share;    // fraction of wall time, summed over threads
+        };
+
+        // One thread's histograms; only the owner writes
+        struct ThreadProfile
+        {
+            struct PhaseData
+            {
+                std::array<std::atomic<uint64_t>, LogHistogram::kBuckets> counts{};
+                std::atomic<uint64_t> sum{0};
+                std::atomic<uint64_t> max{0};
+            };
+
+            void record(uint32_t phase, uint64_t t)
+            {
+                PhaseData &p = phases[phase];
+                auto &c = p.counts[LogHistogram::bucket(t)];
+                // single writer: plain load/store, no read-modify-write
+                c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                p.sum.store(p.sum.load(std::memory_order_relaxed) + t, std::memory_order_relaxed);
+                if (t > p.max.load(std::memory_order_relaxed))
+                    p.max.store(t, std::memory_order_relaxed);
+            }
+
+            void fold_into(std::array<LogHistogram, kNumPhases> &out) const
+            {
+                std::array<uint64_t, LogHistogram::kBuckets> counts;
+                for (uint32_t ph = 0; ph < kNumPhases; ++ph)
+                {
+                    const PhaseData &p = phases[ph];
+                    for (int b = 0; b < LogHistogram::kBuckets; ++b)
+                        counts[b] = p.counts[b].load(std::memory_order_relaxed);
+                    out[ph].merge_buckets(counts.data(), p.sum.load(std::memory_order_relaxed),
+                                          p.max.load(std::memory_order_relaxed));
+                }
+            }
+
+            std::array<PhaseData, kNumPhases> phases;
+        };
+
+        class Registry
+        {
+        public:
+            static Registry &instance()
+            {
+                static Registry registry;
+                return registry;
+            }
+
+            ThreadProfile &local()
+            {
+                thread_local Handle handle(*this);
+                return *handle.profile;
+            }
+
+            // Per-phase statistics since the previous call (or start);
+            // starts a new window
+            std::vector<PhaseSummary> collect()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::array<LogHistogram, kNumPhases> total;
+                for (uint32_t ph = 0; ph < kNumPhases; ++ph)
+                    total[ph].merge(retired_[ph]);
+                for (auto *p : live_)
+                    p->fold_into(total);
+
+                auto now_wall = std::chrono::steady_clock::now();
+                uint64_t now_ticks = ticks();
+                double wall_ns = std::chrono::duration<double, std::nano>(now_wall - window_wall_).count();
+                double total_ns = std::chrono::duration<double, std::nano>(now_wall - start_wall_).count();
+                double ns_per_tick = now_ticks > start_ticks_ ? total_ns / (now_ticks - start_ticks_) : 1.0;
+
+                std::vector<PhaseSummary> out;
+                for (uint32_t ph = 0; ph < kNumPhases; ++ph)
+                {
+                    LogHistogram window = total[ph];
+                    window.subtract(last_[ph]);
+                    last_[ph] = total[ph];
+                    PhaseSummary s{};
+                    s.name = phase_name(ph);
+                    s.count = window.count();
+                    if (s.count == 0)
+                        continue;
+                    s.per_sec = wall_ns > 0 ? s.count / (wall_ns * 1e-9) : 0.0;
+                    s.p50_us = window.percentile(0.50) * ns_per_tick * 1e-3;
+                    s.p99_us = window.percentile(0.99) * ns_per_tick * 1e-3;
+                    s.mean_us = window.mean() * ns_per_tick * 1e-3;
+                    s.share = wall_ns > 0 ? window.mean() * s.count * ns_per_tick / wall_ns : 0.0;
+                    out.push_back(s);
+                }
+                window_wall_ = now_wall;
+                return out;
+            }
+
+            void report(std::ostream &os)
+            {
+                auto phases = collect();
+                auto precision = os.precision(3);
+                os << "[profile]";
+                for (const auto &s : phases)
+                    os << "  " << s.name
+                       << " n=" << s.count
+                       << " " << s.per_sec << "/s"
+                       << " p50=" << s.p50_us << "us"
+                       << " p99=" << s.p99_us << "us"
+                       << " " << s.share * 100.0 << "%";
+                os << "\n";
+                os.precision(precision);
+            }
+
+        private:
+            struct Handle
+            {
+                explicit Handle(Registry &r) : registry(r), profile(std::make_unique<ThreadProfile>())
+                {
+                    std::lock_guard<std::mutex> lock(registry.mutex_);
+                    registry.live_.push_back(profile.get());
+                }
+
+                // fold the exiting thread's samples into the retired totals
+                ~Handle()
+                {
+                    std::lock_guard<std::mutex> lock(registry.mutex_);
+                    std::array<LogHistogram, kNumPhases> mine;
+                    profile->fold_into(mine);
+                    for (uint32_t ph = 0; ph < kNumPhases; ++ph)
+                        registry.retired_[ph].merge(mine[ph]);
+                    auto &live = registry.live_;
+                    for (size_t i = 0; i < live.size(); ++i)
+                        if (live[i] == profile.get())
+                        {
+                            live[i] = live.back();
+                            live.pop_back();
+                            break;
+                        }
+                }
+
+                Registry &registry;
+                std::unique_ptr<ThreadProfile> profile;
+            };
+
+            Registry()
+                : start_wall_(std::chrono::steady_clock::now()),
+                  window_wall_(start_wall_),
+                  start_ticks_(ticks())
+            {
+            }
+
+            std::mutex mutex_;
+            std::vector<ThreadProfile *> live_;
+            std::array<LogHistogram, kNumPhases> retired_;
+            std::array<LogHistogram, kNumPhases> last_;
+            std::chrono::steady_clock::time_point start_wall_;
+            std::chrono::steady_clock::time_point window_wall_;
+            uint64_t start_ticks_;
+        };
+
+        class ScopedTimer
+        {
+        public:
+            explicit ScopedTimer(Phase phase)
+                : profile_(Registry::instance().local()), phase_(phase), start_(ticks())
+            {
+            }
+
+            ~ScopedTimer()
+            {
+                profile_.record(phase_, ticks() - start_);
+            }
+
+            ScopedTimer(const ScopedTimer &) = delete;
+            ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+        private:
+            ThreadProfile &profile_;
+            Phase phase_;
+            uint64_t start_;
+        };
+    }
+}
+
+#define TINY_RL_PROFILE_CONCAT_(a, b) a##b
+#define TINY_RL_PROFILE_CONCAT(a, b) TINY_RL_PROFILE_CONCAT_(a, b)
+
+#if TINY_RL_PROFILE
+#define TINY_RL_PROFILE_SCOPE(phase) \
+    ::tiny_rl::profiler::ScopedTimer TINY_RL_PROFILE_CONCAT(tiny_rl_profile_, __LINE__)(::tiny_rl::profiler::phase)
+#define TINY_RL_PROFILE_REPORT(os) ::tiny_rl::profiler::Registry::instance().report(os)
+#else
+#define TINY_RL_PROFILE_SCOPE(phase) ((void)0)
+#define TINY_RL_PROFILE_REPORT(os) ((void)0)
+#endif
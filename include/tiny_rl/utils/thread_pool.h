@@ -0,0 +1,365 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include "config.h"
+
+/*
+ Work-stealing task pool shared by the library. Each worker owns a deque:
+ it pushes and pops its own tasks at the back and steals from the front of
+ the others when it runs dry. Threads that are not workers submit round
+ robin and, while they wait, run queued tasks themselves (help_until), so
+ nested parallel_for calls cannot deadlock.
+
+ Workers can be pinned to CPUs, either an explicit list or every CPU of one
+ NUMA node (read from sysfs, no libnuma needed). Linux places pages on the
+ node of the thread that first touches them, so buffers a pinned worker
+ fills stay node-local.
+*/
+
+namespace tiny_rl
+{
+    // CPUs this thread may run on
+    inline std::vector<int> thread_affinity()
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        std::vector<int> cpus;
+        if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            return cpus;
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &set))
+                cpus.push_back(c);
+        return cpus;
+    }
+
+    // Restricts the calling thread to `cpus`; returns false if the OS refuses
+    inline bool set_thread_affinity(const std::vector<int> &cpus)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : cpus)
+            if (c >= 0 && c < CPU_SETSIZE)
+                CPU_SET(c, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    // CPU list of a NUMA node, e.g. "0-3,8-11" in sysfs; empty if unknown
+    inline std::vector<int> numa_node_cpus(int node)
+    {
+        std::vector<int> cpus;
+        std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+        std::FILE *f = std::fopen(path.c_str(), "r");
+        if (!f)
+            return cpus;
+        int lo, hi;
+        while (std::fscanf(f, "%d", &lo) == 1)
+        {
+            hi = lo;
+            int sep = std::fgetc(f);
+            if (sep == '-')
+            {
+                if (std::fscanf(f, "%d", &hi) != 1)
+                    break;
+                sep = std::fgetc(f);
+            }
+            for (int c = lo; c <= hi; ++c)
+                cpus.push_back(c);
+            if (sep != ',')
+                break;
+        }
+        std::fclose(f);
+        return cpus;
+    }
+
+    class ThreadPool
+    {
+    public:
+        using Task = std::function<void()>;
+
+        explicit ThreadPool(ThreadPoolConfig config = {})
+            : config_(std::move(config)),
+              pending_(0),
+              next_queue_(0),
+              stop_(false)
+        {
+            cpus_ = config_.cpus;
+            if (cpus_.empty() && config_.numa_node >= 0)
+            {
+                cpus_ = numa_node_cpus(config_.numa_node);
+                if (cpus_.empty())
+                    throw std::invalid_argument("ThreadPool: unknown NUMA node " + std::to_string(config_.numa_node));
+            }
+            if (cpus_.empty())
+                cpus_ = thread_affinity();
+
+            size_t n = config_.num_threads;
+            if (n == 0)
+            {
+                // leave one CPU for the thread that submits and helps
+                size_t avail = cpus_.empty() ? std::thread::hardware_concurrency() : cpus_.size();
+                n = std::max<size_t>(1, avail > 1 ? avail - 1 : 1);
+            }
+
+            for (size_t i = 0; i < n; ++i)
+                queues_.push_back(std::make_unique<Queue>());
+            for (size_t i = 0; i < n; ++i)
+                threads_.emplace_back([this, i]
+                                      { worker_loop(i); });
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex_);
+                stop_ = true;
+            }
+            sleep_cv_.notify_all();
+            for (auto &t : threads_)
+                t.join();
+        }
+
+        size_t size() const
+        {
+            return threads_.size();
+        }
+
+        // CPUs the workers are spread over (all allowed CPUs if unpinned)
+        const std::vector<int> &cpus() const
+        {
+            return cpus_;
+        }
+
+        // Fire-and-forget. Tasks must not throw; use parallel_for for work
+        // that can fail.
+        void submit(Task task)
+        {
+            size_t q = (current_pool() == this) ? current_index() : next_queue_.fetch_add(1) % queues_.size();
+            {
+                std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+                queues_[q]->tasks.push_back(std::move(task));
+            }
+            pending_.fetch_add(1);
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex_);
+            }
+            sleep_cv_.notify_one();
+        }
+
+        // Runs one queued task on the calling thread, if there is one
+        bool run_pending()
+        {
+            Task task;
+            size_t home = (current_pool() == this) ? current_index() : 0;
+            if (!take(home, task))
+                return false;
+            task();
+            return true;
+        }
+
+        // Keeps the calling thread busy with queued tasks until done() holds
+        template <typename Pred>
+        void help_until(Pred done)
+        {
+            while (!done())
+                if (!run_pending())
+                    std::this_thread::yield();
+        }
+
+        // Splits [0, n) into chunks of `grain` and runs fn(begin, end) on each,
+        // the caller included. Chunk boundaries depend only on n and grain, so
+        // per-chunk reductions combined in chunk order are reproducible for any
+        // pool size. Rethrows the first exception after all chunks finish.
+        template <typename Fn>
+        void parallel_for(size_t n, size_t grain, Fn &&fn)
+        {
+            grain = std::max<size_t>(grain, 1);
+            size_t chunks = (n + grain - 1) / grain;
+            if (chunks <= 1)
+            {
+                if (n > 0)
+                    fn(size_t(0), n);
+                return;
+            }
+
+            struct Shared
+            {
+                std::atomic<size_t> next{0};
+                std::atomic<size_t> helpers{0};
+                std::mutex error_mutex;
+                std::exception_ptr error;
+            } shared;
+
+            auto drain = [&]
+            {
+                size_t c;
+                while ((c = shared.next.fetch_add(1)) < chunks)
+                {
+                    size_t begin = c * grain;
+                    try
+                    {
+                        fn(begin, std::min(n, begin + grain));
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(shared.error_mutex);
+                        if (!shared.error)
+                            shared.error = std::current_exception();
+                    }
+                }
+            };
+
+            size_t helpers = std::min(chunks - 1, size());
+            shared.helpers = helpers;
+            for (size_t h = 0; h < helpers; ++h)
+                submit([&]
+                       { drain(); shared.helpers.fetch_sub(1); });
+            drain();
+            // helpers reference this frame, so wait until all have started and left
+            help_until([&]
+                       { return shared.helpers.load() == 0; });
+
+            if (shared.error)
+                std::rethrow_exception(shared.error);
+        }
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        static ThreadPool *&current_pool()
+        {
+            thread_local ThreadPool *pool = nullptr;
+            return pool;
+        }
+
+        static size_t &current_index()
+        {
+            thread_local size_t index = 0;
+            return index;
+        }
+
+        // Own queue from the back, then steal from the others' fronts
+        bool take(size_t home, Task &task)
+        {
+            if (pending_.load() == 0)
+                return false;
+            size_t n = queues_.size();
+            for (size_t k = 0; k < n; ++k)
+            {
+                Queue &q = *queues_[(home + k) % n];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (q.tasks.empty())
+                    continue;
+                if (k == 0 && current_pool() == this)
+                {
+                    task = std::move(q.tasks.back());
+                    q.tasks.pop_back();
+                }
+                else
+                {
+                    task = std::move(q.tasks.front());
+                    q.tasks.pop_front();
+                }
+                pending_.fetch_sub(1);
+                return true;
+            }
+            return false;
+        }
+
+        void worker_loop(size_t index)
+        {
+            current_pool() = this;
+            current_index() = index;
+            if (config_.pin_threads && !cpus_.empty())
+                set_thread_affinity({cpus_[index % cpus_.size()]});
+
+            Task task;
+            while (true)
+            {
+                if (take(index, task))
+                {
+                    task();
+                    task = nullptr;
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex_);
+                sleep_cv_.wait(lock, [this]
+                               { return stop_ || pending_.load() > 0; });
+                if (stop_)
+                    return;
+            }
+        }
+
+        ThreadPoolConfig config_;
+        std::vector<int> cpus_;
+        std::vector<std::unique_ptr<Queue>> queues_;
+        std::vector<std::thread> threads_;
+        std::atomic<size_t> pending_;
+        std::atomic<size_t> next_queue_;
+
+        std::mutex sleep_mutex_;
+        std::condition_variable sleep_cv_;
+        bool stop_;
+    };
+
+    namespace detail
+    {
+        struct SharedPoolState
+        {
+            std::mutex mutex;
+            ThreadPoolConfig config;
+            std::unique_ptr<ThreadPool> pool;
+            std::atomic<ThreadPool *> ready{nullptr};
+        };
+
+        inline SharedPoolState &shared_pool_state()
+        {
+            static SharedPoolState state;
+            return state;
+        }
+    }
+
+    // Sets up the library-wide pool; only allowed before its first use
+    inline void configure_shared_thread_pool(const ThreadPoolConfig &config)
+    {
+        auto &state = detail::shared_pool_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.pool)
+            throw std::logic_error("configure_shared_thread_pool: pool is already running");
+        state.config = config;
+    }
+
+    // The pool optimizers, env stepping and batch sampling submit to
+    inline ThreadPool &shared_thread_pool()
+    {
+        auto &state = detail::shared_pool_state();
+        if (ThreadPool *pool = state.ready.load(std::memory_order_acquire))
+            return *pool;
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (!state.pool)
+        {
+            state.pool = std::make_unique<ThreadPool>(state.config);
+            state.ready.store(state.pool.get(), std::memory_order_release);
+        }
+        return *state.pool;
+    }
+}
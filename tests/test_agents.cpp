@@ -0,0 +1,2112 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <cmath>
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "../include/tiny_rl/tiny_rl.h"
+#include "../include/tiny_rl/agents/ppo_agent.h"
+#include "../include/tiny_rl/serving/policy_server.h"
+#include "../include/tiny_rl/core/rollout_buffer.h"
+
+// counts every heap allocation of this binary, see utils/arena.h
+TINY_RL_DEFINE_ALLOCATION_HOOKS()
+
+// temporary framework for now, generated with AI. Need to be replaced with proper testing framework
+#define TEST_CASE(name) void name()
+#define SECTION(name) std::cout << "  " << name << std::endl;
+#define REQUIRE(condition)                                                                  \
+    if (!(condition))                                                                       \
+    {                                                                                       \
+        std::cerr << "Test failed at line " << __LINE__ << ": " << #condition << std::endl; \
+        assert(condition);                                                                  \
+    }
+#define CHECK(condition)                                                                     \
+    if (!(condition))                                                                        \
+    {                                                                                        \
+        std::cerr << "Check failed at line " << __LINE__ << ": " << #condition << std::endl; \
+    }
+
+using Net = tiny_dnn::network<tiny_dnn::sequential>;
+
+void build_net(Net &n)
+{
+    n << tiny_dnn::fully_connected_layer(4, 16)
+      << tiny_dnn::relu_layer()
+      << tiny_dnn::fully_connected_layer(16, 2);
+}
+
+// init_weight() leaves every weight equal, which hides argmax and
+// sampling mistakes; spread them out deterministically instead
+void randomize_weights(Net &net, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> w(-0.5f, 0.5f);
+    for (size_t l = 0; l < net.depth(); ++l)
+        for (auto *p : net[l]->weights())
+            for (auto &x : *p)
+                x = w(gen);
+}
+
+tiny_rl::DQNConfig small_config()
+{
+    tiny_rl::DQNConfig config{0.99f, 1.0f, 0.99f, 0.05f, 0.001f, 16, 1000, 100};
+    config.learn_start = 32;
+    return config;
+}
+
+void fill_replay(tiny_rl::DQNAgent &agent, int steps)
+{
+    tiny_rl::CartPoleEnv env;
+    auto raw_state = env.reset();
+    tiny_dnn::vec_t state(raw_state.begin(), raw_state.end());
+    for (int i = 0; i < steps; ++i)
+    {
+        int action = agent.select_action(state);
+        auto [next_raw_state, reward, done] = env.step(action);
+        tiny_dnn::vec_t next_state(next_raw_state.begin(), next_raw_state.end());
+        agent.store_experience(state, action, reward, next_state, done);
+        agent.learn();
+        if (done)
+        {
+            raw_state = env.reset();
+            state.assign(raw_state.begin(), raw_state.end());
+        }
+        else
+        {
+            state = std::move(next_state);
+        }
+    }
+}
+
+TEST_CASE(test_dqn_checkpoint_roundtrip)
+{
+    std::cout << "Testing DQN checkpoint save/load" << std::endl;
+
+    Net online, target;
+    build_net(online);
+    build_net(target);
+    tiny_rl::QNetwork qnet(online, target);
+    tiny_rl::DQNAgent agent(qnet, small_config());
+    fill_replay(agent, 200);
+
+    const std::string path = "test_agents_ckpt.bin";
+    agent.save(path);
+    agent.wait_for_checkpoint();
+
+    Net online2, target2;
+    build_net(online2);
+    build_net(target2);
+    tiny_rl::QNetwork qnet2(online2, target2);
+    tiny_rl::DQNAgent restored(qnet2, small_config());
+    restored.load(path);
+
+    SECTION("Parameters match")
+    std::vector<float> a, b;
+    tiny_rl::flatten_params(online, a);
+    tiny_rl::flatten_params(online2, b);
+    REQUIRE(a == b);
+
+    SECTION("Counters and replay match")
+    REQUIRE(restored.env_steps() == agent.env_steps());
+    REQUIRE(restored.train_steps() == agent.train_steps());
+    REQUIRE(restored.replay_size() == agent.replay_size());
+
+    SECTION("Restored agent keeps learning")
+    REQUIRE(restored.train_step());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE(test_param_publisher)
+{
+    std::cout << "Testing lock-free parameter snapshots" << std::endl;
+
+    Net net;
+    build_net(net);
+    net.init_weight();
+    tiny_rl::ParamPublisher publisher(net, 2);
+    tiny_rl::FlatScratch scratch;
+    tiny_dnn::vec_t obs = {0.1f, -0.2f, 0.3f, -0.4f};
+
+    SECTION("Snapshot matches the network")
+    auto expected = net.predict(obs);
+    {
+        auto snap = publisher.acquire();
+        const float *q = snap->forward(obs.data(), scratch);
+        for (size_t a = 0; a < expected.size(); ++a)
+            REQUIRE(std::abs(q[a] - expected[a]) < 1e-5f);
+    }
+
+    SECTION("Pinned snapshot survives a publish")
+    auto pinned = publisher.acquire();
+    uint64_t before = pinned->version;
+    const float *row = pinned->forward(obs.data(), scratch);
+    std::vector<float> old_q(row, row + pinned->num_actions);
+    for (auto *w : net[0]->weights())
+        for (auto &x : *w)
+            x += 0.5f;
+    REQUIRE(publisher.publish(net));
+    REQUIRE(publisher.version() == before + 1);
+    const float *q = pinned->forward(obs.data(), scratch);
+    for (size_t a = 0; a < old_q.size(); ++a)
+        REQUIRE(q[a] == old_q[a]);
+
+    SECTION("Publish refuses to overwrite pinned slots")
+    // with two slots, one is current and the other is still pinned
+    REQUIRE(!publisher.publish(net));
+    pinned = tiny_rl::ParamPublisher::Ref();
+    REQUIRE(publisher.publish(net));
+}
+
+TEST_CASE(test_parallel_optimizer_update)
+{
+    std::cout << "Testing pooled optimizer update" << std::endl;
+
+    tiny_dnn::vec_t serial(50000), pooled, grad(50000);
+    for (size_t i = 0; i < serial.size(); ++i)
+    {
+        serial[i] = std::sin(0.1f * i);
+        grad[i] = std::cos(0.37f * i);
+    }
+    pooled = serial;
+
+    tiny_rl::clipped_adam a, b;
+    for (int k = 0; k < 3; ++k)
+    {
+        a.update(grad, serial, false);
+        b.update(grad, pooled, true);
+    }
+
+    SECTION("Pooled and serial updates are bitwise equal")
+    REQUIRE(serial == pooled);
+
+    SECTION("parallel_for rethrows task errors")
+    bool thrown = false;
+    try
+    {
+        tiny_rl::shared_thread_pool().parallel_for(8, 1, [](size_t begin, size_t)
+                                                   { if (begin == 3) throw std::runtime_error("chunk"); });
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    REQUIRE(thrown);
+}
+
+TEST_CASE(test_data_parallel_learner)
+{
+    std::cout << "Testing data-parallel learner" << std::endl;
+
+    std::vector<tiny_dnn::vec_t> inputs(37), targets(37);
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        inputs[i] = {std::sin(0.3f * i), std::cos(0.7f * i), 0.1f * (i % 5), -0.05f * i};
+        targets[i] = {std::cos(0.2f * i), std::sin(0.9f * i)};
+    }
+
+    auto run = [&](size_t workers)
+    {
+        Net net;
+        build_net(net);
+        for (size_t l = 0; l < net.depth(); ++l)
+            for (auto *w : net[l]->weights())
+                for (size_t i = 0; i < w->size(); ++i)
+                    (*w)[i] = 0.3f * std::sin(1.7f * i + l);
+        tiny_rl::clipped_adam opt;
+        tiny_rl::DataParallelLearner learner(net, workers);
+        float first = learner.train(inputs, targets, opt);
+        float last = first;
+        for (int step = 0; step < 50; ++step)
+            last = learner.train(inputs, targets, opt);
+        std::vector<float> params;
+        tiny_rl::flatten_params(net, params);
+        return std::make_pair(last < first, params);
+    };
+
+    auto a = run(3);
+    auto b = run(3);
+    auto single = run(1);
+
+    SECTION("Loss decreases")
+    REQUIRE(a.first);
+
+    SECTION("Fixed worker count is bitwise reproducible")
+    REQUIRE(a.second == b.second);
+
+    SECTION("Sharded and single-shard steps agree")
+    for (size_t i = 0; i < a.second.size(); ++i)
+        REQUIRE(std::abs(a.second[i] - single.second[i]) < 1e-4f);
+}
+
+TEST_CASE(test_shm_replay)
+{
+    std::cout << "Testing shared-memory replay arena" << std::endl;
+
+    tiny_rl::ShmReplay server("/tiny_rl_test_replay", 4, 2, sizeof(float) * 3);
+    tiny_rl::ShmReplay actor("/tiny_rl_test_replay");
+
+    SECTION("Records written through one mapping are sampled through the other")
+    float state[2] = {1.0f, 2.0f};
+    float next_state[2] = {3.0f, 4.0f};
+    actor.add(state, 1, 0.5f, next_state, true);
+    tiny_rl::SampledBatch batch;
+    std::mt19937 rng(0);
+    REQUIRE(!server.sample_batch(batch, 2, rng));
+    REQUIRE(server.sample_batch(batch, 1, rng));
+    REQUIRE(batch.actions[0] == 1);
+    REQUIRE(batch.rewards[0] == 0.5f);
+    REQUIRE(batch.dones[0]);
+    REQUIRE(batch.next_states[0][1] == 4.0f);
+
+    SECTION("Arena wraps at capacity")
+    for (int i = 0; i < 10; ++i)
+        actor.add(state, 0, 0.0f, next_state, false);
+    REQUIRE(server.size() == 4);
+    REQUIRE(server.transitions() == 11);
+
+    SECTION("Parameters reach the actor once per version")
+    float params[3] = {0.1f, 0.2f, 0.3f};
+    float copy[3] = {};
+    uint64_t seen = 0;
+    REQUIRE(!actor.fetch_params(copy, seen));
+    server.publish_params(params);
+    REQUIRE(actor.fetch_params(copy, seen));
+    REQUIRE(copy[2] == 0.3f);
+    REQUIRE(!actor.fetch_params(copy, seen));
+
+    SECTION("A producer never writes over a slot that is still being written")
+    {
+        tiny_rl::ShmReplay replay("/tiny_rl_test_claim", 2, 2, 0);
+        // a writer that took ticket 0 and died half-way leaves slot 0 odd
+        int fd = ::shm_open("/tiny_rl_test_claim", O_RDWR, 0600);
+        REQUIRE(fd >= 0);
+        struct stat st;
+        REQUIRE(::fstat(fd, &st) == 0);
+        char *base = static_cast<char *>(::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        ::close(fd);
+        REQUIRE(base != MAP_FAILED);
+        auto *header = reinterpret_cast<tiny_rl::ShmReplayHeader *>(base);
+        auto *slot0 = reinterpret_cast<std::atomic<uint64_t> *>(base + header->slots_offset);
+        header->reserved.fetch_add(1);
+        slot0->store(1);
+
+        float a[2] = {1.0f, 1.0f}, b[2] = {2.0f, 2.0f};
+        replay.add(a, 1, 1.0f, a, false); // ticket 1, slot 1
+        replay.add(b, 0, 2.0f, b, false); // ticket 2, slot 0 is busy
+        REQUIRE(slot0->load() == 1);
+        REQUIRE(replay.dropped() == 1);
+        REQUIRE(replay.transitions() == 1);
+
+        // only the intact record is ever sampled
+        replay.add(a, 1, 1.0f, a, false); // ticket 3, slot 1 again
+        tiny_rl::SampledBatch claimed;
+        REQUIRE(replay.sample_batch(claimed, 2, rng));
+        for (size_t i = 0; i < 2; ++i)
+        {
+            REQUIRE(claimed.indices[i] == 1);
+            REQUIRE(claimed.rewards[i] == 1.0f);
+        }
+        ::munmap(base, st.st_size);
+    }
+
+    SECTION("A ticket whose producer died before claiming does not block its slot")
+    {
+        tiny_rl::ShmReplay replay("/tiny_rl_test_lost", 2, 2, 0);
+        int fd = ::shm_open("/tiny_rl_test_lost", O_RDWR, 0600);
+        REQUIRE(fd >= 0);
+        struct stat st;
+        REQUIRE(::fstat(fd, &st) == 0);
+        char *base = static_cast<char *>(::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        ::close(fd);
+        REQUIRE(base != MAP_FAILED);
+        // ticket 0 is taken and never written, so slot 0 stays at seq 0
+        reinterpret_cast<tiny_rl::ShmReplayHeader *>(base)->reserved.fetch_add(1);
+
+        // a producer that waited on slot 0 would give up and drop its record
+        float v[2] = {1.0f, 1.0f};
+        for (int i = 0; i < 20; ++i)
+            replay.add(v, 0, 1.0f, v, false);
+        REQUIRE(replay.dropped() == 0);
+        REQUIRE(replay.transitions() == 20);
+        ::munmap(base, st.st_size);
+    }
+
+    SECTION("Records stay whole under concurrent producers lapping a small arena")
+    {
+        tiny_rl::ShmReplay replay("/tiny_rl_test_lap", 3, 8, 0);
+        std::vector<std::thread> producers;
+        for (int p = 0; p < 3; ++p)
+            producers.emplace_back([&replay, p]
+                                   {
+                                       float v[8];
+                                       for (int i = 0; i < 3000; ++i)
+                                       {
+                                           std::fill(v, v + 8, static_cast<float>(p * 10000 + i));
+                                           replay.add(v, p, v[0], v, false);
+                                       } });
+        tiny_rl::SampledBatch sampled;
+        bool whole = true;
+        while (replay.transitions() + replay.dropped() < 9000)
+        {
+            if (!replay.sample_batch(sampled, 2, rng))
+                continue;
+            for (size_t i = 0; i < 2; ++i)
+                for (size_t k = 0; k < 8; ++k)
+                    whole = whole && sampled.states[i][k] == sampled.rewards[i] &&
+                            sampled.next_states[i][k] == sampled.rewards[i] &&
+                            sampled.actions[i] == static_cast<int>(sampled.rewards[i]) / 10000;
+        }
+        for (auto &t : producers)
+            t.join();
+        REQUIRE(whole);
+        REQUIRE(replay.transitions() + replay.dropped() == 9000);
+    }
+
+    SECTION("The spawner restarts crashed actors, or the run ends without respawning")
+    {
+        // every actor process dies on its 60th step
+        struct CrashingEnv : tiny_rl::CartPoleEnv
+        {
+            int steps = 0;
+            std::pair<float, bool> step_into(int action, float *obs) override
+            {
+                if (++steps == 60)
+                    ::_exit(3);
+                return tiny_rl::CartPoleEnv::step_into(action, obs);
+            }
+        };
+        for (bool respawn : {true, false})
+        {
+            Net online, target;
+            build_net(online);
+            build_net(target);
+            tiny_rl::QNetwork qnet(online, target);
+            tiny_rl::DQNAgent agent(qnet, small_config());
+            tiny_rl::MultiProcessConfig config;
+            config.shm_name = "/tiny_rl_test_spawner";
+            config.capacity = 1000;
+            config.report_interval = 0;
+            config.respawn_actors = respawn;
+            tiny_rl::MultiProcessDQNTrainer trainer(agent, []
+                                                    { return std::make_shared<CrashingEnv>(); }, config);
+            trainer.train(respawn ? 20 : 1000);
+            const tiny_rl::MultiProcessStats &s = trainer.stats();
+            if (respawn)
+            {
+                REQUIRE(s.episodes >= 20);
+                REQUIRE(s.actor_crashes >= 1);
+            }
+            else
+            {
+                REQUIRE(s.episodes < 1000);
+                REQUIRE(s.actor_crashes == 2);
+            }
+        }
+    }
+
+    SECTION("Multi-process trainer rejects a zero publish interval")
+    {
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNAgent agent(qnet, small_config());
+        tiny_rl::MultiProcessConfig config;
+        config.publish_interval = 0;
+        bool threw = false;
+        try
+        {
+            tiny_rl::MultiProcessDQNTrainer trainer(agent, []
+                                                    { return std::make_shared<tiny_rl::CartPoleEnv>(); }, config);
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+    }
+}
+
+TEST_CASE(test_profiler_windows)
+{
+    std::cout << "Testing profiler windows" << std::endl;
+    using namespace tiny_rl::profiler;
+    Registry &registry = Registry::instance();
+    registry.collect(); // start a fresh window
+
+    SECTION("Samples from exited threads are kept")
+    std::thread worker([]
+                       {
+                           for (int i = 0; i < 100; ++i)
+                               ScopedTimer timer(kReplayAdd);
+                       });
+    worker.join();
+    for (int i = 0; i < 50; ++i)
+        ScopedTimer timer(kReplayAdd);
+
+    auto phases = registry.collect();
+    REQUIRE(phases.size() == 1);
+    REQUIRE(std::string(phases[0].name) == "replay_add");
+    REQUIRE(phases[0].count == 150);
+    REQUIRE(phases[0].p50_us <= phases[0].p99_us);
+
+    SECTION("Each collect() only reports its own window")
+    REQUIRE(registry.collect().empty());
+}
+
+TEST_CASE(test_metrics_logger)
+{
+    std::cout << "Testing metrics logger" << std::endl;
+    const std::string path = "test_agents_metrics.jsonl";
+
+    SECTION("Records from every thread reach the file")
+    {
+        tiny_rl::MetricsLoggerConfig config;
+        config.path = path;
+        config.flush_interval_ms = 1;
+        tiny_rl::MetricsLogger logger(config);
+        tiny_rl::set_metrics_logger(&logger);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 3; ++t)
+            threads.emplace_back([]
+                                 {
+                                     for (int i = 0; i < 1000; ++i)
+                                         tiny_rl::log_metric(tiny_rl::Metric::kLoss, i, 0.5f);
+                                 });
+        for (auto &t : threads)
+            t.join();
+        tiny_rl::set_metrics_logger(nullptr);
+        tiny_rl::log_metric(tiny_rl::Metric::kLoss, 0, 0.0f); // no logger: ignored
+        REQUIRE(logger.dropped() == 0);
+    }
+    std::ifstream in(path);
+    std::string line;
+    size_t lines = 0;
+    while (std::getline(in, line))
+        ++lines;
+    REQUIRE(lines == 3000);
+
+    SECTION("A full ring drops instead of blocking")
+    {
+        tiny_rl::MetricsLoggerConfig config;
+        config.path = path;
+        config.format = tiny_rl::MetricsFormat::kCsv;
+        config.ring_capacity = 4;
+        config.flush_interval_ms = 60000;
+        tiny_rl::MetricsLogger logger(config);
+        for (int i = 0; i < 10; ++i)
+            logger.log(tiny_rl::Metric::kEpisodeReward, i, 1.0f);
+        REQUIRE(logger.dropped() == 6);
+    }
+    std::ifstream csv(path);
+    std::getline(csv, line);
+    REQUIRE(line == "t,thread,step,metric,value");
+    std::getline(csv, line);
+    REQUIRE(line.find(",0,0,episode_reward,1") != std::string::npos);
+    std::remove(path.c_str());
+}
+
+TEST_CASE(test_offline_dataset)
+{
+    std::cout << "Testing offline dataset recording and loading" << std::endl;
+    const std::string path = "test_agents_dataset.bin";
+
+    SECTION("Recorded transitions read back in order")
+    {
+        tiny_rl::TransitionRecorder recorder(path, 4, 32);
+        for (int i = 0; i < 100; ++i)
+        {
+            float f = static_cast<float>(i);
+            recorder.record({f, f, f, f}, i % 2, 0.5f * f, {f + 1, f + 1, f + 1, f + 1}, i % 10 == 9);
+        }
+        recorder.close();
+        REQUIRE(recorder.recorded() == 100);
+    }
+    {
+        tiny_rl::OfflineDataset data(path);
+        REQUIRE(data.size() == 100);
+        REQUIRE(data.state_dim() == 4);
+        REQUIRE(data.episodes() == 10);
+        auto e = data.at(77);
+        REQUIRE(e.state[3] == 77.0f && e.next_state[0] == 78.0f);
+        REQUIRE(e.action == 1 && e.reward == 38.5f && !e.done);
+        REQUIRE(data.at(79).done);
+
+        SECTION("Shuffled batches cover an epoch and repeat for a seed")
+        tiny_rl::OfflineBatchLoader a(data, 20, 7), b(data, 20, 7);
+        std::vector<int> seen(100, 0);
+        for (int k = 0; k < 5; ++k)
+        {
+            const auto &ba = a.acquire();
+            const auto &bb = b.acquire();
+            REQUIRE(ba.indices == bb.indices);
+            for (size_t i = 0; i < ba.indices.size(); ++i)
+            {
+                ++seen[ba.indices[i]];
+                REQUIRE(ba.states[i][0] == static_cast<float>(ba.indices[i]));
+            }
+            a.release();
+            b.release();
+        }
+        for (int c : seen)
+            REQUIRE(c == 1);
+
+        SECTION("Batches train a DQN agent")
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNAgent agent(qnet, small_config());
+        agent.train_step(a.acquire());
+        a.release();
+    }
+
+    SECTION("A truncated file keeps its complete chunks")
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), bytes.size() - 10);
+    }
+    REQUIRE(tiny_rl::OfflineDataset(path).size() == 96);
+
+    SECTION("A rejected recorder leaves an existing file alone")
+    {
+        bool threw = false;
+        try
+        {
+            tiny_rl::TransitionRecorder bad(path, 0);
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+        REQUIRE(tiny_rl::OfflineDataset(path).size() == 96);
+    }
+
+    SECTION("A failed load unmaps the files it had already mapped")
+    {
+        const std::string bad_path = "test_agents_dataset_bad.bin";
+        {
+            std::ofstream out(bad_path, std::ios::binary);
+            out << std::string(sizeof(tiny_rl::dataset::FileHeader), 'x');
+        }
+        bool threw = false;
+        try
+        {
+            tiny_rl::OfflineDataset data(std::vector<std::string>{path, bad_path});
+        }
+        catch (const std::runtime_error &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+        std::ifstream maps("/proc/self/maps");
+        std::string line;
+        while (std::getline(maps, line))
+        {
+            REQUIRE(line.find(path) == std::string::npos);
+        }
+        std::remove(bad_path.c_str());
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE(test_steady_state_allocations)
+{
+    std::cout << "Testing steady-state allocations" << std::endl;
+    REQUIRE(tiny_rl::allocation_hooks_installed());
+
+    SECTION("A rewound arena reuses its blocks")
+    {
+        tiny_rl::MonotonicArena arena(256);
+        auto cycle = [&arena]
+        {
+            tiny_rl::ArenaScope scope(arena);
+            for (int i = 0; i < 8; ++i)
+                REQUIRE(reinterpret_cast<uintptr_t>(arena.allocate_array<double>(20)) % alignof(double) == 0);
+            tiny_rl::ArenaVector<int> v{tiny_rl::ArenaAllocator<int>(arena)};
+            v.reserve(100);
+        };
+        cycle();
+        size_t blocks = arena.blocks();
+        REQUIRE(blocks > 1);
+        auto before = tiny_rl::thread_allocation_counts();
+        cycle();
+        auto used = tiny_rl::thread_allocation_counts() - before;
+        REQUIRE(used.arena_blocks == 0);
+        REQUIRE(used.heap == 0);
+        REQUIRE(arena.blocks() == blocks);
+    }
+
+    SECTION("Rollout buffers recycle state buffers after the first rollout")
+    {
+        tiny_rl::RolloutBuffer rollout(64);
+        tiny_dnn::vec_t state(4, 0.5f);
+        for (int round = 0; round < 3; ++round)
+        {
+            auto before = tiny_rl::thread_allocation_counts();
+            for (int i = 0; i < 64; ++i)
+                rollout.add(state, i % 2, 1.0f, false, -0.7f, 0.1f);
+            auto used = tiny_rl::thread_allocation_counts() - before;
+            REQUIRE(rollout.full());
+            REQUIRE(rollout.data()[5].state == state);
+            if (round == 0)
+            {
+                REQUIRE(used.pool_misses == 64);
+            }
+            else
+            {
+                REQUIRE(used.heap == 0 && used.pool_misses == 0);
+            }
+            rollout.clear();
+        }
+    }
+
+    SECTION("Acting and storing does not allocate once replay has wrapped")
+    {
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNConfig config = small_config();
+        config.memory_size = 64;
+        config.epsilon_min = 1.0f; // random actions: no forward passes in tiny_dnn
+        config.learn_start = 1000000;
+        tiny_rl::DQNAgent agent(qnet, config);
+
+        tiny_rl::StepTrainer trainer(agent, []
+                                     { return std::make_shared<tiny_rl::CartPoleEnv>(); }, 4, 0);
+        tiny_rl::StepBudget budget;
+        budget.max_frames = 200;
+        trainer.run(budget);
+        REQUIRE(agent.replay_size() == 64);
+
+        auto before = tiny_rl::thread_allocation_counts();
+        trainer.run(budget);
+        auto used = tiny_rl::thread_allocation_counts() - before;
+        REQUIRE(used.heap == 0);
+        REQUIRE(used.arena_blocks == 0);
+        REQUIRE(trainer.last_frame_allocations().heap == 0);
+        REQUIRE(trainer.episodes() > 0);
+    }
+}
+
+TEST_CASE(test_move_only_store)
+{
+    std::cout << "Testing ownership-transferring stores" << std::endl;
+
+    SECTION("Replay slots take the caller's buffer and return the evicted one")
+    {
+        tiny_rl::PrioritizedReplayBuffer replay(4);
+        tiny_dnn::vec_t next_state(4, 2.0f);
+        std::vector<const float *> stored;
+        for (int i = 0; i < 4; ++i)
+        {
+            tiny_dnn::vec_t state(4, static_cast<float>(i));
+            stored.push_back(state.data());
+            replay.add(std::move(state), i % 2, 1.0f, next_state, false);
+            REQUIRE(state.size() == 4);
+            REQUIRE(replay.slot(i).state.data() == stored[i]);
+        }
+
+        tiny_dnn::vec_t state(4, 9.0f);
+        const float *incoming = state.data();
+        replay.add(std::move(state), 1, 1.0f, next_state, true);
+        REQUIRE(replay.slot(0).state.data() == incoming);
+        REQUIRE(replay.slot(0).state[0] == 9.0f);
+        REQUIRE(state.data() == stored[0]); // evicted buffer comes back
+        REQUIRE(state.size() == 4);
+    }
+
+    SECTION("Rollout entries keep the state buffer")
+    {
+        tiny_rl::RolloutBuffer rollout(2);
+        tiny_dnn::vec_t state(3, 1.0f);
+        const float *written = state.data();
+        rollout.add(std::move(state), 0, 1.0f, false, -0.5f, 0.0f);
+        REQUIRE(rollout.data()[0].state.data() == written);
+        REQUIRE(state.size() == 3);
+    }
+
+    SECTION("DQNAgent stores through the move path")
+    {
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNAgent agent(qnet, small_config());
+        tiny_rl::BaseAgent &base = agent;
+
+        std::vector<tiny_dnn::vec_t> states(3, tiny_dnn::vec_t(4, 0.1f));
+        std::vector<tiny_dnn::vec_t> next_states(3, tiny_dnn::vec_t(4, 0.2f));
+        std::vector<int> actions{0, 1, 0};
+        std::vector<float> rewards{1.0f, 1.0f, 1.0f};
+        std::vector<bool> dones{false, false, true};
+        base.store_experiences(std::move(states), actions, rewards, next_states, dones);
+        base.store_experience(std::move(states[0]), 1, 1.0f, next_states[0], false);
+        REQUIRE(agent.replay_size() == 4);
+        REQUIRE(agent.env_steps() == 4);
+        for (const auto &s : states)
+            REQUIRE(s.size() == 4);
+    }
+}
+
+TEST_CASE(test_static_dqn_agent)
+{
+    std::cout << "Testing compile-time sized DQN agent" << std::endl;
+    using Agent = tiny_rl::StaticDQNAgent<4, 2, 16>;
+
+    Net online, target;
+    build_net(online);
+    build_net(target);
+    online.init_weight();
+    tiny_rl::QNetwork qnet(online, target);
+
+    SECTION("Shape and batch size are checked against the network and config")
+    {
+        tiny_rl::DQNConfig config = small_config();
+        config.batch_size = 32;
+        bool threw = false;
+        try
+        {
+            Agent agent(qnet, config);
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+
+        threw = false;
+        try
+        {
+            tiny_rl::StaticDQNAgent<3, 2, 16> agent(qnet, small_config());
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+    }
+
+    SECTION("Greedy actions match the tiny_dnn network")
+    {
+        tiny_rl::DQNConfig config = small_config();
+        config.epsilon = 0.0f;
+        Agent agent(qnet, config);
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+        std::vector<tiny_dnn::vec_t> states(8, tiny_dnn::vec_t(4));
+        for (auto &s : states)
+            for (auto &x : s)
+                x = u(rng);
+        std::vector<int> actions;
+        agent.select_actions(states, actions);
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            int expected = qnet.argmax_action(qnet.predict(states[i]));
+            REQUIRE(agent.select_action(states[i]) == expected);
+            REQUIRE(actions[i] == expected);
+        }
+    }
+
+    SECTION("Learns from CartPole and checkpoints like DQNAgent")
+    {
+        Agent agent(qnet, small_config());
+        tiny_rl::CartPoleEnv env;
+        tiny_dnn::vec_t state(4), next_state(4);
+        env.reset_into(state.data());
+        for (int i = 0; i < 300; ++i)
+        {
+            int action = agent.select_action(state);
+            auto [reward, done] = env.step_into(action, next_state.data());
+            agent.store_experience(std::move(state), action, reward, next_state, done);
+            agent.learn();
+            state.swap(next_state);
+            if (done)
+            {
+                agent.on_episode_end();
+                env.reset_into(state.data());
+            }
+        }
+        REQUIRE(agent.env_steps() == 300);
+        REQUIRE(agent.replay_size() == 300);
+        REQUIRE(agent.train_steps() > 0);
+        for (float e : agent.td_errors())
+            REQUIRE(std::isfinite(e));
+
+        const std::string path = "test_static_dqn.ckpt";
+        agent.save(path);
+        Net online2, target2;
+        build_net(online2);
+        build_net(target2);
+        tiny_rl::QNetwork qnet2(online2, target2);
+        tiny_rl::DQNAgent loaded(qnet2, small_config());
+        loaded.load(path);
+        REQUIRE(loaded.env_steps() == 300);
+        std::vector<float> a, b;
+        tiny_rl::flatten_params(online, a);
+        tiny_rl::flatten_params(online2, b);
+        REQUIRE(a == b);
+        std::remove(path.c_str());
+    }
+}
+
+TEST_CASE(test_throughput_tuner)
+{
+    SECTION("Sweeps every combination and pins the pick")
+    {
+        tiny_rl::ThroughputTunerConfig config;
+        config.batch_sizes = {16, 32};
+        config.learner_threads = {1};
+        config.thread_budget = 2;
+        config.target_update_to_data = 0.25f;
+        config.warmup_seconds = 0.05;
+        config.trial_seconds = 0.2;
+        tiny_rl::ThroughputTuner tuner(build_net, []
+                                       { return std::make_shared<tiny_rl::CartPoleEnv>(); },
+                                       small_config(), {}, config);
+        tiny_rl::TunedConfig tuned = tuner.run(false);
+
+        REQUIRE(tuner.trials().size() == 2);
+        bool found = false;
+        for (const auto &t : tuner.trials())
+        {
+            REQUIRE(t.num_actors == 1);
+            REQUIRE(t.env_steps_per_sec > 0.0);
+            REQUIRE(t.learner_utilization >= 0.0 && t.learner_utilization <= 1.0);
+            found = found || (t.batch_size == tuned.batch_size && t.grad_steps_per_sec == tuned.grad_steps_per_sec);
+        }
+        REQUIRE(found);
+        REQUIRE(tuned.train_frequency == 4);
+
+        const std::string path = "test_tuned.cfg";
+        tuned.save(path);
+        tiny_rl::TunedConfig loaded = tiny_rl::TunedConfig::load(path);
+        REQUIRE(loaded.batch_size == tuned.batch_size);
+        REQUIRE(loaded.num_actors == tuned.num_actors);
+        REQUIRE(loaded.replay_ratio == tuned.replay_ratio);
+
+        tiny_rl::DQNConfig dqn = small_config();
+        tiny_rl::ActorLearnerConfig al;
+        loaded.apply(dqn, al);
+        REQUIRE(dqn.batch_size == tuned.batch_size);
+        REQUIRE(dqn.learner_threads == 1);
+        REQUIRE(al.num_actors == 1);
+        std::remove(path.c_str());
+    }
+
+    SECTION("Unknown keys in a tuned config are rejected")
+    {
+        const std::string path = "test_tuned_bad.cfg";
+        {
+            std::ofstream out(path);
+            out << "batch_size = 64\nbatch_sise = 32\n";
+        }
+        bool threw = false;
+        try
+        {
+            tiny_rl::TunedConfig::load(path);
+        }
+        catch (const std::runtime_error &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+        std::remove(path.c_str());
+    }
+}
+
+// Episode k (counted across all copies sharing `episodes`) lasts
+// 1 + k % 10 steps with reward 1 per step
+class CountingEnv : public tiny_rl::BaseEnv
+{
+public:
+    CountingEnv(std::shared_ptr<std::atomic<int>> episodes, int step_sleep_us = 0)
+        : episodes_(std::move(episodes)), step_sleep_us_(step_sleep_us) {}
+
+    std::vector<float> reset() override
+    {
+        length_ = 1 + episodes_->fetch_add(1) % 10;
+        t_ = 0;
+        return std::vector<float>(4, 0.0f);
+    }
+
+    std::tuple<std::vector<float>, float, bool> step(int) override
+    {
+        if (step_sleep_us_ > 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(step_sleep_us_));
+        ++t_;
+        return {std::vector<float>(4, 0.1f * t_), 1.0f, t_ >= length_};
+    }
+
+    int state_size() const override { return 4; }
+    int action_size() const override { return 2; }
+
+private:
+    std::shared_ptr<std::atomic<int>> episodes_;
+    int step_sleep_us_;
+    int length_ = 1;
+    int t_ = 0;
+};
+
+TEST_CASE(test_async_evaluator)
+{
+    std::cout << "Testing async evaluator" << std::endl;
+
+    SECTION("Greedy returns are summarized and logged with the snapshot step")
+    {
+        const std::string path = "test_agents_eval.jsonl";
+        tiny_rl::MetricsLoggerConfig mcfg;
+        mcfg.path = path;
+        mcfg.flush_interval_ms = 1;
+        {
+            tiny_rl::MetricsLogger logger(mcfg);
+            tiny_rl::set_metrics_logger(&logger);
+
+            Net net;
+            build_net(net);
+            auto counter = std::make_shared<std::atomic<int>>(0);
+            tiny_rl::EvaluationConfig config;
+            config.interval_steps = 0;
+            config.episodes = 10;
+            config.num_threads = 2;
+            tiny_rl::AsyncEvaluator evaluator(net, [counter]
+                                              { return std::make_shared<CountingEnv>(counter); },
+                                              config);
+            REQUIRE(evaluator.evaluate(1234));
+            evaluator.wait();
+            tiny_rl::set_metrics_logger(nullptr);
+
+            tiny_rl::EvaluationResult r = evaluator.last_result();
+            REQUIRE(evaluator.completed() == 1);
+            REQUIRE(r.step == 1234);
+            REQUIRE(r.episodes == 10);
+            REQUIRE(std::fabs(r.mean - 5.5f) < 1e-5f);
+            REQUIRE(std::fabs(r.p10 - 1.9f) < 1e-5f);
+            REQUIRE(std::fabs(r.p50 - 5.5f) < 1e-5f);
+            REQUIRE(std::fabs(r.p90 - 9.1f) < 1e-5f);
+            REQUIRE(r.min == 1.0f && r.max == 10.0f);
+            REQUIRE(std::fabs(r.mean_length - 5.5) < 1e-9);
+        }
+        std::ifstream in(path);
+        std::string line;
+        int eval_lines = 0;
+        while (std::getline(in, line))
+            if (line.find("eval_return_") != std::string::npos)
+            {
+                REQUIRE(line.find("1234") != std::string::npos);
+                ++eval_lines;
+            }
+        REQUIRE(eval_lines == 4);
+        std::remove(path.c_str());
+    }
+
+    SECTION("The caller never waits and skips snapshots while a round runs")
+    {
+        Net net;
+        build_net(net);
+        auto counter = std::make_shared<std::atomic<int>>(0);
+        tiny_rl::EvaluationConfig config;
+        config.interval_steps = 100;
+        config.episodes = 4;
+        config.max_episode_steps = 3;
+        tiny_rl::AsyncEvaluator evaluator(net, [counter]
+                                          { return std::make_shared<CountingEnv>(counter, 5000); },
+                                          config);
+        REQUIRE(!evaluator.maybe_evaluate(50));
+        REQUIRE(evaluator.maybe_evaluate(100));
+        REQUIRE(evaluator.busy());
+        REQUIRE(!evaluator.evaluate(101)); // about 45 ms of episodes still to go
+        REQUIRE(!evaluator.maybe_evaluate(150));
+        evaluator.wait();
+        REQUIRE(evaluator.maybe_evaluate(260));
+        evaluator.wait();
+
+        tiny_rl::EvaluationResult r = evaluator.last_result();
+        REQUIRE(evaluator.completed() == 2);
+        REQUIRE(r.step == 260);
+        REQUIRE(r.max <= 3.0f); // episodes are cut at max_episode_steps
+        REQUIRE(!evaluator.maybe_evaluate(300));
+        REQUIRE(evaluator.maybe_evaluate(360));
+    }
+
+    SECTION("A round cut short by destruction is not published")
+    {
+        const std::string path = "test_agents_eval_stop.jsonl";
+        tiny_rl::MetricsLoggerConfig mcfg;
+        mcfg.path = path;
+        mcfg.flush_interval_ms = 1;
+        {
+            tiny_rl::MetricsLogger logger(mcfg);
+            tiny_rl::set_metrics_logger(&logger);
+            {
+                Net net;
+                build_net(net);
+                auto counter = std::make_shared<std::atomic<int>>(0);
+                tiny_rl::EvaluationConfig config;
+                config.interval_steps = 0;
+                config.episodes = 8;
+                config.max_episode_steps = 3;
+                tiny_rl::AsyncEvaluator evaluator(net, [counter]
+                                                  { return std::make_shared<CountingEnv>(counter, 5000); },
+                                                  config);
+                REQUIRE(evaluator.evaluate(42));
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                // about 120 ms of episodes still to go
+            }
+            tiny_rl::set_metrics_logger(nullptr);
+        }
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            REQUIRE(line.find("eval_return_") == std::string::npos);
+        }
+        std::remove(path.c_str());
+    }
+
+    SECTION("Trainers hand the online network over as they go")
+    {
+        auto make_env = []
+        { return std::make_shared<tiny_rl::CartPoleEnv>(); };
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNAgent agent(qnet, small_config());
+        tiny_rl::StepTrainer trainer(agent, make_env, 2, 0);
+
+        tiny_rl::EvaluationConfig config;
+        config.interval_steps = 50;
+        config.episodes = 2;
+        config.max_episode_steps = 200;
+        tiny_rl::AsyncEvaluator evaluator(online, make_env, config);
+        trainer.evaluate_with(&evaluator);
+        tiny_rl::StepBudget budget;
+        budget.max_frames = 300;
+        trainer.run(budget);
+        evaluator.wait();
+        REQUIRE(evaluator.completed() >= 1);
+        REQUIRE(evaluator.last_result().step >= 50);
+        REQUIRE(evaluator.last_result().episodes == 2);
+    }
+
+    SECTION("Envs that do not match the network are rejected")
+    {
+        Net net;
+        net << tiny_dnn::fully_connected_layer(3, 2);
+        bool threw = false;
+        try
+        {
+            tiny_rl::AsyncEvaluator evaluator(net, []
+                                              { return std::make_shared<tiny_rl::CartPoleEnv>(); });
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+    }
+}
+
+TEST_CASE(test_population_trainer)
+{
+    std::cout << "Testing population trainer" << std::endl;
+    auto make_env = []
+    { return std::make_shared<tiny_rl::CartPoleEnv>(); };
+
+    SECTION("Exploit copies weights and Adam moments, retune swaps hyperparameters")
+    {
+        Net a_online, a_target, b_online, b_target;
+        build_net(a_online);
+        build_net(a_target);
+        build_net(b_online);
+        build_net(b_target);
+        tiny_rl::QNetwork qa(a_online, a_target), qb(b_online, b_target);
+        tiny_rl::DQNAgent a(qa, small_config()), b(qb, small_config());
+        auto env = make_env();
+        tiny_dnn::vec_t s(4), s2(4);
+        env->reset_into(s.data());
+        for (int i = 0; i < 200; ++i)
+        {
+            int action = a.select_action(s);
+            auto [r, done] = env->step_into(action, s2.data());
+            a.store_experience(s, action, r, s2, done);
+            a.learn();
+            if (done)
+                env->reset_into(s.data());
+            else
+                s.swap(s2);
+        }
+        REQUIRE(a.train_steps() > 0);
+
+        b.copy_learner_state(a);
+        tiny_dnn::vec_t probe = {0.1f, -0.2f, 0.05f, 0.3f};
+        REQUIRE(qa.predict(probe) == qb.predict(probe));
+        REQUIRE(qa.predict(probe, true) == qb.predict(probe, true));
+
+        tiny_rl::DQNConfig c = small_config();
+        c.learning_rate = 0.01f;
+        c.gamma = 0.9f;
+        c.target_update_freq = 7;
+        b.retune(c);
+        REQUIRE(b.get_config().learning_rate == 0.01f);
+        REQUIRE(b.get_config().gamma == 0.9f);
+        REQUIRE(b.get_config().target_update_freq == 7);
+        REQUIRE(b.get_config().batch_size == small_config().batch_size);
+    }
+
+    SECTION("A plain sweep gives every member the same env steps")
+    {
+        std::vector<tiny_rl::DQNConfig> configs(3, small_config());
+        configs[1].learning_rate = 0.0005f;
+        configs[2].gamma = 0.95f;
+        tiny_rl::PopulationConfig config;
+        config.slice_steps = 64;
+        config.exploit_interval = 0;
+        tiny_rl::PopulationTrainer population(build_net, make_env, configs, config);
+        population.run(300);
+
+        tiny_rl::PopulationReport r = population.results();
+        REQUIRE(r.members.size() == 3);
+        REQUIRE(r.env_steps == 900);
+        REQUIRE(r.env_steps_per_sec > 0.0);
+        for (size_t i = 0; i < r.members.size(); ++i)
+        {
+            const auto &m = r.members[i];
+            REQUIRE(m.env_steps == 300);
+            REQUIRE(m.episodes > 0);
+            REQUIRE(m.exploits == 0 && m.parent == -1);
+            REQUIRE(m.config.learning_rate == configs[m.id].learning_rate);
+            REQUIRE(m.config.gamma == configs[m.id].gamma);
+            if (i > 0)
+            {
+                REQUIRE(r.members[i - 1].score >= m.score);
+            }
+        }
+        REQUIRE(r.score_max == r.members.front().score);
+    }
+
+    SECTION("Bottom members copy and perturb top members")
+    {
+        std::vector<tiny_rl::DQNConfig> configs(4, small_config());
+        tiny_rl::PopulationConfig config;
+        config.slice_steps = 50;
+        config.exploit_interval = 100;
+        config.truncation = 0.25f;
+        config.perturb = 0.5f;
+        config.seed = 7;
+        tiny_rl::PopulationTrainer population(build_net, make_env, configs, config);
+        population.run(1000);
+
+        tiny_rl::PopulationReport r = population.results();
+        size_t exploits = 0;
+        for (const auto &m : r.members)
+        {
+            REQUIRE(m.env_steps == 1000);
+            exploits += m.exploits;
+            if (m.exploits > 0)
+            {
+                REQUIRE(m.parent >= 0 && static_cast<size_t>(m.parent) != m.id);
+                // explore moves learning rate by a factor of 0.5 or 1.5 each time
+                REQUIRE(m.config.learning_rate != small_config().learning_rate);
+            }
+        }
+        REQUIRE(exploits > 0);
+    }
+}
+
+TEST_CASE(test_frame_stacking)
+{
+    std::cout << "Testing frame stacking" << std::endl;
+
+    SECTION("The env shows the last frames oldest first, the reset frame repeated")
+    {
+        auto counter = std::make_shared<std::atomic<int>>(5); // episode lasts 6 steps
+        tiny_rl::FrameStackEnv env(std::make_shared<CountingEnv>(counter), 3);
+        REQUIRE(env.state_size() == 12);
+        REQUIRE(env.frame_size() == 4);
+        std::vector<float> obs(12);
+        env.reset_into(obs.data());
+        REQUIRE(obs == std::vector<float>(12, 0.0f));
+        for (int t = 1; t <= 5; ++t)
+        {
+            auto [reward, done] = env.step_into(0, obs.data());
+            REQUIRE(reward == 1.0f && !done);
+            for (int k = 0; k < 3; ++k)
+            {
+                float expect = 0.1f * std::max(t - 2 + k, 0);
+                REQUIRE(obs[k * 4] == expect && obs[k * 4 + 3] == expect);
+            }
+        }
+        auto [obs2, reward, done] = env.step(1);
+        REQUIRE(done);
+        REQUIRE(obs2[0] == 0.1f * 4 && obs2[11] == 0.1f * 6);
+    }
+
+    SECTION("A stack below one is rejected before anything is allocated")
+    {
+        auto counter = std::make_shared<std::atomic<int>>(0);
+        for (int stack : {0, -1})
+        {
+            bool threw = false;
+            try
+            {
+                tiny_rl::FrameStackEnv env(std::make_shared<CountingEnv>(counter), stack);
+            }
+            catch (const std::invalid_argument &)
+            {
+                threw = true;
+            }
+            REQUIRE(threw);
+        }
+    }
+
+    SECTION("Replay rebuilds the stacked states each env saw")
+    {
+        const size_t stack = 3, streams = 2, per_stream = 40;
+        tiny_rl::FrameStackReplayBuffer replay(per_stream * streams, 4, stack, streams);
+        REQUIRE(replay.capacity() == 80);
+        // Experience slots would hold state and next_state, stack frames each
+        REQUIRE(replay.memory_bytes() * 2 < replay.capacity() * 2 * stack * 4 * sizeof(float));
+
+        std::map<size_t, std::pair<tiny_dnn::vec_t, tiny_dnn::vec_t>> truth;
+        std::vector<std::unique_ptr<tiny_rl::FrameStackEnv>> envs;
+        std::vector<tiny_dnn::vec_t> obs(streams, tiny_dnn::vec_t(12));
+        std::vector<size_t> written(streams, 0);
+        auto counter = std::make_shared<std::atomic<int>>(0);
+        for (size_t e = 0; e < streams; ++e)
+        {
+            envs.push_back(std::make_unique<tiny_rl::FrameStackEnv>(std::make_shared<CountingEnv>(counter), stack));
+            envs[e]->reset_into(obs[e].data());
+            replay.begin_episode(e, obs[e].data() + 8);
+            ++written[e];
+        }
+        std::mt19937 rng(3);
+        for (int step = 0; step < 150; ++step)
+            for (size_t e = 0; e < streams; ++e)
+            {
+                tiny_dnn::vec_t next(12);
+                auto [reward, done] = envs[e]->step_into(step % 2, next.data());
+                replay.add(e, step % 2, reward, next.data() + 8, done);
+                truth[e * per_stream + written[e]++ % per_stream] = {obs[e], next};
+                if (done)
+                {
+                    envs[e]->reset_into(obs[e].data());
+                    replay.begin_episode(e, obs[e].data() + 8);
+                    ++written[e];
+                }
+                else
+                {
+                    obs[e] = next;
+                }
+            }
+
+        tiny_rl::SampledBatch batch;
+        for (int round = 0; round < 20; ++round)
+        {
+            REQUIRE(replay.sample_batch(batch, 32, rng));
+            for (size_t i = 0; i < 32; ++i)
+            {
+                auto it = truth.find(batch.indices[i]);
+                REQUIRE(it != truth.end());
+                REQUIRE(batch.states[i] == it->second.first);
+                REQUIRE(batch.next_states[i] == it->second.second);
+                REQUIRE(batch.is_weights[i] == 1.0f);
+            }
+        }
+    }
+
+    SECTION("Sampled batches train a DQN agent on stacked input")
+    {
+        Net online, target;
+        auto build = [](Net &n)
+        {
+            n << tiny_dnn::fully_connected_layer(16, 16)
+              << tiny_dnn::relu_layer()
+              << tiny_dnn::fully_connected_layer(16, 2);
+        };
+        build(online);
+        build(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNAgent agent(qnet, small_config());
+
+        tiny_rl::FrameStackEnv env(std::make_shared<tiny_rl::CartPoleEnv>(), 4);
+        tiny_rl::FrameStackReplayBuffer replay(1000, 4, 4);
+        std::vector<float> obs(16), next(16);
+        env.reset_into(obs.data());
+        replay.begin_episode(0, obs.data() + 12);
+        std::mt19937 rng(1);
+        tiny_rl::SampledBatch batch;
+        for (int step = 0; step < 300; ++step)
+        {
+            int action = agent.select_action(tiny_dnn::vec_t(obs.begin(), obs.end()));
+            auto [reward, done] = env.step_into(action, next.data());
+            replay.add(0, action, reward, next.data() + 12, done);
+            if (done)
+            {
+                env.reset_into(obs.data());
+                replay.begin_episode(0, obs.data() + 12);
+            }
+            else
+            {
+                obs.swap(next);
+            }
+            if (step % 4 == 0 && replay.sample_batch(batch, 16, rng))
+                agent.train_step(batch);
+        }
+        REQUIRE(agent.train_steps() > 50);
+        REQUIRE(agent.td_errors().size() == 16);
+    }
+}
+
+TEST_CASE(test_actor_learner_trainer)
+{
+    std::cout << "Testing actor/learner trainer" << std::endl;
+    auto make_env = []
+    { return std::make_shared<tiny_rl::CartPoleEnv>(); };
+
+    SECTION("Actors and learner both advance and the learner keeps to replay_ratio")
+    {
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNAgent agent(qnet, small_config());
+        tiny_rl::ActorLearnerConfig config;
+        config.num_actors = 2;
+        config.replay_ratio = 0.25f;
+        config.publish_interval = 10;
+        config.report_interval = 2; // actors finish several per learner iteration
+        tiny_rl::ActorLearnerDQNTrainer trainer(agent, make_env, config);
+        std::ostringstream out;
+        std::streambuf *saved = std::cout.rdbuf(out.rdbuf());
+        trainer.train_for(0.3);
+        std::cout.rdbuf(saved);
+
+        const tiny_rl::ActorLearnerStats &s = trainer.stats();
+        REQUIRE(s.episodes >= 2); // reported at least once
+        // one report per crossed interval, however many an iteration crosses,
+        // so the same episode count never prints twice
+        std::istringstream lines(out.str());
+        std::string line;
+        size_t reports = 0, last_reported = 0;
+        while (std::getline(lines, line))
+            if (line.rfind("Episode: ", 0) == 0)
+            {
+                size_t episodes = std::stoul(line.substr(9));
+                REQUIRE(episodes > last_reported);
+                last_reported = episodes;
+                ++reports;
+            }
+        REQUIRE(reports >= 1);
+        REQUIRE(s.elapsed_sec >= 0.3);
+        REQUIRE(s.env_steps > 0 && s.env_steps == agent.env_steps());
+        REQUIRE(s.grad_steps > 0 && s.grad_steps == agent.train_steps());
+        size_t learn_start = static_cast<size_t>(small_config().learn_start);
+        // the throttle is checked before each update, so at most one past the ratio
+        REQUIRE(s.grad_steps <= static_cast<size_t>(config.replay_ratio * (s.env_steps - learn_start)) + 1);
+        REQUIRE(s.actor_steps_per_sec > 0.0 && s.learner_steps_per_sec > 0.0);
+
+        size_t before = agent.env_steps();
+        trainer.train(5);
+        REQUIRE(trainer.stats().episodes >= 5);
+        REQUIRE(agent.env_steps() > before);
+    }
+
+    SECTION("A zero publish interval is rejected")
+    {
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNAgent agent(qnet, small_config());
+        tiny_rl::ActorLearnerConfig config;
+        config.publish_interval = 0;
+        bool threw = false;
+        try
+        {
+            tiny_rl::ActorLearnerDQNTrainer trainer(agent, make_env, config);
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+    }
+}
+
+TEST_CASE(test_batched_acting)
+{
+    std::cout << "Testing batched action selection" << std::endl;
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<float> obs(-1.0f, 1.0f);
+    std::vector<tiny_dnn::vec_t> states(9, tiny_dnn::vec_t(4));
+    for (auto &s : states)
+        for (auto &x : s)
+            x = obs(gen);
+
+    SECTION("Greedy DQN actions match per-state predictions")
+    {
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        randomize_weights(online, 1);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNConfig config = small_config();
+        config.epsilon = 0.0f;
+        tiny_rl::DQNAgent agent(qnet, config);
+
+        std::vector<int> actions;
+        agent.select_actions(states, actions);
+        REQUIRE(actions.size() == states.size());
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            REQUIRE(actions[i] == qnet.argmax_action(qnet.predict(states[i])));
+        }
+    }
+
+    Net base, policy, value;
+    base << tiny_dnn::fully_connected_layer(4, 16) << tiny_dnn::relu_layer();
+    policy << tiny_dnn::fully_connected_layer(16, 3);
+    value << tiny_dnn::fully_connected_layer(16, 1);
+    randomize_weights(base, 2);
+    randomize_weights(policy, 3);
+    randomize_weights(value, 4);
+    tiny_rl::ActorCriticNetwork ac_net(base, policy, value);
+    tiny_rl::PPOConfig config;
+    config.buffer_capacity = 9 * 4;
+
+    SECTION("PPO samples from the same probabilities as ActorCriticNetwork::predict")
+    {
+        tiny_rl::PPOAgent agent(ac_net, config);
+        agent.seed(5);
+        std::vector<int> actions;
+        agent.select_actions(states, actions);
+        REQUIRE(actions.size() == states.size());
+
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            auto probs = ac_net.predict(states[i]).first;
+            float u = uni(rng);
+            int expected = static_cast<int>(probs.size()) - 1;
+            float cdf = 0.0f;
+            for (size_t a = 0; a < probs.size(); ++a)
+            {
+                cdf += probs[a];
+                if (u < cdf)
+                {
+                    expected = static_cast<int>(a);
+                    break;
+                }
+            }
+            REQUIRE(actions[i] == expected);
+        }
+    }
+
+    SECTION("PPO acts per state when a head cannot be flattened")
+    {
+        tiny_rl::PPOAgent batched(ac_net, config);
+        batched.seed(5);
+        std::vector<int> expected;
+        batched.select_actions(states, expected);
+
+        // trunk and policy copy fine; the value head's second activation does not
+        Net odd_value;
+        odd_value << tiny_dnn::fully_connected_layer(16, 1) << tiny_dnn::relu_layer() << tiny_dnn::relu_layer();
+        randomize_weights(odd_value, 4);
+        tiny_rl::ActorCriticNetwork odd_net(base, policy, odd_value);
+        tiny_rl::PPOAgent agent(odd_net, config);
+        agent.seed(5);
+        std::vector<int> actions;
+        agent.select_actions(states, actions);
+        REQUIRE(actions == expected);
+        agent.select_actions(states, actions);
+        REQUIRE(actions.size() == states.size());
+    }
+
+    SECTION("PPO rejects storing more envs than were acted on")
+    {
+        tiny_rl::PPOAgent agent(ac_net, config);
+        std::vector<int> actions;
+        std::vector<tiny_dnn::vec_t> three(states.begin(), states.begin() + 3);
+        agent.select_actions(three, actions);
+        agent.store_experiences(three, actions, std::vector<float>(3, 1.0f), three, std::vector<bool>(3, false));
+
+        bool threw = false;
+        try
+        {
+            agent.store_experiences(states, std::vector<int>(states.size(), 0), std::vector<float>(states.size(), 1.0f),
+                                    states, std::vector<bool>(states.size(), false));
+        }
+        catch (const std::logic_error &)
+        {
+            threw = true;
+        }
+        REQUIRE(threw);
+    }
+}
+
+TEST_CASE(test_prefetch_sampler)
+{
+    std::cout << "Testing prefetch sampler priority write-back" << std::endl;
+    const size_t capacity = 16, batch_size = 4;
+    tiny_dnn::vec_t s(4, 0.0f);
+
+    SECTION("Priorities from batch k are in place when batch k+2 is drawn")
+    {
+        // alpha = 1: a 1e9 priority against fifteen of 1 leaves a ~1e-8 chance per draw
+        tiny_rl::PrioritizedReplayBuffer buffer(capacity, 1.0f);
+        std::mutex mutex;
+        for (size_t i = 0; i < capacity; ++i)
+            buffer.add(s, 0, 0.0f, s, false);
+        tiny_rl::PrefetchSampler sampler(buffer, mutex, batch_size);
+
+        const tiny_rl::SampledBatch &b0 = sampler.acquire();
+        size_t hot = b0.indices[0];
+        std::vector<float> errors(batch_size, 1.0f);
+        for (size_t i = 0; i < batch_size; ++i)
+            if (b0.indices[i] == hot)
+                errors[i] = 1e9f;
+        sampler.release(errors);
+
+        // batch k+1 was drawn before the update; keep `hot` hot whatever it held
+        const tiny_rl::SampledBatch &b1 = sampler.acquire();
+        for (size_t i = 0; i < batch_size; ++i)
+            errors[i] = b1.indices[i] == hot ? 1e9f : 1.0f;
+        sampler.release(errors);
+
+        const tiny_rl::SampledBatch &b2 = sampler.acquire();
+        for (size_t index : b2.indices)
+        {
+            REQUIRE(index == hot);
+        }
+        sampler.release(std::vector<float>(batch_size, 1.0f));
+    }
+
+    SECTION("A slot recycled before release keeps its fresh priority")
+    {
+        tiny_rl::PrioritizedReplayBuffer buffer(capacity);
+        std::mutex mutex;
+        for (size_t i = 0; i < capacity; ++i)
+            buffer.add(s, 0, 0.0f, s, false);
+        tiny_rl::PrefetchSampler sampler(buffer, mutex, batch_size);
+
+        const tiny_rl::SampledBatch &batch = sampler.acquire();
+        std::vector<size_t> indices = batch.indices;
+        {
+            // every slot is overwritten while the learner holds the batch
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < capacity; ++i)
+                buffer.add(s, 1, 0.0f, s, false);
+        }
+        sampler.release(std::vector<float>(batch_size, 1e9f));
+        for (size_t index : indices)
+        {
+            REQUIRE(buffer.priority(index) < 1e9f);
+        }
+
+        // batch k+2 is drawn after the overwrite and updated as usual
+        sampler.acquire();
+        sampler.release(std::vector<float>(batch_size, 1.0f));
+        const tiny_rl::SampledBatch &fresh = sampler.acquire();
+        indices = fresh.indices;
+        sampler.release(std::vector<float>(batch_size, 1e9f));
+        for (size_t index : indices)
+        {
+            REQUIRE(buffer.priority(index) >= 1e9f);
+        }
+    }
+}
+
+TEST_CASE(test_target_cache)
+{
+    std::cout << "Testing target value cache" << std::endl;
+
+    SECTION("Rows hit until invalidated or their slot is recycled")
+    {
+        tiny_rl::TargetValueCache cache(8, 2);
+        REQUIRE(cache.find(3, 1) == nullptr);
+        cache.put(3, 1, tiny_dnn::vec_t{0.5f, -0.5f});
+        const float *row = cache.find(3, 1);
+        REQUIRE(row != nullptr);
+        REQUIRE(row[0] == 0.5f && row[1] == -0.5f);
+        REQUIRE(cache.find(3, 2) == nullptr);
+
+        cache.invalidate();
+        REQUIRE(cache.find(3, 1) == nullptr);
+        cache.put(3, 2, tiny_dnn::vec_t{1.0f, 2.0f});
+        REQUIRE(cache.find(3, 2) != nullptr);
+        REQUIRE(cache.find(3, 2)[1] == 2.0f);
+        REQUIRE(cache.hits() == 3);
+        REQUIRE(cache.misses() == 3);
+    }
+
+    SECTION("Cached targets equal recomputed ones across syncs and recycling")
+    {
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        randomize_weights(online, 21);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::DQNConfig config = small_config();
+        config.memory_size = 32;
+        config.batch_size = 8;
+        config.target_update_freq = 20;
+        config.cache_target_values = true;
+        tiny_rl::DQNAgent agent(qnet, config);
+        REQUIRE(agent.target_cache() != nullptr);
+
+        std::vector<tiny_dnn::vec_t> states, next_states;
+        std::vector<float> rewards;
+        auto fill = [&](float phase)
+        {
+            states.clear();
+            next_states.clear();
+            rewards.clear();
+            for (int i = 0; i < config.memory_size; ++i)
+            {
+                float t = phase + 0.37f * i;
+                states.push_back({std::sin(t), std::cos(t), 0.1f * i, -0.2f});
+                next_states.push_back({std::cos(1.3f * t), std::sin(t), -0.05f * i, 0.3f});
+                rewards.push_back(phase + i);
+                agent.store_experience(states.back(), i % 2, rewards.back(), next_states.back(), false);
+            }
+        };
+
+        // every slot's TD error, with target rows computed afresh
+        auto expected = [&]()
+        {
+            std::vector<float> errors;
+            for (size_t i = 0; i < states.size(); ++i)
+            {
+                auto next_online = qnet.predict(next_states[i]);
+                auto next_target = qnet.predict(next_states[i], true);
+                float y = rewards[i] + config.gamma * next_target[qnet.argmax_action(next_online)];
+                errors.push_back(std::fabs(y - qnet.predict(states[i])[i % 2]));
+            }
+            return errors;
+        };
+
+        auto train_and_check = [&](int steps)
+        {
+            auto errors = expected();
+            for (int step = 0; step < steps; ++step)
+            {
+                REQUIRE(agent.train_step());
+                for (float e : agent.td_errors())
+                {
+                    bool found = false;
+                    for (float x : errors)
+                        found = found || std::fabs(e - x) < 1e-5f;
+                    REQUIRE(found);
+                }
+            }
+        };
+
+        fill(0.0f);
+        train_and_check(19);
+        REQUIRE(agent.target_cache()->hits() > 0);
+
+        // the 21st update syncs the target to the changed online net
+        randomize_weights(online, 22);
+        agent.train_step();
+        agent.train_step();
+        train_and_check(5);
+
+        // overwrite every slot with new transitions
+        fill(100.0f);
+        train_and_check(10);
+    }
+}
+
+TEST_CASE(test_flat_policy)
+{
+    std::cout << "Testing flat policy export" << std::endl;
+    const std::string path = "test_agents_policy.flat";
+    std::vector<tiny_dnn::vec_t> states;
+    for (int i = 0; i < 6; ++i)
+        states.push_back({std::sin(0.9f * i), std::cos(0.4f * i), 0.3f * i - 0.8f, -0.5f});
+
+    SECTION("Q-network export matches QNetwork::predict")
+    {
+        Net online, target;
+        for (Net *n : {&online, &target})
+            *n << tiny_dnn::fully_connected_layer(4, 16)
+               << tiny_dnn::leaky_relu_layer(0.2f)
+               << tiny_dnn::fully_connected_layer(16, 3);
+        randomize_weights(online, 31);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::export_flat_policy(qnet, path);
+
+        tiny_rl::FlatPolicy policy(path);
+        REQUIRE(policy.input_size() == 4);
+        REQUIRE(policy.num_actions() == 3);
+        tiny_rl::FlatScratch scratch;
+        for (const auto &s : states)
+        {
+            auto expected = qnet.predict(s);
+            const float *q = policy.forward(s.data(), scratch);
+            for (size_t a = 0; a < expected.size(); ++a)
+            {
+                REQUIRE(std::fabs(q[a] - expected[a]) < 1e-5f);
+            }
+            REQUIRE(policy.act(s.data(), scratch) == qnet.argmax_action(expected));
+        }
+    }
+
+    SECTION("Actor-critic export matches ActorCriticNetwork::predict")
+    {
+        Net base, head, value;
+        base << tiny_dnn::fully_connected_layer(4, 12) << tiny_dnn::leaky_relu_layer(0.1f);
+        head << tiny_dnn::fully_connected_layer(12, 3);
+        value << tiny_dnn::fully_connected_layer(12, 1);
+        randomize_weights(base, 32);
+        randomize_weights(head, 33);
+        randomize_weights(value, 34);
+        tiny_rl::ActorCriticNetwork ac_net(base, head, value);
+        tiny_rl::export_flat_policy(ac_net, path);
+
+        tiny_rl::FlatPolicy policy(path);
+        tiny_rl::FlatScratch scratch;
+        std::vector<float> obs;
+        for (const auto &s : states)
+            obs.insert(obs.end(), s.begin(), s.end());
+        const float *batch = policy.forward_batch(obs.data(), states.size(), scratch);
+        std::vector<float> probs(batch, batch + states.size() * 3);
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            auto [expected, v] = ac_net.predict(states[i]);
+            for (size_t a = 0; a < 3; ++a)
+            {
+                REQUIRE(std::fabs(probs[i * 3 + a] - expected[a]) < 1e-5f);
+            }
+            REQUIRE(std::fabs(policy.value(states[i].data(), scratch) - v) < 1e-5f);
+        }
+    }
+
+    SECTION("Corrupted files are rejected")
+    {
+        Net online, target;
+        build_net(online);
+        build_net(target);
+        tiny_rl::QNetwork qnet(online, target);
+        tiny_rl::export_flat_policy(qnet, path);
+        std::vector<char> good;
+        {
+            std::ifstream in(path, std::ios::binary);
+            good.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        auto rejects = [&](const std::function<void(std::vector<char> &)> &corrupt)
+        {
+            std::vector<char> bytes = good;
+            corrupt(bytes);
+            {
+                std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            }
+            try
+            {
+                tiny_rl::FlatPolicy policy(path);
+            }
+            catch (const std::runtime_error &)
+            {
+                return true;
+            }
+            return false;
+        };
+        auto header = [](std::vector<char> &b)
+        { return reinterpret_cast<tiny_rl::FlatPolicyHeader *>(b.data()); };
+        auto layer = [](std::vector<char> &b, size_t l)
+        { return reinterpret_cast<tiny_rl::FlatLayerDesc *>(b.data() + sizeof(tiny_rl::FlatPolicyHeader)) + l; };
+
+        REQUIRE(!rejects([](std::vector<char> &) {}));
+        REQUIRE(rejects([](std::vector<char> &b) { b[0] = 'X'; }));
+        REQUIRE(rejects([](std::vector<char> &b) { b.resize(b.size() - 4); }));
+        REQUIRE(rejects([&](std::vector<char> &b) { layer(b, 1)->in = 15; }));
+        REQUIRE(rejects([&](std::vector<char> &b) { layer(b, 0)->out = 0; }));
+        REQUIRE(rejects([&](std::vector<char> &b) { layer(b, 1)->weight_offset = ~0ull - 8; }));
+        REQUIRE(rejects([&](std::vector<char> &b) { header(b)->input_size = 5; }));
+        REQUIRE(rejects([&](std::vector<char> &b) { header(b)->output_size = 3; }));
+        REQUIRE(rejects([&](std::vector<char> &b) { header(b)->policy_layers = 1; header(b)->trunk_layers = 1; }));
+        REQUIRE(rejects([&](std::vector<char> &b) { header(b)->kind = 7; }));
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE(test_policy_server)
+{
+    std::cout << "Testing policy server" << std::endl;
+
+    SECTION("LogHistogram percentiles stay within one bucket")
+    {
+        tiny_rl::LogHistogram h;
+        REQUIRE(h.percentile(0.5) == 0);
+        for (uint64_t v = 0; v < 8; ++v)
+            h.record(v);
+        REQUIRE(h.percentile(0.0) == 0);
+        REQUIRE(h.percentile(1.0) == 7);
+        REQUIRE(h.percentile(0.5) == 3);
+
+        h.reset();
+        for (uint64_t v = 1; v <= 1000; ++v)
+            h.record(v);
+        REQUIRE(h.count() == 1000);
+        REQUIRE(h.max() == 1000);
+        REQUIRE(std::fabs(h.mean() - 500.5) < 1e-9);
+        for (double p : {0.1, 0.5, 0.9, 0.99})
+        {
+            uint64_t exact = static_cast<uint64_t>(p * 999) + 1;
+            uint64_t got = h.percentile(p);
+            REQUIRE(got >= exact);
+            REQUIRE(got <= exact + exact / 8);
+        }
+        REQUIRE(h.percentile(1.0) == 1000);
+    }
+
+    const std::string policy_path = "test_agents_server.flat";
+    Net online, target;
+    for (Net *n : {&online, &target})
+        *n << tiny_dnn::fully_connected_layer(4, 16)
+           << tiny_dnn::relu_layer()
+           << tiny_dnn::fully_connected_layer(16, 3);
+    randomize_weights(online, 41);
+    tiny_rl::QNetwork qnet(online, target);
+    tiny_rl::export_flat_policy(qnet, policy_path);
+    tiny_rl::FlatPolicy policy(policy_path);
+    tiny_rl::FlatScratch scratch;
+    std::vector<float> obs{0.3f, -0.7f, 0.1f, 0.9f};
+
+    tiny_rl::PolicyServerConfig config;
+    config.socket_path = "test_agents_policy.sock";
+
+    // the batcher records stats just after it sends the replies
+    auto settled_stats = [](const tiny_rl::PolicyServer &server, uint64_t requests)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        auto stats = server.stats();
+        while (stats.requests < requests && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            stats = server.stats();
+        }
+        return stats;
+    };
+
+    SECTION("Actions and values round-trip over the socket")
+    {
+        tiny_rl::PolicyServer server(policy, config);
+        server.start();
+        tiny_rl::PolicyClient client(config.socket_path);
+        REQUIRE(client.act(obs) == policy.act(obs.data(), scratch));
+
+        std::vector<float> values;
+        int action = client.values(obs, values);
+        const float *expected = policy.forward(obs.data(), scratch);
+        REQUIRE(action == policy.act(obs.data(), scratch));
+        REQUIRE(values.size() == 3);
+        for (size_t a = 0; a < 3; ++a)
+        {
+            REQUIRE(values[a] == expected[a]);
+        }
+        REQUIRE(settled_stats(server, 2).requests == 2);
+    }
+
+    SECTION("A zero max_batch or a negative max_delay_us is rejected")
+    {
+        for (int bad = 0; bad < 2; ++bad)
+        {
+            tiny_rl::PolicyServerConfig c = config;
+            if (bad == 0)
+                c.max_batch = 0;
+            else
+                c.max_delay_us = -1;
+            bool threw = false;
+            try
+            {
+                tiny_rl::PolicyServer server(policy, c);
+            }
+            catch (const std::invalid_argument &)
+            {
+                threw = true;
+            }
+            REQUIRE(threw);
+        }
+    }
+
+    SECTION("A mismatched obs_size gets -1, an oversized one closes the connection")
+    {
+        tiny_rl::PolicyServer server(policy, config);
+        server.start();
+        tiny_rl::PolicyClient client(config.socket_path);
+        REQUIRE(client.act({1.0f, 2.0f, 3.0f}) == -1);
+        REQUIRE(client.act(std::vector<float>(5000, 1.0f)) == -1);
+        // the stream stays in sync after the rejected payloads
+        REQUIRE(client.act(obs) == policy.act(obs.data(), scratch));
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = tiny_rl::serving::make_address(config.socket_path);
+        REQUIRE(::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0);
+        tiny_rl::serving::RequestHeader header{tiny_rl::serving::kAction, tiny_rl::serving::kMaxObsSize + 1};
+        REQUIRE(tiny_rl::serving::write_full(fd, &header, sizeof(header)));
+        tiny_rl::serving::ResponseHeader reply;
+        REQUIRE(!tiny_rl::serving::read_full(fd, &reply, sizeof(reply)));
+        ::close(fd);
+    }
+
+    SECTION("Requests are batched up to max_batch, or until the deadline")
+    {
+        config.max_batch = 4;
+        config.max_delay_us = 2000000;
+        {
+            tiny_rl::PolicyServer server(policy, config);
+            server.start();
+            std::vector<std::thread> clients;
+            std::atomic<int> correct{0};
+            int expected = policy.act(obs.data(), scratch);
+            for (int i = 0; i < 4; ++i)
+                clients.emplace_back([&]
+                                     {
+                                         tiny_rl::PolicyClient client(config.socket_path);
+                                         correct += client.act(obs) == expected; });
+            for (auto &t : clients)
+                t.join();
+            auto stats = settled_stats(server, 4);
+            REQUIRE(correct == 4);
+            REQUIRE(stats.batches == 1);
+            REQUIRE(stats.batch_sizes[4] == 1);
+        }
+
+        config.max_delay_us = 20000;
+        tiny_rl::PolicyServer server(policy, config);
+        server.start();
+        tiny_rl::PolicyClient client(config.socket_path);
+        auto t0 = std::chrono::steady_clock::now();
+        client.act(obs);
+        auto waited = std::chrono::steady_clock::now() - t0;
+        REQUIRE(waited >= std::chrono::microseconds(20000));
+        auto stats = settled_stats(server, 1);
+        REQUIRE(stats.batch_sizes[1] == 1);
+        REQUIRE(stats.latency_max_us >= 20000);
+    }
+
+    SECTION("A client that stops reading does not stall the others")
+    {
+        config.max_batch = 32;
+        config.max_delay_us = 100;
+        tiny_rl::PolicyServer server(policy, config);
+        server.start();
+
+        // pipelines requests and never reads the replies
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = tiny_rl::serving::make_address(config.socket_path);
+        REQUIRE(::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0);
+        std::vector<char> requests;
+        tiny_rl::serving::RequestHeader header{tiny_rl::serving::kValues, 4};
+        for (int i = 0; i < 20000; ++i)
+        {
+            const char *h = reinterpret_cast<const char *>(&header);
+            const char *o = reinterpret_cast<const char *>(obs.data());
+            requests.insert(requests.end(), h, h + sizeof(header));
+            requests.insert(requests.end(), o, o + obs.size() * sizeof(float));
+        }
+        REQUIRE(tiny_rl::serving::write_full(fd, requests.data(), requests.size()));
+
+        tiny_rl::PolicyClient client(config.socket_path);
+        REQUIRE(client.act(obs) == policy.act(obs.data(), scratch));
+        ::close(fd);
+    }
+    std::remove(policy_path.c_str());
+}
+
+TEST_CASE(test_prioritized_draw)
+{
+    std::cout << "Testing prioritized sampling in a partly filled buffer" << std::endl;
+
+    SECTION("Sampled indices stay below size() while the buffer is not full")
+    {
+        const size_t capacity = 1 << 16, filled = 40000, batch_size = 256;
+        tiny_rl::PrioritizedReplayBuffer buffer(capacity);
+        tiny_dnn::vec_t s(1, 0.0f);
+        for (size_t i = 0; i < filled; ++i)
+            buffer.add(s, 0, 0.0f, s, false);
+
+        // large priorities written back and then replaced by small ones
+        // leave rounding residue in the tree sums, so the top segment
+        // reaches past the last filled leaf
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> error(0.0f, 0.01f);
+        std::vector<size_t> indices(filled);
+        std::vector<float> errors(filled);
+        for (size_t i = 0; i < filled; ++i)
+        {
+            indices[i] = i;
+            errors[i] = 1e6f;
+        }
+        buffer.update_priorities(indices, errors);
+        for (size_t i = 0; i < filled; ++i)
+            errors[i] = error(rng);
+        buffer.update_priorities(indices, errors);
+
+        tiny_rl::SampledBatch batch;
+        for (int round = 0; round < 20; ++round)
+        {
+            buffer.sample_batch(batch, batch_size);
+            for (size_t i = 0; i < batch_size; ++i)
+            {
+                REQUIRE(batch.indices[i] < buffer.size());
+                REQUIRE(std::isfinite(batch.is_weights[i]));
+            }
+        }
+    }
+}
+
+int main()
+{
+    std::cout << "Starting agent tests\n"
+              << std::endl;
+
+    test_dqn_checkpoint_roundtrip();
+    test_param_publisher();
+    test_parallel_optimizer_update();
+    test_data_parallel_learner();
+    test_shm_replay();
+    test_profiler_windows();
+    test_metrics_logger();
+    test_offline_dataset();
+    test_steady_state_allocations();
+    test_move_only_store();
+    test_static_dqn_agent();
+    test_throughput_tuner();
+    test_async_evaluator();
+    test_population_trainer();
+    test_frame_stacking();
+    test_actor_learner_trainer();
+    test_batched_acting();
+    test_prefetch_sampler();
+    test_target_cache();
+    test_flat_policy();
+    test_policy_server();
+    test_prioritized_draw();
+
+    std::cout << "\nAll tests completed successfully!" << std::endl;
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include <cmath>
 #include <cassert>
 #include <functional>
+#include <cstdio>
+#include <algorithm>
 #include "../include/tiny_rl/tiny_rl.h"
 
 // temporary framework for now, generated with AI. Need to be replaced with proper testing framework
@@ -184,6 +186,62 @@ TEST_CASE(test_cartpole_termination)
     }
 }
 
+TEST_CASE(test_cartpole_snapshot)
+{
+    std::cout << "Testing CartPole snapshot/restore" << std::endl;
+
+    auto env = std::make_shared<tiny_rl::CartPoleEnv>();
+    env->reset();
+    env->step(1);
+    env->step(0);
+
+    SECTION("Restore replays the same trajectory")
+    auto snap = env->snapshot();
+    auto [first, r1, d1] = env->step(1);
+    env->step(1);
+    auto restored = env->restore(snap);
+    auto [second, r2, d2] = env->step(1);
+    for (size_t i = 0; i < first.size(); ++i)
+        REQUIRE(first[i] == second[i]);
+    REQUIRE(d1 == d2);
+
+    SECTION("Fork pool scores actions from one state")
+    tiny_rl::EnvForkPool pool([]
+                              { return std::make_shared<tiny_rl::CartPoleEnv>(); },
+                              2);
+    const auto &returns = pool.rollout(
+        snap, 20, [](size_t, const std::vector<float> &s)
+        { return s[2] > 0 ? 1 : 0; },
+        1.0f, {0, 1});
+    REQUIRE(returns.size() == 2);
+    REQUIRE(pool.lengths()[0] <= 20);
+    REQUIRE(returns[0] == static_cast<float>(pool.lengths()[0]));
+}
+
+TEST_CASE(test_gridworld)
+{
+    std::cout << "Testing GridWorld" << std::endl;
+
+    tiny_rl::GridWorldEnv env(3, 3, 50);
+    auto state = env.reset();
+    REQUIRE(state.size() == 2);
+    REQUIRE(env.action_size() == 4);
+
+    SECTION("Reaching the goal terminates the episode")
+    env.step(1);
+    auto snap = env.snapshot();
+    env.step(1);
+    env.step(2);
+    auto [goal_state, reward, done] = env.step(2);
+    REQUIRE(done);
+    REQUIRE(roughly_equal(reward, 1.0f));
+
+    SECTION("Restore returns to the saved cell")
+    auto restored = env.restore(snap);
+    REQUIRE(roughly_equal(restored[0], 0.5f));
+    REQUIRE(roughly_equal(restored[1], 0.0f));
+}
+
 void run_cartpole_example(bool verbose = false)
 {
     std::cout << "Running example CartPole episode" << std::endl;
@@ -219,6 +277,77 @@ void run_cartpole_example(bool verbose = false)
     std::cout << "  Episode completed " << max_steps << " steps with reward " << total_reward << std::endl;
 }
 
+TEST_CASE(test_observation_normalizer)
+{
+    std::cout << "Testing observation normalizer" << std::endl;
+
+    // rows of 3 features with known mean/variance
+    std::vector<tiny_dnn::vec_t> rows;
+    for (int i = 0; i < 200; ++i)
+        rows.push_back({static_cast<float>(i), 5.0f + 0.5f * (i % 4), -3.0f * i});
+
+    SECTION("Batched updates match the exact statistics")
+    tiny_rl::ObservationNormalizer whole(3);
+    auto copy = rows;
+    whole.process(copy);
+    REQUIRE(whole.count() == 200.0);
+    REQUIRE(roughly_equal(whole.mean(0), 99.5f));
+    REQUIRE(roughly_equal(whole.variance(0), (200.0f * 200.0f - 1.0f) / 12.0f, 0.01f));
+    REQUIRE(roughly_equal(whole.mean(1), 5.75f));
+
+    SECTION("Merging per-worker normalizers equals one pass")
+    tiny_rl::ObservationNormalizer a(3), b(3);
+    std::vector<tiny_dnn::vec_t> first(rows.begin(), rows.begin() + 70), second(rows.begin() + 70, rows.end());
+    for (size_t i = 0; i < first.size(); i += 10)
+    {
+        std::vector<tiny_dnn::vec_t> chunk(first.begin() + i, first.begin() + std::min(first.size(), i + 10));
+        a.process(chunk);
+    }
+    b.process(second);
+    a.merge(b);
+    for (size_t j = 0; j < 3; ++j)
+    {
+        REQUIRE(std::abs(a.mean(j) - whole.mean(j)) < 1e-9);
+        REQUIRE(std::abs(a.variance(j) - whole.variance(j)) < 1e-6 * whole.variance(j));
+    }
+
+    SECTION("Frozen statistics scale but do not move")
+    whole.freeze();
+    tiny_dnn::vec_t obs = {99.5f, 5.75f, 0.0f};
+    std::vector<tiny_dnn::vec_t> one = {obs};
+    whole.process(one);
+    REQUIRE(whole.count() == 200.0);
+    REQUIRE(roughly_equal(one[0][0], 0.0f));
+
+    SECTION("Statistics survive a checkpoint round trip")
+    {
+        tiny_rl::CheckpointWriter writer("test_envs_norm.bin");
+        whole.save(writer);
+        writer.close();
+    }
+    tiny_rl::ObservationNormalizer restored(3);
+    restored.load(tiny_rl::CheckpointReader("test_envs_norm.bin"));
+    std::remove("test_envs_norm.bin");
+    REQUIRE(restored.frozen());
+    std::vector<float> x = {10.0f, 6.0f, -100.0f}, y = x;
+    whole.process(x);
+    restored.process(y);
+    REQUIRE(x == y);
+
+    SECTION("Wrapped raw CartPole observations come out standardized")
+    auto shared = std::make_shared<tiny_rl::ObservationNormalizer>(4, 5.0f);
+    tiny_rl::NormalizedEnv env(std::make_shared<tiny_rl::CartPoleEnv>(false), shared);
+    auto state = env.reset();
+    for (int i = 0; i < 2000; ++i)
+    {
+        auto [next, reward, done] = env.step(i % 3 == 0 ? 0 : 1);
+        state = done ? env.reset() : next;
+        for (float v : state)
+            REQUIRE(std::abs(v) <= 5.0f);
+    }
+    REQUIRE(shared->count() > 2000.0);
+}
+
 int main()
 {
     std::cout << "Starting CartPole environment tests\n"
@@ -229,6 +358,9 @@ int main()
     test_cartpole_physics();
     test_cartpole_rewards();
     test_cartpole_termination();
+    test_cartpole_snapshot();
+    test_gridworld();
+    test_observation_normalizer();
 
     // Run example episode
     run_cartpole_example();